@@ -0,0 +1,714 @@
+#include "gtfs_parser.cpp"
+#include "gtfs_realtime.cpp"
+#include "gtfs_feeds.cpp"
+#include "gtfs_query.cpp"
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// Native benchmarks for the parsers, the stop_times finalize, the stop_times and trip
+// queries and realtime decode, run against a synthetic feed without N-API:
+//   gtfs_bench [--scale N] [--min-time SECONDS] [--filter SUBSTRING] [--out FILE]
+// Results are written as JSON to stdout (or FILE); progress goes to stderr.
+
+using namespace gtfs;
+
+namespace {
+
+struct Options {
+    int scale = 4;
+    double min_time = 0.5;
+    std::string filter;
+    std::string out;
+};
+
+// --- Synthetic feed ---
+
+// Per scale unit: 1000 stops, 40 routes with two directions of 25 stops and
+// 24 trips each, so 1920 trips and 48000 stop_times.
+constexpr int STOPS_PER_SCALE = 1000;
+constexpr int ROUTES_PER_SCALE = 40;
+constexpr int STOPS_PER_ROUTE = 25;
+constexpr int TRIPS_PER_DIRECTION = 24;
+constexpr int SHAPE_POINTS_PER_STOP = 4;
+
+struct SyntheticFeed {
+    std::vector<std::pair<std::string, std::string>> files; // name, contents
+    std::vector<char> zip;
+    size_t stops = 0, trips = 0, stop_times = 0, shape_points = 0;
+
+    const std::string& file(const std::string& name) const {
+        for (const auto& f : files) if (f.first == name) return f.second;
+        throw std::runtime_error("missing synthetic file " + name);
+    }
+};
+
+std::string hms(int seconds) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%02d:%02d:%02d", seconds / 3600, seconds / 60 % 60, seconds % 60);
+    return buf;
+}
+
+std::string fixed(double v, int digits) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", digits, v);
+    return buf;
+}
+
+SyntheticFeed generate_feed(int scale) {
+    SyntheticFeed feed;
+    std::mt19937 rng(20240611u);
+    const int stop_count = STOPS_PER_SCALE * scale;
+    const int route_count = ROUTES_PER_SCALE * scale;
+    const int station_count = stop_count / 10;
+    // Stops on a square grid of about 150 m around Brisbane
+    const int side = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(stop_count))));
+    auto stop_lat = [side](int i) { return -27.47 - (i / side) * 0.00135; };
+    auto stop_lon = [side](int i) { return 153.02 + (i % side) * 0.0015; };
+
+    feed.files.emplace_back("agency.txt",
+        "agency_id,agency_name,agency_url,agency_timezone\n"
+        "BENCH,Benchmark Transit,https://example.com,Australia/Brisbane\n");
+    feed.files.emplace_back("feed_info.txt",
+        "feed_publisher_name,feed_publisher_url,feed_lang,feed_start_date,feed_end_date,feed_version\n"
+        "Benchmark Transit,https://example.com,en,20240101,20241231,bench\n");
+    feed.files.emplace_back("calendar.txt",
+        "service_id,monday,tuesday,wednesday,thursday,friday,saturday,sunday,start_date,end_date\n"
+        "WK,1,1,1,1,1,0,0,20240101,20241231\n"
+        "SA,0,0,0,0,0,1,0,20240101,20241231\n"
+        "SU,0,0,0,0,0,0,1,20240101,20241231\n");
+
+    std::string calendar_dates = "service_id,date,exception_type\n";
+    for (int month = 1; month <= 12; ++month) {
+        std::string date = std::string("2024") + (month < 10 ? "0" : "") + std::to_string(month) + "15";
+        calendar_dates += "WK," + date + ",2\nSU," + date + ",1\n";
+    }
+    feed.files.emplace_back("calendar_dates.txt", std::move(calendar_dates));
+
+    std::string stops = "stop_id,stop_name,stop_lat,stop_lon,location_type,parent_station\n";
+    for (int s = 0; s < station_count; ++s) {
+        int anchor = s * 10;
+        stops += "P" + std::to_string(s) + ",Station " + std::to_string(s) + "," +
+                 fixed(stop_lat(anchor), 6) + "," + fixed(stop_lon(anchor), 6) + ",1,\n";
+    }
+    for (int i = 0; i < stop_count; ++i) {
+        stops += "S" + std::to_string(i) + ",Stop " + std::to_string(i) + "," +
+                 fixed(stop_lat(i), 6) + "," + fixed(stop_lon(i), 6) + ",0," +
+                 (i % 10 < 3 ? "P" + std::to_string(i / 10) : std::string()) + "\n";
+    }
+    feed.stops = static_cast<size_t>(stop_count + station_count);
+    feed.files.emplace_back("stops.txt", std::move(stops));
+
+    std::string routes = "route_id,agency_id,route_short_name,route_long_name,route_type\n";
+    std::string trips = "route_id,service_id,trip_id,trip_headsign,direction_id,shape_id,block_id\n";
+    std::string stop_times = "trip_id,arrival_time,departure_time,stop_id,stop_sequence,pickup_type,drop_off_type,shape_dist_traveled\n";
+    std::string shapes = "shape_id,shape_pt_lat,shape_pt_lon,shape_pt_sequence,shape_dist_traveled\n";
+    const char* services[] = { "WK", "WK", "SA", "SU" };
+    std::uniform_int_distribution<int> pick_stop(0, stop_count - 1);
+    std::uniform_int_distribution<int> hop(60, 240);
+    std::uniform_int_distribution<int> dwell(0, 30);
+
+    for (int r = 0; r < route_count; ++r) {
+        std::string route_id = "R" + std::to_string(r);
+        routes += route_id + ",BENCH," + std::to_string(r) + ",Route " + std::to_string(r) + "," + (r % 5 == 0 ? "2" : "3") + "\n";
+
+        std::vector<int> path(STOPS_PER_ROUTE);
+        for (int& p : path) p = pick_stop(rng);
+        std::vector<int> hops(STOPS_PER_ROUTE);
+        for (int& h : hops) h = hop(rng);
+
+        for (int dir = 0; dir < 2; ++dir) {
+            std::vector<int> order = path;
+            if (dir == 1) std::reverse(order.begin(), order.end());
+            std::string shape_id = route_id + "_" + std::to_string(dir);
+
+            double dist = 0;
+            int seq = 1;
+            std::vector<double> stop_dist(STOPS_PER_ROUTE);
+            for (int i = 0; i < STOPS_PER_ROUTE; ++i) {
+                int a = order[i], b = order[std::min(i + 1, STOPS_PER_ROUTE - 1)];
+                stop_dist[i] = dist;
+                for (int k = 0; k < SHAPE_POINTS_PER_STOP; ++k) {
+                    double t = static_cast<double>(k) / SHAPE_POINTS_PER_STOP;
+                    double lat = stop_lat(a) + (stop_lat(b) - stop_lat(a)) * t;
+                    double lon = stop_lon(a) + (stop_lon(b) - stop_lon(a)) * t;
+                    shapes += shape_id + "," + fixed(lat, 6) + "," + fixed(lon, 6) + "," +
+                              std::to_string(seq++) + "," + fixed(dist, 2) + "\n";
+                    dist += 37.5 + k;
+                    ++feed.shape_points;
+                }
+            }
+
+            for (int t = 0; t < TRIPS_PER_DIRECTION; ++t) {
+                std::string trip_id = route_id + "_" + std::to_string(dir) + "_" + std::to_string(t);
+                trips += route_id + "," + services[t % 4] + "," + trip_id + ",To " + std::to_string(order.back()) + "," +
+                         std::to_string(dir) + "," + shape_id + ",B" + std::to_string(r) + "_" + std::to_string(t / 4) + "\n";
+                ++feed.trips;
+
+                // Spread from 05:00 to past midnight so some trips run into the next service day
+                int time = 5 * 3600 + t * 3600 * 20 / TRIPS_PER_DIRECTION + r % 7 * 60;
+                for (int i = 0; i < STOPS_PER_ROUTE; ++i) {
+                    int arrival = time;
+                    int departure = arrival + (i == 0 || i + 1 == STOPS_PER_ROUTE ? 0 : dwell(rng));
+                    stop_times += trip_id + "," + hms(arrival) + "," + hms(departure) + ",S" + std::to_string(order[i]) + "," +
+                                  std::to_string(i + 1) + "," + (i + 1 == STOPS_PER_ROUTE ? "1" : "0") + "," +
+                                  (i == 0 ? "1" : "0") + "," + fixed(stop_dist[i], 2) + "\n";
+                    time = departure + hops[dir == 0 ? i : STOPS_PER_ROUTE - 1 - i];
+                    ++feed.stop_times;
+                }
+            }
+        }
+    }
+    feed.files.emplace_back("routes.txt", std::move(routes));
+    feed.files.emplace_back("trips.txt", std::move(trips));
+    feed.files.emplace_back("stop_times.txt", std::move(stop_times));
+    feed.files.emplace_back("shapes.txt", std::move(shapes));
+
+    mz_zip_archive zip;
+    memset(&zip, 0, sizeof(zip));
+    if (!mz_zip_writer_init_heap(&zip, 0, 0)) throw std::runtime_error("Failed to init zip writer");
+    for (const auto& [name, contents] : feed.files) {
+        if (!mz_zip_writer_add_mem(&zip, name.c_str(), contents.data(), contents.size(), MZ_DEFAULT_COMPRESSION))
+            throw std::runtime_error("Failed to add " + name + " to the synthetic zip");
+    }
+    void* archive = nullptr;
+    size_t archive_size = 0;
+    if (!mz_zip_writer_finalize_heap_archive(&zip, &archive, &archive_size)) throw std::runtime_error("Failed to finalize the synthetic zip");
+    feed.zip.assign(static_cast<const char*>(archive), static_cast<const char*>(archive) + archive_size);
+    mz_free(archive);
+    mz_zip_writer_end(&zip);
+    return feed;
+}
+
+// --- Synthetic realtime ---
+
+// Minimal protobuf writer for the GTFS-realtime messages the decoder reads
+struct ProtoWriter {
+    std::string out;
+
+    void varint(uint64_t v) {
+        while (v >= 0x80) { out.push_back(static_cast<char>(v | 0x80)); v >>= 7; }
+        out.push_back(static_cast<char>(v));
+    }
+    void tag(uint32_t field, uint32_t wire) { varint((static_cast<uint64_t>(field) << 3) | wire); }
+    void uint(uint32_t field, uint64_t v) { tag(field, 0); varint(v); }
+    void sint32(uint32_t field, int32_t v) { tag(field, 0); varint(static_cast<uint64_t>(static_cast<int64_t>(v))); }
+    void fixed32(uint32_t field, float v) {
+        tag(field, 5);
+        char buf[4];
+        memcpy(buf, &v, 4);
+        out.append(buf, 4);
+    }
+    void bytes(uint32_t field, const std::string& v) { tag(field, 2); varint(v.size()); out += v; }
+};
+
+std::string feed_header(uint64_t timestamp) {
+    ProtoWriter h;
+    h.bytes(1, "2.0");
+    h.uint(2, 0); // FULL_DATASET
+    h.uint(3, timestamp);
+    return h.out;
+}
+
+// One TripUpdate per trip with a stop_time_update for every remaining stop
+std::string trip_updates_message(const GTFSData& data, uint64_t timestamp) {
+    ProtoWriter msg;
+    msg.bytes(1, feed_header(timestamp));
+    StopTimeRows rows = data.stop_time_rows();
+    size_t row = 0;
+    for (const Trip& trip : data.trips) {
+        const std::string& trip_id = data.string_pool.get(trip.trip_id);
+        ProtoWriter descriptor;
+        descriptor.bytes(1, trip_id);
+        descriptor.bytes(3, "20240610");
+        descriptor.bytes(5, data.string_pool.get(trip.route_id));
+
+        ProtoWriter tu;
+        tu.bytes(1, descriptor.out);
+        while (row < rows.size() && rows[row].trip_id < trip.trip_id) ++row;
+        int delay = static_cast<int>(trip.trip_id % 300);
+        for (size_t r = row; r < rows.size() && rows[r].trip_id == trip.trip_id; ++r) {
+            StopTime st = rows[r];
+            if (st.stop_sequence < 10) continue;
+            ProtoWriter event;
+            event.sint32(1, delay);
+            ProtoWriter stu;
+            stu.uint(1, static_cast<uint32_t>(st.stop_sequence));
+            stu.bytes(2, event.out);
+            stu.bytes(3, event.out);
+            stu.bytes(4, data.string_pool.get(st.stop_id));
+            tu.bytes(2, stu.out);
+        }
+        ProtoWriter vehicle;
+        vehicle.bytes(1, "V" + trip_id);
+        tu.bytes(3, vehicle.out);
+        tu.uint(4, timestamp);
+
+        ProtoWriter entity;
+        entity.bytes(1, "TU" + trip_id);
+        entity.bytes(3, tu.out);
+        msg.bytes(2, entity.out);
+    }
+    return msg.out;
+}
+
+std::string vehicle_positions_message(const GTFSData& data, uint64_t timestamp) {
+    ProtoWriter msg;
+    msg.bytes(1, feed_header(timestamp));
+    StopTimeRows stop_times = data.stop_time_rows();
+    for (const Trip& trip : data.trips) {
+        const std::string& trip_id = data.string_pool.get(trip.trip_id);
+        ProtoWriter descriptor;
+        descriptor.bytes(1, trip_id);
+        descriptor.bytes(5, data.string_pool.get(trip.route_id));
+
+        // Between stops 11 and 12, as current_stop_sequence 12 says, and about
+        // 20 m off the line
+        double lat = -27.47, lon = 153.02;
+        auto [first, last] = stop_times.trip_rows(trip.trip_id);
+        const Stop* from = nullptr;
+        const Stop* to = nullptr;
+        for (uint32_t i = first; i != last; ++i) {
+            StopTime st = stop_times[i];
+            if (st.stop_sequence == 11) from = data.stops.find(st.feed_id, st.stop_id);
+            if (st.stop_sequence == 12) to = data.stops.find(st.feed_id, st.stop_id);
+        }
+        if (from && to) {
+            double t = (trip.trip_id % 10) / 10.0;
+            lat = from->stop_lat + (to->stop_lat - from->stop_lat) * t + 0.0002;
+            lon = from->stop_lon + (to->stop_lon - from->stop_lon) * t;
+        }
+        ProtoWriter position;
+        position.fixed32(1, static_cast<float>(lat));
+        position.fixed32(2, static_cast<float>(lon));
+        ProtoWriter vehicle;
+        vehicle.bytes(1, "V" + trip_id);
+
+        ProtoWriter vp;
+        vp.bytes(1, descriptor.out);
+        vp.bytes(2, position.out);
+        vp.uint(3, 12);
+        vp.uint(5, timestamp);
+        vp.bytes(8, vehicle.out);
+
+        ProtoWriter entity;
+        entity.bytes(1, "VP" + trip_id);
+        entity.bytes(4, vp.out);
+        msg.bytes(2, entity.out);
+    }
+    return msg.out;
+}
+
+// --- Runner ---
+
+struct Result {
+    std::string name;
+    size_t iterations = 0;
+    double mean_ns = 0, median_ns = 0, min_ns = 0, max_ns = 0, stddev_ns = 0;
+    double bytes_per_second = 0, items_per_second = 0;
+};
+
+using Clock = std::chrono::steady_clock;
+
+// Runs setup (untimed) and then run (timed) until min_time has been spent in run,
+// with at least three iterations after one warm-up iteration.
+class Runner {
+public:
+    explicit Runner(const Options& opts) : opts_(opts) {}
+
+    template <typename Setup, typename Run>
+    void bench(const std::string& name, size_t bytes, size_t items, Setup setup, Run run) {
+        if (!opts_.filter.empty() && name.find(opts_.filter) == std::string::npos) return;
+        fprintf(stderr, "%-40s", name.c_str());
+
+        setup();
+        run();
+        std::vector<double> samples;
+        double total = 0;
+        while (samples.size() < 3 || total < opts_.min_time * 1e9) {
+            setup();
+            auto t0 = Clock::now();
+            run();
+            double ns = std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+            samples.push_back(ns);
+            total += ns;
+        }
+
+        Result r;
+        r.name = name;
+        r.iterations = samples.size();
+        r.mean_ns = total / samples.size();
+        double var = 0;
+        for (double s : samples) var += (s - r.mean_ns) * (s - r.mean_ns);
+        r.stddev_ns = std::sqrt(var / samples.size());
+        std::sort(samples.begin(), samples.end());
+        r.min_ns = samples.front();
+        r.max_ns = samples.back();
+        r.median_ns = samples[samples.size() / 2];
+        if (bytes) r.bytes_per_second = bytes / (r.median_ns / 1e9);
+        if (items) r.items_per_second = items / (r.median_ns / 1e9);
+        fprintf(stderr, "%12.3f ms  %6zu iterations", r.median_ns / 1e6, r.iterations);
+        if (bytes) fprintf(stderr, "  %8.1f MB/s", r.bytes_per_second / 1e6);
+        if (items) fprintf(stderr, "  %12.0f items/s", r.items_per_second);
+        fprintf(stderr, "\n");
+        results_.push_back(std::move(r));
+    }
+
+    const std::vector<Result>& results() const { return results_; }
+
+private:
+    const Options& opts_;
+    std::vector<Result> results_;
+};
+
+void json_string(std::string& out, const std::string& s) {
+    out += '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') { out += '\\'; out += c; }
+        else if (static_cast<unsigned char>(c) < 0x20) { char buf[8]; snprintf(buf, sizeof(buf), "\\u%04x", c); out += buf; }
+        else out += c;
+    }
+    out += '"';
+}
+
+std::string to_json(const Options& opts, const SyntheticFeed& feed, const std::vector<Result>& results) {
+    char date[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    auto num = [](double v) { return fixed(v, 1); };
+
+    std::string out = "{\n  \"context\": {\n    \"date\": ";
+    json_string(out, date);
+    out += ",\n    \"scale\": " + std::to_string(opts.scale);
+    out += ",\n    \"min_time\": " + fixed(opts.min_time, 3);
+    out += ",\n    \"hardware_threads\": " + std::to_string(std::thread::hardware_concurrency());
+    out += ",\n    \"compiler\": ";
+#if defined(__VERSION__)
+    json_string(out, __VERSION__);
+#elif defined(_MSC_VER)
+    json_string(out, "MSVC " + std::to_string(_MSC_VER));
+#else
+    json_string(out, "unknown");
+#endif
+    out += ",\n    \"feed\": { \"stops\": " + std::to_string(feed.stops) + ", \"trips\": " + std::to_string(feed.trips) +
+           ", \"stop_times\": " + std::to_string(feed.stop_times) + ", \"shape_points\": " + std::to_string(feed.shape_points) +
+           ", \"zip_bytes\": " + std::to_string(feed.zip.size()) + " }\n  },\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        out += i ? ",\n    { \"name\": " : "\n    { \"name\": ";
+        json_string(out, r.name);
+        out += ", \"iterations\": " + std::to_string(r.iterations) + ", \"mean_ns\": " + num(r.mean_ns) +
+               ", \"median_ns\": " + num(r.median_ns) + ", \"min_ns\": " + num(r.min_ns) + ", \"max_ns\": " + num(r.max_ns) +
+               ", \"stddev_ns\": " + num(r.stddev_ns) + ", \"bytes_per_second\": " + num(r.bytes_per_second) +
+               ", \"items_per_second\": " + num(r.items_per_second) + " }";
+    }
+    out += "\n  ]\n}\n";
+    return out;
+}
+
+// --- Benchmarks ---
+
+// Keeps query results observable so the loops are not optimized away
+volatile size_t bench_sink = 0;
+
+using Parser = size_t (*)(GTFSData&, const char*, size_t, int, const std::string&, const std::function<void(size_t)>&);
+
+void parser_benchmarks(Runner& runner, const SyntheticFeed& feed) {
+    std::unique_ptr<GTFSData> data;
+    auto fresh = [&data] { data = std::make_unique<GTFSData>(); };
+
+    const std::pair<const char*, Parser> parsers[] = {
+        { "agency.txt", parse_agency }, { "routes.txt", parse_routes }, { "trips.txt", parse_trips },
+        { "stops.txt", parse_stops }, { "calendar.txt", parse_calendar },
+        { "calendar_dates.txt", parse_calendar_dates }, { "feed_info.txt", parse_feed_info },
+    };
+    for (const auto& [name, parser] : parsers) {
+        const std::string& text = feed.file(name);
+        size_t lines = std::count(text.begin(), text.end(), '\n') - 1;
+        runner.bench(std::string("parse/") + name, text.size(), lines, fresh, [&, parser = parser] {
+            parser(*data, text.data(), text.size(), 0, "bench", nullptr);
+        });
+    }
+
+    const std::string& shapes = feed.file("shapes.txt");
+    std::unordered_map<uint32_t, std::vector<Shape>> merged_shapes;
+    runner.bench("parse/shapes.txt", shapes.size(), feed.shape_points,
+        [&] { fresh(); merged_shapes.clear(); },
+        [&] { parse_shapes(*data, merged_shapes, shapes.data(), shapes.size(), 0, "bench", nullptr); });
+
+    // One chunk on the calling thread, as each parse task of the stream sees it
+    const std::string& stop_times = feed.file("stop_times.txt");
+    size_t header_len = stop_times.find('\n');
+    std::vector<std::string> headers = parse_csv_line(stop_times.substr(0, header_len));
+    std::vector<StopTime> rows;
+    runner.bench("parse/stop_times.txt/chunk", stop_times.size(), feed.stop_times,
+        [&] { fresh(); std::vector<StopTime>().swap(rows); },
+        [&] {
+            rows.reserve(stop_times.size() / 50);
+            parse_stop_times_chunk(data->string_pool, stop_times.data() + header_len + 1, stop_times.size() - header_len - 1,
+                headers, data->string_pool.intern(std::string("bench")), rows);
+        });
+
+    // Inflating from the archive with parse tasks on a pool of one thread per hardware thread
+    std::vector<std::vector<StopTime>> chunks;
+    mz_zip_archive zip;
+    memset(&zip, 0, sizeof(zip));
+    if (!mz_zip_reader_init_mem(&zip, feed.zip.data(), feed.zip.size(), 0)) throw std::runtime_error("Failed to open the synthetic zip");
+    int index = mz_zip_reader_locate_file(&zip, "stop_times.txt", nullptr, 0);
+    ThreadPool pool;
+    runner.bench("parse/stop_times.txt/stream", stop_times.size(), feed.stop_times,
+        [&] { fresh(); chunks.clear(); },
+        [&] {
+            parse_stop_times_stream(data->string_pool, zip, static_cast<mz_uint>(index),
+                data->string_pool.intern(std::string("bench")), pool, pool.size() * STREAM_BLOCKS_PER_THREAD, chunks);
+        });
+    mz_zip_reader_end(&zip);
+
+    size_t total_bytes = 0;
+    for (const auto& f : feed.files) total_bytes += f.second.size();
+    std::vector<BufferView> buffers = { { reinterpret_cast<const unsigned char*>(feed.zip.data()), feed.zip.size() } };
+    runner.bench("load/feed", total_bytes, feed.stop_times, fresh,
+        [&] { load_feeds(*data, buffers, { "bench" }, 0, nullptr, nullptr); });
+
+    // shapes.txt kept compressed, then parsed on first use
+    const std::vector<std::string> lazy = { "shapes.txt" };
+    runner.bench("load/feed_lazy", total_bytes, feed.stop_times, fresh,
+        [&] { load_feeds(*data, buffers, { "bench" }, 0, nullptr, nullptr, {}, 0, lazy); });
+    runner.bench("load/lazy_shapes", 0, feed.shape_points,
+        [&] { fresh(); load_feeds(*data, buffers, { "bench" }, 0, nullptr, nullptr, {}, 0, lazy); },
+        [&] { load_lazy_file(*data, "shapes.txt"); });
+
+    // Nine copies of the feed under their own ids, parsed side by side on one pool
+    std::vector<BufferView> nine_buffers(9, buffers[0]);
+    std::vector<std::string> nine_ids;
+    for (int i = 0; i < 9; ++i) nine_ids.push_back("bench" + std::to_string(i));
+    runner.bench("load/feeds_9", total_bytes * 9, feed.stop_times * 9, fresh,
+        [&] { load_feeds(*data, nine_buffers, nine_ids, 0, nullptr, nullptr); });
+
+    // Feed changes next to a loaded feed: the loaded rows are copied, not parsed.
+    // The second copy of the feed owns every trip, so removing the first one
+    // copies all stop_times.
+    GTFSData one_feed, two_feeds;
+    load_feeds(one_feed, buffers, { "bench" }, 0, nullptr, nullptr);
+    change_feed(two_feeds, one_feed, FeedChange::Add, buffers[0], "bench2", 0, nullptr, nullptr);
+    runner.bench("load/add_feed", total_bytes, feed.stop_times, fresh,
+        [&] { change_feed(*data, one_feed, FeedChange::Add, buffers[0], "bench2", 0, nullptr, nullptr); });
+    runner.bench("load/remove_feed", 0, feed.stop_times, fresh,
+        [&] { change_feed(*data, two_feeds, FeedChange::Remove, buffers[0], "bench", 0, nullptr, nullptr); });
+}
+
+void finalize_benchmarks(Runner& runner, GTFSData& data) {
+    // Parsed chunks list trips in file order, which is not interned id order
+    std::vector<StopTime> sorted(data.stop_times.begin(), data.stop_times.end());
+    std::vector<std::pair<size_t, size_t>> groups;
+    for (size_t i = 0; i < sorted.size();) {
+        size_t j = i;
+        while (j < sorted.size() && sorted[j].trip_id == sorted[i].trip_id) ++j;
+        groups.emplace_back(i, j);
+        i = j;
+    }
+    std::shuffle(groups.begin(), groups.end(), std::mt19937(7));
+    constexpr size_t ROWS_PER_BLOCK = 80000;
+    std::vector<StopTimeBlock> parsed(1);
+    for (const auto& [b, e] : groups) {
+        if (parsed.back().rows.size() >= ROWS_PER_BLOCK) parsed.emplace_back();
+        parsed.back().rows.insert(parsed.back().rows.end(), sorted.begin() + b, sorted.begin() + e);
+    }
+
+    ThreadPool pool;
+    std::vector<StopTimeBlock> blocks;
+    std::vector<StopTime> out;
+    runner.bench("finalize/sort_stop_times", 0, sorted.size(),
+        [&] { blocks = parsed; out.clear(); },
+        [&] { sort_stop_times(blocks, data.string_pool.size(), {}, pool, out); });
+
+    StopTimeIndex index;
+    runner.bench("finalize/stop_time_index", 0, data.stop_times.size(),
+        [&] { index.clear(); },
+        [&] { index.build(data.stop_time_rows(), data.string_pool.size(), &pool); });
+
+    runner.bench("finalize/service_index", 0, data.trips.size(), [] {}, [&] { build_service_index(data); });
+    runner.bench("finalize/stop_grid", 0, data.stops.size(), [] {}, [&] { data.build_stop_grid(); });
+    runner.bench("finalize/trip_indexes", 0, data.trips.size(), [] {}, [&] { data.build_trip_indexes(); });
+}
+
+void query_benchmarks(Runner& runner, const GTFSData& data) {
+    constexpr size_t BATCH = 1000;
+    std::mt19937 rng(11);
+    std::vector<uint32_t> stop_ids, trip_ids, route_ids, block_ids;
+    for (size_t i = 0; i < BATCH; ++i) {
+        stop_ids.push_back(data.stops[rng() % data.stops.size()].stop_id);
+        trip_ids.push_back(data.trips[rng() % data.trips.size()].trip_id);
+        route_ids.push_back(data.trips[rng() % data.trips.size()].route_id);
+        block_ids.push_back(data.trips[rng() % data.trips.size()].block_id);
+    }
+    uint32_t feed_id = data.string_pool.get_id(std::string("bench"));
+    int32_t day = parse_date_days("20240610");
+    size_t sink = 0;
+
+    runner.bench("query/stop_times/by_stop", 0, BATCH, [] {}, [&] {
+        for (uint32_t id : stop_ids) {
+            StopTimeFilter f;
+            f.stop_id = id;
+            f.has_stop_id = true;
+            sink += collect_stop_times(data, f).size();
+        }
+    });
+    runner.bench("query/stop_times/by_stop_window_day", 0, BATCH, [] {}, [&] {
+        for (uint32_t id : stop_ids) {
+            StopTimeFilter f;
+            f.stop_id = id;
+            f.has_stop_id = true;
+            f.start_time = 7 * 3600;
+            f.end_time = 9 * 3600;
+            f.day = day;
+            f.timestamp_mode = true;
+            sink += collect_stop_times(data, f).size();
+        }
+    });
+    runner.bench("query/stop_times/by_trip", 0, BATCH, [] {}, [&] {
+        for (uint32_t id : trip_ids) {
+            StopTimeFilter f;
+            f.trip_id = id;
+            f.has_trip_id = true;
+            f.feed_id = feed_id;
+            f.has_feed_id = true;
+            sink += collect_stop_times(data, f).size();
+        }
+    });
+    runner.bench("query/departures", 0, BATCH, [] {}, [&] {
+        for (uint32_t id : stop_ids) {
+            DepartureQuery q;
+            q.stop_id = id;
+            q.include_children = true;
+            q.day = day;
+            q.after = 8 * 3600;
+            sink += collect_departures(data, q).size();
+        }
+    });
+    runner.bench("query/trips/by_trip", 0, BATCH, [] {}, [&] {
+        for (uint32_t id : trip_ids) {
+            TripFilter f;
+            f.trip_id = data.string_pool.get(id);
+            sink += collect_trips(data, f).size();
+        }
+    });
+    runner.bench("query/trips/by_route_day", 0, BATCH, [] {}, [&] {
+        for (uint32_t id : route_ids) {
+            TripFilter f;
+            f.route_id = data.string_pool.get(id);
+            f.day = day;
+            sink += collect_trips(data, f).size();
+        }
+    });
+    runner.bench("query/trips/by_block", 0, BATCH, [] {}, [&] {
+        for (uint32_t id : block_ids) {
+            TripFilter f;
+            f.block_id = data.string_pool.get(id);
+            sink += collect_trips(data, f).size();
+        }
+    });
+    runner.bench("query/trips/by_day", 0, 10, [] {}, [&] {
+        for (int32_t d = day; d < day + 10; ++d) {
+            TripFilter f;
+            f.day = d;
+            sink += collect_trips(data, f).size();
+        }
+    });
+    bench_sink = sink;
+}
+
+void realtime_benchmarks(Runner& runner, GTFSData& data) {
+    const std::string trip_updates = trip_updates_message(data, 1718000000);
+    const std::string vehicle_positions = vehicle_positions_message(data, 1718000000);
+    auto bytes = [](const std::string& s) { return reinterpret_cast<const unsigned char*>(s.data()); };
+    uint32_t feed_id = data.string_pool.intern(std::string("bench"));
+
+    RealtimeMessage msg;
+    runner.bench("realtime/decode/trip_updates", trip_updates.size(), data.trips.size(),
+        [&] { msg = RealtimeMessage(); },
+        [&] { decode_realtime_message(data.string_pool, bytes(trip_updates), trip_updates.size(), realtime_source(RT_TRIP_UPDATES, 0), feed_id, msg); });
+    runner.bench("realtime/decode/vehicle_positions", vehicle_positions.size(), data.trips.size(),
+        [&] { msg = RealtimeMessage(); },
+        [&] { decode_realtime_message(data.string_pool, bytes(vehicle_positions), vehicle_positions.size(), realtime_source(RT_VEHICLE_POSITIONS, 0), feed_id, msg); });
+
+    // Decode, merge into the store and rebuild the trip and stop joins, as updateRealtime does
+    runner.bench("realtime/update", trip_updates.size() + vehicle_positions.size(), 2 * data.trips.size(),
+        [&] { data.realtime.clear(); },
+        [&] {
+            RealtimeFeed& feed = realtime_feed_for_update(data, "bench");
+            parse_realtime_feed(feed, data.string_pool, realtime_source(RT_TRIP_UPDATES, 0), bytes(trip_updates), trip_updates.size(), feed_id);
+            parse_realtime_feed(feed, data.string_pool, realtime_source(RT_VEHICLE_POSITIONS, 0), bytes(vehicle_positions), vehicle_positions.size(), feed_id);
+            rebuild_realtime_indexes(data);
+        });
+
+    // Snapping alone, with the shape tracks built and the stop distances of
+    // every trip cached, as on each update after the first
+    runner.bench("realtime/snap_vehicles", 0, data.vehicles.size(), [] {}, [&] { snap_vehicles(data); });
+    data.trip_stop_distances.clear();
+    runner.bench("realtime/snap_vehicles_cold", 0, data.vehicles.size(),
+        [&] { data.trip_stop_distances.clear(); },
+        [&] { snap_vehicles(data); });
+}
+
+bool parse_args(int argc, char** argv, Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> const char* {
+            if (i + 1 >= argc) throw std::runtime_error("Missing value for " + arg);
+            return argv[++i];
+        };
+        if (arg == "--scale") opts.scale = std::max(1, atoi(value()));
+        else if (arg == "--min-time") opts.min_time = std::max(0.0, atof(value()));
+        else if (arg == "--filter") opts.filter = value();
+        else if (arg == "--out") opts.out = value();
+        else return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opts;
+    try {
+        if (!parse_args(argc, argv, opts)) {
+            fprintf(stderr, "Usage: gtfs_bench [--scale N] [--min-time SECONDS] [--filter SUBSTRING] [--out FILE]\n");
+            return 2;
+        }
+
+        fprintf(stderr, "Generating synthetic feed at scale %d...\n", opts.scale);
+        SyntheticFeed feed = generate_feed(opts.scale);
+        fprintf(stderr, "%zu stops, %zu trips, %zu stop_times, %zu shape points, %.1f MB zipped\n",
+            feed.stops, feed.trips, feed.stop_times, feed.shape_points, feed.zip.size() / 1e6);
+
+        Runner runner(opts);
+        parser_benchmarks(runner, feed);
+
+        GTFSData data;
+        std::vector<BufferView> buffers = { { reinterpret_cast<const unsigned char*>(feed.zip.data()), feed.zip.size() } };
+        load_feeds(data, buffers, { "bench" }, 0, nullptr, nullptr);
+        finalize_benchmarks(runner, data);
+        query_benchmarks(runner, data);
+        realtime_benchmarks(runner, data);
+
+        std::string json = to_json(opts, feed, runner.results());
+        if (opts.out.empty()) {
+            fputs(json.c_str(), stdout);
+        } else {
+            FILE* f = fopen(opts.out.c_str(), "wb");
+            if (!f) throw std::runtime_error("Failed to open " + opts.out);
+            fwrite(json.data(), 1, json.size(), f);
+            fclose(f);
+            fprintf(stderr, "Wrote %s\n", opts.out.c_str());
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "gtfs_bench: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
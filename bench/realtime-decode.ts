@@ -0,0 +1,38 @@
+import { GTFS } from "../index.js";
+import fs from "fs";
+
+// Decode throughput of updateRealtime for GTFS-realtime files given on the command line:
+//   tsx bench/realtime-decode.ts <tripUpdates.pb> [vehiclePositions.pb] [alerts.pb]
+// Each round clears the realtime state first, so every buffer is decoded in full.
+
+const ROUNDS = Number( process.env.ROUNDS || 50 );
+
+function main() {
+	const [tuPath, vpPath, alPath] = process.argv.slice( 2 );
+	if ( !tuPath ) {
+		console.error( "Usage: tsx bench/realtime-decode.ts <tripUpdates.pb> [vehiclePositions.pb] [alerts.pb]" );
+		process.exit( 1 );
+	}
+	const read = ( p?: string ) => p ? [fs.readFileSync( p )] : [];
+	const tripUpdates = read( tuPath ), vehiclePositions = read( vpPath ), alerts = read( alPath );
+	const bytes = [...tripUpdates, ...vehiclePositions, ...alerts].reduce( ( n, b ) => n + b.length, 0 );
+
+	const g = new GTFS();
+	g.updateRealtime( alerts, tripUpdates, vehiclePositions );
+	const entities = g.getRealtimeTripUpdates().length + g.getRealtimeVehiclePositions().length + g.getRealtimeAlerts().length;
+
+	let elapsed = 0;
+	for ( let i = 0; i < ROUNDS; i++ ) {
+		g.clearRealtime();
+		const start = process.hrtime.bigint();
+		g.updateRealtime( alerts, tripUpdates, vehiclePositions );
+		elapsed += Number( process.hrtime.bigint() - start );
+	}
+
+	const seconds = elapsed / 1e9;
+	console.log( `${ROUNDS} rounds, ${( bytes / 1024 ).toFixed( 1 )} KB and ${entities} entities per round` );
+	console.log( `${( elapsed / ROUNDS / 1e6 ).toFixed( 3 )} ms per round` );
+	console.log( `${( bytes * ROUNDS / 1024 / 1024 / seconds ).toFixed( 1 )} MB/s, ${Math.round( entities * ROUNDS / seconds )} entities/s` );
+}
+
+main();
@@ -7,9 +7,10 @@ import { fileURLToPath } from 'url';
 import * as crypto from 'crypto';
 import {
     Agency, Route, Stop, StopTime, FeedInfo, Trip, Shape, Calendar, CalendarDate,
-    RealtimeTripUpdate, RealtimeVehiclePosition, RealtimeAlert, StopTimeQuery, TripQuery, GTFSOptions, ProgressInfo,
+    RealtimeTripUpdate, RealtimeVehiclePosition, RealtimeAlert, StopTimeQuery, StopTimeWithRealtimeQuery, StopTimeWithRealtime, DepartureQuery, Departure, JourneyQuery, Journey, NearbyStop, TripQuery, GTFSOptions, ProgressInfo,
+    StopTimesColumnar, ShapesColumnar, ShapePolylineOptions, VehicleProgressColumnar,
     GTFSMergeStrategy, GTFSFeedConfig, GTFSActions,
-    RealtimeFilter
+    RealtimeFilter, StopTimeCompaction, GTFSStats
 } from './types.js';
 
 export * from './types.js';
@@ -32,18 +33,43 @@ try {
             if (process.env.NODE_ENV === 'test') {
                 GTFSAddon = class MockAddon {
                     loadFromBuffers() { }
+                    changeFeed() { return Promise.resolve(true); }
+                    saveSnapshot() { }
+                    loadSnapshot() { }
+                    attachSnapshot() { }
                     getFeedInfo() { return []; }
                     getRoutes() { return []; }
                     getAgencies() { return []; }
                     getStops() { return []; }
+                    getStopsNear() { return []; }
                     getStopTimes() { return []; }
+                    getStopTimesColumnar() { return { length: 0 }; }
+                    getStopTimesAsync() { return Promise.resolve([]); }
+                    getStopTimesWithRealtime() { return []; }
+                    getDepartures() { return []; }
+                    compactStopTimes() { return { rows: 0, trips: 0, patterns: 0, profiles: 0, flat_bytes: 0, compact_bytes: 0 }; }
+                    getStats() { return { generation: 0, load: { total_ms: 0, files: [], phases: [] }, memory: { total: 0 }, methods: {} }; }
+                    setStringCache() {}
+                    planJourney() { return []; }
+                    planJourneyAsync() { return Promise.resolve([]); }
+                    getStopTimesColumnarAsync() { return Promise.resolve({ length: 0 }); }
+                    getStringTable() { return []; }
                     getTrips() { return []; }
+                    getTripsAsync() { return Promise.resolve([]); }
                     getShapes() { return []; }
+                    getShapesColumnar() { return { length: 0 }; }
+                    getShapesAsync() { return Promise.resolve([]); }
+                    getShapesColumnarAsync() { return Promise.resolve({ length: 0 }); }
+                    getShapePolyline() { return null; }
                     getCalendars() { return []; }
                     getCalendarDates() { return []; }
+                    getCalendarDatesAsync() { return Promise.resolve([]); }
                     updateRealtime() { }
+                    updateRealtimeAsync() { return Promise.resolve(); }
                     getRealtimeTripUpdates() { return []; }
                     getRealtimeVehiclePositions() { return []; }
+                    getVehiclesInBBox() { return []; }
+                    getVehicleProgress() { return { length: 0 }; }
                     getRealtimeAlerts() { return []; }
                 };
             } else {
@@ -86,6 +112,10 @@ export class GTFS {
     private lastProgressUpdate: number = 0;
     private filesToLoad?: string[];
     private skipStopTimes: boolean;
+    private snapshot: boolean;
+    private threads?: number;
+    private lazyFiles?: string[];
+    private compactStopTimesOnLoad: boolean;
     private serviceDatesCache: Record<string, string[]> | null = null;
     private serviceDatesSets: Record<string, Set<string>> | null = null;
     private serviceIdsByDateCache: Record<string, string[]> | null = null;
@@ -111,6 +141,11 @@ export class GTFS {
         this.mergeStrategy = options?.mergeStrategy !== undefined ? options.mergeStrategy : GTFSMergeStrategy.OVERWRITE;
         this.filesToLoad = options?.filesToLoad;
         this.skipStopTimes = options?.skipStopTimes || false;
+        this.snapshot = options?.snapshot || false;
+        this.threads = options?.threads;
+        this.lazyFiles = options?.lazyFiles;
+        this.compactStopTimesOnLoad = options?.compactStopTimes || false;
+        if (options?.cacheStrings) this.addonInstance.setStringCache(true);
     }
 
     private showProgress(task: string, current: number, total: number, speed: number, eta: number) {
@@ -146,11 +181,13 @@ export class GTFS {
     async loadStatic(feeds: (GTFSFeedConfig | string)[] | GTFSFeedConfig | string): Promise<void> {
         const feedList = Array.isArray(feeds) ? feeds : [feeds];
         const buffers: Buffer[] = [];
+        const versions: string[] = [];
+        const cacheDir = this.cacheDir || './cache';
 
         for (const feed of feedList) {
             const config: GTFSFeedConfig = typeof feed === 'string' ? { url: feed } : feed;
             let buffer: Buffer | null = null;
-            const cacheDir = this.cacheDir || './cache';
+            let etag: string | undefined;
             let cachePath = '';
 
             if (this.cache) {
@@ -162,6 +199,9 @@ export class GTFS {
                     const stats = fs.statSync(cachePath);
                     const age = Date.now() - stats.mtimeMs;
                     const oneDay = 24 * 60 * 60 * 1000;
+                    if (fs.existsSync(cachePath + '.etag')) {
+                        etag = fs.readFileSync(cachePath + '.etag', 'utf8');
+                    }
 
                     if (age < oneDay) {
                         if (this.logger) this.logger(`Loading from cache: ${cachePath}`);
@@ -170,6 +210,23 @@ export class GTFS {
                         } catch (e) {
                             if (this.logger) this.logger(`Failed to read cache: ${e}`);
                         }
+                    } else if (etag) {
+                        // Revalidate instead of redownloading; an unchanged feed keeps its snapshot.
+                        try {
+                            const res = await this.fetch(config.url, "Downloading", true, { ...config.headers, 'If-None-Match': etag });
+                            if (res.notModified) {
+                                if (this.logger) this.logger(`Cache still valid for ${config.url}`);
+                                buffer = fs.readFileSync(cachePath);
+                                const now = new Date();
+                                fs.utimesSync(cachePath, now, now);
+                            } else {
+                                buffer = res.buffer;
+                                etag = res.etag;
+                                this.writeCache(cacheDir, cachePath, buffer, etag);
+                            }
+                        } catch (e) {
+                            if (this.logger) this.logger(`Failed to revalidate cache: ${e}`);
+                        }
                     } else {
                         if (this.logger) this.logger(`Cache expired for ${config.url}, redownloading...`);
                     }
@@ -184,20 +241,114 @@ export class GTFS {
                         this.logger(`Downloading ${config.url}...`);
                     }
                 }
-                buffer = await this.download(config.url, "Downloading", true, config.headers);
+                const res = await this.fetch(config.url, "Downloading", true, config.headers);
+                buffer = res.buffer;
+                etag = res.etag;
 
                 if (this.cache && cachePath) {
-                    if (!fs.existsSync(cacheDir)) {
-                        fs.mkdirSync(cacheDir, { recursive: true });
-                    }
-                    fs.writeFileSync(cachePath, buffer);
+                    this.writeCache(cacheDir, cachePath, buffer, etag);
                 }
             }
             buffers.push(buffer as Buffer);
+            // Without an ETag fall back to the content hash so a changed feed never reuses a stale snapshot
+            versions.push(`${config.url}|${etag || crypto.createHash('md5').update(buffer as Buffer).digest('hex')}`);
         }
 
         const feedIds = feedList.map(f => typeof f === 'string' ? '' : (f.feed_id || ''));
-        return this.loadFromBuffers(buffers, feedIds);
+
+        if (!this.cache || !this.snapshot) {
+            return this.loadFromBuffers(buffers, feedIds);
+        }
+
+        // The scope names everything but the feed versions: processes sharing
+        // cacheDir with other feeds or options never remove each other's snapshots
+        const urls = feedList.map(f => typeof f === 'string' ? f : f.url);
+        const snapshotScope = crypto.createHash('md5')
+            .update(JSON.stringify({ urls, feedIds, mergeStrategy: this.mergeStrategy, files: this.getEffectiveFiles() }))
+            .digest('hex');
+        const snapshotKey = crypto.createHash('md5')
+            .update(JSON.stringify({ versions, feedIds, mergeStrategy: this.mergeStrategy, files: this.getEffectiveFiles() }))
+            .digest('hex');
+        const snapshotPath = path.join(cacheDir, `${snapshotScope}-${snapshotKey}.snapshot`);
+
+        if (fs.existsSync(snapshotPath)) {
+            try {
+                await this.attachSnapshot(snapshotPath);
+                this.removeStaleSnapshots(cacheDir, snapshotScope, snapshotKey);
+                return;
+            } catch (e) {
+                if (this.logger) this.logger(`Failed to load snapshot ${snapshotPath}: ${e}`);
+            }
+        }
+
+        await this.loadFromBuffers(buffers, feedIds);
+        try {
+            await this.saveSnapshot(snapshotPath);
+            this.removeStaleSnapshots(cacheDir, snapshotScope, snapshotKey);
+        } catch (e) {
+            if (this.logger) this.logger(`Failed to save snapshot ${snapshotPath}: ${e}`);
+        }
+    }
+
+    // Snapshots of earlier versions of the same feeds are never read again once
+    // the current one is in place, so drop them. Temporary files may belong to a
+    // save still running in another process; only those a day old are treated as
+    // left behind by a failed save. Processes that still map a removed snapshot
+    // keep their view of it.
+    private removeStaleSnapshots(cacheDir: string, snapshotScope: string, snapshotKey: string) {
+        const tmpMaxAge = 24 * 60 * 60 * 1000;
+        let names: string[];
+        try {
+            names = fs.readdirSync(cacheDir);
+        } catch (e) {
+            return;
+        }
+        for (const name of names) {
+            const match = /^([0-9a-f]{32})-([0-9a-f]{32})\.snapshot(\.\d+\.[0-9a-f]+\.tmp)?$/.exec(name);
+            if (!match || match[1] !== snapshotScope) continue;
+            try {
+                if (match[3]) {
+                    if (Date.now() - fs.statSync(path.join(cacheDir, name)).mtimeMs < tmpMaxAge) continue;
+                } else if (match[2] === snapshotKey) {
+                    continue;
+                }
+                fs.unlinkSync(path.join(cacheDir, name));
+            } catch (e) {
+                if (this.logger) this.logger(`Failed to remove stale snapshot ${name}: ${e}`);
+            }
+        }
+    }
+
+    private writeCache(cacheDir: string, cachePath: string, buffer: Buffer, etag?: string) {
+        if (!fs.existsSync(cacheDir)) {
+            fs.mkdirSync(cacheDir, { recursive: true });
+        }
+        fs.writeFileSync(cachePath, buffer);
+        if (etag) {
+            fs.writeFileSync(cachePath + '.etag', etag);
+        } else if (fs.existsSync(cachePath + '.etag')) {
+            fs.unlinkSync(cachePath + '.etag');
+        }
+    }
+
+    saveSnapshot(snapshotPath: string): Promise<void> {
+        return this.addonInstance.saveSnapshot(snapshotPath, this.logger, this.ansi);
+    }
+
+    loadSnapshot(snapshotPath: string): Promise<void> {
+        return this.addonInstance.loadSnapshot(snapshotPath, this.logger, this.ansi)
+            .then((result: void) => {
+                this.onStaticDataReplaced();
+                return result;
+            });
+    }
+
+    attachSnapshot(snapshotPath: string): Promise<void> {
+        return this.addonInstance.attachSnapshot(snapshotPath, this.logger, this.ansi)
+            .then((result: void) => {
+                this.onStaticDataReplaced(true);
+                return result;
+            });
     }
 
     async loadFromPath(paths: string[], feedIds?: string[]): Promise<void> {
@@ -206,8 +357,41 @@ export class GTFS {
     }
 
     loadFromBuffers(buffers: Buffer[], feedIds?: string[]): Promise<void> {
+        return this.addonInstance.loadFromBuffers(buffers, this.mergeStrategy, this.logger, this.ansi, this.progressBridge(), feedIds || [], this.getEffectiveFiles(), this.threads || 0, this.lazyFiles || [])
+            .then((result: void) => {
+                this.onStaticDataReplaced();
+                return result;
+            });
+    }
+
+    // Feed changes parse only the given feed; the other loaded feeds are copied
+    // from the current data, and the new copy is swapped in like a load.
+    // source is a ZIP buffer or a local path.
+    addFeed(source: Buffer | string, feedId: string): Promise<void> {
+        return this.changeFeed('add', feedId, source).then(() => undefined);
+    }
+
+    replaceFeed(source: Buffer | string, feedId: string): Promise<void> {
+        return this.changeFeed('replace', feedId, source).then(() => undefined);
+    }
+
+    // Resolves false when no feed with this id is loaded
+    removeFeed(feedId: string): Promise<boolean> {
+        return this.changeFeed('remove', feedId);
+    }
+
+    private changeFeed(mode: 'add' | 'replace' | 'remove', feedId: string, source?: Buffer | string): Promise<boolean> {
+        const buffer = typeof source === 'string' ? fs.readFileSync(source) : source;
+        return this.addonInstance.changeFeed(mode, feedId, buffer, this.mergeStrategy, this.logger, this.ansi, this.progressBridge(), this.getEffectiveFiles(), this.threads || 0, this.lazyFiles || [])
+            .then((changed: boolean) => {
+                if (changed) this.onStaticDataReplaced();
+                return changed;
+            });
+    }
+
+    private progressBridge() {
         const startTime = Date.now();
-        const progressBridge = (task: string, current: number, total: number) => {
+        return (task: string, current: number, total: number) => {
             const now = Date.now();
             const elapsed = (now - startTime) / 1000;
             const speed = elapsed > 0 ? current / elapsed : 0;
@@ -215,7 +399,19 @@ export class GTFS {
             const eta = speed > 0 ? remaining / speed : 0;
             this.showProgress(task, current, total, speed, eta);
         };
+    }
+
+    // attached: the stop times are mapped from a shared snapshot, and compacting
+    // them would copy them into this process
+    private onStaticDataReplaced(attached = false) {
+        this.serviceDatesCache = null;
+        this.serviceDatesSets = null;
+        this.serviceIdsByDateCache = null;
+        this.tripsByServiceIdCache = null;
+        if (this.compactStopTimesOnLoad && !attached) this.addonInstance.compactStopTimes();
+    }
 
+    private getEffectiveFiles(): string[] {
         const ALL_FILES = ['agency.txt','routes.txt','trips.txt','stops.txt','stop_times.txt','calendar.txt','calendar_dates.txt','shapes.txt','feed_info.txt'];
         let effectiveFiles: string[] = this.filesToLoad ? [...this.filesToLoad] : [];
         if (this.skipStopTimes && effectiveFiles.length === 0) {
@@ -223,15 +419,7 @@ export class GTFS {
         } else if (this.skipStopTimes) {
             effectiveFiles = effectiveFiles.filter(f => f !== 'stop_times.txt');
         }
-
-        return this.addonInstance.loadFromBuffers(buffers, this.mergeStrategy, this.logger, this.ansi, progressBridge, feedIds || [], effectiveFiles)
-            .then((result: void) => {
-                this.serviceDatesCache = null;
-                this.serviceDatesSets = null;
-                this.serviceIdsByDateCache = null;
-                this.tripsByServiceIdCache = null;
-                return result;
-            });
+        return effectiveFiles;
     }
 
     getRoutes(filter?: Partial<Route>): Route[] {
@@ -246,10 +434,79 @@ export class GTFS {
         return this.addonInstance.getStops(filter);
     }
 
+    /** Stops within radius meters of lat/lon, nearest first; limit 0 returns all of them. */
+    getStopsNear(lat: number, lon: number, radius: number, limit: number = 0): NearbyStop[] {
+        return this.addonInstance.getStopsNear(lat, lon, radius, limit);
+    }
+
     getStopTimes(query?: StopTimeQuery): StopTime[] {
         return this.addonInstance.getStopTimes(query || {});
     }
 
+    getStopTimesColumnar(query?: StopTimeQuery): StopTimesColumnar {
+        return this.addonInstance.getStopTimesColumnar(query || {});
+    }
+
+    /** Same as getStopTimes, evaluated on the libuv threadpool. */
+    getStopTimesAsync(query?: StopTimeQuery): Promise<StopTime[]> {
+        return this.addonInstance.getStopTimesAsync(query || {});
+    }
+
+    /**
+     * getStopTimes rows merged with the loaded realtime trip updates, with delays
+     * propagated along each trip.
+     */
+    getStopTimesWithRealtime(query?: StopTimeWithRealtimeQuery): StopTimeWithRealtime[] {
+        return this.addonInstance.getStopTimesWithRealtime(query || {});
+    }
+
+    /** Next departures at a stop (or station with include_children), in time order. */
+    getDepartures(query: DepartureQuery): Departure[] {
+        return this.addonInstance.getDepartures(query);
+    }
+
+    /**
+     * Journeys between two stops or stations, planned with RAPTOR. Without a window,
+     * the earliest arrival for each number of transfers that arrives sooner; with
+     * one, every departure in it that is not beaten on departure, arrival and transfers.
+     */
+    planJourney(query: JourneyQuery): Journey[] {
+        return this.addonInstance.planJourney(query);
+    }
+
+    /** Same as planJourney, evaluated on the libuv threadpool. */
+    planJourneyAsync(query: JourneyQuery): Promise<Journey[]> {
+        return this.addonInstance.planJourneyAsync(query);
+    }
+
+    getStopTimesColumnarAsync(query?: StopTimeQuery): Promise<StopTimesColumnar> {
+        return this.addonInstance.getStopTimesColumnarAsync(query || {});
+    }
+
+    /**
+     * Stores the loaded stop times as shared stop patterns plus per-trip start times,
+     * expanding rows on access. Results of every getter are unchanged.
+     */
+    compactStopTimes(): StopTimeCompaction {
+        return this.addonInstance.compactStopTimes();
+    }
+
+    getStats(): GTFSStats {
+        return this.addonInstance.getStats();
+    }
+
+    /**
+     * Keeps the strings sync getters return for reuse by later calls, one per string
+     * id, until the next load or feed change. Repeated ids then cost one conversion.
+     */
+    setStringCache(enabled: boolean): void {
+        this.addonInstance.setStringCache(enabled);
+    }
+
+    getStringTable(ids?: Uint32Array | number[]): (string | null)[] {
+        return ids ? this.addonInstance.getStringTable(ids) : this.addonInstance.getStringTable();
+    }
+
     getFeedInfo(): FeedInfo[] {
         return this.addonInstance.getFeedInfo();
     }
@@ -354,10 +611,34 @@ export class GTFS {
         return this.addonInstance.getTrips(filter || {});
     }
 
+    getTripsAsync(filter?: TripQuery | Partial<Trip>): Promise<Trip[]> {
+        return this.addonInstance.getTripsAsync(filter || {});
+    }
+
     getShapes(filter?: Partial<Shape>): Shape[] {
         return this.addonInstance.getShapes(filter);
     }
 
+    getShapesAsync(filter?: Partial<Shape>): Promise<Shape[]> {
+        return this.addonInstance.getShapesAsync(filter);
+    }
+
+    getShapesColumnar(filter?: Partial<Shape>): ShapesColumnar {
+        return this.addonInstance.getShapesColumnar(filter);
+    }
+
+    getShapesColumnarAsync(filter?: Partial<Shape>): Promise<ShapesColumnar> {
+        return this.addonInstance.getShapesColumnarAsync(filter);
+    }
+
+    /**
+     * Returns one shape simplified for a web-map zoom level (omit zoom for every point).
+     * Returns null when the shape does not exist.
+     */
+    getShapePolyline(shape_id: string, zoom?: number, options?: ShapePolylineOptions): string | Float64Array | null {
+        return this.addonInstance.getShapePolyline(shape_id, zoom, options);
+    }
+
     getCalendars(filter?: Partial<Calendar>): Calendar[] {
         return this.addonInstance.getCalendars(filter);
     }
@@ -366,6 +647,10 @@ export class GTFS {
         return this.addonInstance.getCalendarDates(filter);
     }
 
+    getCalendarDatesAsync(filter?: Partial<CalendarDate>): Promise<CalendarDate[]> {
+        return this.addonInstance.getCalendarDatesAsync(filter);
+    }
+
     getServiceDates(service_id: string): string[] {
         return this.getServiceDatesMap()[service_id] ?? [];
     }
@@ -380,6 +665,13 @@ export class GTFS {
         this.addonInstance.updateRealtime(alerts, tripUpdates, vehiclePositions, feed_id || "");
     }
 
+    /**
+     * Like updateRealtime, but decodes the buffers on worker threads and merges them in one step.
+     */
+    updateRealtimeAsync(alerts: Buffer | Buffer[], tripUpdates: Buffer | Buffer[], vehiclePositions: Buffer | Buffer[], feed_id?: string): Promise<void> {
+        return this.addonInstance.updateRealtimeAsync(alerts, tripUpdates, vehiclePositions, feed_id || "");
+    }
+
     async updateRealtimeFromUrl(
         alertsArg?: (GTFSFeedConfig | string)[] | GTFSFeedConfig | string | null,
         tripUpdatesArg?: (GTFSFeedConfig | string)[] | GTFSFeedConfig | string | null,
@@ -407,7 +699,7 @@ export class GTFS {
 
         // Note: this doesn't handle multiple feeds with different IDs in a single call easily if we want to associate them.
         // But for common use cases it's fine or user can call multiple times.
-        this.addonInstance.updateRealtime(alerts, tripUpdates, vehiclePositions);
+        await this.addonInstance.updateRealtimeAsync(alerts, tripUpdates, vehiclePositions);
     }
 
     getRealtimeTripUpdates(filter?: RealtimeFilter): RealtimeTripUpdate[] {
@@ -418,6 +710,14 @@ export class GTFS {
         return this.addonInstance.getRealtimeVehiclePositions(filter || {});
     }
 
+    getVehiclesInBBox(min_lat: number, min_lon: number, max_lat: number, max_lon: number): RealtimeVehiclePosition[] {
+        return this.addonInstance.getVehiclesInBBox(min_lat, min_lon, max_lat, max_lon);
+    }
+
+    getVehicleProgress(): VehicleProgressColumnar {
+        return this.addonInstance.getVehicleProgress();
+    }
+
     getRealtimeAlerts(filter?: RealtimeFilter): RealtimeAlert[] {
         return this.addonInstance.getRealtimeAlerts(filter || {});
     }
@@ -427,13 +727,22 @@ export class GTFS {
     }
 
     private download(url: string, taskName: string = "Downloading", showProgressBar: boolean = true, headers?: Record<string, string>): Promise<Buffer> {
+        return this.fetch(url, taskName, showProgressBar, headers).then(res => res.buffer);
+    }
+
+    private fetch(url: string, taskName: string = "Downloading", showProgressBar: boolean = true, headers?: Record<string, string>): Promise<{ buffer: Buffer, etag?: string, notModified: boolean }> {
         return new Promise((resolve, reject) => {
             const onResponse = (res: any) => {
                 res.on('error', (err: Error) => reject(err));
+                if (res.statusCode === 304) {
+                    res.resume();
+                    resolve({ buffer: Buffer.alloc(0), notModified: true });
+                    return;
+                }
                 if (res.statusCode !== 200) {
                     if ((res.statusCode === 301 || res.statusCode === 302) && res.headers.location) {
                         if (this.logger) this.logger(`Redirected to ${res.headers.location}`);
-                        this.download(res.headers.location as string, taskName, showProgressBar, headers).then(resolve).catch(reject);
+                        this.fetch(res.headers.location as string, taskName, showProgressBar, headers).then(resolve).catch(reject);
                         return;
                     }
                     reject(new Error(`Failed to download ${url}: ${res.statusCode}`));
@@ -441,6 +750,7 @@ export class GTFS {
                 }
 
                 const total = parseInt(res.headers['content-length'] || '0', 10);
+                const etag = typeof res.headers.etag === 'string' ? res.headers.etag : undefined;
                 let current = 0;
                 const data: Buffer[] = [];
                 const startTime = Date.now();
@@ -469,7 +779,7 @@ export class GTFS {
                         this.showProgress(taskName, current, total, speed, 0);
                         if (this.ansi && process.stdout.isTTY) process.stdout.write('\n');
                     }
-                    resolve(Buffer.concat(data))
+                    resolve({ buffer: Buffer.concat(data), etag, notModified: false })
                 });
             };
 
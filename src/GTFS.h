@@ -7,15 +7,26 @@
 #include <map>
 #include <unordered_map>
 #include <memory>
+#include <memory_resource>
 #include <iostream>
 #include <algorithm>
 #include <shared_mutex>
 #include <mutex>
+#include <condition_variable>
+#include <stdexcept>
 #include <utility>
 #include <optional>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <climits>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+
+#include "metrics.h"
+#include "thread_pool.h"
 
 
 namespace gtfs {
@@ -26,6 +37,14 @@ constexpr uint32_t ST_NO_HEADSIGN = 0xFFFFFFFFu;
 constexpr double   ST_NO_DIST    = -1.0;
 constexpr int8_t   ST_NO_INT8    = -1;
 
+// Sentinels of the compact entity records: interned string ids use NO_STR,
+// optional ints NO_INT (or ST_NO_INT8 for enum-like fields), coordinates NaN
+constexpr uint32_t NO_STR        = 0xFFFFFFFFu;
+constexpr int32_t  NO_INT        = INT32_MIN;
+
+constexpr uint32_t NO_SERVICE    = 0xFFFFFFFFu;
+constexpr int32_t  NO_DAY        = INT32_MIN;
+
 struct BufferView {
     const unsigned char* data;
     size_t size;
@@ -39,19 +58,177 @@ struct TransparentStringHash {
     }
 };
 
+// Memory accounting for getStats(). Hash container sizes are estimates: the
+// bucket array plus one node (value, next pointer, cached hash) per element.
+template<typename V>
+size_t vector_bytes(const std::vector<V>& v) { return v.capacity() * sizeof(V); }
+
+template<typename Map>
+size_t hash_table_bytes(const Map& m) {
+    return m.bucket_count() * sizeof(void*) + m.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void*));
+}
+
+inline size_t string_heap_bytes(const std::string& s) {
+    static const size_t inline_capacity = std::string().capacity();
+    return s.capacity() > inline_capacity ? s.capacity() + 1 : 0;
+}
+
+// Flat array that either owns its elements or views a read-only image
+// (see gtfs_snapshot.cpp). Reads never copy; mut() copies a viewed array
+// into private memory before the first write.
+template<typename T>
+class FlatArray {
+    std::vector<T> owned_;
+    const T* ext_ = nullptr;
+    size_t ext_size_ = 0;
+public:
+    size_t size() const { return ext_ ? ext_size_ : owned_.size(); }
+    bool empty() const { return size() == 0; }
+    const T* data() const { return ext_ ? ext_ : owned_.data(); }
+    const T* begin() const { return data(); }
+    const T* end() const { return data() + size(); }
+    const T& operator[](size_t i) const { return data()[i]; }
+    bool is_external() const { return ext_ != nullptr; }
+    // Viewed arrays count the bytes they span in the image
+    size_t memory_bytes() const { return ext_ ? ext_size_ * sizeof(T) : vector_bytes(owned_); }
+
+    void attach(const T* p, size_t n) {
+        owned_.clear();
+        owned_.shrink_to_fit();
+        ext_ = n ? p : nullptr;
+        ext_size_ = n;
+    }
+
+    std::vector<T>& mut() {
+        if (ext_) {
+            owned_.assign(ext_, ext_ + ext_size_);
+            ext_ = nullptr;
+            ext_size_ = 0;
+        }
+        return owned_;
+    }
+
+    void clear() {
+        owned_.clear();
+        ext_ = nullptr;
+        ext_size_ = 0;
+    }
+};
+
+// Interned strings. Their bytes live in monotonic arenas rather than in one heap
+// string per entry (two, counting the map key): a pool frees them a chunk at a time
+// when it is cleared or destroyed, and a copied pool shares the chunks of its source
+// instead of copying them. Ids interned before freeze() are read without locking.
 class StringPool {
-    std::unordered_map<std::string, uint32_t, TransparentStringHash, std::equal_to<>> str_to_id;
-    std::vector<std::string> id_to_str;
+    using Arena = std::pmr::monotonic_buffer_resource;
+
+    std::unordered_map<std::string_view, uint32_t, TransparentStringHash, std::equal_to<>> str_to_id;
+    std::vector<std::string_view> frozen_;           // ids from ext_count_, immutable once published
+    std::vector<std::string_view> id_to_str;         // ids after the frozen ones, under mutex_
+    std::shared_ptr<Arena> arena_;                   // created on the first miss
+    std::vector<std::shared_ptr<Arena>> shared_;     // arenas of the pools this one was assigned from
     mutable std::shared_mutex mutex_;
+
+    // Copies sv into the arena; callers hold mutex_ exclusively
+    std::string_view store(std::string_view sv) {
+        if (sv.empty()) return {};
+        if (!arena_) arena_ = std::make_shared<Arena>(INITIAL_ARENA_BYTES);
+        char* bytes = static_cast<char*>(arena_->allocate(sv.size(), 1));
+        memcpy(bytes, sv.data(), sv.size());
+        return std::string_view(bytes, sv.size());
+    }
+
+    uint32_t dynamic_base() const { return ext_count_ + static_cast<uint32_t>(frozen_.size()); }
+
+    uint32_t add(std::string_view sv) {
+        uint32_t id = dynamic_base() + static_cast<uint32_t>(id_to_str.size());
+        std::string_view stored = store(sv);
+        str_to_id.emplace(stored, id);
+        id_to_str.push_back(stored);
+        return id;
+    }
+
+    // Ids [0, ext_count_) live in an attached image: offset table + blob, plus an
+    // open-addressing table of ids for lookups. Newer strings go to the maps above.
+    const uint32_t* ext_offsets_ = nullptr; // ext_count_ + 1 entries
+    const char* ext_blob_ = nullptr;
+    const uint32_t* ext_slots_ = nullptr;   // ext_slot_mask_ + 1 entries, EXT_EMPTY if unused
+    uint32_t ext_count_ = 0;
+    uint32_t ext_slot_mask_ = 0;
+
+    std::string_view ext_view(uint32_t id) const {
+        return std::string_view(ext_blob_ + ext_offsets_[id], ext_offsets_[id + 1] - ext_offsets_[id]);
+    }
+
+    uint32_t ext_find(std::string_view sv) const {
+        if (!ext_slots_) return 0xFFFFFFFF;
+        for (uint32_t h = stable_hash(sv) & ext_slot_mask_;; h = (h + 1) & ext_slot_mask_) {
+            uint32_t id = ext_slots_[h];
+            if (id == EXT_EMPTY) return 0xFFFFFFFF;
+            if (ext_view(id) == sv) return id;
+        }
+    }
 public:
+    static constexpr uint32_t EXT_EMPTY = 0xFFFFFFFF;
+    static constexpr size_t INITIAL_ARENA_BYTES = 64 * 1024;
+
+    // FNV-1a; unlike std::hash it is stable across builds, so it can be persisted
+    static uint32_t stable_hash(std::string_view sv) {
+        uint32_t h = 2166136261u;
+        for (unsigned char c : sv) {
+            h ^= c;
+            h *= 16777619u;
+        }
+        return h;
+    }
+
     void clear() {
         std::unique_lock<std::shared_mutex> lock(mutex_);
         str_to_id.clear();
+        frozen_.clear();
         id_to_str.clear();
+        arena_.reset();
+        shared_.clear();
+        ext_offsets_ = nullptr;
+        ext_blob_ = nullptr;
+        ext_slots_ = nullptr;
+        ext_count_ = 0;
+        ext_slot_mask_ = 0;
+    }
+
+    // Copy of other with the same ids; an attached image is shared, not copied,
+    // so the caller keeps it alive for this pool's lifetime too
+    void assign(const StringPool& other) {
+        if (&other == this) return;
+        std::shared_lock<std::shared_mutex> from(other.mutex_);
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        str_to_id = other.str_to_id;
+        frozen_ = other.frozen_;
+        id_to_str = other.id_to_str;
+        shared_ = other.shared_;
+        if (other.arena_) shared_.push_back(other.arena_);
+        arena_.reset();
+        ext_offsets_ = other.ext_offsets_;
+        ext_blob_ = other.ext_blob_;
+        ext_slots_ = other.ext_slots_;
+        ext_count_ = other.ext_count_;
+        ext_slot_mask_ = other.ext_slot_mask_;
+    }
+
+    // Pool must be empty; the caller keeps the image alive for the pool's lifetime
+    void attach(const uint32_t* offsets, const char* blob, uint32_t count, const uint32_t* slots, uint32_t slot_count) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        ext_offsets_ = offsets;
+        ext_blob_ = blob;
+        ext_count_ = count;
+        ext_slots_ = slot_count ? slots : nullptr;
+        ext_slot_mask_ = slot_count ? slot_count - 1 : 0;
     }
 
     // Heterogeneous intern: avoids allocation if already interned
     uint32_t intern(std::string_view sv) {
+        uint32_t ext = ext_find(sv);
+        if (ext != 0xFFFFFFFF) return ext;
         {
             std::shared_lock<std::shared_mutex> lock(mutex_);
             auto it = str_to_id.find(sv);
@@ -61,10 +238,30 @@ public:
         auto it = str_to_id.find(sv);
         if (it != str_to_id.end()) return it->second;
 
-        uint32_t id = static_cast<uint32_t>(id_to_str.size());
-        str_to_id.emplace(std::string(sv), id);
-        id_to_str.emplace_back(sv);
-        return id;
+        return add(sv);
+    }
+
+    // Interns n strings with one shared pass for the hits and one exclusive pass for the
+    // misses, instead of locking per string
+    void intern_all(const std::string_view* svs, size_t n, uint32_t* out) {
+        std::vector<size_t> misses;
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            for (size_t i = 0; i < n; ++i) {
+                uint32_t ext = ext_find(svs[i]);
+                if (ext != 0xFFFFFFFF) { out[i] = ext; continue; }
+                auto it = str_to_id.find(svs[i]);
+                if (it != str_to_id.end()) out[i] = it->second;
+                else misses.push_back(i);
+            }
+        }
+        if (misses.empty()) return;
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        for (size_t i : misses) {
+            auto it = str_to_id.find(svs[i]);
+            if (it != str_to_id.end()) { out[i] = it->second; continue; }
+            out[i] = add(svs[i]);
+        }
     }
 
     uint32_t intern(const char* s, size_t len) {
@@ -75,15 +272,31 @@ public:
         return intern(std::string_view(s));
     }
 
-    std::string get(uint32_t id) const {
+    // Makes every id interned so far readable without the lock. The caller has the
+    // pool to itself: DataGenerations freezes a generation before publishing it.
+    void freeze() {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        frozen_.insert(frozen_.end(), id_to_str.begin(), id_to_str.end());
+        id_to_str.clear();
+    }
+
+    // The bytes stay valid for the pool's lifetime; empty for unknown ids. Lock-free
+    // for image and frozen ids, which are all of them for loaded data.
+    std::string_view view(uint32_t id) const {
+        if (id < ext_count_) return ext_view(id);
+        if (id - ext_count_ < frozen_.size()) return frozen_[id - ext_count_];
         std::shared_lock<std::shared_mutex> lock(mutex_);
-        if (id < id_to_str.size()) return id_to_str[id];
-        return "";
+        uint32_t base = dynamic_base();
+        if (id >= base && id - base < id_to_str.size()) return id_to_str[id - base];
+        return {};
+    }
+
+    std::string get(uint32_t id) const {
+        return std::string(view(id));
     }
 
     bool exists(std::string_view sv) const {
-        std::shared_lock<std::shared_mutex> lock(mutex_);
-        return str_to_id.count(sv) > 0;
+        return get_id(sv) != 0xFFFFFFFF;
     }
 
     bool exists(const std::string& s) const {
@@ -91,6 +304,8 @@ public:
     }
 
     uint32_t get_id(std::string_view sv) const {
+        uint32_t ext = ext_find(sv);
+        if (ext != 0xFFFFFFFF) return ext;
         std::shared_lock<std::shared_mutex> lock(mutex_);
         auto it = str_to_id.find(sv);
         if (it != str_to_id.end()) return it->second;
@@ -100,6 +315,27 @@ public:
     uint32_t get_id(const std::string& s) const {
         return get_id(std::string_view(s));
     }
+
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return dynamic_base() + id_to_str.size();
+    }
+
+    void reserve(size_t n) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        str_to_id.reserve(n);
+        id_to_str.reserve(n);
+    }
+
+    size_t memory_bytes() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        size_t bytes = vector_bytes(frozen_) + vector_bytes(id_to_str) + hash_table_bytes(str_to_id);
+        for (std::string_view s : frozen_) bytes += s.size(); // arena bytes, whether owned or shared
+        for (std::string_view s : id_to_str) bytes += s.size();
+        if (ext_offsets_) bytes += (ext_count_ + 1) * sizeof(uint32_t) + ext_offsets_[ext_count_];
+        if (ext_slots_) bytes += (static_cast<size_t>(ext_slot_mask_) + 1) * sizeof(uint32_t);
+        return bytes;
+    }
 };
 
 struct Agency {
@@ -115,17 +351,18 @@ struct Agency {
 };
 
 struct Calendar {
-    std::string service_id;
-    bool monday;
-    bool tuesday;
-    bool wednesday;
-    bool thursday;
-    bool friday;
-    bool saturday;
-    bool sunday;
-    std::string start_date;
-    std::string end_date;
-    std::string feed_id;
+    uint32_t service_id = 0;
+    uint32_t start_date = 0;  // YYYYMMDD string, interned
+    uint32_t end_date = 0;
+    uint32_t feed_id = 0;
+    bool monday = false;
+    bool tuesday = false;
+    bool wednesday = false;
+    bool thursday = false;
+    bool friday = false;
+    bool saturday = false;
+    bool sunday = false;
+    uint8_t  _pad[1] = {};
 };
 
 struct CalendarDate {
@@ -135,40 +372,45 @@ struct CalendarDate {
     std::string feed_id;
 };
 
+// Compact Route/Stop/Trip/Shape: every string is a string_pool id (NO_STR when
+// absent) and the owning feed is an id, so records are trivially copyable and
+// can be viewed in place from a snapshot.
 struct Route {
-    std::string route_id;
-    std::optional<std::string> agency_id = std::nullopt;
-    std::optional<std::string> route_short_name = std::nullopt;
-    std::optional<std::string> route_long_name = std::nullopt;
-    std::optional<std::string> route_desc = std::nullopt;
-    int route_type;
-    std::optional<std::string> route_url = std::nullopt;
-    std::optional<std::string> route_color = std::nullopt;
-    std::optional<std::string> route_text_color = std::nullopt;
-    std::optional<int> continuous_pickup = std::nullopt;
-    std::optional<int> continuous_drop_off = std::nullopt;
-    std::optional<int> route_sort_order = std::nullopt;
-    std::optional<std::string> network_id = std::nullopt;
-    std::string feed_id;
+    uint32_t route_id = 0;
+    uint32_t agency_id = NO_STR;
+    uint32_t route_short_name = NO_STR;
+    uint32_t route_long_name = NO_STR;
+    uint32_t route_desc = NO_STR;
+    uint32_t route_url = NO_STR;
+    uint32_t route_color = NO_STR;
+    uint32_t route_text_color = NO_STR;
+    uint32_t network_id = NO_STR;
+    uint32_t feed_id = 0;
+    int32_t  route_type = 0;
+    int32_t  route_sort_order = NO_INT;
+    int8_t   continuous_pickup = ST_NO_INT8;
+    int8_t   continuous_drop_off = ST_NO_INT8;
+    uint8_t  _pad[2] = {};
 };
 
 struct Stop {
-    std::string stop_id;
-    std::optional<std::string> stop_code = std::nullopt;
-    std::string stop_name;
-    std::optional<std::string> stop_desc = std::nullopt;
-    std::optional<double> stop_lat = std::nullopt;
-    std::optional<double> stop_lon = std::nullopt;
-    std::optional<std::string> zone_id = std::nullopt;
-    std::optional<std::string> stop_url = std::nullopt;
-    std::optional<int> location_type = std::nullopt;
-    std::optional<std::string> parent_station = std::nullopt;
-    std::optional<std::string> stop_timezone = std::nullopt;
-    std::optional<int> wheelchair_boarding = std::nullopt;
-    std::optional<std::string> level_id = std::nullopt;
-    std::optional<std::string> platform_code = std::nullopt;
-    std::optional<std::string> tts_stop_name = std::nullopt;
-    std::string feed_id;
+    uint32_t stop_id = 0;
+    uint32_t stop_code = NO_STR;
+    uint32_t stop_name = NO_STR;
+    uint32_t stop_desc = NO_STR;
+    uint32_t zone_id = NO_STR;
+    uint32_t stop_url = NO_STR;
+    uint32_t parent_station = NO_STR;
+    uint32_t stop_timezone = NO_STR;
+    uint32_t level_id = NO_STR;
+    uint32_t platform_code = NO_STR;
+    uint32_t tts_stop_name = NO_STR;
+    uint32_t feed_id = 0;
+    double   stop_lat = std::numeric_limits<double>::quiet_NaN();
+    double   stop_lon = std::numeric_limits<double>::quiet_NaN();
+    int8_t   location_type = ST_NO_INT8;
+    int8_t   wheelchair_boarding = ST_NO_INT8;
+    uint8_t  _pad[6] = {};
 };
 
 // Compact StopTime: sentinel values replace std::optional (~48 bytes vs ~88 bytes)
@@ -189,27 +431,623 @@ struct StopTime {
     uint8_t  _pad[3]          = {};
 };
 
+// Departure-board ordering key: departure time, arrival time when missing
+inline int32_t stop_time_board_time(const StopTime& st) {
+    return st.departure_time != ST_NO_TIME ? st.departure_time : st.arrival_time;
+}
+
+// Stop times stored as trip patterns: the runs of rows of one (trip, feed) that
+// share every field but the times point at one copy of those fields, and runs
+// whose times differ only by a constant point at one timing profile of offsets.
+// Row numbers are the same as in the flat rows the store was built from.
+class CompactStopTimes {
+public:
+    struct PatternStop {
+        uint32_t stop_id = 0;
+        int32_t  stop_sequence = 0;
+        uint32_t stop_headsign = ST_NO_HEADSIGN;
+        int8_t   pickup_type = 0;
+        int8_t   drop_off_type = 0;
+        int8_t   timepoint = ST_NO_INT8;
+        int8_t   continuous_pickup = ST_NO_INT8;
+        int8_t   continuous_drop_off = ST_NO_INT8;
+        uint8_t  _pad[7] = {}; // every byte named and zeroed: dedupe keys on the raw bytes
+        double   shape_dist_traveled = ST_NO_DIST;
+    };
+    static_assert(sizeof(PatternStop) == 32, "PatternStop must have no implicit padding");
+
+    struct Offset {
+        int32_t arrival = ST_NO_TIME;   // seconds after the run's start_time
+        int32_t departure = ST_NO_TIME;
+    };
+    static_assert(sizeof(Offset) == 8, "Offset must have no implicit padding");
+
+    struct Run {
+        uint32_t trip_id = 0;
+        uint32_t feed_id = 0;
+        uint32_t first_row = 0;
+        uint32_t row_count = 0;
+        uint32_t pattern = 0;  // into pattern_stops_
+        uint32_t profile = 0;  // into offsets_
+        int32_t  start_time = 0;
+    };
+
+private:
+    std::vector<Run> runs_;                 // in row order, so also by trip_id
+    std::vector<PatternStop> pattern_stops_;
+    std::vector<Offset> offsets_;
+    size_t row_count_ = 0;
+    size_t pattern_count_ = 0;
+    size_t profile_count_ = 0;
+
+    const Run& run_of(size_t row) const {
+        auto it = std::upper_bound(runs_.begin(), runs_.end(), static_cast<uint32_t>(row), [](uint32_t r, const Run& run) {
+            return r < run.first_row;
+        });
+        return *(it - 1);
+    }
+
+    // Keys on the bytes of items, so T must not have padding that is left
+    // uninitialized (see the static_asserts on PatternStop and Offset)
+    template<typename T>
+    static uint32_t dedupe(std::vector<T>& pool, std::unordered_map<std::string, uint32_t>& seen, const T* items, size_t n) {
+        std::string key(reinterpret_cast<const char*>(items), n * sizeof(T));
+        auto [it, inserted] = seen.try_emplace(std::move(key), static_cast<uint32_t>(pool.size()));
+        if (inserted) pool.insert(pool.end(), items, items + n);
+        return it->second;
+    }
+
+public:
+    size_t size() const { return row_count_; }
+    bool empty() const { return runs_.empty(); }
+    size_t run_count() const { return runs_.size(); }
+    size_t pattern_count() const { return pattern_count_; }
+    size_t profile_count() const { return profile_count_; }
+    size_t memory_bytes() const {
+        return runs_.capacity() * sizeof(Run) + pattern_stops_.capacity() * sizeof(PatternStop) + offsets_.capacity() * sizeof(Offset);
+    }
+
+    // rows must be grouped by (trip_id, feed_id) runs, as the loader sorts them
+    void build(const StopTime* rows, size_t n) {
+        clear();
+        std::unordered_map<std::string, uint32_t> patterns, profiles;
+        std::vector<PatternStop> stops;
+        std::vector<Offset> offsets;
+        for (size_t begin = 0; begin < n;) {
+            size_t end = begin + 1;
+            while (end < n && rows[end].trip_id == rows[begin].trip_id && rows[end].feed_id == rows[begin].feed_id) ++end;
+
+            Run run;
+            run.trip_id = rows[begin].trip_id;
+            run.feed_id = rows[begin].feed_id;
+            run.first_row = static_cast<uint32_t>(begin);
+            run.row_count = static_cast<uint32_t>(end - begin);
+            for (size_t i = begin; i < end; ++i) {
+                int32_t t = rows[i].arrival_time != ST_NO_TIME ? rows[i].arrival_time : rows[i].departure_time;
+                if (t != ST_NO_TIME) {
+                    run.start_time = t;
+                    break;
+                }
+            }
+
+            stops.clear();
+            offsets.clear();
+            for (size_t i = begin; i < end; ++i) {
+                const StopTime& st = rows[i];
+                PatternStop ps;
+                ps.stop_id = st.stop_id;
+                ps.stop_sequence = st.stop_sequence;
+                ps.stop_headsign = st.stop_headsign;
+                ps.pickup_type = st.pickup_type;
+                ps.drop_off_type = st.drop_off_type;
+                ps.timepoint = st.timepoint;
+                ps.continuous_pickup = st.continuous_pickup;
+                ps.continuous_drop_off = st.continuous_drop_off;
+                ps.shape_dist_traveled = st.shape_dist_traveled;
+                stops.push_back(ps);
+                Offset o;
+                if (st.arrival_time != ST_NO_TIME) o.arrival = st.arrival_time - run.start_time;
+                if (st.departure_time != ST_NO_TIME) o.departure = st.departure_time - run.start_time;
+                offsets.push_back(o);
+            }
+            run.pattern = dedupe(pattern_stops_, patterns, stops.data(), stops.size());
+            run.profile = dedupe(offsets_, profiles, offsets.data(), offsets.size());
+            runs_.push_back(run);
+            begin = end;
+        }
+        runs_.shrink_to_fit();
+        pattern_stops_.shrink_to_fit();
+        offsets_.shrink_to_fit();
+        row_count_ = n;
+        pattern_count_ = patterns.size();
+        profile_count_ = profiles.size();
+    }
+
+    StopTime operator[](size_t row) const {
+        const Run& run = run_of(row);
+        size_t i = row - run.first_row;
+        const PatternStop& ps = pattern_stops_[run.pattern + i];
+        const Offset& o = offsets_[run.profile + i];
+        StopTime st;
+        st.trip_id = run.trip_id;
+        st.feed_id = run.feed_id;
+        st.arrival_time = o.arrival != ST_NO_TIME ? run.start_time + o.arrival : ST_NO_TIME;
+        st.departure_time = o.departure != ST_NO_TIME ? run.start_time + o.departure : ST_NO_TIME;
+        st.stop_id = ps.stop_id;
+        st.stop_sequence = ps.stop_sequence;
+        st.stop_headsign = ps.stop_headsign;
+        st.shape_dist_traveled = ps.shape_dist_traveled;
+        st.pickup_type = ps.pickup_type;
+        st.drop_off_type = ps.drop_off_type;
+        st.timepoint = ps.timepoint;
+        st.continuous_pickup = ps.continuous_pickup;
+        st.continuous_drop_off = ps.continuous_drop_off;
+        return st;
+    }
+
+    int32_t board_time(size_t row) const {
+        const Run& run = run_of(row);
+        const Offset& o = offsets_[run.profile + (row - run.first_row)];
+        int32_t t = o.departure != ST_NO_TIME ? o.departure : o.arrival;
+        return t != ST_NO_TIME ? run.start_time + t : ST_NO_TIME;
+    }
+
+    // Rows of trip_id across feeds: [first, second)
+    std::pair<uint32_t, uint32_t> trip_rows(uint32_t trip_id) const {
+        auto first = std::lower_bound(runs_.begin(), runs_.end(), trip_id, [](const Run& r, uint32_t id) { return r.trip_id < id; });
+        auto last = std::upper_bound(first, runs_.end(), trip_id, [](uint32_t id, const Run& r) { return id < r.trip_id; });
+        if (first == last) return { 0, 0 };
+        return { first->first_row, (last - 1)->first_row + (last - 1)->row_count };
+    }
+
+    void expand(std::vector<StopTime>& out) const {
+        out.clear();
+        out.reserve(row_count_);
+        for (size_t row = 0; row < row_count_; ++row) out.push_back((*this)[row]);
+    }
+
+    // Rewrites stop ids in place; patterns that become equal stay separate
+    template<typename Fn>
+    void remap_stops(Fn&& fn) {
+        for (PatternStop& ps : pattern_stops_) ps.stop_id = fn(ps.stop_id);
+    }
+
+    void clear() {
+        runs_.clear();
+        pattern_stops_.clear();
+        offsets_.clear();
+        row_count_ = pattern_count_ = profile_count_ = 0;
+    }
+};
+
+// Read access to the live stop time rows, flat or compact. Rows are returned by
+// value because compact rows are assembled on access.
+class StopTimeRows {
+    const StopTime* flat_ = nullptr;
+    size_t flat_size_ = 0;
+    const CompactStopTimes* compact_ = nullptr;
+public:
+    StopTimeRows(const StopTime* rows, size_t n) : flat_(rows), flat_size_(n) {}
+    explicit StopTimeRows(const CompactStopTimes& compact) : compact_(&compact) {}
+
+    size_t size() const { return compact_ ? compact_->size() : flat_size_; }
+    StopTime operator[](size_t row) const { return compact_ ? (*compact_)[row] : flat_[row]; }
+
+    int32_t board_time(size_t row) const {
+        return compact_ ? compact_->board_time(row) : stop_time_board_time(flat_[row]);
+    }
+
+    // Rows of trip_id across feeds: [first, second)
+    std::pair<uint32_t, uint32_t> trip_rows(uint32_t trip_id) const {
+        if (compact_) return compact_->trip_rows(trip_id);
+        const StopTime* first = std::lower_bound(flat_, flat_ + flat_size_, trip_id, [](const StopTime& st, uint32_t id) { return st.trip_id < id; });
+        const StopTime* last = std::upper_bound(first, flat_ + flat_size_, trip_id, [](uint32_t id, const StopTime& st) { return id < st.trip_id; });
+        return { static_cast<uint32_t>(first - flat_), static_cast<uint32_t>(last - flat_) };
+    }
+};
+
+// CSR index of stop_times rows by interned stop_id: rows of stop k are
+// rows[offsets[k] .. offsets[k + 1]), sorted by stop_time_board_time (rows
+// without any time first), so a time window is two binary searches.
+class StopTimeIndex {
+    FlatArray<uint32_t> offsets_; // key_count + 1 entries
+    FlatArray<uint32_t> rows_;
+    int32_t max_span_ = 0;        // largest |departure - arrival| of any row
+public:
+    size_t memory_bytes() const { return offsets_.memory_bytes() + rows_.memory_bytes(); }
+
+    struct Range {
+        const uint32_t* first = nullptr;
+        const uint32_t* last = nullptr;
+        const uint32_t* begin() const { return first; }
+        const uint32_t* end() const { return last; }
+        size_t size() const { return static_cast<size_t>(last - first); }
+        bool empty() const { return first == last; }
+    };
+
+    Range find(uint32_t key) const {
+        if (static_cast<size_t>(key) + 1 >= offsets_.size()) return {};
+        const uint32_t* r = rows_.data();
+        return { r + offsets_[key], r + offsets_[key + 1] };
+    }
+
+    // Rows of key that can have an arrival or departure in [start, end]. The
+    // range is widened by max_span_ because only one of the two times is the
+    // sort key; callers still check each row exactly.
+    Range find_window(uint32_t key, const StopTimeRows& stop_times, int32_t start, int32_t end) const {
+        Range all = find(key);
+        int64_t lo = static_cast<int64_t>(start) - max_span_;
+        int64_t hi = static_cast<int64_t>(end) + max_span_;
+        auto first = std::lower_bound(all.first, all.last, lo, [&stop_times](uint32_t row, int64_t t) {
+            int32_t bt = stop_times.board_time(row);
+            return bt == ST_NO_TIME || bt < t;
+        });
+        auto last = std::upper_bound(first, all.last, hi, [&stop_times](int64_t t, uint32_t row) {
+            return t < stop_times.board_time(row);
+        });
+        return { first, last };
+    }
+
+    // Counting sort of the rows by key, then each key's rows by board time; with a
+    // pool the board times and the per-key sorts are split across it
+    void build(const StopTimeRows& stop_times, size_t key_count, ThreadPool* pool = nullptr) {
+        std::vector<uint32_t>& offsets = offsets_.mut();
+        std::vector<uint32_t>& rows = rows_.mut();
+        size_t row_count = stop_times.size();
+        offsets.assign(key_count + 1, 0);
+        std::vector<int32_t> board(row_count);
+        std::vector<uint32_t> stop_ids(row_count);
+
+        // Reads of compact rows expand them, so that part is worth spreading
+        constexpr size_t SLICE = 1 << 16;
+        size_t slices = (row_count + SLICE - 1) / SLICE;
+        std::vector<int64_t> slice_span(slices, 0);
+        auto read_slice = [&](size_t s) {
+            int64_t span = 0;
+            for (size_t i = s * SLICE, end = std::min(row_count, i + SLICE); i < end; ++i) {
+                StopTime st = stop_times[i];
+                stop_ids[i] = st.stop_id;
+                board[i] = stop_time_board_time(st);
+                if (st.arrival_time != ST_NO_TIME && st.departure_time != ST_NO_TIME) {
+                    span = std::max<int64_t>(span, std::abs(static_cast<int64_t>(st.departure_time) - st.arrival_time));
+                }
+            }
+            slice_span[s] = span;
+        };
+        if (pool) pool->parallel_for(slices, read_slice);
+        else for (size_t s = 0; s < slices; ++s) read_slice(s);
+        int64_t span = 0;
+        for (int64_t v : slice_span) span = std::max(span, v);
+        max_span_ = static_cast<int32_t>(std::min<int64_t>(span, INT32_MAX));
+
+        for (size_t i = 0; i < row_count; ++i) offsets[stop_ids[i] + 1]++;
+        for (size_t k = 0; k < key_count; ++k) offsets[k + 1] += offsets[k];
+        rows.resize(row_count);
+        std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < row_count; ++i) rows[cursor[stop_ids[i]]++] = static_cast<uint32_t>(i);
+
+        // ST_NO_TIME is INT32_MIN, so untimed rows sort first; ties keep row order.
+        // Keys are sorted in ranges of about SLICE rows.
+        std::vector<size_t> range_start = { 0 };
+        for (size_t k = 0; k < key_count; ++k) {
+            if (offsets[k + 1] - offsets[range_start.back()] >= SLICE) range_start.push_back(k + 1);
+        }
+        if (range_start.back() != key_count) range_start.push_back(key_count);
+        auto sort_range = [&](size_t r) {
+            for (size_t k = range_start[r]; k < range_start[r + 1]; ++k) {
+                if (offsets[k + 1] - offsets[k] < 2) continue;
+                std::sort(rows.begin() + offsets[k], rows.begin() + offsets[k + 1], [&board](uint32_t a, uint32_t b) {
+                    if (board[a] != board[b]) return board[a] < board[b];
+                    return a < b;
+                });
+            }
+        };
+        if (pool) pool->parallel_for(range_start.size() - 1, sort_range);
+        else for (size_t r = 0; r + 1 < range_start.size(); ++r) sort_range(r);
+    }
+
+    void attach(const uint32_t* offsets, size_t offset_count, const uint32_t* rows, size_t row_count, int32_t max_span) {
+        offsets_.attach(offsets, offset_count);
+        rows_.attach(rows, row_count);
+        max_span_ = max_span;
+    }
+
+    const FlatArray<uint32_t>& offsets() const { return offsets_; }
+    const FlatArray<uint32_t>& rows() const { return rows_; }
+    int32_t max_span() const { return max_span_; }
+
+    void clear() {
+        offsets_.clear();
+        rows_.clear();
+        max_span_ = 0;
+    }
+};
+
+// Rows of a table grouped by a uint32 key (an interned id or a dense index). Only
+// keys that occur are stored, sorted, so the index is sized by the table rather
+// than by the key space; a lookup is a binary search plus a contiguous run.
+class RowIndex {
+    std::vector<uint32_t> keys_;
+    std::vector<uint32_t> offsets_; // keys_.size() + 1 entries
+    std::vector<uint32_t> rows_;
+public:
+    using Range = StopTimeIndex::Range;
+
+    // key_of(row) gives the key of a row, NO_STR to leave it out; each key's
+    // rows stay in row order
+    template<typename KeyOf>
+    void build(size_t row_count, KeyOf key_of) {
+        std::vector<std::pair<uint32_t, uint32_t>> pairs;
+        pairs.reserve(row_count);
+        for (size_t row = 0; row < row_count; ++row) {
+            uint32_t key = key_of(static_cast<uint32_t>(row));
+            if (key != NO_STR) pairs.emplace_back(key, static_cast<uint32_t>(row));
+        }
+        std::sort(pairs.begin(), pairs.end());
+        keys_.clear();
+        offsets_.clear();
+        rows_.clear();
+        rows_.reserve(pairs.size());
+        for (const auto& [key, row] : pairs) {
+            if (keys_.empty() || keys_.back() != key) {
+                keys_.push_back(key);
+                offsets_.push_back(static_cast<uint32_t>(rows_.size()));
+            }
+            rows_.push_back(row);
+        }
+        offsets_.push_back(static_cast<uint32_t>(rows_.size()));
+    }
+
+    // Reorders the rows of every key
+    template<typename Less>
+    void sort_runs(Less less) {
+        for (size_t k = 0; k < keys_.size(); ++k) {
+            std::stable_sort(rows_.begin() + offsets_[k], rows_.begin() + offsets_[k + 1], less);
+        }
+    }
+
+    Range find(uint32_t key) const {
+        auto it = std::lower_bound(keys_.begin(), keys_.end(), key);
+        if (it == keys_.end() || *it != key) return {};
+        size_t k = static_cast<size_t>(it - keys_.begin());
+        return { rows_.data() + offsets_[k], rows_.data() + offsets_[k + 1] };
+    }
+
+    size_t memory_bytes() const { return vector_bytes(keys_) + vector_bytes(offsets_) + vector_bytes(rows_); }
+
+    void clear() {
+        keys_.clear();
+        offsets_.clear();
+        rows_.clear();
+    }
+};
+
 struct Trip {
-    std::string route_id;
-    std::string service_id;
-    std::string trip_id;
-    std::optional<std::string> trip_headsign = std::nullopt;
-    std::optional<std::string> trip_short_name = std::nullopt;
-    std::optional<int> direction_id = std::nullopt;
-    std::optional<std::string> block_id = std::nullopt;
-    std::optional<std::string> shape_id = std::nullopt;
-    std::optional<int> wheelchair_accessible = std::nullopt;
-    std::optional<int> bikes_allowed = std::nullopt;
-    std::string feed_id;
+    uint32_t trip_id = 0;
+    uint32_t route_id = 0;
+    uint32_t service_id = 0;
+    uint32_t trip_headsign = NO_STR;
+    uint32_t trip_short_name = NO_STR;
+    uint32_t block_id = NO_STR;
+    uint32_t shape_id = NO_STR;
+    uint32_t feed_id = 0;
+    uint32_t service_index = NO_SERVICE; // into GTFSData::services
+    int8_t   direction_id = ST_NO_INT8;
+    int8_t   wheelchair_accessible = ST_NO_INT8;
+    int8_t   bikes_allowed = ST_NO_INT8;
+    uint8_t  _pad[1] = {};
+};
+
+// Active days of one (feed_id, service_id), materialized from calendar.txt and
+// calendar_dates.txt. Day numbers count days since 1970-01-01.
+struct ServiceDays {
+    int32_t  first_day = 0;    // day of bit 0
+    uint32_t day_count = 0;
+    size_t   word_offset = 0;  // into GTFSData::service_day_bits
+    // calendar.txt rule for days past the materialized window (no exceptions there)
+    int32_t  start_day = 1;
+    int32_t  end_day = 0;
+    uint8_t  weekdays = 0;     // bit 0 = Sunday
+    uint8_t  _pad[7] = {};
 };
 
+// One shape point; points of a shape are contiguous and in sequence order
 struct Shape {
-    std::string shape_id;
-    double shape_pt_lat;
-    double shape_pt_lon;
-    int shape_pt_sequence;
-    std::optional<double> shape_dist_traveled = std::nullopt;
-    std::string feed_id;
+    uint32_t shape_id = 0;
+    uint32_t feed_id = 0;
+    double   shape_pt_lat = 0.0;
+    double   shape_pt_lon = 0.0;
+    double   shape_dist_traveled = ST_NO_DIST;
+    int32_t  shape_pt_sequence = 0;
+    uint8_t  _pad[4] = {};
+};
+
+// Points of one (feed_id, shape_id) are shapes[first, first + count)
+struct ShapeSpan {
+    uint32_t shape_id = 0;
+    uint32_t feed_id = 0;
+    uint32_t first = 0;
+    uint32_t count = 0;
+};
+
+// Per-shape lookup over the grouped shape points, plus a Douglas-Peucker
+// tolerance per point: simplifying a shape with tolerance t (meters) keeps
+// exactly the points whose tolerance is >= t, so every detail level is one
+// filter pass. Endpoints are never dropped.
+class ShapeIndex {
+    FlatArray<ShapeSpan> spans_;
+    FlatArray<float> tolerance_;
+    std::unordered_map<uint64_t, uint32_t> by_key_;   // (feed_id << 32 | shape_id) -> span
+    std::unordered_map<uint32_t, uint32_t> by_shape_; // shape_id -> first span with it
+
+    void reindex() {
+        by_key_.clear();
+        by_shape_.clear();
+        by_key_.reserve(spans_.size());
+        for (size_t i = 0; i < spans_.size(); ++i) {
+            const ShapeSpan& sp = spans_[i];
+            by_key_.emplace((static_cast<uint64_t>(sp.feed_id) << 32) | sp.shape_id, static_cast<uint32_t>(i));
+            by_shape_.emplace(sp.shape_id, static_cast<uint32_t>(i));
+        }
+    }
+
+    // Distance of p from segment a-b on a local equirectangular plane
+    static double segment_distance(double px, double py, double ax, double ay, double bx, double by) {
+        double dx = bx - ax, dy = by - ay;
+        double len2 = dx * dx + dy * dy;
+        double t = len2 > 0 ? ((px - ax) * dx + (py - ay) * dy) / len2 : 0.0;
+        t = std::clamp(t, 0.0, 1.0);
+        double ex = px - (ax + t * dx), ey = py - (ay + t * dy);
+        return std::sqrt(ex * ex + ey * ey);
+    }
+
+    static void compute_tolerance(const Shape* pts, size_t n, float* out) {
+        if (n == 0) return;
+        constexpr double EARTH_RADIUS_M = 6371008.8;
+        constexpr double DEG = 3.14159265358979323846 / 180.0;
+        double kx = EARTH_RADIUS_M * DEG * std::cos(pts[0].shape_pt_lat * DEG);
+        double ky = EARTH_RADIUS_M * DEG;
+        auto x = [&](size_t i) { return pts[i].shape_pt_lon * kx; };
+        auto y = [&](size_t i) { return pts[i].shape_pt_lat * ky; };
+
+        for (size_t i = 0; i < n; ++i) out[i] = 0.0f;
+        out[0] = out[n - 1] = std::numeric_limits<float>::infinity();
+
+        // Explicit stack; a split point's tolerance is capped by its parent's so levels nest
+        struct Range { size_t a, b; float cap; };
+        std::vector<Range> stack;
+        if (n > 2) stack.push_back({ 0, n - 1, std::numeric_limits<float>::infinity() });
+        while (!stack.empty()) {
+            Range r = stack.back();
+            stack.pop_back();
+            double best = -1.0;
+            size_t split = r.a;
+            for (size_t i = r.a + 1; i < r.b; ++i) {
+                double d = segment_distance(x(i), y(i), x(r.a), y(r.a), x(r.b), y(r.b));
+                if (d > best) { best = d; split = i; }
+            }
+            float tol = std::min(static_cast<float>(best), r.cap);
+            out[split] = tol;
+            if (split - r.a > 1) stack.push_back({ r.a, split, tol });
+            if (r.b - split > 1) stack.push_back({ split, r.b, tol });
+        }
+    }
+public:
+    // Groups consecutive points of the same shape; points must already be
+    // grouped per shape and in sequence order
+    void build(const Shape* pts, size_t n) {
+        std::vector<ShapeSpan>& spans = spans_.mut();
+        std::vector<float>& tolerance = tolerance_.mut();
+        spans.clear();
+        tolerance.assign(n, 0.0f);
+        size_t i = 0;
+        while (i < n) {
+            size_t j = i + 1;
+            while (j < n && pts[j].shape_id == pts[i].shape_id && pts[j].feed_id == pts[i].feed_id) ++j;
+            spans.push_back({ pts[i].shape_id, pts[i].feed_id, static_cast<uint32_t>(i), static_cast<uint32_t>(j - i) });
+            compute_tolerance(pts + i, j - i, tolerance.data() + i);
+            i = j;
+        }
+        reindex();
+    }
+
+    void attach(const ShapeSpan* spans, size_t span_count, const float* tolerance, size_t point_count) {
+        spans_.attach(spans, span_count);
+        tolerance_.attach(tolerance, point_count);
+        reindex();
+    }
+
+    // feed_id NO_STR matches the shape in any feed
+    const ShapeSpan* find(uint32_t feed_id, uint32_t shape_id) const {
+        if (feed_id == NO_STR) {
+            auto it = by_shape_.find(shape_id);
+            return it == by_shape_.end() ? nullptr : &spans_[it->second];
+        }
+        auto it = by_key_.find((static_cast<uint64_t>(feed_id) << 32) | shape_id);
+        return it == by_key_.end() ? nullptr : &spans_[it->second];
+    }
+
+    const FlatArray<ShapeSpan>& spans() const { return spans_; }
+    const FlatArray<float>& tolerance() const { return tolerance_; }
+    size_t memory_bytes() const {
+        return spans_.memory_bytes() + tolerance_.memory_bytes() + hash_table_bytes(by_key_) + hash_table_bytes(by_shape_);
+    }
+
+    void clear() {
+        spans_.clear();
+        tolerance_.clear();
+        by_key_.clear();
+        by_shape_.clear();
+    }
+};
+
+// Records of one type in a flat array, keyed by (feed_id << 32 | *Id). Rows
+// may view a snapshot image; writes go through put() or mut() + reindex().
+template<typename T, uint32_t T::*Id>
+class EntityTable {
+    FlatArray<T> rows_;
+    std::unordered_map<uint64_t, uint32_t> index_;
+public:
+    static constexpr uint32_t NO_ROW = 0xFFFFFFFFu;
+
+    static uint64_t key(uint32_t feed_id, uint32_t id) { return (static_cast<uint64_t>(feed_id) << 32) | id; }
+    static uint32_t id_of(const T& row) { return row.*Id; }
+
+    size_t size() const { return rows_.size(); }
+    bool empty() const { return rows_.empty(); }
+    const T* data() const { return rows_.data(); }
+    const T* begin() const { return rows_.begin(); }
+    const T* end() const { return rows_.end(); }
+    const T& operator[](size_t i) const { return rows_[i]; }
+    const FlatArray<T>& rows() const { return rows_; }
+    size_t memory_bytes() const { return rows_.memory_bytes() + hash_table_bytes(index_); }
+
+    uint32_t find_row(uint32_t feed_id, uint32_t id) const {
+        auto it = index_.find(key(feed_id, id));
+        return it == index_.end() ? NO_ROW : it->second;
+    }
+
+    const T* find(uint32_t feed_id, uint32_t id) const {
+        uint32_t row = find_row(feed_id, id);
+        return row == NO_ROW ? nullptr : &rows_[row];
+    }
+
+    bool contains(uint32_t feed_id, uint32_t id) const { return index_.count(key(feed_id, id)) != 0; }
+
+    // Appends row, or overwrites the row with the same key
+    uint32_t put(const T& row) {
+        auto [it, inserted] = index_.emplace(key(row.feed_id, row.*Id), static_cast<uint32_t>(rows_.size()));
+        std::vector<T>& rows = rows_.mut();
+        if (inserted) rows.push_back(row);
+        else rows[it->second] = row;
+        return it->second;
+    }
+
+    void reserve(size_t n) {
+        rows_.mut().reserve(n);
+        index_.reserve(n);
+    }
+
+    // Private copy of the rows; call reindex() after changing keys or removing rows
+    std::vector<T>& mut() { return rows_.mut(); }
+
+    void reindex() {
+        index_.clear();
+        index_.reserve(rows_.size());
+        for (size_t i = 0; i < rows_.size(); ++i) {
+            index_.emplace(key(rows_[i].feed_id, rows_[i].*Id), static_cast<uint32_t>(i));
+        }
+    }
+
+    void attach(const T* rows, size_t n) {
+        rows_.attach(rows, n);
+        reindex();
+    }
+
+    void clear() {
+        rows_.clear();
+        index_.clear();
+    }
 };
 
 struct FeedInfo {
@@ -225,28 +1063,48 @@ struct FeedInfo {
     std::string feed_id;
 };
 
+// A realtime string field that is not a join key: its bytes live in the
+// RealtimeArena of the feed (or staged message) holding the record, so they are
+// released when the feed is compacted. Empty when the field was absent.
+class RealtimeText {
+    const char* data_ = nullptr;
+    uint32_t size_ = 0;
+public:
+    RealtimeText() = default;
+    RealtimeText(const char* data, uint32_t size) : data_(data), size_(size) {}
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+    std::string_view view() const { return size_ ? std::string_view(data_, size_) : std::string_view(); }
+};
+
+// Realtime records hold interned ids (NO_STR when absent) for the fields that join
+// them to the static data (trip, route and stop ids). Every other string is a
+// RealtimeText, except the free-form alert texts, so polls do not grow the string
+// pool with ids, labels and dates that change from poll to poll.
 struct RealtimeTripDescriptor {
-    std::string trip_id;
-    std::string route_id;
+    uint32_t trip_id = NO_STR;
+    uint32_t route_id = NO_STR;
     int direction_id = -1;
-    std::string start_time;
-    std::string start_date;
+    RealtimeText start_time;
+    RealtimeText start_date;
     int schedule_relationship = 0;
-    std::string feed_id;
+    uint32_t feed_id = NO_STR;
 };
 
 struct RealtimeVehicleDescriptor {
-    std::string id;
-    std::string label;
-    std::string license_plate;
+    RealtimeText id;
+    RealtimeText label;
+    RealtimeText license_plate;
 };
 
+// start_date and start_time are those of the trip update holding the row
 struct RealtimeStopTimeUpdate {
     int stop_sequence = -1;
-    std::string stop_id;
-    std::string trip_id;
-    std::string start_date;
-    std::string start_time;
+    uint32_t stop_id = NO_STR;
+    uint32_t trip_id = NO_STR;
+    RealtimeText start_date;
+    RealtimeText start_time;
     int arrival_delay = -2147483648;
     int64_t arrival_time = -1;
     int arrival_uncertainty = -1;
@@ -256,18 +1114,78 @@ struct RealtimeStopTimeUpdate {
     int departure_uncertainty = -1;
 
     int schedule_relationship = 0;
-    std::string feed_id;
+    uint32_t feed_id = NO_STR;
+};
+
+static_assert(std::is_trivially_copyable_v<RealtimeStopTimeUpdate>, "stop time updates are copied between arenas and never destroyed");
+
+// Stop time updates of one trip update: a run in the RealtimeArena of the
+// RealtimeFeed (or staged message) holding the update
+class StopTimeUpdateSpan {
+    RealtimeStopTimeUpdate* data_ = nullptr;
+    size_t size_ = 0;
+public:
+    StopTimeUpdateSpan() = default;
+    StopTimeUpdateSpan(RealtimeStopTimeUpdate* data, size_t size) : data_(data), size_(size) {}
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const RealtimeStopTimeUpdate& operator[](size_t i) const { return data_[i]; }
+    RealtimeStopTimeUpdate& operator[](size_t i) { return data_[i]; }
+    const RealtimeStopTimeUpdate* begin() const { return data_; }
+    const RealtimeStopTimeUpdate* end() const { return data_ + size_; }
+    RealtimeStopTimeUpdate* begin() { return data_; }
+    RealtimeStopTimeUpdate* end() { return data_ + size_; }
+};
+
+// Bump allocator for stop time update runs and RealtimeText bytes. Nothing is
+// freed one by one: a replaced record leaves its old bytes behind until
+// RealtimeFeed::compact copies the live ones into a new arena and drops the old
+// one whole.
+class RealtimeArena {
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> resource_;
+    size_t initial_bytes_;
+    size_t bytes_ = 0;
+
+    void* allocate(size_t bytes, size_t align) {
+        if (!resource_) resource_ = std::make_unique<std::pmr::monotonic_buffer_resource>(initial_bytes_);
+        bytes_ += bytes;
+        return resource_->allocate(bytes, align);
+    }
+public:
+    static constexpr size_t MIN_CHUNK_BYTES = 16 * 1024;
+
+    explicit RealtimeArena(size_t initial_bytes = MIN_CHUNK_BYTES) : initial_bytes_(std::max(initial_bytes, MIN_CHUNK_BYTES)) {}
+
+    StopTimeUpdateSpan copy(const RealtimeStopTimeUpdate* rows, size_t n) {
+        if (n == 0) return {};
+        void* p = allocate(n * sizeof(RealtimeStopTimeUpdate), alignof(RealtimeStopTimeUpdate));
+        memcpy(p, rows, n * sizeof(RealtimeStopTimeUpdate));
+        return { static_cast<RealtimeStopTimeUpdate*>(p), n };
+    }
+
+    StopTimeUpdateSpan copy(const StopTimeUpdateSpan& span) { return copy(span.begin(), span.size()); }
+
+    RealtimeText copy(std::string_view s) {
+        if (s.empty()) return {};
+        char* p = static_cast<char*>(allocate(s.size(), 1));
+        memcpy(p, s.data(), s.size());
+        return { p, static_cast<uint32_t>(s.size()) };
+    }
+
+    // Bytes handed out, live or not
+    size_t bytes() const { return bytes_; }
 };
 
 struct RealtimeTripUpdate {
-    std::string update_id;
+    RealtimeText update_id; // the FeedEntity id, shared with the store entry
     bool is_deleted = false;
     RealtimeTripDescriptor trip;
     RealtimeVehicleDescriptor vehicle;
-    std::vector<RealtimeStopTimeUpdate> stop_time_updates;
+    StopTimeUpdateSpan stop_time_updates;
     uint64_t timestamp = 0;
     int delay = -2147483648;
-    std::string feed_id;
+    uint32_t feed_id = NO_STR;
 };
 
 struct RealtimePosition {
@@ -279,23 +1197,23 @@ struct RealtimePosition {
 };
 
 struct RealtimeVehiclePosition {
-    std::string update_id;
+    RealtimeText update_id;
     bool is_deleted = false;
     RealtimeTripDescriptor trip;
     RealtimeVehicleDescriptor vehicle;
     RealtimePosition position;
     int current_stop_sequence = -1;
-    std::string stop_id;
+    uint32_t stop_id = NO_STR;
     int current_status = -1;
     uint64_t timestamp = 0;
     int congestion_level = -1;
     int occupancy_status = -1;
     int occupancy_percentage = -1;
-    std::string feed_id;
+    uint32_t feed_id = NO_STR;
 };
 
 struct RealtimeAlert {
-    std::string update_id;
+    RealtimeText update_id;
     bool is_deleted = false;
     std::vector<std::string> active_period_start;
     std::vector<std::string> active_period_end;
@@ -305,33 +1223,935 @@ struct RealtimeAlert {
     std::string header_text;
     std::string description_text;
     int severity_level = -1;
+    uint32_t feed_id = NO_STR;
+};
+
+// Kinds of realtime message an update call receives; with the index of the buffer
+// within its argument they identify the source an entity came from.
+constexpr uint32_t RT_TRIP_UPDATES = 0;
+constexpr uint32_t RT_VEHICLE_POSITIONS = 1;
+constexpr uint32_t RT_ALERTS = 2;
+
+inline uint32_t realtime_source(uint32_t kind, uint32_t index) { return (kind << 16) | (index & 0xFFFF); }
+
+// Heap bytes a realtime record owns beyond its own size
+inline size_t heap_bytes(const RealtimeTripUpdate&) { return 0; } // counted with the feed's arena
+inline size_t heap_bytes(const RealtimeVehiclePosition&) { return 0; }
+inline size_t heap_bytes(const RealtimeAlert& a) {
+    size_t bytes = vector_bytes(a.active_period_start) + vector_bytes(a.active_period_end);
+    for (const std::string& s : a.active_period_start) bytes += string_heap_bytes(s);
+    for (const std::string& s : a.active_period_end) bytes += string_heap_bytes(s);
+    return bytes + string_heap_bytes(a.url) + string_heap_bytes(a.header_text) + string_heap_bytes(a.description_text);
+}
+
+// Copies the arena-held parts of a record (its RealtimeText fields and stop time
+// updates, not update_id) into arena, repointing the record at the copies
+inline void relocate(RealtimeTripDescriptor& t, RealtimeArena& arena) {
+    t.start_time = arena.copy(t.start_time.view());
+    t.start_date = arena.copy(t.start_date.view());
+}
+inline void relocate(RealtimeVehicleDescriptor& v, RealtimeArena& arena) {
+    v.id = arena.copy(v.id.view());
+    v.label = arena.copy(v.label.view());
+    v.license_plate = arena.copy(v.license_plate.view());
+}
+inline void relocate(RealtimeTripUpdate& u, RealtimeArena& arena) {
+    relocate(u.trip, arena);
+    relocate(u.vehicle, arena);
+    u.stop_time_updates = arena.copy(u.stop_time_updates);
+    for (RealtimeStopTimeUpdate& stu : u.stop_time_updates) {
+        stu.start_date = u.trip.start_date;
+        stu.start_time = u.trip.start_time;
+    }
+}
+inline void relocate(RealtimeVehiclePosition& p, RealtimeArena& arena) {
+    relocate(p.trip, arena);
+    relocate(p.vehicle, arena);
+}
+inline void relocate(RealtimeAlert&, RealtimeArena&) {}
+
+// Arena bytes the live parts of a record use, as relocate copies them
+inline size_t arena_bytes(const RealtimeTripDescriptor& t) { return t.start_time.size() + t.start_date.size(); }
+inline size_t arena_bytes(const RealtimeVehicleDescriptor& v) { return v.id.size() + v.label.size() + v.license_plate.size(); }
+inline size_t arena_bytes(const RealtimeTripUpdate& u) {
+    return arena_bytes(u.trip) + arena_bytes(u.vehicle) + u.stop_time_updates.size() * sizeof(RealtimeStopTimeUpdate);
+}
+inline size_t arena_bytes(const RealtimeVehiclePosition& p) { return arena_bytes(p.trip) + arena_bytes(p.vehicle); }
+inline size_t arena_bytes(const RealtimeAlert&) { return 0; }
+
+template<typename T>
+struct RealtimeEntry {
+    T value;
+    RealtimeText id;         // FeedEntity id (or a positional key when the feed omits it), in the store's arena
+    uint32_t source = 0;     // realtime_source() of the message that last wrote it
+    uint32_t generation = 0; // RealtimeFeed::generation of that message
+};
+
+// Realtime entities of one kind keyed by FeedEntity id, in insertion order. The
+// ids are RealtimeText in the arena passed to put, which the index keys view.
+template<typename T>
+class RealtimeStore {
+    std::vector<RealtimeEntry<T>> rows_;
+    std::unordered_map<std::string_view, uint32_t> index_;
+
+    void reindex() {
+        index_.clear();
+        for (uint32_t i = 0; i < rows_.size(); ++i) index_.emplace(rows_[i].id.view(), i);
+    }
+public:
+    size_t size() const { return rows_.size(); }
+    bool empty() const { return rows_.empty(); }
+    size_t memory_bytes() const {
+        size_t bytes = vector_bytes(rows_) + hash_table_bytes(index_);
+        for (const RealtimeEntry<T>& entry : rows_) bytes += heap_bytes(entry.value);
+        return bytes;
+    }
+    auto begin() const { return rows_.begin(); }
+    auto end() const { return rows_.end(); }
+    auto begin() { return rows_.begin(); }
+    auto end() { return rows_.end(); }
+
+    // value's own texts must already be in arena (see relocate); the id is copied
+    // there only when it is new to the store
+    void put(std::string_view id, T&& value, uint32_t source, uint32_t generation, RealtimeArena& arena) {
+        auto it = index_.find(id);
+        if (it == index_.end()) {
+            rows_.emplace_back();
+            rows_.back().id = arena.copy(id);
+            it = index_.emplace(rows_.back().id.view(), static_cast<uint32_t>(rows_.size() - 1)).first;
+        }
+        RealtimeEntry<T>& entry = rows_[it->second];
+        entry.value = std::move(value);
+        entry.value.update_id = entry.id;
+        entry.source = source;
+        entry.generation = generation;
+    }
+
+    // Keeps the order of the other rows; erase_if removes many in one pass
+    bool erase(std::string_view id) {
+        auto it = index_.find(id);
+        if (it == index_.end()) return false;
+        uint32_t row = it->second;
+        index_.erase(it);
+        rows_.erase(rows_.begin() + row);
+        for (uint32_t i = row; i < rows_.size(); ++i) index_[rows_[i].id.view()] = i;
+        return true;
+    }
+
+    template<typename Pred>
+    size_t erase_if(Pred pred) {
+        size_t before = rows_.size();
+        rows_.erase(std::remove_if(rows_.begin(), rows_.end(), pred), rows_.end());
+        if (rows_.size() == before) return 0;
+        reindex();
+        return before - rows_.size();
+    }
+
+    // Copies the ids and the records' arena-held parts into arena
+    void relocate(RealtimeArena& arena) {
+        for (RealtimeEntry<T>& entry : rows_) {
+            entry.id = arena.copy(entry.id.view());
+            entry.value.update_id = entry.id;
+            gtfs::relocate(entry.value, arena);
+        }
+        reindex();
+    }
+
+    size_t arena_bytes() const {
+        size_t bytes = 0;
+        for (const RealtimeEntry<T>& entry : rows_) bytes += entry.id.size() + gtfs::arena_bytes(entry.value);
+        return bytes;
+    }
+
+    void clear() {
+        rows_.clear();
+        index_.clear();
+    }
+};
+
+// Realtime state of one feed. Messages are merged in place: FULL_DATASET replaces
+// what the same source sent before, DIFFERENTIAL only upserts and deletes.
+// Entity ids, RealtimeText fields and stop time updates are kept in the feed's
+// arena (see RealtimeArena), so a copy of the feed gets its own arena holding
+// just the live bytes.
+struct RealtimeFeed {
+    RealtimeStore<RealtimeTripUpdate> trip_updates;
+    RealtimeStore<RealtimeVehiclePosition> vehicle_positions;
+    RealtimeStore<RealtimeAlert> alerts;
+    std::unordered_map<uint32_t, uint64_t> header_timestamps; // source -> FeedHeader.timestamp last applied
+    uint32_t generation = 0;
+    RealtimeArena arena;
+
+    RealtimeFeed() = default;
+    RealtimeFeed(RealtimeFeed&&) = default;
+    RealtimeFeed& operator=(RealtimeFeed&&) = default;
+
+    RealtimeFeed(const RealtimeFeed& other)
+        : trip_updates(other.trip_updates), vehicle_positions(other.vehicle_positions), alerts(other.alerts),
+          header_timestamps(other.header_timestamps), generation(other.generation) {
+        compact();
+    }
+
+    RealtimeFeed& operator=(const RealtimeFeed& other) {
+        if (this != &other) *this = RealtimeFeed(other);
+        return *this;
+    }
+
+    size_t live_arena_bytes() const {
+        return trip_updates.arena_bytes() + vehicle_positions.arena_bytes() + alerts.arena_bytes();
+    }
+
+    // More than half of the arena belongs to replaced or erased records
+    bool sparse() const {
+        return arena.bytes() > RealtimeArena::MIN_CHUNK_BYTES && arena.bytes() > 2 * live_arena_bytes();
+    }
+
+    // Moves the live bytes into a new arena and releases the old one; pointers
+    // into it (RealtimeJoin, GTFSData::vehicles) must be rebuilt afterwards
+    void compact() {
+        RealtimeArena next(live_arena_bytes());
+        trip_updates.relocate(next);
+        vehicle_positions.relocate(next);
+        alerts.relocate(next);
+        arena = std::move(next);
+    }
+
+    size_t memory_bytes() const {
+        return trip_updates.memory_bytes() + vehicle_positions.memory_bytes() + alerts.memory_bytes() + hash_table_bytes(header_timestamps) + arena.bytes();
+    }
+};
+
+// Great-circle distance in meters
+inline double haversine_m(double lat1, double lon1, double lat2, double lon2) {
+    constexpr double EARTH_RADIUS_M = 6371008.8;
+    constexpr double DEG = 3.14159265358979323846 / 180.0;
+    double dlat = (lat2 - lat1) * DEG, dlon = (lon2 - lon1) * DEG;
+    double a = std::sin(dlat / 2) * std::sin(dlat / 2) +
+               std::cos(lat1 * DEG) * std::cos(lat2 * DEG) * std::sin(dlon / 2) * std::sin(dlon / 2);
+    return 2 * EARTH_RADIUS_M * std::asin(std::min(1.0, std::sqrt(a)));
+}
+
+// Uniform lat/lon grid over a set of points: items of cell c are
+// items[offsets[c] .. offsets[c + 1]), cells row-major by latitude. Cells are
+// sized for a few points each and roughly square on the ground. Points with a
+// NaN coordinate are left out.
+class GeoGrid {
+    std::vector<uint32_t> offsets_;
+    std::vector<uint32_t> items_;
+    double min_lat_ = 0, min_lon_ = 0;
+    double cell_lat_ = 1, cell_lon_ = 1;
+    uint32_t nx_ = 0, ny_ = 0;
+
+    uint32_t cell_x(double lon) const {
+        double x = std::floor((lon - min_lon_) / cell_lon_);
+        return static_cast<uint32_t>(std::clamp(x, 0.0, static_cast<double>(nx_ - 1)));
+    }
+    uint32_t cell_y(double lat) const {
+        double y = std::floor((lat - min_lat_) / cell_lat_);
+        return static_cast<uint32_t>(std::clamp(y, 0.0, static_cast<double>(ny_ - 1)));
+    }
+public:
+    static constexpr size_t POINTS_PER_CELL = 4;
+    static constexpr uint32_t MAX_CELLS_PER_AXIS = 4096;
+
+    // latlon(i, lat, lon) yields point i; returns false to leave it out
+    template<typename LatLon>
+    void build(size_t n, LatLon latlon) {
+        offsets_.clear();
+        items_.clear();
+        nx_ = ny_ = 0;
+
+        double max_lat = -90, max_lon = -180;
+        min_lat_ = 90;
+        min_lon_ = 180;
+        size_t count = 0;
+        for (size_t i = 0; i < n; ++i) {
+            double lat, lon;
+            if (!latlon(i, lat, lon) || std::isnan(lat) || std::isnan(lon)) continue;
+            min_lat_ = std::min(min_lat_, lat);
+            max_lat = std::max(max_lat, lat);
+            min_lon_ = std::min(min_lon_, lon);
+            max_lon = std::max(max_lon, lon);
+            ++count;
+        }
+        if (count == 0) return;
+
+        constexpr double DEG = 3.14159265358979323846 / 180.0;
+        double lon_scale = std::max(0.01, std::cos((min_lat_ + max_lat) / 2 * DEG));
+        double span_lat = std::max(max_lat - min_lat_, 1e-6);
+        double span_lon = std::max((max_lon - min_lon_) * lon_scale, 1e-6);
+        double cells = std::max(1.0, static_cast<double>(count) / POINTS_PER_CELL);
+        double cell = std::sqrt(span_lat * span_lon / cells);
+        nx_ = static_cast<uint32_t>(std::clamp(std::ceil(span_lon / cell), 1.0, static_cast<double>(MAX_CELLS_PER_AXIS)));
+        ny_ = static_cast<uint32_t>(std::clamp(std::ceil(span_lat / cell), 1.0, static_cast<double>(MAX_CELLS_PER_AXIS)));
+        cell_lat_ = span_lat / ny_;
+        cell_lon_ = span_lon / lon_scale / nx_;
+
+        std::vector<uint32_t> cell_of(n, 0xFFFFFFFF);
+        offsets_.assign(static_cast<size_t>(nx_) * ny_ + 1, 0);
+        for (size_t i = 0; i < n; ++i) {
+            double lat, lon;
+            if (!latlon(i, lat, lon) || std::isnan(lat) || std::isnan(lon)) continue;
+            cell_of[i] = cell_y(lat) * nx_ + cell_x(lon);
+            ++offsets_[cell_of[i] + 1];
+        }
+        for (size_t c = 1; c < offsets_.size(); ++c) offsets_[c] += offsets_[c - 1];
+        items_.resize(count);
+        std::vector<uint32_t> fill(offsets_.begin(), offsets_.end() - 1);
+        for (size_t i = 0; i < n; ++i) {
+            if (cell_of[i] != 0xFFFFFFFF) items_[fill[cell_of[i]]++] = static_cast<uint32_t>(i);
+        }
+    }
+
+    // Calls f(item) for the items of every cell overlapping the box; callers
+    // check the exact coordinates
+    template<typename F>
+    void visit(double min_lat, double min_lon, double max_lat, double max_lon, F f) const {
+        if (nx_ == 0 || min_lat > max_lat || min_lon > max_lon) return;
+        uint32_t x0 = cell_x(min_lon), x1 = cell_x(max_lon);
+        uint32_t y0 = cell_y(min_lat), y1 = cell_y(max_lat);
+        for (uint32_t y = y0; y <= y1; ++y) {
+            uint32_t row = y * nx_;
+            for (uint32_t i = offsets_[row + x0]; i < offsets_[row + x1 + 1]; ++i) f(items_[i]);
+        }
+    }
+
+    size_t size() const { return items_.size(); }
+    size_t memory_bytes() const { return vector_bytes(offsets_) + vector_bytes(items_); }
+
+    void clear() {
+        offsets_.clear();
+        items_.clear();
+        nx_ = ny_ = 0;
+    }
+};
+
+// Shapes as tracks to snap positions onto: meters along its shape for every
+// point of GTFSData::shapes, and a grid over segment midpoints (item i is the
+// segment from point i to point i + 1). Built on first use by snap_vehicles;
+// shapes only change by loading a new GTFSData.
+class ShapeTracks {
+    std::vector<float> distance_;
+    std::vector<float> reach_; // per span of the ShapeIndex: half its longest segment, meters
+    GeoGrid segments_;
+    bool built_ = false;
+
+    static constexpr double EARTH_RADIUS_M = 6371008.8;
+    static constexpr double DEG = 3.14159265358979323846 / 180.0;
+public:
+    // Positions farther than this from every segment the grid returns are
+    // matched by scanning the whole allowed part of the shape instead
+    static constexpr double SNAP_RADIUS_M = 200.0;
+    // Spans with a longer segment are always scanned; the grid box would cover them
+    static constexpr double MAX_REACH_M = 1000.0;
+    // Allowed stretches of up to this many segments are scanned without the grid
+    static constexpr uint32_t SCAN_SEGMENTS = 32;
+
+    struct Snap {
+        double lat = 0, lon = 0;
+        double distance = 0; // meters along the shape
+        double offset = 0;   // meters from the position snapped
+    };
+
+    bool built() const { return built_; }
+
+    void build(const FlatArray<Shape>& pts, const ShapeIndex& index) {
+        distance_.assign(pts.size(), 0.0f);
+        reach_.assign(index.spans().size(), 0.0f);
+        for (size_t s = 0; s < index.spans().size(); ++s) {
+            const ShapeSpan& sp = index.spans()[s];
+            double d = 0, longest = 0;
+            for (uint32_t i = sp.first + 1; i < sp.first + sp.count; ++i) {
+                double seg = haversine_m(pts[i - 1].shape_pt_lat, pts[i - 1].shape_pt_lon, pts[i].shape_pt_lat, pts[i].shape_pt_lon);
+                d += seg;
+                longest = std::max(longest, seg);
+                distance_[i] = static_cast<float>(d);
+            }
+            reach_[s] = static_cast<float>(longest / 2);
+        }
+        std::vector<uint8_t> last(pts.size(), 0);
+        for (const ShapeSpan& sp : index.spans()) {
+            if (sp.count > 0) last[sp.first + sp.count - 1] = 1;
+        }
+        segments_.build(pts.size(), [&](size_t i, double& lat, double& lon) {
+            if (last[i]) return false;
+            lat = (pts[i].shape_pt_lat + pts[i + 1].shape_pt_lat) / 2;
+            lon = (pts[i].shape_pt_lon + pts[i + 1].shape_pt_lon) / 2;
+            return true;
+        });
+        built_ = true;
+    }
+
+    double distance(uint32_t point) const { return distance_[point]; }
+    double length(const ShapeSpan& sp) const { return sp.count > 0 ? distance_[sp.first + sp.count - 1] : 0.0; }
+
+    // Meters along the shape where it has travelled `traveled` in the units of
+    // shape_dist_traveled; false when its points do not all have one
+    bool at_traveled(const Shape* pts, const ShapeSpan& sp, double traveled, double& out) const {
+        if (sp.count == 0 || pts[sp.first].shape_dist_traveled == ST_NO_DIST || pts[sp.first + sp.count - 1].shape_dist_traveled == ST_NO_DIST) return false;
+        const Shape* first = pts + sp.first;
+        const Shape* last = first + sp.count;
+        const Shape* it = std::lower_bound(first, last, traveled, [](const Shape& p, double t) { return p.shape_dist_traveled < t; });
+        if (it == first) {
+            out = distance_[sp.first];
+        } else if (it == last) {
+            out = distance_[sp.first + sp.count - 1];
+        } else {
+            uint32_t b = static_cast<uint32_t>(it - pts);
+            double span = it->shape_dist_traveled - it[-1].shape_dist_traveled;
+            double t = span > 0 ? (traveled - it[-1].shape_dist_traveled) / span : 0.0;
+            out = distance_[b - 1] + t * (distance_[b] - distance_[b - 1]);
+        }
+        return true;
+    }
+
+    // Closest point to (lat, lon) on span sp (the span_index-th of the
+    // ShapeIndex) between min_dist and max_dist meters along it. Among points
+    // about as close, the earliest wins, so a loop's start beats its end.
+    bool snap(const Shape* pts, const ShapeSpan& sp, size_t span_index, double lat, double lon, double min_dist, double max_dist, Snap& out) const {
+        if (!built_ || sp.count == 0 || std::isnan(lat) || std::isnan(lon)) return false;
+        double kx = EARTH_RADIUS_M * DEG * std::cos(lat * DEG);
+        double ky = EARTH_RADIUS_M * DEG;
+        bool found = false;
+
+        auto consider = [&](uint32_t a) {
+            uint32_t b = a + 1 < sp.first + sp.count ? a + 1 : a;
+            double da = distance_[a], db = distance_[b];
+            if (db < min_dist || da > max_dist) return;
+            double ax = (pts[a].shape_pt_lon - lon) * kx, ay = (pts[a].shape_pt_lat - lat) * ky;
+            double bx = (pts[b].shape_pt_lon - lon) * kx, by = (pts[b].shape_pt_lat - lat) * ky;
+            double dx = bx - ax, dy = by - ay;
+            double len2 = dx * dx + dy * dy;
+            double t = len2 > 0 ? -(ax * dx + ay * dy) / len2 : 0.0;
+            double t_min = 0, t_max = 1;
+            if (db > da) {
+                t_min = std::max(0.0, (min_dist - da) / (db - da));
+                t_max = std::min(1.0, (max_dist - da) / (db - da));
+            }
+            t = std::clamp(t, t_min, std::max(t_min, t_max));
+            double ex = ax + t * dx, ey = ay + t * dy;
+            double offset = std::sqrt(ex * ex + ey * ey);
+            double d = da + t * (db - da);
+            if (!found || offset < out.offset - 1.0 || (offset <= out.offset + 1.0 && d < out.distance)) {
+                out.lat = pts[a].shape_pt_lat + t * (pts[b].shape_pt_lat - pts[a].shape_pt_lat);
+                out.lon = pts[a].shape_pt_lon + t * (pts[b].shape_pt_lon - pts[a].shape_pt_lon);
+                out.distance = d;
+                out.offset = offset;
+                found = true;
+            }
+        };
+
+        // Segments [a0, a1) overlap the allowed part of the span
+        uint32_t end = sp.first + std::max<uint32_t>(sp.count, 2) - 1;
+        const float* first = distance_.data() + sp.first;
+        const float* last = distance_.data() + end;
+        uint32_t a0 = sp.first + static_cast<uint32_t>(std::max<ptrdiff_t>(0, std::lower_bound(first, last, static_cast<float>(min_dist)) - first - 1));
+        uint32_t a1 = max_dist == std::numeric_limits<double>::infinity() ? end :
+            sp.first + static_cast<uint32_t>(std::upper_bound(first, last, static_cast<float>(max_dist)) - first);
+
+        double reach = reach_[span_index];
+        if (a1 - a0 > SCAN_SEGMENTS && reach <= MAX_REACH_M) {
+            double r = SNAP_RADIUS_M + reach;
+            double dlat = r / ky, dlon = r / std::max(kx, 1.0);
+            segments_.visit(lat - dlat, lon - dlon, lat + dlat, lon + dlon, [&](uint32_t a) {
+                if (a >= a0 && a < a1) consider(a);
+            });
+            if (found && out.offset <= SNAP_RADIUS_M) return true;
+        }
+
+        // Short stretch, off the route or no grid match: scan the allowed part
+        for (uint32_t a = a0; a < a1; ++a) consider(a);
+        return found;
+    }
+
+    size_t memory_bytes() const { return vector_bytes(distance_) + vector_bytes(reach_) + segments_.memory_bytes(); }
+
+    void clear() {
+        distance_.clear();
+        reach_.clear();
+        segments_.clear();
+        built_ = false;
+    }
+};
+
+// Where a realtime vehicle is along the shape of its trip, parallel to
+// GTFSData::vehicles; see snap_vehicles. Distances are meters along the shape,
+// NaN and NO_STR when the vehicle has no trip with a shape.
+struct VehicleProgress {
+    uint32_t shape_id = NO_STR;
+    double lat = std::numeric_limits<double>::quiet_NaN();      // snapped position
+    double lon = std::numeric_limits<double>::quiet_NaN();
+    double distance = std::numeric_limits<double>::quiet_NaN();
+    double offset = std::numeric_limits<double>::quiet_NaN();   // meters from the reported position
+    double shape_length = std::numeric_limits<double>::quiet_NaN();
+    uint32_t next_stop_id = NO_STR;
+    int32_t next_stop_sequence = -1;
+    double next_stop_distance = std::numeric_limits<double>::quiet_NaN(); // from the vehicle
+};
+
+// Trip update matched to static trips by interned (trip_id, feed_id, start date).
+// Its stop time updates are stops[first_stop, first_stop + stop_count), sorted by
+// stop_sequence; updates naming only a stop_id get the sequence of that stop in
+// the static trip.
+struct RealtimeTripRef {
+    uint32_t trip_id = NO_STR;
+    uint32_t feed_id = NO_STR; // feed_id of the update call, NO_STR matches any feed
+    int32_t  day = NO_DAY;     // start_date, NO_DAY matches any service day
+    uint32_t first_stop = 0;
+    uint32_t stop_count = 0;
+    const RealtimeTripUpdate* update = nullptr;
+};
+
+struct RealtimeStopRef {
+    int32_t stop_sequence = 0;
+    const RealtimeStopTimeUpdate* update = nullptr;
+};
+
+// Join of the realtime trip updates to the static schedule, rebuilt whenever the
+// realtime state changes. It points into the RealtimeStores, so it is only valid
+// until their next mutation.
+class RealtimeJoin {
+    std::vector<RealtimeTripRef> trips_; // grouped by trip_id
+    std::vector<RealtimeStopRef> stops_;
+    std::unordered_map<uint32_t, uint32_t> first_by_trip_;
+public:
+    struct TripRange {
+        const RealtimeTripRef* first = nullptr;
+        const RealtimeTripRef* last = nullptr;
+        const RealtimeTripRef* begin() const { return first; }
+        const RealtimeTripRef* end() const { return last; }
+        bool empty() const { return first == last; }
+    };
+
+    void build(std::vector<RealtimeTripRef>&& trips, std::vector<RealtimeStopRef>&& stops) {
+        trips_ = std::move(trips);
+        stops_ = std::move(stops);
+        std::stable_sort(trips_.begin(), trips_.end(), [](const RealtimeTripRef& a, const RealtimeTripRef& b) {
+            return a.trip_id < b.trip_id;
+        });
+        first_by_trip_.clear();
+        first_by_trip_.reserve(trips_.size());
+        for (size_t i = 0; i < trips_.size(); ++i) {
+            first_by_trip_.emplace(trips_[i].trip_id, static_cast<uint32_t>(i));
+        }
+    }
+
+    // Every update for trip_id, across feeds and service days
+    TripRange find(uint32_t trip_id) const {
+        auto it = first_by_trip_.find(trip_id);
+        if (it == first_by_trip_.end()) return {};
+        const RealtimeTripRef* first = trips_.data() + it->second;
+        const RealtimeTripRef* last = first;
+        const RealtimeTripRef* end = trips_.data() + trips_.size();
+        while (last != end && last->trip_id == trip_id) ++last;
+        return { first, last };
+    }
+
+    // Update for one static trip run: an exact feed and day beat the wildcards.
+    // day NO_DAY accepts an update for any day.
+    const RealtimeTripRef* find(uint32_t feed_id, uint32_t trip_id, int32_t day) const {
+        const RealtimeTripRef* best = nullptr;
+        int best_score = -1;
+        for (const RealtimeTripRef& ref : find(trip_id)) {
+            if (ref.feed_id != NO_STR && ref.feed_id != feed_id) continue;
+            if (ref.day != NO_DAY && day != NO_DAY && ref.day != day) continue;
+            int score = (ref.feed_id == feed_id ? 2 : 0) + (ref.day == day ? 1 : 0);
+            if (score > best_score) {
+                best = &ref;
+                best_score = score;
+            }
+        }
+        return best;
+    }
+
+    const RealtimeStopRef* stops_begin(const RealtimeTripRef& ref) const { return stops_.data() + ref.first_stop; }
+    const RealtimeStopRef* stops_end(const RealtimeTripRef& ref) const { return stops_.data() + ref.first_stop + ref.stop_count; }
+
+    // Stop time update of ref at stop_sequence, nullptr when the feed has none
+    const RealtimeStopTimeUpdate* find_stop(const RealtimeTripRef& ref, int32_t stop_sequence) const {
+        const RealtimeStopRef* last = stops_end(ref);
+        const RealtimeStopRef* it = std::lower_bound(stops_begin(ref), last, stop_sequence, [](const RealtimeStopRef& s, int32_t seq) {
+            return s.stop_sequence < seq;
+        });
+        return it != last && it->stop_sequence == stop_sequence ? it->update : nullptr;
+    }
+
+    size_t size() const { return trips_.size(); }
+    size_t memory_bytes() const { return vector_bytes(trips_) + vector_bytes(stops_) + hash_table_bytes(first_by_trip_); }
+
+    void clear() {
+        trips_.clear();
+        stops_.clear();
+        first_by_trip_.clear();
+    }
+};
+
+struct RaptorTimetable; // gtfs_raptor.cpp
+
+// How the load that built a GTFSData spent its time, for getStats()
+struct FileLoadStats {
     std::string feed_id;
+    std::string file;
+    size_t bytes = 0;       // uncompressed
+    size_t records = 0;
+    double inflate_ms = 0;
+    double parse_ms = 0;    // summed over the parse tasks of stop_times.txt
+};
+
+struct PhaseLoadStats {
+    std::string name;
+    double ms = 0;          // wall time
+    double busy_ms = 0;     // time threads spent working on it, summed
+    unsigned int threads = 1;
+
+    // Capped at 1: busy time also counts tasks the OS time-sliced on fewer cores
+    double utilization() const { return ms > 0 && threads > 0 ? std::min(1.0, busy_ms / (ms * threads)) : 0; }
+};
+
+struct LoadStats {
+    std::vector<FileLoadStats> files;
+    std::vector<PhaseLoadStats> phases; // in the order they ran
+    double total_ms = 0;
+
+    void clear() {
+        files.clear();
+        phases.clear();
+        total_ms = 0;
+    }
+};
+
+using CalendarDateMap = std::unordered_map<std::string, std::unordered_map<std::string, std::unordered_map<std::string, int>>>; // feed_id -> service_id -> date -> exception_type
+
+// Compressed bytes of a file a lazy load kept instead of parsing; copies made
+// by feed changes share them
+struct LazyFile {
+    std::string name;
+    std::string feed_id;
+    int method = 0;           // zip compression method: 0 stored, 8 deflate
+    uint32_t crc = 0;         // CRC-32 of the uncompressed bytes
+    size_t uncompressed_size = 0;
+    std::shared_ptr<const std::vector<unsigned char>> compressed;
+};
+
+// Files kept compressed by a lazy load (see load_feeds), per file name in feed
+// order, until their first use parses them. One parse per file runs at a time;
+// the others wait for it and get its error. load_lazy_file parses on the
+// calling thread; LazyFileLoader claims a file and parses it on its own thread
+// for callers that must only wait, such as the addon's sync getters.
+class LazyFiles {
+    enum class State { Pending, Loading, Loaded, Failed };
+    struct Entry {
+        std::vector<LazyFile> files;
+        State state = State::Pending;
+        std::string error;
+    };
+    std::map<std::string, Entry> entries_;
+    mutable std::mutex mutex_;
+    std::condition_variable done_;
+public:
+    int merge_strategy = 0; // of the load that kept them
+
+    void add(LazyFile file) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string name = file.name;
+        entries_[name].files.push_back(std::move(file));
+    }
+
+    // Files of name not parsed yet, also while a parse of them runs
+    std::vector<LazyFile> pending(const std::string& name) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(name);
+        if (it == entries_.end() || it->second.state == State::Loaded) return {};
+        return it->second.files;
+    }
+
+    bool has_feed(const std::string& feed_id) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& [name, entry] : entries_) {
+            if (entry.state == State::Loaded) continue;
+            for (const LazyFile& f : entry.files) {
+                if (f.feed_id == feed_id) return true;
+            }
+        }
+        return false;
+    }
+
+    // Adds the files of other not parsed yet, except those of feed_id. Callers
+    // hold other's GTFSData::mutex, so a parse cannot finish halfway through.
+    void copy_pending(const LazyFiles& other, const std::string& feed_id) {
+        std::scoped_lock lock(mutex_, other.mutex_);
+        for (const auto& [name, entry] : other.entries_) {
+            if (entry.state == State::Loaded) continue;
+            for (const LazyFile& f : entry.files) {
+                if (f.feed_id != feed_id) entries_[name].files.push_back(f);
+            }
+        }
+    }
+
+    // Marks the pending files of name as loading. When it returns true the
+    // caller must parse them with load_claimed; load waits until then.
+    bool claim(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(name);
+        if (it == entries_.end() || it->second.state != State::Pending) return false;
+        it->second.state = State::Loading;
+        return true;
+    }
+
+    // Calls parse(files) for the pending files of name unless they were parsed
+    // already, or waits for the parse another thread runs. parse must call
+    // loaded(name) while it holds the exclusive GTFSData::mutex to install its
+    // rows. Throws when the parse failed.
+    template<typename Parse>
+    void load(const std::string& name, Parse parse) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto it = entries_.find(name);
+        if (it == entries_.end()) return;
+        Entry& e = it->second;
+        if (e.state == State::Pending) {
+            e.state = State::Loading;
+            run(lock, e, parse);
+        } else {
+            done_.wait(lock, [&e] { return e.state != State::Loading; });
+        }
+        if (e.state == State::Failed) throw std::runtime_error("Failed to load " + name + ": " + e.error);
+    }
+
+    // load() for a name claim() returned true for, which only the claimer may call
+    template<typename Parse>
+    void load_claimed(const std::string& name, Parse parse) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto it = entries_.find(name);
+        if (it == entries_.end() || it->second.state != State::Loading) return;
+        Entry& e = it->second;
+        run(lock, e, parse);
+        if (e.state == State::Failed) throw std::runtime_error("Failed to load " + name + ": " + e.error);
+    }
+
+    void loaded(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Entry& e = entries_[name];
+        e.state = State::Loaded;
+        std::vector<LazyFile>().swap(e.files);
+    }
+
+    size_t memory_bytes() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t bytes = 0;
+        for (const auto& [name, entry] : entries_) {
+            bytes += string_heap_bytes(name) + vector_bytes(entry.files);
+            for (const LazyFile& f : entry.files) bytes += f.compressed ? vector_bytes(*f.compressed) : 0;
+        }
+        return bytes;
+    }
+
+    // Not while a parse runs
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.clear();
+        merge_strategy = 0;
+    }
+
+private:
+    // Runs parse for e, which the caller set to Loading, and wakes the waiters
+    template<typename Parse>
+    void run(std::unique_lock<std::mutex>& lock, Entry& e, Parse& parse) {
+        std::vector<LazyFile> files = e.files;
+        lock.unlock();
+        std::string error;
+        try {
+            parse(files);
+        } catch (const std::exception& ex) {
+            error = ex.what();
+        }
+        lock.lock();
+        if (e.state == State::Loading) {
+            e.state = State::Failed;
+            e.error = error;
+        }
+        done_.notify_all();
+    }
 };
 
 class GTFSData {
 public:
     StringPool string_pool;
 
-    std::vector<RealtimeTripUpdate> realtime_trip_updates;
-    std::vector<RealtimeVehiclePosition> realtime_vehicle_positions;
-    std::vector<RealtimeAlert> realtime_alerts;
+    std::unordered_map<std::string, RealtimeFeed> realtime; // feed_id -> realtime state
+    RealtimeJoin realtime_join; // over realtime; see rebuild_realtime_indexes
+    std::vector<const RealtimeVehiclePosition*> vehicles; // positioned vehicles of realtime
+    GeoGrid vehicles_by_location; // over vehicles
+    std::vector<VehicleProgress> vehicle_progress; // parallel to vehicles
+    // Trip row -> meters along its shape of each stop time, for the trips of
+    // vehicles; writers that move stops clear it
+    std::unordered_map<uint32_t, std::vector<double>> trip_stop_distances;
 
     std::unordered_map<std::string, std::unordered_map<std::string, Agency>> agencies;
-    std::unordered_map<std::string, std::unordered_map<std::string, Calendar>> calendars;
-    std::unordered_map<std::string, std::unordered_map<std::string, std::unordered_map<std::string, int>>> calendar_dates; // feed_id -> service_id -> date -> exception_type
-    std::unordered_map<std::string, std::unordered_map<std::string, Route>> routes;
-    std::unordered_map<std::string, std::unordered_map<std::string, Stop>> stops;
+    EntityTable<Calendar, &Calendar::service_id> calendars;
+    CalendarDateMap calendar_dates;
+    EntityTable<Route, &Route::route_id> routes;
+    EntityTable<Stop, &Stop::stop_id> stops;
+    GeoGrid stops_by_location; // over stops rows; see build_stop_grid
 
-    std::vector<StopTime> stop_times; // Flat list, sorted by trip_id, stop_sequence
+    FlatArray<StopTime> stop_times; // Flat list, sorted by trip_id, feed_id, stop_sequence
+    CompactStopTimes compact_stop_times; // holds the rows instead once compacted; read both through stop_time_rows()
 
-    std::unordered_map<uint32_t, std::vector<size_t>> stop_times_by_stop_id; // index into stop_times
+    StopTimeIndex stop_times_by_stop_id; // index into stop_times
 
-    std::unordered_map<std::string, std::unordered_map<std::string, Trip>> trips;
-    std::vector<Shape> shapes;
+    EntityTable<Trip, &Trip::trip_id> trips;
+    // Trip rows by interned trip_id, route_id, block_id and service_id, and by
+    // service_index; see build_trip_indexes. A block's trips are ordered by first
+    // departure.
+    RowIndex trips_by_id;
+    RowIndex trips_by_route;
+    RowIndex trips_by_block;
+    RowIndex trips_by_service_id;
+    RowIndex trips_by_service;
+    FlatArray<Shape> shapes; // grouped by shape, in sequence order
+    ShapeIndex shapes_by_id; // spans and simplification tolerances over shapes
+    ShapeTracks shape_tracks; // over shapes, for snapping vehicles
     std::vector<FeedInfo> feed_info;
+    LazyFiles lazy_files; // shapes.txt of a lazy load, until first use
+
+    // Feed ids in merge order, and the stop_times and shape rows that lost a
+    // merge conflict to another feed, so that a feed change merges the feeds
+    // again as a full load of them would (see change_feed)
+    std::vector<std::string> feed_order;
+    FlatArray<StopTime> merge_lost_stop_times;
+    FlatArray<Shape> merge_lost_shapes;
+
+    // Service calendars, built after load; trips refer to them by service_index
+    std::vector<ServiceDays> services;
+    std::vector<uint64_t> service_day_bits;
+    std::unordered_map<uint64_t, uint32_t> service_by_intern_id; // (feed_id_intern << 32 | service_id_intern)
+
+    bool service_active(uint32_t service_index, int32_t day) const {
+        if (service_index >= services.size() || day == NO_DAY) return false;
+        const ServiceDays& sd = services[service_index];
+        int64_t bit = static_cast<int64_t>(day) - sd.first_day;
+        if (bit >= 0 && bit < sd.day_count) {
+            return (service_day_bits[sd.word_offset + (bit >> 6)] >> (bit & 63)) & 1;
+        }
+        if (day < sd.start_day || day > sd.end_day) return false;
+        // 1970-01-01 was a Thursday
+        int wday = static_cast<int>(((static_cast<int64_t>(day) % 7) + 11) % 7);
+        return (sd.weekdays >> wday) & 1;
+    }
+
+    StopTimeRows stop_time_rows() const {
+        if (!compact_stop_times.empty()) return StopTimeRows(compact_stop_times);
+        return StopTimeRows(stop_times.data(), stop_times.size());
+    }
 
-    // O(1) trip lookup by (feed_id_intern << 32 | trip_id_intern)
-    std::unordered_map<uint64_t, const Trip*> trip_by_intern_id;
+    // Moves the stop times into compact_stop_times; row numbers, and so the stop
+    // index, stay valid
+    void compact_stop_time_rows() {
+        if (stop_times.empty()) return;
+        compact_stop_times.build(stop_times.data(), stop_times.size());
+        stop_times = FlatArray<StopTime>();
+    }
+
+    // Approximate bytes per container, for getStats(); the journey planner
+    // timetable is counted by the caller (see raptor_memory_bytes)
+    std::vector<std::pair<const char*, size_t>> memory_usage() const {
+        size_t agency_bytes = hash_table_bytes(agencies);
+        for (const auto& [feed, by_id] : agencies) {
+            agency_bytes += string_heap_bytes(feed) + hash_table_bytes(by_id);
+            for (const auto& [id, a] : by_id) {
+                agency_bytes += string_heap_bytes(id) + string_heap_bytes(a.agency_name) + string_heap_bytes(a.agency_url) + string_heap_bytes(a.agency_timezone) + string_heap_bytes(a.feed_id);
+            }
+        }
+        size_t calendar_date_bytes = hash_table_bytes(calendar_dates);
+        for (const auto& [feed, services_of_feed] : calendar_dates) {
+            calendar_date_bytes += string_heap_bytes(feed) + hash_table_bytes(services_of_feed);
+            for (const auto& [service, dates] : services_of_feed) {
+                calendar_date_bytes += string_heap_bytes(service) + hash_table_bytes(dates);
+                for (const auto& [date, type] : dates) calendar_date_bytes += string_heap_bytes(date);
+            }
+        }
+        size_t trip_stop_bytes = hash_table_bytes(trip_stop_distances);
+        for (const auto& [row, distances] : trip_stop_distances) trip_stop_bytes += vector_bytes(distances);
+        size_t realtime_bytes = hash_table_bytes(realtime);
+        for (const auto& [feed, rt] : realtime) realtime_bytes += string_heap_bytes(feed) + rt.memory_bytes();
+
+        return {
+            { "stop_times", stop_times.memory_bytes() + compact_stop_times.memory_bytes() },
+            { "stop_times_by_stop_id", stop_times_by_stop_id.memory_bytes() },
+            { "string_pool", string_pool.memory_bytes() },
+            { "trips", trips.memory_bytes() },
+            { "trip_indexes", trips_by_id.memory_bytes() + trips_by_route.memory_bytes() + trips_by_block.memory_bytes() + trips_by_service_id.memory_bytes() + trips_by_service.memory_bytes() },
+            { "routes", routes.memory_bytes() },
+            { "stops", stops.memory_bytes() },
+            { "stops_by_location", stops_by_location.memory_bytes() },
+            { "shapes", shapes.memory_bytes() },
+            { "shapes_by_id", shapes_by_id.memory_bytes() },
+            { "shape_tracks", shape_tracks.memory_bytes() },
+            { "calendars", calendars.memory_bytes() },
+            { "calendar_dates", calendar_date_bytes },
+            { "agencies", agency_bytes },
+            { "feed_info", vector_bytes(feed_info) },
+            { "services", vector_bytes(services) + vector_bytes(service_day_bits) + hash_table_bytes(service_by_intern_id) },
+            { "lazy_files", lazy_files.memory_bytes() },
+            { "merge_lost_rows", merge_lost_stop_times.memory_bytes() + merge_lost_shapes.memory_bytes() + vector_bytes(feed_order) },
+            { "realtime", realtime_bytes },
+            { "realtime_join", realtime_join.memory_bytes() + vector_bytes(vehicles) + vehicles_by_location.memory_bytes() },
+            { "vehicle_progress", vector_bytes(vehicle_progress) + trip_stop_bytes },
+        };
+    }
+
+    void build_stop_grid() {
+        stops_by_location.build(stops.size(), [this](size_t i, double& lat, double& lon) {
+            lat = stops[i].stop_lat;
+            lon = stops[i].stop_lon;
+            return true;
+        });
+    }
+
+    // Rebuilds the trips_by_* indexes; call after trips, stop times or services
+    // change. Trips whose stop times have no time sort last in their block.
+    void build_trip_indexes() {
+        size_t n = trips.size();
+        trips_by_id.build(n, [this](uint32_t row) { return trips[row].trip_id; });
+        trips_by_route.build(n, [this](uint32_t row) { return trips[row].route_id; });
+        trips_by_service_id.build(n, [this](uint32_t row) { return trips[row].service_id; });
+        trips_by_service.build(n, [this](uint32_t row) { return trips[row].service_index; });
+        trips_by_block.build(n, [this](uint32_t row) { return trips[row].block_id; });
+
+        StopTimeRows stop_times = stop_time_rows();
+        std::vector<int32_t> first_departure(n, std::numeric_limits<int32_t>::max());
+        for (size_t row = 0; row < n; ++row) {
+            const Trip& t = trips[row];
+            if (t.block_id == NO_STR) continue;
+            auto [first, last] = stop_times.trip_rows(t.trip_id);
+            for (uint32_t i = first; i != last; ++i) {
+                StopTime st = stop_times[i];
+                if (st.feed_id != t.feed_id) continue;
+                int32_t time = st.departure_time != ST_NO_TIME ? st.departure_time : st.arrival_time;
+                if (time != ST_NO_TIME) {
+                    first_departure[row] = time;
+                    break;
+                }
+            }
+        }
+        trips_by_block.sort_runs([&first_departure](uint32_t a, uint32_t b) { return first_departure[a] < first_departure[b]; });
+    }
+
+    // Keeps a loaded or mapped snapshot alive while stop_times, the stop index
+    // and the string pool view into it
+    std::shared_ptr<const void> image;
+
+    LoadStats load_stats;
+
+    // Readers (sync getters, async query workers) hold it shared; realtime
+    // updates, stop merges and compaction hold it exclusively. Loads and snapshot
+    // restores fill a new GTFSData instead (see DataGenerations). clear() does
+    // not take it, callers do.
+    mutable std::shared_mutex mutex;
+
+    // Journey planner timetable, built on first use by raptor_timetable(); writers
+    // that change stops, trips or stop_times reset it under the exclusive lock
+    mutable std::mutex raptor_mutex;
+    mutable std::shared_ptr<const RaptorTimetable> raptor;
 
     void clear() {
         string_pool.clear();
@@ -340,16 +2160,78 @@ public:
         calendar_dates.clear();
         routes.clear();
         stops.clear();
+        stops_by_location.clear();
         stop_times.clear();
+        compact_stop_times.clear();
         stop_times_by_stop_id.clear();
         trips.clear();
+        trips_by_id.clear();
+        trips_by_route.clear();
+        trips_by_block.clear();
+        trips_by_service_id.clear();
+        trips_by_service.clear();
         shapes.clear();
+        shapes_by_id.clear();
+        shape_tracks.clear();
         feed_info.clear();
-        trip_by_intern_id.clear();
+        lazy_files.clear();
+        feed_order.clear();
+        merge_lost_stop_times.clear();
+        merge_lost_shapes.clear();
+        services.clear();
+        service_day_bits.clear();
+        service_by_intern_id.clear();
+
+        realtime.clear();
+        realtime_join.clear();
+        vehicles.clear();
+        vehicles_by_location.clear();
+        vehicle_progress.clear();
+        trip_stop_distances.clear();
+        raptor.reset();
+
+        image.reset();
+        load_stats.clear();
+    }
+};
+
+// The published GTFSData of an instance. Loads fill a new generation off to the
+// side and publish it with a pointer swap; queries and workers hold the
+// generation they started on, which is freed when the last of them drops it.
+class DataGenerations {
+    mutable std::mutex mutex_;
+    std::shared_ptr<GTFSData> current_ = std::make_shared<GTFSData>();
+    uint64_t number_ = 0;
+public:
+    std::shared_ptr<GTFSData> current() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return current_;
+    }
+
+    // Number of generations published so far; 0 before the first load
+    uint64_t number() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return number_;
+    }
+
+    // Returns the replaced generation, so the caller can release it off the main thread
+    std::shared_ptr<GTFSData> publish(std::shared_ptr<GTFSData> next) {
+        next->string_pool.freeze();
+        std::lock_guard<std::mutex> lock(mutex_);
+        current_.swap(next);
+        ++number_;
+        return next;
+    }
 
-        realtime_trip_updates.clear();
-        realtime_vehicle_positions.clear();
-        realtime_alerts.clear();
+    // publish() only while expected is still current, for updates derived from
+    // it; otherwise leaves next with the caller and returns false
+    bool publish_if(const std::shared_ptr<GTFSData>& expected, std::shared_ptr<GTFSData>& next) {
+        next->string_pool.freeze();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (current_ != expected) return false;
+        current_.swap(next);
+        ++number_;
+        return true;
     }
 };
 
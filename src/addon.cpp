@@ -2,11 +2,15 @@
 #include "GTFS.h"
 #include "gtfs_parser.cpp"
 #include "gtfs_realtime.cpp"
-#include <ctime>
+#include "gtfs_feeds.cpp"
+#include "gtfs_snapshot.cpp"
+#include "gtfs_query.cpp"
+#include "gtfs_raptor.cpp"
 #include <string_view>
 #include <vector>
 #include <functional>
-#include <iomanip>
+#include <limits>
+#include <optional>
 
 
 struct Logger {
@@ -15,10 +19,26 @@ struct Logger {
     bool ansi;
 };
 
+// Records a sync addon call in its MethodStats when it returns; the call failed
+// if it left a JS exception pending
+class MethodTimer {
+public:
+    MethodTimer(Napi::Env env, gtfs::MethodStats& stats) : env(env), stats(stats) {}
+    ~MethodTimer() { stats.record(gtfs::elapsed_ns(start), env.IsExceptionPending() || std::uncaught_exceptions() > 0); }
+
+    MethodTimer(const MethodTimer&) = delete;
+    MethodTimer& operator=(const MethodTimer&) = delete;
+
+private:
+    Napi::Env env;
+    gtfs::MethodStats& stats;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+};
+
 class GTFSWorker : public Napi::AsyncWorker {
 public:
-    GTFSWorker(Napi::Env env, std::vector<gtfs::BufferView>&& zipBuffers, std::vector<Napi::Reference<Napi::Buffer<unsigned char>>>&& bufferRefs, std::vector<std::string>&& feedIds, int mergeStrategy, gtfs::GTFSData* targetData, Logger logger, std::vector<std::string>&& filesToLoad)
-        : Napi::AsyncWorker(env, "GTFSWorker"), deferred(Napi::Promise::Deferred::New(env)), zipBuffers(std::move(zipBuffers)), bufferRefs(std::move(bufferRefs)), feedIds(std::move(feedIds)), mergeStrategy(mergeStrategy), targetData(targetData), logger(logger), filesToLoad(std::move(filesToLoad)) {}
+    GTFSWorker(Napi::Env env, Napi::Object owner, std::vector<gtfs::BufferView>&& zipBuffers, std::vector<Napi::Reference<Napi::Buffer<unsigned char>>>&& bufferRefs, std::vector<std::string>&& feedIds, int mergeStrategy, gtfs::DataGenerations* generations, Logger logger, std::vector<std::string>&& filesToLoad, unsigned int parseThreads, std::vector<std::string>&& lazyFiles)
+        : Napi::AsyncWorker(env, "GTFSWorker"), deferred(Napi::Promise::Deferred::New(env)), owner(Napi::Persistent(owner)), zipBuffers(std::move(zipBuffers)), bufferRefs(std::move(bufferRefs)), feedIds(std::move(feedIds)), mergeStrategy(mergeStrategy), generations(generations), logger(logger), filesToLoad(std::move(filesToLoad)), parseThreads(parseThreads), lazyFiles(std::move(lazyFiles)) {}
 
     ~GTFSWorker() {
         if (logger.tsfn) {
@@ -62,7 +82,13 @@ public:
                 logger.progress_tsfn.NonBlockingCall(callback);
             };
 
-            gtfs::load_feeds(*targetData, zipBuffers, feedIds, mergeStrategy, logCallback, progressCallback, filesToLoad);
+            // Built off to the side: queries keep reading the published generation
+            // until the new one replaces it whole
+            auto next = std::make_shared<gtfs::GTFSData>();
+            gtfs::load_feeds(*next, zipBuffers, feedIds, mergeStrategy, logCallback, progressCallback, filesToLoad, parseThreads, lazyFiles);
+            std::shared_ptr<gtfs::GTFSData> previous = generations->publish(std::move(next));
+            // Freed here unless a query still holds it
+            previous.reset();
         } catch (const std::exception& e) {
             SetError(e.what());
         }
@@ -82,13 +108,16 @@ public:
 
 private:
     Napi::Promise::Deferred deferred;
+    Napi::ObjectReference owner;
     std::vector<gtfs::BufferView> zipBuffers;
     std::vector<Napi::Reference<Napi::Buffer<unsigned char>>> bufferRefs;
     std::vector<std::string> feedIds;
     int mergeStrategy;
-    gtfs::GTFSData* targetData;
+    gtfs::DataGenerations* generations;
     Logger logger;
     std::vector<std::string> filesToLoad;
+    unsigned int parseThreads;
+    std::vector<std::string> lazyFiles;
 
     void ReleaseBufferRefs() {
         if (bufferRefs.empty()) return;
@@ -100,153 +129,862 @@ private:
     }
 };
 
-class GTFSAddon : public Napi::ObjectWrap<GTFSAddon> {
+class FeedWorker : public Napi::AsyncWorker {
 public:
-    static Napi::Object Init(Napi::Env env, Napi::Object exports);
-    GTFSAddon(const Napi::CallbackInfo& info);
+    FeedWorker(Napi::Env env, Napi::Object owner, gtfs::FeedChange change, std::string feedId, gtfs::BufferView zipBuffer, Napi::Reference<Napi::Buffer<unsigned char>>&& bufferRef, int mergeStrategy, gtfs::DataGenerations* generations, Logger logger, std::vector<std::string>&& filesToLoad, unsigned int parseThreads, std::vector<std::string>&& lazyFiles)
+        : Napi::AsyncWorker(env, "FeedWorker"), deferred(Napi::Promise::Deferred::New(env)), owner(Napi::Persistent(owner)), change(change), feedId(std::move(feedId)), zipBuffer(zipBuffer), bufferRef(std::move(bufferRef)), mergeStrategy(mergeStrategy), generations(generations), logger(logger), filesToLoad(std::move(filesToLoad)), parseThreads(parseThreads), lazyFiles(std::move(lazyFiles)) {}
+
+    ~FeedWorker() {
+        if (logger.tsfn) {
+            logger.tsfn.Release();
+        }
+        if (logger.progress_tsfn) {
+            logger.progress_tsfn.Release();
+        }
+        ReleaseBufferRef();
+    }
+
+    void Execute() override {
+        try {
+            auto logCallback = [this](const std::string& msg) {
+                if (!logger.tsfn) return;
+                std::string formattedMsg = logger.ansi ? "\033[32m" + msg + "\033[0m" : msg;
+                auto callback = [formattedMsg](Napi::Env env, Napi::Function jsCallback) {
+                    jsCallback.Call({Napi::String::New(env, formattedMsg)});
+                };
+                logger.tsfn.NonBlockingCall(callback);
+            };
+
+            auto progressCallback = [this](std::string task, int64_t current, int64_t total) {
+                if (!logger.progress_tsfn) return;
+                auto callback = [task, current, total](Napi::Env env, Napi::Function jsCallback) {
+                    jsCallback.Call({
+                        Napi::String::New(env, task),
+                        Napi::Number::New(env, current),
+                        Napi::Number::New(env, total)
+                    });
+                };
+                logger.progress_tsfn.NonBlockingCall(callback);
+            };
+
+            // Rebuilt from the published generation; when a load or another feed
+            // change publishes first, the change is redone on top of that one
+            for (;;) {
+                std::shared_ptr<gtfs::GTFSData> current = generations->current();
+                auto next = std::make_shared<gtfs::GTFSData>();
+                changed = gtfs::change_feed(*next, *current, change, zipBuffer, feedId, mergeStrategy, logCallback, progressCallback, filesToLoad, parseThreads, lazyFiles);
+                if (!changed || generations->publish_if(current, next)) break;
+            }
+        } catch (const std::exception& e) {
+            SetError(e.what());
+        }
+    }
 
-    gtfs::GTFSData data; 
+    void OnOK() override {
+        ReleaseBufferRef();
+        deferred.Resolve(Napi::Boolean::New(Env(), changed));
+    }
+
+    void OnError(const Napi::Error& e) override {
+        ReleaseBufferRef();
+        deferred.Reject(e.Value());
+    }
+
+    Napi::Promise GetPromise() { return deferred.Promise(); }
 
 private:
-    Napi::Value LoadFromBuffers(const Napi::CallbackInfo& info);
-    Napi::Value GetRoutes(const Napi::CallbackInfo& info);
-    Napi::Value GetAgencies(const Napi::CallbackInfo& info);
-    Napi::Value GetStops(const Napi::CallbackInfo& info);
-    Napi::Value GetStopTimes(const Napi::CallbackInfo& info);
-    Napi::Value GetFeedInfo(const Napi::CallbackInfo& info);
-    Napi::Value GetTrips(const Napi::CallbackInfo& info);
-    Napi::Value GetShapes(const Napi::CallbackInfo& info);
-    Napi::Value GetCalendars(const Napi::CallbackInfo& info);
-    Napi::Value GetCalendarDates(const Napi::CallbackInfo& info);
-    Napi::Value GetRealtimeTripUpdates(const Napi::CallbackInfo& info);
-    Napi::Value GetRealtimeVehiclePositions(const Napi::CallbackInfo& info);
-    Napi::Value GetRealtimeAlerts(const Napi::CallbackInfo& info);
-    Napi::Value UpdateRealtime(const Napi::CallbackInfo& info);
-    Napi::Value ClearRealtime(const Napi::CallbackInfo& info);
-    Napi::Value MergeStops(const Napi::CallbackInfo& info);
-    Napi::Value UpdateStop(const Napi::CallbackInfo& info);
+    Napi::Promise::Deferred deferred;
+    Napi::ObjectReference owner;
+    gtfs::FeedChange change;
+    std::string feedId;
+    gtfs::BufferView zipBuffer;
+    Napi::Reference<Napi::Buffer<unsigned char>> bufferRef;
+    int mergeStrategy;
+    gtfs::DataGenerations* generations;
+    Logger logger;
+    std::vector<std::string> filesToLoad;
+    unsigned int parseThreads;
+    std::vector<std::string> lazyFiles;
+    bool changed = false;
+
+    void ReleaseBufferRef() {
+        if (bufferRef.IsEmpty()) return;
+        bufferRef.Unref();
+        bufferRef.Reset();
+    }
+};
+
+class SnapshotWorker : public Napi::AsyncWorker {
+public:
+    enum class Mode { Save, Load, Attach };
+
+    SnapshotWorker(Napi::Env env, Napi::Object owner, Mode mode, std::string path, gtfs::DataGenerations* generations, Logger logger)
+        : Napi::AsyncWorker(env, "SnapshotWorker"), deferred(Napi::Promise::Deferred::New(env)), owner(Napi::Persistent(owner)), mode(mode), path(std::move(path)), generations(generations), logger(logger) {}
+
+    ~SnapshotWorker() {
+        if (logger.tsfn) {
+            logger.tsfn.Release();
+        }
+    }
+
+    void Execute() override {
+        try {
+            auto logCallback = [this](const std::string& msg) {
+                if (!logger.tsfn) return;
+                std::string formattedMsg = logger.ansi ? "\033[32m" + msg + "\033[0m" : msg;
+                auto callback = [formattedMsg](Napi::Env env, Napi::Function jsCallback) {
+                    jsCallback.Call({Napi::String::New(env, formattedMsg)});
+                };
+                logger.tsfn.NonBlockingCall(callback);
+            };
+
+            if (mode == Mode::Save) {
+                std::shared_ptr<gtfs::GTFSData> data = generations->current();
+                // A snapshot holds every table
+                for (const std::string& file : gtfs::LAZY_FEED_FILES) gtfs::load_lazy_file(*data, file);
+                std::shared_lock<std::shared_mutex> lock(data->mutex);
+                gtfs::save_snapshot(*data, path);
+                logCallback("Saved snapshot " + path);
+            } else {
+                // Restored into a new generation, published like a load
+                auto next = std::make_shared<gtfs::GTFSData>();
+                if (mode == Mode::Load) gtfs::load_snapshot(*next, path, logCallback);
+                else gtfs::attach_snapshot(*next, path, logCallback);
+                std::shared_ptr<gtfs::GTFSData> previous = generations->publish(std::move(next));
+                previous.reset();
+            }
+        } catch (const std::exception& e) {
+            SetError(e.what());
+        }
+    }
+
+    void OnOK() override {
+        deferred.Resolve(Env().Null());
+    }
+
+    void OnError(const Napi::Error& e) override {
+        deferred.Reject(e.Value());
+    }
+
+    Napi::Promise GetPromise() { return deferred.Promise(); }
+
+private:
+    Napi::Promise::Deferred deferred;
+    Napi::ObjectReference owner;
+    Mode mode;
+    std::string path;
+    gtfs::DataGenerations* generations;
+    Logger logger;
+};
 
+// --- Result builders ---
+// Shared by the sync getters and the async workers; the async paths call them
+// in OnOK on copies, so they never touch GTFSData. str() maps an interned id
+// to a Napi::String.
 
+// Strings of the interned ids an async result refers to, captured under the
+// data lock
+struct StringCapture {
+    std::unordered_map<uint32_t, std::string> strings;
 
-    // Helpers
-    bool IsServiceActive(const std::string& service_id, const std::string& date_str);
-    int GetDayOfWeek(const std::string& date_str);
-    std::string GetPreviousDate(const std::string& date_str);
+    void add(const gtfs::StringPool& pool, uint32_t id) {
+        if (id != gtfs::NO_STR && !strings.count(id)) strings.emplace(id, pool.view(id));
+    }
 };
 
+// str() for OnOK: resolves captured ids, creating each JS string once
+class CapturedStrings {
+    Napi::Env env_;
+    const StringCapture& capture_;
+    std::unordered_map<uint32_t, Napi::String> cache_;
+public:
+    CapturedStrings(Napi::Env env, const StringCapture& capture) : env_(env), capture_(capture) {}
 
-// --- Helpers ---
-int GTFSAddon::GetDayOfWeek(const std::string& date_str) {
-    if (date_str.length() != 8) return -1;
-    try {
-        int y = std::stoi(date_str.substr(0, 4));
-        int m = std::stoi(date_str.substr(4, 2));
-        int d = std::stoi(date_str.substr(6, 2));
+    Napi::String operator()(uint32_t id) {
+        auto it = cache_.find(id);
+        if (it != cache_.end()) return it->second;
+        auto found = capture_.strings.find(id);
+        Napi::String v = Napi::String::New(env_, found != capture_.strings.end() ? found->second : std::string());
+        cache_.emplace(id, v);
+        return v;
+    }
+};
+
+// JS strings by interned id, kept across calls for one generation so that an id
+// repeated in many rows (a stop id in getStopTimes) is converted once. Enabled
+// with setStringCache and only used on the JS thread. Ids are never reused within
+// a generation, so entries go stale only when another one is published.
+class JsStringCache {
+    std::weak_ptr<gtfs::GTFSData> owner_;
+    std::vector<Napi::Reference<Napi::String>> strings_;
+    bool enabled_ = false;
+public:
+    bool enabled() const { return enabled_; }
+
+    void set_enabled(bool enabled) {
+        enabled_ = enabled;
+        if (!enabled) clear();
+    }
 
-        std::tm time_in = {};
+    void clear() {
+        strings_.clear();
+        owner_.reset();
+    }
 
-        time_in.tm_mday = d;
-        time_in.tm_mon  = m - 1;
-        time_in.tm_year = y - 1900;
-        time_in.tm_isdst = -1;
+    // Drops the entries of any other generation; false when caching is off
+    bool bind(const std::shared_ptr<gtfs::GTFSData>& data) {
+        if (!enabled_) return false;
+        if (owner_.owner_before(data) || data.owner_before(owner_)) {
+            clear();
+            owner_ = data;
+        }
+        return true;
+    }
 
-        std::time_t time_temp = std::mktime(&time_in);
+    Napi::String get(Napi::Env env, const gtfs::StringPool& pool, uint32_t id) {
+        if (id >= strings_.size()) {
+            size_t n = pool.size();
+            if (id >= n) return Napi::String::New(env, "");
+            strings_.resize(n);
+        }
+        Napi::Reference<Napi::String>& ref = strings_[id];
+        if (!ref.IsEmpty()) return ref.Value();
+        std::string_view sv = pool.view(id);
+        Napi::String v = Napi::String::New(env, sv.empty() ? "" : sv.data(), sv.size());
+        ref = Napi::Persistent(v);
+        return v;
+    }
+};
+
+// str() for the sync getters: converts straight from the pool's bytes, through the
+// addon's JsStringCache when it is enabled
+class PoolStrings {
+    Napi::Env env_;
+    const gtfs::StringPool& pool_;
+    JsStringCache* cache_;
+public:
+    PoolStrings(Napi::Env env, const gtfs::StringPool& pool, JsStringCache* cache) : env_(env), pool_(pool), cache_(cache) {}
 
-        if (time_temp == -1) return -1;
-        const std::tm * time_out = std::localtime(&time_temp);
-        
-        return time_out->tm_wday;
-    } catch(...) {
-        return -1;
+    Napi::String operator()(uint32_t id) const {
+        if (cache_) return cache_->get(env_, pool_, id);
+        std::string_view sv = pool_.view(id);
+        return Napi::String::New(env_, sv.empty() ? "" : sv.data(), sv.size());
     }
+};
+
+template<typename StrFn>
+void SetStr(Napi::Env env, Napi::Object& obj, const char* key, uint32_t id, StrFn& str) {
+    if (id != gtfs::NO_STR) obj.Set(key, str(id));
+    else obj.Set(key, env.Null());
 }
 
-std::string GTFSAddon::GetPreviousDate(const std::string& date_str) {
-    if (date_str.length() != 8) return "";
-    try {
-        int y = std::stoi(date_str.substr(0, 4));
-        int m = std::stoi(date_str.substr(4, 2));
-        int d = std::stoi(date_str.substr(6, 2));
+// Realtime strings outside the pool; "" when absent, like str() of NO_STR
+Napi::String Text(Napi::Env env, std::string_view sv) {
+    return Napi::String::New(env, sv.empty() ? "" : sv.data(), sv.size());
+}
+
+Napi::String Text(Napi::Env env, const gtfs::RealtimeText& t) { return Text(env, t.view()); }
+
+void SetText(Napi::Env env, Napi::Object& obj, const char* key, const gtfs::RealtimeText& t) {
+    if (!t.empty()) obj.Set(key, Text(env, t));
+    else obj.Set(key, env.Null());
+}
+
+template<typename StrFn>
+Napi::Object JourneyToObject(Napi::Env env, const gtfs::Journey& j, StrFn str) {
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("departure_time", j.departure);
+    obj.Set("arrival_time", j.arrival);
+    obj.Set("transfers", j.transfers);
+    Napi::Array legs = Napi::Array::New(env, j.legs.size());
+    for (size_t i = 0; i < j.legs.size(); ++i) {
+        const gtfs::JourneyLeg& leg = j.legs[i];
+        Napi::Object l = Napi::Object::New(env);
+        l.Set("mode", leg.trip_row != gtfs::NO_STR ? "transit" : "walk");
+        l.Set("from_stop_id", str(leg.from_stop));
+        l.Set("to_stop_id", str(leg.to_stop));
+        l.Set("departure_time", leg.departure);
+        l.Set("arrival_time", leg.arrival);
+        SetStr(env, l, "trip_id", leg.trip_id, str);
+        SetStr(env, l, "route_id", leg.route_id, str);
+        SetStr(env, l, "feed_id", leg.feed_id, str);
+        legs[i] = l;
+    }
+    obj.Set("legs", legs);
+    return obj;
+}
 
-        std::tm time_in = {};
+template<typename StrFn>
+Napi::Object VehiclePositionToObject(Napi::Env env, const gtfs::RealtimeVehiclePosition& vp, StrFn str) {
+    Napi::Object obj = Napi::Object::New(env);
 
+    obj.Set("update_id", Text(env, vp.update_id));
+    obj.Set("is_deleted", vp.is_deleted);
 
-        time_in.tm_mday = d - 1; 
-        time_in.tm_mon  = m - 1;
-        time_in.tm_year = y - 1900;
-        time_in.tm_isdst = -1;
+    Napi::Object trip = Napi::Object::New(env);
+    trip.Set("trip_id", str(vp.trip.trip_id));
+    trip.Set("route_id", str(vp.trip.route_id));
 
-        std::time_t time_temp = std::mktime(&time_in);
-        if (time_temp == -1) return "";
+    if (vp.trip.direction_id != -1) trip.Set("direction_id", vp.trip.direction_id);
+    else trip.Set("direction_id", env.Null());
 
-        const std::tm * time_out = std::localtime(&time_temp);
+    trip.Set("start_time", Text(env, vp.trip.start_time));
+    SetText(env, trip, "start_date", vp.trip.start_date);
 
-        std::stringstream ss;
-        ss << (time_out->tm_year + 1900)
-           << std::setfill('0') << std::setw(2) << (time_out->tm_mon + 1)
-           << std::setfill('0') << std::setw(2) << time_out->tm_mday;
-        return ss.str();
-    } catch(...) {
-        return "";
+    trip.Set("schedule_relationship", vp.trip.schedule_relationship);
+
+    obj.Set("trip", trip);
+
+    Napi::Object vehicle = Napi::Object::New(env);
+    vehicle.Set("id", Text(env, vp.vehicle.id));
+    vehicle.Set("label", Text(env, vp.vehicle.label));
+    vehicle.Set("license_plate", Text(env, vp.vehicle.license_plate));
+    obj.Set("vehicle", vehicle);
+
+    Napi::Object position = Napi::Object::New(env);
+    position.Set("latitude", vp.position.latitude);
+    position.Set("longitude", vp.position.longitude);
+
+    if (vp.position.bearing != -1.0f) position.Set("bearing", vp.position.bearing);
+    else position.Set("bearing", env.Null());
+
+    if (vp.position.odometer != -1.0) position.Set("odometer", vp.position.odometer);
+    else position.Set("odometer", env.Null());
+
+    if (vp.position.speed != -1.0f) position.Set("speed", vp.position.speed);
+    else position.Set("speed", env.Null());
+
+    obj.Set("position", position);
+
+    if (vp.current_stop_sequence != -1) obj.Set("current_stop_sequence", vp.current_stop_sequence);
+    else obj.Set("current_stop_sequence", env.Null());
+
+    obj.Set("stop_id", str(vp.stop_id));
+
+    if (vp.current_status != -1) obj.Set("current_status", vp.current_status);
+    else obj.Set("current_status", env.Null());
+
+    if (vp.timestamp != 0) obj.Set("timestamp", (double)vp.timestamp);
+    else obj.Set("timestamp", env.Null());
+
+    if (vp.congestion_level != -1) obj.Set("congestion_level", vp.congestion_level);
+    else obj.Set("congestion_level", env.Null());
+
+    if (vp.occupancy_status != -1) obj.Set("occupancy_status", vp.occupancy_status);
+    else obj.Set("occupancy_status", env.Null());
+
+    if (vp.occupancy_percentage != -1) obj.Set("occupancy_percentage", vp.occupancy_percentage);
+    else obj.Set("occupancy_percentage", env.Null());
+    obj.Set("feed_id", str(vp.feed_id));
+    return obj;
+}
+
+// Resolves an optional string filter of the realtime getters to a pool id: the empty
+// string matches unset fields (NO_STR). Returns false when the value was never interned,
+// so nothing can match.
+bool RealtimeFilterId(const Napi::Object& filter, bool has_filter, const char* key, const gtfs::StringPool& pool, std::optional<uint32_t>& out) {
+    if (!has_filter || !filter.Has(key)) return true;
+    std::string value = filter.Get(key).As<Napi::String>().Utf8Value();
+    if (value.empty()) {
+        out = gtfs::NO_STR;
+        return true;
     }
+    uint32_t id = pool.get_id(value);
+    if (id == 0xFFFFFFFF) return false;
+    out = id;
+    return true;
+}
+
+bool RealtimeFilterMatch(const std::optional<uint32_t>& want, uint32_t id) {
+    return !want || *want == id;
+}
+
+// Filter on a field kept as RealtimeText; the empty string matches unset fields
+void RealtimeFilterText(const Napi::Object& filter, bool has_filter, const char* key, std::optional<std::string>& out) {
+    if (has_filter && filter.Has(key)) out = filter.Get(key).As<Napi::String>().Utf8Value();
+}
+
+bool RealtimeFilterMatch(const std::optional<std::string>& want, const gtfs::RealtimeText& text) {
+    return !want || *want == text.view();
+}
+
+void SetInt8(Napi::Env env, Napi::Object& obj, const char* key, int8_t v) {
+    if (v != gtfs::ST_NO_INT8) obj.Set(key, (int)v);
+    else obj.Set(key, env.Null());
+}
+
+template<typename StrFn>
+Napi::Object StopTimeToObject(Napi::Env env, const gtfs::StopTime& st, StrFn str) {
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("trip_id", str(st.trip_id));
+    if (st.arrival_time != gtfs::ST_NO_TIME) obj.Set("arrival_time", st.arrival_time);
+    else obj.Set("arrival_time", env.Null());
+    if (st.departure_time != gtfs::ST_NO_TIME) obj.Set("departure_time", st.departure_time);
+    else obj.Set("departure_time", env.Null());
+    obj.Set("stop_id", str(st.stop_id));
+    obj.Set("stop_sequence", st.stop_sequence);
+    if (st.stop_headsign != gtfs::ST_NO_HEADSIGN) obj.Set("stop_headsign", str(st.stop_headsign));
+    else obj.Set("stop_headsign", env.Null());
+    obj.Set("pickup_type", (int)st.pickup_type);
+    obj.Set("drop_off_type", (int)st.drop_off_type);
+    if (st.shape_dist_traveled != gtfs::ST_NO_DIST) obj.Set("shape_dist_traveled", st.shape_dist_traveled);
+    else obj.Set("shape_dist_traveled", env.Null());
+    if (st.timepoint != gtfs::ST_NO_INT8) obj.Set("timepoint", (int)st.timepoint);
+    else obj.Set("timepoint", env.Null());
+    if (st.continuous_pickup != gtfs::ST_NO_INT8) obj.Set("continuous_pickup", (int)st.continuous_pickup);
+    else obj.Set("continuous_pickup", env.Null());
+    if (st.continuous_drop_off != gtfs::ST_NO_INT8) obj.Set("continuous_drop_off", (int)st.continuous_drop_off);
+    else obj.Set("continuous_drop_off", env.Null());
+    obj.Set("feed_id", str(st.feed_id));
+    return obj;
+}
+
+template<typename StrFn>
+Napi::Object TripToObject(Napi::Env env, const gtfs::Trip& t, StrFn str) {
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("trip_id", str(t.trip_id));
+    obj.Set("route_id", str(t.route_id));
+    obj.Set("service_id", str(t.service_id));
+    SetStr(env, obj, "trip_headsign", t.trip_headsign, str);
+    SetStr(env, obj, "trip_short_name", t.trip_short_name, str);
+    SetInt8(env, obj, "direction_id", t.direction_id);
+    SetStr(env, obj, "block_id", t.block_id, str);
+    SetStr(env, obj, "shape_id", t.shape_id, str);
+    SetInt8(env, obj, "wheelchair_accessible", t.wheelchair_accessible);
+    SetInt8(env, obj, "bikes_allowed", t.bikes_allowed);
+    obj.Set("feed_id", str(t.feed_id));
+    return obj;
+}
+
+template<typename StrFn>
+Napi::Object ShapeToObject(Napi::Env env, const gtfs::Shape& sh, StrFn str) {
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("shape_id", str(sh.shape_id));
+    obj.Set("shape_pt_lat", sh.shape_pt_lat);
+    obj.Set("shape_pt_lon", sh.shape_pt_lon);
+    obj.Set("shape_pt_sequence", sh.shape_pt_sequence);
+    if (sh.shape_dist_traveled != gtfs::ST_NO_DIST) obj.Set("shape_dist_traveled", sh.shape_dist_traveled); else obj.Set("shape_dist_traveled", env.Null());
+    obj.Set("feed_id", str(sh.feed_id));
+    return obj;
+}
+
+template<typename StrFn>
+Napi::Object RouteToObject(Napi::Env env, const gtfs::Route& r, StrFn str) {
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("route_id", str(r.route_id));
+    SetStr(env, obj, "agency_id", r.agency_id, str);
+    SetStr(env, obj, "route_short_name", r.route_short_name, str);
+    SetStr(env, obj, "route_long_name", r.route_long_name, str);
+    SetStr(env, obj, "route_desc", r.route_desc, str);
+    obj.Set("route_type", r.route_type);
+    SetStr(env, obj, "route_url", r.route_url, str);
+    SetStr(env, obj, "route_color", r.route_color, str);
+    SetStr(env, obj, "route_text_color", r.route_text_color, str);
+    SetInt8(env, obj, "continuous_pickup", r.continuous_pickup);
+    SetInt8(env, obj, "continuous_drop_off", r.continuous_drop_off);
+    if (r.route_sort_order != gtfs::NO_INT) obj.Set("route_sort_order", r.route_sort_order); else obj.Set("route_sort_order", env.Null());
+    SetStr(env, obj, "network_id", r.network_id, str);
+    obj.Set("feed_id", str(r.feed_id));
+    return obj;
+}
+
+template<typename StrFn>
+Napi::Object StopToObject(Napi::Env env, const gtfs::Stop& s, StrFn str) {
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("stop_id", str(s.stop_id));
+    SetStr(env, obj, "stop_code", s.stop_code, str);
+    SetStr(env, obj, "stop_name", s.stop_name, str);
+    SetStr(env, obj, "stop_desc", s.stop_desc, str);
+    if (!std::isnan(s.stop_lat)) obj.Set("stop_lat", s.stop_lat); else obj.Set("stop_lat", env.Null());
+    if (!std::isnan(s.stop_lon)) obj.Set("stop_lon", s.stop_lon); else obj.Set("stop_lon", env.Null());
+    SetStr(env, obj, "zone_id", s.zone_id, str);
+    SetStr(env, obj, "stop_url", s.stop_url, str);
+    SetInt8(env, obj, "location_type", s.location_type);
+    SetStr(env, obj, "parent_station", s.parent_station, str);
+    SetStr(env, obj, "stop_timezone", s.stop_timezone, str);
+    SetInt8(env, obj, "wheelchair_boarding", s.wheelchair_boarding);
+    SetStr(env, obj, "level_id", s.level_id, str);
+    SetStr(env, obj, "platform_code", s.platform_code, str);
+    SetStr(env, obj, "tts_stop_name", s.tts_stop_name, str);
+    obj.Set("feed_id", str(s.feed_id));
+    return obj;
+}
+
+template<typename StrFn>
+Napi::Object CalendarToObject(Napi::Env env, const gtfs::Calendar& c, StrFn str) {
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("service_id", str(c.service_id));
+    obj.Set("monday", c.monday);
+    obj.Set("tuesday", c.tuesday);
+    obj.Set("wednesday", c.wednesday);
+    obj.Set("thursday", c.thursday);
+    obj.Set("friday", c.friday);
+    obj.Set("saturday", c.saturday);
+    obj.Set("sunday", c.sunday);
+    obj.Set("start_date", str(c.start_date));
+    obj.Set("end_date", str(c.end_date));
+    obj.Set("feed_id", str(c.feed_id));
+    return obj;
+}
+
+Napi::Object CalendarDateToObject(Napi::Env env, const gtfs::CalendarDate& cd) {
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("service_id", cd.service_id);
+    obj.Set("date", cd.date);
+    obj.Set("exception_type", cd.exception_type);
+    obj.Set("feed_id", cd.feed_id);
+    return obj;
+}
+
+// Hands a native column to JS without copying; the vector is freed with the ArrayBuffer
+template<typename T>
+Napi::TypedArrayOf<T> TakeTypedArray(Napi::Env env, std::vector<T>&& vec) {
+#ifdef NODE_API_NO_EXTERNAL_BUFFERS_ALLOWED
+    auto arr = Napi::TypedArrayOf<T>::New(env, vec.size());
+    if (!vec.empty()) memcpy(arr.Data(), vec.data(), vec.size() * sizeof(T));
+    return arr;
+#else
+    if (vec.empty()) return Napi::TypedArrayOf<T>::New(env, 0);
+    auto* owned = new std::vector<T>(std::move(vec));
+    Napi::ArrayBuffer buffer = Napi::ArrayBuffer::New(env, owned->data(), owned->size() * sizeof(T),
+        [](Napi::Env, void*, std::vector<T>* v) { delete v; }, owned);
+    return Napi::TypedArrayOf<T>::New(env, owned->size(), buffer, 0);
+#endif
+}
+
+Napi::Object StopTimeColumnsToObject(Napi::Env env, gtfs::StopTimeColumns&& c) {
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("length", static_cast<double>(c.trip_id.size()));
+    obj.Set("trip_id", TakeTypedArray(env, std::move(c.trip_id)));
+    obj.Set("stop_id", TakeTypedArray(env, std::move(c.stop_id)));
+    obj.Set("arrival_time", TakeTypedArray(env, std::move(c.arrival_time)));
+    obj.Set("departure_time", TakeTypedArray(env, std::move(c.departure_time)));
+    obj.Set("stop_sequence", TakeTypedArray(env, std::move(c.stop_sequence)));
+    obj.Set("stop_headsign", TakeTypedArray(env, std::move(c.stop_headsign)));
+    obj.Set("shape_dist_traveled", TakeTypedArray(env, std::move(c.shape_dist_traveled)));
+    obj.Set("pickup_type", TakeTypedArray(env, std::move(c.pickup_type)));
+    obj.Set("drop_off_type", TakeTypedArray(env, std::move(c.drop_off_type)));
+    obj.Set("timepoint", TakeTypedArray(env, std::move(c.timepoint)));
+    obj.Set("continuous_pickup", TakeTypedArray(env, std::move(c.continuous_pickup)));
+    obj.Set("continuous_drop_off", TakeTypedArray(env, std::move(c.continuous_drop_off)));
+    obj.Set("feed_id", TakeTypedArray(env, std::move(c.feed_id)));
+    obj.Set("day_offset", TakeTypedArray(env, std::move(c.day_offset)));
+    return obj;
+}
+
+Napi::Object ShapeColumnsToObject(Napi::Env env, gtfs::ShapeColumns&& c) {
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("length", static_cast<double>(c.shape_id.size()));
+    obj.Set("shape_id", TakeTypedArray(env, std::move(c.shape_id)));
+    obj.Set("shape_pt_lat", TakeTypedArray(env, std::move(c.shape_pt_lat)));
+    obj.Set("shape_pt_lon", TakeTypedArray(env, std::move(c.shape_pt_lon)));
+    obj.Set("shape_pt_sequence", TakeTypedArray(env, std::move(c.shape_pt_sequence)));
+    obj.Set("shape_dist_traveled", TakeTypedArray(env, std::move(c.shape_dist_traveled)));
+    obj.Set("feed_id", TakeTypedArray(env, std::move(c.feed_id)));
+    return obj;
+}
+
+Napi::Object VehicleProgressColumnsToObject(Napi::Env env, gtfs::VehicleProgressColumns&& c) {
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("length", static_cast<double>(c.update_id.size()));
+    Napi::Array update_id = Napi::Array::New(env, c.update_id.size());
+    Napi::Array vehicle_id = Napi::Array::New(env, c.vehicle_id.size());
+    for (size_t i = 0; i < c.update_id.size(); ++i) {
+        update_id[i] = Text(env, c.update_id[i]);
+        vehicle_id[i] = Text(env, c.vehicle_id[i]);
+    }
+    obj.Set("update_id", update_id);
+    obj.Set("vehicle_id", vehicle_id);
+    obj.Set("trip_id", TakeTypedArray(env, std::move(c.trip_id)));
+    obj.Set("feed_id", TakeTypedArray(env, std::move(c.feed_id)));
+    obj.Set("shape_id", TakeTypedArray(env, std::move(c.shape_id)));
+    obj.Set("lat", TakeTypedArray(env, std::move(c.lat)));
+    obj.Set("lon", TakeTypedArray(env, std::move(c.lon)));
+    obj.Set("distance", TakeTypedArray(env, std::move(c.distance)));
+    obj.Set("offset", TakeTypedArray(env, std::move(c.offset)));
+    obj.Set("shape_length", TakeTypedArray(env, std::move(c.shape_length)));
+    obj.Set("next_stop_id", TakeTypedArray(env, std::move(c.next_stop_id)));
+    obj.Set("next_stop_sequence", TakeTypedArray(env, std::move(c.next_stop_sequence)));
+    obj.Set("next_stop_distance", TakeTypedArray(env, std::move(c.next_stop_distance)));
+    return obj;
 }
 
-bool CheckServiceActiveLogic(const gtfs::GTFSData& data, const std::string& feed_id, const std::string& service_id, const std::string& date_str, int wday) {
-    // Check calendar_dates.txt for exceptions
-    if (data.calendar_dates.count(feed_id)) {
-        const auto& feed_dates = data.calendar_dates.at(feed_id);
-        if (feed_dates.count(service_id)) {
-            const auto& dates = feed_dates.at(service_id);
-            if (dates.count(date_str)) {
-                int exception = dates.at(date_str);
-                if (exception == 1) return true; // Service added
-                if (exception == 2) return false; // Service removed
+// Runs a read-only query on the libuv threadpool under a shared lock of
+// GTFSData::mutex. run() must copy everything build() needs, since build()
+// runs in OnOK after the lock is released. Holds a reference to the owning
+// addon object so its data outlives the worker.
+class QueryWorker : public Napi::AsyncWorker {
+public:
+    using RunFn = std::function<void(gtfs::GTFSData&)>;
+    using BuildFn = std::function<Napi::Value(Napi::Env)>;
+
+    // Runs against the generation given, even if a load publishes a new one
+    // meanwhile. stats records the time from the call until the promise settles.
+    QueryWorker(Napi::Env env, Napi::Object owner, gtfs::MethodStats& stats, std::shared_ptr<gtfs::GTFSData> targetData, RunFn run, BuildFn build)
+        : Napi::AsyncWorker(env, "GTFSQueryWorker"), deferred(Napi::Promise::Deferred::New(env)), owner(Napi::Persistent(owner)), stats(stats), targetData(std::move(targetData)), run(std::move(run)), build(std::move(build)) {}
+
+    // Parses a file a lazy load kept, unless that already happened, before run()
+    // takes the lock
+    void Needs(const char* file) { lazyFiles.push_back(file); }
+
+    void Execute() override {
+        try {
+            for (const std::string& file : lazyFiles) gtfs::load_lazy_file(*targetData, file);
+            std::shared_lock<std::shared_mutex> lock(targetData->mutex);
+            run(*targetData);
+        } catch (const std::exception& e) {
+            SetError(e.what());
+        }
+    }
+
+    void OnOK() override {
+        deferred.Resolve(build(Env()));
+        stats.record(gtfs::elapsed_ns(start), false);
+    }
+
+    void OnError(const Napi::Error& e) override {
+        deferred.Reject(e.Value());
+        stats.record(gtfs::elapsed_ns(start), true);
+    }
+
+    Napi::Promise GetPromise() { return deferred.Promise(); }
+
+private:
+    Napi::Promise::Deferred deferred;
+    Napi::ObjectReference owner;
+    gtfs::MethodStats& stats;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::shared_ptr<gtfs::GTFSData> targetData;
+    RunFn run;
+    BuildFn build;
+    std::vector<std::string> lazyFiles;
+};
+
+// Decodes realtime buffers on worker threads, one per buffer and under the shared data
+// lock, then merges all of them under a single exclusive lock, so readers see either
+// the previous state or the complete update.
+class RealtimeWorker : public Napi::AsyncWorker {
+public:
+    struct Input {
+        uint32_t source;
+        gtfs::BufferView buffer;
+    };
+
+    RealtimeWorker(Napi::Env env, Napi::Object owner, gtfs::MethodStats& stats, gtfs::DataGenerations* generations, std::string feedId, std::vector<Input>&& inputs, std::vector<Napi::Reference<Napi::Buffer<unsigned char>>>&& bufferRefs)
+        : Napi::AsyncWorker(env, "GTFSRealtimeWorker"), deferred(Napi::Promise::Deferred::New(env)), owner(Napi::Persistent(owner)), stats(stats), generations(generations), feedId(std::move(feedId)), inputs(std::move(inputs)), bufferRefs(std::move(bufferRefs)) {}
+
+    ~RealtimeWorker() {
+        ReleaseBufferRefs();
+    }
+
+    void Execute() override {
+        try {
+            // Buffers whose header matches the last applied one are not decoded at all.
+            // Decoding interns ids into the string pool of the generation it started on.
+            std::vector<char> changed(inputs.size(), 1);
+            std::vector<gtfs::RealtimeMessage> messages(inputs.size());
+            std::shared_ptr<gtfs::GTFSData> targetData = generations->current();
+            {
+                std::shared_lock<std::shared_mutex> lock(targetData->mutex);
+                auto it = targetData->realtime.find(feedId);
+                if (it != targetData->realtime.end()) {
+                    for (size_t i = 0; i < inputs.size(); ++i) {
+                        uint64_t timestamp;
+                        bool full_dataset;
+                        gtfs::read_realtime_header(inputs[i].buffer.data, inputs[i].buffer.size, timestamp, full_dataset);
+                        changed[i] = !gtfs::realtime_unchanged(it->second, inputs[i].source, timestamp);
+                    }
+                }
+
+                uint32_t feed_id = feedId.empty() ? gtfs::NO_STR : targetData->string_pool.intern(feedId);
+                std::vector<std::future<void>> decoding;
+                for (size_t i = 0; i < inputs.size(); ++i) {
+                    if (!changed[i]) continue;
+                    decoding.push_back(std::async(std::launch::async, [this, &targetData, &messages, i, feed_id]() {
+                        gtfs::decode_realtime_message(targetData->string_pool, inputs[i].buffer.data, inputs[i].buffer.size, inputs[i].source, feed_id, messages[i]);
+                    }));
+                }
+                for (auto& f : decoding) f.get();
             }
+
+            std::shared_ptr<gtfs::GTFSData> latest = generations->current();
+            bool reloaded = latest != targetData;
+            targetData = std::move(latest);
+            std::unique_lock<std::shared_mutex> lock(targetData->mutex);
+            if (reloaded) {
+                // A load or feed change published a new generation in between; the
+                // decoded ids belong to the old pool, so every buffer is decoded again
+                uint32_t feed_id = feedId.empty() ? gtfs::NO_STR : targetData->string_pool.intern(feedId);
+                for (size_t i = 0; i < inputs.size(); ++i) {
+                    changed[i] = 1;
+                    messages[i] = gtfs::RealtimeMessage();
+                    gtfs::decode_realtime_message(targetData->string_pool, inputs[i].buffer.data, inputs[i].buffer.size, inputs[i].source, feed_id, messages[i]);
+                }
+            }
+            gtfs::RealtimeFeed& feed = gtfs::realtime_feed_for_update(*targetData, feedId);
+            std::vector<uint32_t> sources;
+            for (size_t i = 0; i < inputs.size(); ++i) {
+                sources.push_back(inputs[i].source);
+                // Another update may have applied the same message in the meantime
+                if (changed[i] && !gtfs::realtime_unchanged(feed, inputs[i].source, messages[i].timestamp)) {
+                    gtfs::apply_realtime_message(feed, messages[i]);
+                }
+            }
+            gtfs::retain_realtime_sources(feed, sources);
+            gtfs::rebuild_realtime_indexes(*targetData);
+        } catch (const std::exception& e) {
+            SetError(e.what());
         }
     }
 
-    // Check calendar.txt
-    if (data.calendars.count(feed_id)) {
-        const auto& feed_cal = data.calendars.at(feed_id);
-        if (feed_cal.count(service_id)) {
-            const auto& cal = feed_cal.at(service_id);
-            if (date_str < cal.start_date || date_str > cal.end_date) {
-                return false;
-            }
-            switch (wday) {
-                case 0: return cal.sunday;
-                case 1: return cal.monday;
-                case 2: return cal.tuesday;
-                case 3: return cal.wednesday;
-                case 4: return cal.thursday;
-                case 5: return cal.friday;
-                case 6: return cal.saturday;
-                default: return false;
-            }
-        }
-    }
-    return false; 
-}
+    void OnOK() override {
+        ReleaseBufferRefs();
+        deferred.Resolve(Env().Null());
+        stats.record(gtfs::elapsed_ns(start), false);
+    }
+
+    void OnError(const Napi::Error& e) override {
+        ReleaseBufferRefs();
+        deferred.Reject(e.Value());
+        stats.record(gtfs::elapsed_ns(start), true);
+    }
+
+    Napi::Promise GetPromise() { return deferred.Promise(); }
+
+private:
+    Napi::Promise::Deferred deferred;
+    Napi::ObjectReference owner;
+    gtfs::MethodStats& stats;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    gtfs::DataGenerations* generations;
+    std::string feedId;
+    std::vector<Input> inputs;
+    std::vector<Napi::Reference<Napi::Buffer<unsigned char>>> bufferRefs;
+
+    void ReleaseBufferRefs() {
+        if (bufferRefs.empty()) return;
+        for (auto& ref : bufferRefs) {
+            ref.Unref();
+            ref.Reset();
+        }
+        bufferRefs.clear();
+    }
+};
+
+class GTFSAddon : public Napi::ObjectWrap<GTFSAddon> {
+public:
+    static Napi::Object Init(Napi::Env env, Napi::Object exports);
+    GTFSAddon(const Napi::CallbackInfo& info);
+    ~GTFSAddon();
+
+    gtfs::DataGenerations generations;
+    gtfs::Metrics metrics; // per-method counters, see getStats
+
+private:
+    Napi::Value LoadFromBuffers(const Napi::CallbackInfo& info);
+    Napi::Value ChangeFeed(const Napi::CallbackInfo& info);
+    Napi::Value SaveSnapshot(const Napi::CallbackInfo& info);
+    Napi::Value LoadSnapshot(const Napi::CallbackInfo& info);
+    Napi::Value AttachSnapshot(const Napi::CallbackInfo& info);
+    Napi::Value QueueSnapshotWorker(const Napi::CallbackInfo& info, SnapshotWorker::Mode mode);
+    Napi::Value GetRoutes(const Napi::CallbackInfo& info);
+    Napi::Value GetAgencies(const Napi::CallbackInfo& info);
+    Napi::Value GetStops(const Napi::CallbackInfo& info);
+    Napi::Value GetStopsNear(const Napi::CallbackInfo& info);
+    Napi::Value GetStopTimes(const Napi::CallbackInfo& info);
+    Napi::Value GetStopTimesAsync(const Napi::CallbackInfo& info);
+    Napi::Value GetStopTimesWithRealtime(const Napi::CallbackInfo& info);
+    Napi::Value GetDepartures(const Napi::CallbackInfo& info);
+    Napi::Value PlanJourney(const Napi::CallbackInfo& info);
+    Napi::Value PlanJourneyAsync(const Napi::CallbackInfo& info);
+    Napi::Value GetStopTimesColumnar(const Napi::CallbackInfo& info);
+    Napi::Value GetStopTimesColumnarAsync(const Napi::CallbackInfo& info);
+    Napi::Value GetStringTable(const Napi::CallbackInfo& info);
+    Napi::Value GetFeedInfo(const Napi::CallbackInfo& info);
+    Napi::Value GetTrips(const Napi::CallbackInfo& info);
+    Napi::Value GetTripsAsync(const Napi::CallbackInfo& info);
+    Napi::Value GetShapes(const Napi::CallbackInfo& info);
+    Napi::Value GetShapesAsync(const Napi::CallbackInfo& info);
+    Napi::Value GetShapesColumnar(const Napi::CallbackInfo& info);
+    Napi::Value GetShapesColumnarAsync(const Napi::CallbackInfo& info);
+    Napi::Value GetShapePolyline(const Napi::CallbackInfo& info);
+    Napi::Value GetCalendars(const Napi::CallbackInfo& info);
+    Napi::Value GetCalendarDates(const Napi::CallbackInfo& info);
+    Napi::Value GetCalendarDatesAsync(const Napi::CallbackInfo& info);
+    Napi::Value GetRealtimeTripUpdates(const Napi::CallbackInfo& info);
+    Napi::Value GetRealtimeVehiclePositions(const Napi::CallbackInfo& info);
+    Napi::Value GetVehiclesInBBox(const Napi::CallbackInfo& info);
+    Napi::Value GetVehicleProgress(const Napi::CallbackInfo& info);
+    Napi::Value GetRealtimeAlerts(const Napi::CallbackInfo& info);
+    Napi::Value UpdateRealtime(const Napi::CallbackInfo& info);
+    Napi::Value UpdateRealtimeAsync(const Napi::CallbackInfo& info);
+    Napi::Value ClearRealtime(const Napi::CallbackInfo& info);
+    Napi::Value CompactStopTimes(const Napi::CallbackInfo& info);
+    Napi::Value MergeStops(const Napi::CallbackInfo& info);
+    Napi::Value UpdateStop(const Napi::CallbackInfo& info);
+    Napi::Value GetStats(const Napi::CallbackInfo& info);
+    Napi::Value SetStringCache(const Napi::CallbackInfo& info);
+
+    JsStringCache stringCache;
+    PoolStrings Strings(Napi::Env env, const std::shared_ptr<gtfs::GTFSData>& generation);
+
+    // Parses lazy files for the sync getters off the JS thread; stopped by the
+    // env cleanup hook or the destructor, whichever runs first
+    gtfs::LazyFileLoader lazyLoader;
+    napi_env env_;
+    static void StopLazyLoader(void* loader);
+    bool LoadLazyFile(Napi::Env env, const std::shared_ptr<gtfs::GTFSData>& generation, const char* name);
+
+    bool ParseStopTimeFilter(const gtfs::GTFSData& data, const Napi::Object& config, gtfs::StopTimeFilter& f);
+    void ParseTripFilter(const Napi::CallbackInfo& info, gtfs::TripFilter& f);
+    bool ParseJourneyRequest(const gtfs::GTFSData& data, const Napi::CallbackInfo& info, gtfs::JourneyRequest& r);
+};
+
 
 Napi::Object GTFSAddon::Init(Napi::Env env, Napi::Object exports) {
     Napi::Function func = DefineClass(env, "GTFSAddon", {
         InstanceMethod("loadFromBuffers", &GTFSAddon::LoadFromBuffers),
+        InstanceMethod("changeFeed", &GTFSAddon::ChangeFeed),
+        InstanceMethod("saveSnapshot", &GTFSAddon::SaveSnapshot),
+        InstanceMethod("loadSnapshot", &GTFSAddon::LoadSnapshot),
+        InstanceMethod("attachSnapshot", &GTFSAddon::AttachSnapshot),
         InstanceMethod("getRoutes", &GTFSAddon::GetRoutes),
         InstanceMethod("getAgencies", &GTFSAddon::GetAgencies),
         InstanceMethod("getStops", &GTFSAddon::GetStops),
+        InstanceMethod("getStopsNear", &GTFSAddon::GetStopsNear),
         InstanceMethod("getStopTimes", &GTFSAddon::GetStopTimes),
+        InstanceMethod("getStopTimesAsync", &GTFSAddon::GetStopTimesAsync),
+        InstanceMethod("getStopTimesWithRealtime", &GTFSAddon::GetStopTimesWithRealtime),
+        InstanceMethod("getDepartures", &GTFSAddon::GetDepartures),
+        InstanceMethod("planJourney", &GTFSAddon::PlanJourney),
+        InstanceMethod("planJourneyAsync", &GTFSAddon::PlanJourneyAsync),
+        InstanceMethod("getStopTimesColumnar", &GTFSAddon::GetStopTimesColumnar),
+        InstanceMethod("getStopTimesColumnarAsync", &GTFSAddon::GetStopTimesColumnarAsync),
+        InstanceMethod("getStringTable", &GTFSAddon::GetStringTable),
         InstanceMethod("getFeedInfo", &GTFSAddon::GetFeedInfo),
         InstanceMethod("getTrips", &GTFSAddon::GetTrips),
+        InstanceMethod("getTripsAsync", &GTFSAddon::GetTripsAsync),
         InstanceMethod("getShapes", &GTFSAddon::GetShapes),
+        InstanceMethod("getShapesAsync", &GTFSAddon::GetShapesAsync),
+        InstanceMethod("getShapesColumnar", &GTFSAddon::GetShapesColumnar),
+        InstanceMethod("getShapesColumnarAsync", &GTFSAddon::GetShapesColumnarAsync),
+        InstanceMethod("getShapePolyline", &GTFSAddon::GetShapePolyline),
         InstanceMethod("getCalendars", &GTFSAddon::GetCalendars),
         InstanceMethod("getCalendarDates", &GTFSAddon::GetCalendarDates),
+        InstanceMethod("getCalendarDatesAsync", &GTFSAddon::GetCalendarDatesAsync),
         InstanceMethod("getRealtimeTripUpdates", &GTFSAddon::GetRealtimeTripUpdates),
         InstanceMethod("getRealtimeVehiclePositions", &GTFSAddon::GetRealtimeVehiclePositions),
+        InstanceMethod("getVehiclesInBBox", &GTFSAddon::GetVehiclesInBBox),
+        InstanceMethod("getVehicleProgress", &GTFSAddon::GetVehicleProgress),
         InstanceMethod("getRealtimeAlerts", &GTFSAddon::GetRealtimeAlerts),
         InstanceMethod("updateRealtime", &GTFSAddon::UpdateRealtime),
+        InstanceMethod("updateRealtimeAsync", &GTFSAddon::UpdateRealtimeAsync),
         InstanceMethod("clearRealtime", &GTFSAddon::ClearRealtime),
+        InstanceMethod("compactStopTimes", &GTFSAddon::CompactStopTimes),
         InstanceMethod("mergeStops", &GTFSAddon::MergeStops),
-        InstanceMethod("updateStop", &GTFSAddon::UpdateStop)
+        InstanceMethod("updateStop", &GTFSAddon::UpdateStop),
+        InstanceMethod("getStats", &GTFSAddon::GetStats),
+        InstanceMethod("setStringCache", &GTFSAddon::SetStringCache)
     });
 
 
@@ -258,7 +996,47 @@ Napi::Object GTFSAddon::Init(Napi::Env env, Napi::Object exports) {
     return exports;
 }
 
-GTFSAddon::GTFSAddon(const Napi::CallbackInfo& info) : Napi::ObjectWrap<GTFSAddon>(info) {
+GTFSAddon::GTFSAddon(const Napi::CallbackInfo& info) : Napi::ObjectWrap<GTFSAddon>(info), env_(info.Env()) {
+    napi_add_env_cleanup_hook(env_, StopLazyLoader, &lazyLoader);
+}
+
+GTFSAddon::~GTFSAddon() {
+    napi_remove_env_cleanup_hook(env_, StopLazyLoader, &lazyLoader);
+    lazyLoader.stop();
+}
+
+void GTFSAddon::StopLazyLoader(void* loader) {
+    static_cast<gtfs::LazyFileLoader*>(loader)->stop();
+}
+
+// Waits until a file a lazy load kept is parsed, before the caller takes the
+// shared lock. The first use parses it on the loader thread; the JS thread only
+// blocks until that finishes. Throws a JS error and returns false when the parse
+// failed.
+bool GTFSAddon::LoadLazyFile(Napi::Env env, const std::shared_ptr<gtfs::GTFSData>& generation, const char* name) {
+    try {
+        lazyLoader.load(generation, name);
+        return true;
+    } catch (const std::exception& e) {
+        Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+        return false;
+    }
+}
+
+PoolStrings GTFSAddon::Strings(Napi::Env env, const std::shared_ptr<gtfs::GTFSData>& generation) {
+    return PoolStrings(env, generation->string_pool, stringCache.bind(generation) ? &stringCache : nullptr);
+}
+
+// setStringCache(enabled): keep the JS strings getters create for reuse by later
+// calls on the same generation
+Napi::Value GTFSAddon::SetStringCache(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsBoolean()) {
+        Napi::TypeError::New(env, "Boolean expected").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    stringCache.set_enabled(info[0].As<Napi::Boolean>().Value());
+    return env.Null();
 }
 
 Napi::Value GTFSAddon::LoadFromBuffers(const Napi::CallbackInfo& info) {
@@ -315,13 +1093,138 @@ Napi::Value GTFSAddon::LoadFromBuffers(const Napi::CallbackInfo& info) {
         }
     }
 
-    auto worker = new GTFSWorker(env, std::move(zipBuffers), std::move(bufferRefs), std::move(feedIds), mergeStrategy, &data, logger, std::move(filesToLoad));
+    unsigned int parseThreads = 0;
+    if (info.Length() > 7 && info[7].IsNumber()) {
+        int32_t n = info[7].As<Napi::Number>().Int32Value();
+        if (n > 0) parseThreads = static_cast<unsigned int>(n);
+    }
+
+    std::vector<std::string> lazyFiles;
+    if (info.Length() > 8 && info[8].IsArray()) {
+        Napi::Array larr = info[8].As<Napi::Array>();
+        for (uint32_t i = 0; i < larr.Length(); ++i) {
+            lazyFiles.push_back(larr.Get(i).As<Napi::String>().Utf8Value());
+        }
+    }
+
+    auto worker = new GTFSWorker(env, info.This().As<Napi::Object>(), std::move(zipBuffers), std::move(bufferRefs), std::move(feedIds), mergeStrategy, &generations, logger, std::move(filesToLoad), parseThreads, std::move(lazyFiles));
+    worker->Queue();
+    return worker->GetPromise();
+}
+
+// changeFeed(mode, feedId, buffer, mergeStrategy, logger, ansi, progress, files, threads, lazyFiles):
+// mode is "add", "replace" or "remove"; buffer is ignored for "remove"
+Napi::Value GTFSAddon::ChangeFeed(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 2 || !info[0].IsString() || !info[1].IsString()) {
+        Napi::TypeError::New(env, "Mode and feed_id (strings) expected").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+
+    std::string mode = info[0].As<Napi::String>().Utf8Value();
+    gtfs::FeedChange change;
+    if (mode == "add") change = gtfs::FeedChange::Add;
+    else if (mode == "replace") change = gtfs::FeedChange::Replace;
+    else if (mode == "remove") change = gtfs::FeedChange::Remove;
+    else {
+        Napi::TypeError::New(env, "Mode must be 'add', 'replace' or 'remove'").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+
+    gtfs::BufferView zipBuffer = { nullptr, 0 };
+    Napi::Reference<Napi::Buffer<unsigned char>> bufferRef;
+    if (change != gtfs::FeedChange::Remove) {
+        if (info.Length() < 3 || !info[2].IsBuffer()) {
+            Napi::TypeError::New(env, "Feed buffer expected").ThrowAsJavaScriptException();
+            return env.Null();
+        }
+        Napi::Buffer<unsigned char> buffer = info[2].As<Napi::Buffer<unsigned char>>();
+        bufferRef = Napi::Persistent(buffer);
+        zipBuffer = { buffer.Data(), buffer.Length() };
+    }
+
+    int mergeStrategy = 0;
+    if (info.Length() > 3 && info[3].IsNumber()) {
+        mergeStrategy = info[3].As<Napi::Number>().Int32Value();
+    }
+
+    Logger logger = { nullptr, nullptr, false };
+    if (info.Length() > 4 && info[4].IsFunction()) {
+        logger.tsfn = Napi::ThreadSafeFunction::New(env, info[4].As<Napi::Function>(), "GTFSLogger", 0, 1);
+    }
+    if (info.Length() > 5 && info[5].IsBoolean()) {
+        logger.ansi = info[5].As<Napi::Boolean>().Value();
+    }
+    if (info.Length() > 6 && info[6].IsFunction()) {
+        logger.progress_tsfn = Napi::ThreadSafeFunction::New(env, info[6].As<Napi::Function>(), "GTFSProgress", 0, 1);
+    }
+
+    std::vector<std::string> filesToLoad;
+    if (info.Length() > 7 && info[7].IsArray()) {
+        Napi::Array flarr = info[7].As<Napi::Array>();
+        for (uint32_t i = 0; i < flarr.Length(); ++i) {
+            filesToLoad.push_back(flarr.Get(i).As<Napi::String>().Utf8Value());
+        }
+    }
+
+    unsigned int parseThreads = 0;
+    if (info.Length() > 8 && info[8].IsNumber()) {
+        int32_t n = info[8].As<Napi::Number>().Int32Value();
+        if (n > 0) parseThreads = static_cast<unsigned int>(n);
+    }
+
+    std::vector<std::string> lazyFiles;
+    if (info.Length() > 9 && info[9].IsArray()) {
+        Napi::Array larr = info[9].As<Napi::Array>();
+        for (uint32_t i = 0; i < larr.Length(); ++i) {
+            lazyFiles.push_back(larr.Get(i).As<Napi::String>().Utf8Value());
+        }
+    }
+
+    auto worker = new FeedWorker(env, info.This().As<Napi::Object>(), change, info[1].As<Napi::String>().Utf8Value(), zipBuffer, std::move(bufferRef), mergeStrategy, &generations, logger, std::move(filesToLoad), parseThreads, std::move(lazyFiles));
+    worker->Queue();
+    return worker->GetPromise();
+}
+
+Napi::Value GTFSAddon::QueueSnapshotWorker(const Napi::CallbackInfo& info, SnapshotWorker::Mode mode) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsString()) {
+        Napi::TypeError::New(env, "Snapshot path (string) expected").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+
+    Logger logger = { nullptr, nullptr, false };
+    if (info.Length() > 1 && info[1].IsFunction()) {
+        logger.tsfn = Napi::ThreadSafeFunction::New(env, info[1].As<Napi::Function>(), "GTFSLogger", 0, 1);
+    }
+    if (info.Length() > 2 && info[2].IsBoolean()) {
+        logger.ansi = info[2].As<Napi::Boolean>().Value();
+    }
+
+    auto worker = new SnapshotWorker(env, info.This().As<Napi::Object>(), mode, info[0].As<Napi::String>().Utf8Value(), &generations, logger);
     worker->Queue();
     return worker->GetPromise();
 }
 
+Napi::Value GTFSAddon::SaveSnapshot(const Napi::CallbackInfo& info) {
+    return QueueSnapshotWorker(info, SnapshotWorker::Mode::Save);
+}
+
+Napi::Value GTFSAddon::LoadSnapshot(const Napi::CallbackInfo& info) {
+    return QueueSnapshotWorker(info, SnapshotWorker::Mode::Load);
+}
+
+// Maps the snapshot read-only instead of reading it; processes attaching the
+// same file share its pages
+Napi::Value GTFSAddon::AttachSnapshot(const Napi::CallbackInfo& info) {
+    return QueueSnapshotWorker(info, SnapshotWorker::Mode::Attach);
+}
+
 Napi::Value GTFSAddon::GetAgencies(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getAgencies"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
 
     Napi::Object filter;
     bool has_filter = false;
@@ -330,6 +1233,7 @@ Napi::Value GTFSAddon::GetAgencies(const Napi::CallbackInfo& info) {
         has_filter = true;
     }
 
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
     std::vector<const gtfs::Agency*> matches;
     matches.reserve(data.agencies.size());
 
@@ -379,6 +1283,9 @@ Napi::Value GTFSAddon::GetAgencies(const Napi::CallbackInfo& info) {
 
 Napi::Value GTFSAddon::GetRoutes(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getRoutes"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
 
     Napi::Object filter;
     bool has_filter = false;
@@ -387,76 +1294,40 @@ Napi::Value GTFSAddon::GetRoutes(const Napi::CallbackInfo& info) {
         has_filter = true;
     }
 
-    std::vector<const gtfs::Route*> matches;
-    matches.reserve(data.routes.size());
-
-    std::string feed_id_filter = "";
-    bool has_feed_id_filter = has_filter && filter.Has("feed_id");
-    if (has_feed_id_filter) feed_id_filter = filter.Get("feed_id").As<Napi::String>().Utf8Value();
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
 
-    auto check_route = [&](const gtfs::Route& r) -> bool {
-        if (has_filter) {
-            if (filter.Has("agency_id")) {
-                std::string v = filter.Get("agency_id").As<Napi::String>().Utf8Value();
-                if (!r.agency_id.has_value() || r.agency_id.value() != v) return false;
-            }
-            if (filter.Has("route_type")) {
-                int v = filter.Get("route_type").As<Napi::Number>().Int32Value();
-                if (r.route_type != v) return false;
-            }
-        }
-        return true;
+    // Filter values are compared as interned ids; one that was never interned matches nothing
+    uint32_t feed_id = gtfs::NO_STR, route_id = gtfs::NO_STR, agency_id = gtfs::NO_STR;
+    auto filter_id = [&](const char* key, uint32_t& out) {
+        if (!has_filter || !filter.Has(key)) return true;
+        out = data.string_pool.get_id(filter.Get(key).As<Napi::String>().Utf8Value());
+        return out != 0xFFFFFFFF;
     };
-
-    if (has_filter && filter.Has("route_id")) {
-        std::string id = filter.Get("route_id").As<Napi::String>().Utf8Value();
-        if (has_feed_id_filter) {
-            if (data.routes.count(feed_id_filter) && data.routes.at(feed_id_filter).count(id)) {
-                const auto& r = data.routes.at(feed_id_filter).at(id);
-                if (check_route(r)) matches.push_back(&r);
-            }
-        } else {
-            for (const auto& [fid, feed_map] : data.routes) {
-                if (feed_map.count(id)) {
-                    const auto& r = feed_map.at(id);
-                    if (check_route(r)) matches.push_back(&r);
-                }
-            }
-        }
-    } else {
-        for (const auto& [fid, feed_map] : data.routes) {
-            if (has_feed_id_filter && fid != feed_id_filter) continue;
-            for (const auto& [id, r] : feed_map) {
-                if (check_route(r)) matches.push_back(&r);
-            }
-        }
+    if (!filter_id("feed_id", feed_id) || !filter_id("route_id", route_id) || !filter_id("agency_id", agency_id)) {
+        return Napi::Array::New(env, 0);
     }
+    bool has_route_type = has_filter && filter.Has("route_type");
+    int route_type = has_route_type ? filter.Get("route_type").As<Napi::Number>().Int32Value() : 0;
 
-    Napi::Array arr = Napi::Array::New(env, matches.size());
-    for (size_t i = 0; i < matches.size(); ++i) {
-        const gtfs::Route& r = *matches[i];
-        Napi::Object obj = Napi::Object::New(env);
-        obj.Set("route_id", r.route_id);
-        if (r.agency_id.has_value()) obj.Set("agency_id", r.agency_id.value()); else obj.Set("agency_id", env.Null());
-        if (r.route_short_name.has_value()) obj.Set("route_short_name", r.route_short_name.value()); else obj.Set("route_short_name", env.Null());
-        if (r.route_long_name.has_value()) obj.Set("route_long_name", r.route_long_name.value()); else obj.Set("route_long_name", env.Null());
-        if (r.route_desc.has_value()) obj.Set("route_desc", r.route_desc.value()); else obj.Set("route_desc", env.Null());
-        obj.Set("route_type", r.route_type);
-        if (r.route_url.has_value()) obj.Set("route_url", r.route_url.value()); else obj.Set("route_url", env.Null());
-        if (r.route_color.has_value()) obj.Set("route_color", r.route_color.value()); else obj.Set("route_color", env.Null());
-        if (r.route_text_color.has_value()) obj.Set("route_text_color", r.route_text_color.value()); else obj.Set("route_text_color", env.Null());
-        if (r.continuous_pickup.has_value()) obj.Set("continuous_pickup", r.continuous_pickup.value()); else obj.Set("continuous_pickup", env.Null());
-        if (r.continuous_drop_off.has_value()) obj.Set("continuous_drop_off", r.continuous_drop_off.value()); else obj.Set("continuous_drop_off", env.Null());
-        if (r.route_sort_order.has_value()) obj.Set("route_sort_order", r.route_sort_order.value()); else obj.Set("route_sort_order", env.Null());
-        if (r.network_id.has_value()) obj.Set("network_id", r.network_id.value()); else obj.Set("network_id", env.Null());
-        obj.Set("feed_id", r.feed_id);
-        arr[i] = obj;
+    std::vector<uint32_t> rows = gtfs::collect_rows(data.routes, feed_id, route_id, [&](const gtfs::Route& r) {
+        if (agency_id != gtfs::NO_STR && r.agency_id != agency_id) return false;
+        if (has_route_type && r.route_type != route_type) return false;
+        return true;
+    });
+
+    PoolStrings str = Strings(env, generation);
+    Napi::Array arr = Napi::Array::New(env, rows.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        arr[i] = RouteToObject(env, data.routes[rows[i]], str);
     }
     return arr;
 }
 
 Napi::Value GTFSAddon::UpdateRealtime(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("updateRealtime"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
     if (info.Length() < 3) {
          Napi::TypeError::New(env, "Expected at least 3 arguments: alerts, tripUpdates, vehiclePositions").ThrowAsJavaScriptException();
          return env.Null();
@@ -467,102 +1338,107 @@ Napi::Value GTFSAddon::UpdateRealtime(const Napi::CallbackInfo& info) {
         feed_id = info[3].As<Napi::String>().Utf8Value();
     }
 
-    // If feed_id is provided, only clear updates for that feed.
-    // Otherwise, clear everything.
-    if (feed_id.empty()) {
-        data.realtime_trip_updates.clear();
-        data.realtime_vehicle_positions.clear();
-        data.realtime_alerts.clear();
-    } else {
-        data.realtime_trip_updates.erase(
-            std::remove_if(data.realtime_trip_updates.begin(), data.realtime_trip_updates.end(), [&](const gtfs::RealtimeTripUpdate& tu){ return tu.feed_id == feed_id; }),
-            data.realtime_trip_updates.end()
-        );
-        data.realtime_vehicle_positions.erase(
-            std::remove_if(data.realtime_vehicle_positions.begin(), data.realtime_vehicle_positions.end(), [&](const gtfs::RealtimeVehiclePosition& vp){ return vp.feed_id == feed_id; }),
-            data.realtime_vehicle_positions.end()
-        );
-        data.realtime_alerts.erase(
-            std::remove_if(data.realtime_alerts.begin(), data.realtime_alerts.end(), [&](const gtfs::RealtimeAlert& al){ return al.feed_id == feed_id; }),
-            data.realtime_alerts.end()
-        );
-    }
-
-    if (info[0].IsBuffer()) {
-        Napi::Buffer<unsigned char> buf = info[0].As<Napi::Buffer<unsigned char>>();
-        gtfs::parse_realtime_feed(data, buf.Data(), buf.Length(), 2, feed_id);
-    } else if (info[0].IsArray()) {
-        Napi::Array arr = info[0].As<Napi::Array>();
-        for(uint32_t i=0; i<arr.Length(); ++i) {
-             Napi::Value v = arr[i];
-             if(v.IsBuffer()) {
-                 Napi::Buffer<unsigned char> buf = v.As<Napi::Buffer<unsigned char>>();
-                 gtfs::parse_realtime_feed(data, buf.Data(), buf.Length(), 2, feed_id);
-             }
+    std::unique_lock<std::shared_mutex> lock(data.mutex);
+    gtfs::RealtimeFeed& feed = gtfs::realtime_feed_for_update(data, feed_id);
+    uint32_t feed_intern = feed_id.empty() ? gtfs::NO_STR : data.string_pool.intern(feed_id);
+
+    // Each buffer is merged into the feed's store in place; sources missing from
+    // this call are dropped afterwards
+    std::vector<uint32_t> sources;
+    auto apply = [&](const Napi::Value& arg, uint32_t kind) {
+        auto apply_buffer = [&](const Napi::Value& v, uint32_t index) {
+            if (!v.IsBuffer()) return;
+            Napi::Buffer<unsigned char> buf = v.As<Napi::Buffer<unsigned char>>();
+            uint32_t source = gtfs::realtime_source(kind, index);
+            sources.push_back(source);
+            gtfs::parse_realtime_feed(feed, data.string_pool, source, buf.Data(), buf.Length(), feed_intern);
+        };
+        if (arg.IsBuffer()) {
+            apply_buffer(arg, 0);
+        } else if (arg.IsArray()) {
+            Napi::Array arr = arg.As<Napi::Array>();
+            for (uint32_t i = 0; i < arr.Length(); ++i) {
+                Napi::Value v = arr[i];
+                apply_buffer(v, i);
+            }
         }
+    };
+    apply(info[0], gtfs::RT_ALERTS);
+    apply(info[1], gtfs::RT_TRIP_UPDATES);
+    apply(info[2], gtfs::RT_VEHICLE_POSITIONS);
+    gtfs::retain_realtime_sources(feed, sources);
+    gtfs::rebuild_realtime_indexes(data);
+
+    return env.Null();
+}
+
+// updateRealtimeAsync(alerts, tripUpdates, vehiclePositions, feed_id?): same merge as
+// updateRealtime, with decoding moved to worker threads
+Napi::Value GTFSAddon::UpdateRealtimeAsync(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 3) {
+         Napi::TypeError::New(env, "Expected at least 3 arguments: alerts, tripUpdates, vehiclePositions").ThrowAsJavaScriptException();
+         return env.Null();
     }
 
-    if (info[1].IsBuffer()) {
-        Napi::Buffer<unsigned char> buf = info[1].As<Napi::Buffer<unsigned char>>();
-        gtfs::parse_realtime_feed(data, buf.Data(), buf.Length(), 0, feed_id);
-    } else if (info[1].IsArray()) {
-        Napi::Array arr = info[1].As<Napi::Array>();
-        for(uint32_t i=0; i<arr.Length(); ++i) {
-             Napi::Value v = arr[i];
-             if(v.IsBuffer()) {
-                 Napi::Buffer<unsigned char> buf = v.As<Napi::Buffer<unsigned char>>();
-                 gtfs::parse_realtime_feed(data, buf.Data(), buf.Length(), 0, feed_id);
-             }
-        }
+    std::string feed_id = "";
+    if (info.Length() > 3 && info[3].IsString()) {
+        feed_id = info[3].As<Napi::String>().Utf8Value();
     }
 
-    if (info[2].IsBuffer()) {
-        Napi::Buffer<unsigned char> buf = info[2].As<Napi::Buffer<unsigned char>>();
-        gtfs::parse_realtime_feed(data, buf.Data(), buf.Length(), 1, feed_id);
-    } else if (info[2].IsArray()) {
-        Napi::Array arr = info[2].As<Napi::Array>();
-        for(uint32_t i=0; i<arr.Length(); ++i) {
-             Napi::Value v = arr[i];
-             if(v.IsBuffer()) {
-                 Napi::Buffer<unsigned char> buf = v.As<Napi::Buffer<unsigned char>>();
-                 gtfs::parse_realtime_feed(data, buf.Data(), buf.Length(), 1, feed_id);
-             }
+    std::vector<RealtimeWorker::Input> inputs;
+    std::vector<Napi::Reference<Napi::Buffer<unsigned char>>> bufferRefs;
+    auto collect = [&](const Napi::Value& arg, uint32_t kind) {
+        auto collect_buffer = [&](const Napi::Value& v, uint32_t index) {
+            if (!v.IsBuffer()) return;
+            Napi::Buffer<unsigned char> buf = v.As<Napi::Buffer<unsigned char>>();
+            bufferRefs.push_back(Napi::Persistent(buf));
+            inputs.push_back({ gtfs::realtime_source(kind, index), { buf.Data(), buf.Length() } });
+        };
+        if (arg.IsBuffer()) {
+            collect_buffer(arg, 0);
+        } else if (arg.IsArray()) {
+            Napi::Array arr = arg.As<Napi::Array>();
+            for (uint32_t i = 0; i < arr.Length(); ++i) {
+                Napi::Value v = arr[i];
+                collect_buffer(v, i);
+            }
         }
-    }
+    };
+    collect(info[0], gtfs::RT_ALERTS);
+    collect(info[1], gtfs::RT_TRIP_UPDATES);
+    collect(info[2], gtfs::RT_VEHICLE_POSITIONS);
 
-    return env.Null();
+    auto worker = new RealtimeWorker(env, info.This().As<Napi::Object>(), metrics.get("updateRealtimeAsync"), &generations, std::move(feed_id), std::move(inputs), std::move(bufferRefs));
+    worker->Queue();
+    return worker->GetPromise();
 }
 
 Napi::Value GTFSAddon::ClearRealtime(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
     std::string feed_id = "";
     if (info.Length() > 0 && info[0].IsString()) {
         feed_id = info[0].As<Napi::String>().Utf8Value();
     }
 
+    std::unique_lock<std::shared_mutex> lock(data.mutex);
+
     if (feed_id.empty()) {
-        data.realtime_trip_updates.clear();
-        data.realtime_vehicle_positions.clear();
-        data.realtime_alerts.clear();
+        data.realtime.clear();
     } else {
-        data.realtime_trip_updates.erase(
-            std::remove_if(data.realtime_trip_updates.begin(), data.realtime_trip_updates.end(), [&](const gtfs::RealtimeTripUpdate& tu){ return tu.feed_id == feed_id; }),
-            data.realtime_trip_updates.end()
-        );
-        data.realtime_vehicle_positions.erase(
-            std::remove_if(data.realtime_vehicle_positions.begin(), data.realtime_vehicle_positions.end(), [&](const gtfs::RealtimeVehiclePosition& vp){ return vp.feed_id == feed_id; }),
-            data.realtime_vehicle_positions.end()
-        );
-        data.realtime_alerts.erase(
-            std::remove_if(data.realtime_alerts.begin(), data.realtime_alerts.end(), [&](const gtfs::RealtimeAlert& al){ return al.feed_id == feed_id; }),
-            data.realtime_alerts.end()
-        );
+        data.realtime.erase(feed_id);
     }
+    gtfs::rebuild_realtime_indexes(data);
     return env.Null();
 }
 
 Napi::Value GTFSAddon::GetRealtimeTripUpdates(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getRealtimeTripUpdates"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
     
     Napi::Object filter;
     bool has_filter = false;
@@ -571,15 +1447,28 @@ Napi::Value GTFSAddon::GetRealtimeTripUpdates(const Napi::CallbackInfo& info) {
         has_filter = true;
     }
 
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
+    PoolStrings str = Strings(env, generation);
+
+    std::optional<uint32_t> feed_id, trip_id, route_id;
+    if (!RealtimeFilterId(filter, has_filter, "feed_id", data.string_pool, feed_id) ||
+        !RealtimeFilterId(filter, has_filter, "trip_id", data.string_pool, trip_id) ||
+        !RealtimeFilterId(filter, has_filter, "route_id", data.string_pool, route_id)) {
+        return Napi::Array::New(env, 0);
+    }
+    std::optional<std::string> vehicle_id;
+    RealtimeFilterText(filter, has_filter, "vehicle_id", vehicle_id);
+
     std::vector<const gtfs::RealtimeTripUpdate*> matches;
-    for (const auto& tu : data.realtime_trip_updates) {
-        if (has_filter) {
-            if (filter.Has("feed_id") && tu.feed_id != filter.Get("feed_id").As<Napi::String>().Utf8Value()) continue;
-            if (filter.Has("trip_id") && tu.trip.trip_id != filter.Get("trip_id").As<Napi::String>().Utf8Value()) continue;
-            if (filter.Has("route_id") && tu.trip.route_id != filter.Get("route_id").As<Napi::String>().Utf8Value()) continue;
-            if (filter.Has("vehicle_id") && tu.vehicle.id != filter.Get("vehicle_id").As<Napi::String>().Utf8Value()) continue;
-        }
+    auto consider = [&](const gtfs::RealtimeTripUpdate& tu) {
+        if (!RealtimeFilterMatch(feed_id, tu.feed_id) || !RealtimeFilterMatch(trip_id, tu.trip.trip_id) ||
+            !RealtimeFilterMatch(route_id, tu.trip.route_id) || !RealtimeFilterMatch(vehicle_id, tu.vehicle.id)) return;
         matches.push_back(&tu);
+    };
+    if (trip_id && *trip_id != gtfs::NO_STR) {
+        for (const gtfs::RealtimeTripRef& ref : data.realtime_join.find(*trip_id)) consider(*ref.update);
+    } else {
+        for (const auto& [feed_key, feed] : data.realtime) for (const auto& entry : feed.trip_updates) consider(entry.value);
     }
 
     Napi::Array arr = Napi::Array::New(env, matches.size());
@@ -587,28 +1476,27 @@ Napi::Value GTFSAddon::GetRealtimeTripUpdates(const Napi::CallbackInfo& info) {
         const auto& tu = *matches[i];
         Napi::Object obj = Napi::Object::New(env);
 
-        obj.Set("update_id", tu.update_id);
+        obj.Set("update_id", Text(env, tu.update_id));
         obj.Set("is_deleted", tu.is_deleted);
 
         Napi::Object trip = Napi::Object::New(env);
-        trip.Set("trip_id", tu.trip.trip_id);
-        trip.Set("route_id", tu.trip.route_id);
+        trip.Set("trip_id", str(tu.trip.trip_id));
+        trip.Set("route_id", str(tu.trip.route_id));
 
         if (tu.trip.direction_id != -1) trip.Set("direction_id", tu.trip.direction_id);
         else trip.Set("direction_id", env.Null());
 
-        trip.Set("start_time", tu.trip.start_time);
-        if (!tu.trip.start_date.empty()) trip.Set("start_date", tu.trip.start_date);
-        else trip.Set("start_date", env.Null());
+        trip.Set("start_time", Text(env, tu.trip.start_time));
+        SetText(env, trip, "start_date", tu.trip.start_date);
 
         trip.Set("schedule_relationship", tu.trip.schedule_relationship);
 
         obj.Set("trip", trip);
 
         Napi::Object vehicle = Napi::Object::New(env);
-        vehicle.Set("id", tu.vehicle.id);
-        vehicle.Set("label", tu.vehicle.label);
-        vehicle.Set("license_plate", tu.vehicle.license_plate);
+        vehicle.Set("id", Text(env, tu.vehicle.id));
+        vehicle.Set("label", Text(env, tu.vehicle.label));
+        vehicle.Set("license_plate", Text(env, tu.vehicle.license_plate));
         obj.Set("vehicle", vehicle);
 
         Napi::Array stus = Napi::Array::New(env, tu.stop_time_updates.size());
@@ -618,12 +1506,10 @@ Napi::Value GTFSAddon::GetRealtimeTripUpdates(const Napi::CallbackInfo& info) {
             if (stu.stop_sequence != -1) stu_obj.Set("stop_sequence", stu.stop_sequence);
             else stu_obj.Set("stop_sequence", env.Null());
 
-            stu_obj.Set("stop_id", stu.stop_id);
-            stu_obj.Set("trip_id", stu.trip_id);
-            if (!stu.start_date.empty()) stu_obj.Set("start_date", stu.start_date);
-            else stu_obj.Set("start_date", env.Null());
-            if (!stu.start_time.empty()) stu_obj.Set("start_time", stu.start_time);
-            else stu_obj.Set("start_time", env.Null());
+            stu_obj.Set("stop_id", str(stu.stop_id));
+            stu_obj.Set("trip_id", str(stu.trip_id));
+            SetText(env, stu_obj, "start_date", stu.start_date);
+            SetText(env, stu_obj, "start_time", stu.start_time);
 
             if (stu.arrival_delay != -2147483648) stu_obj.Set("arrival_delay", stu.arrival_delay);
             else stu_obj.Set("arrival_delay", env.Null());
@@ -644,7 +1530,7 @@ Napi::Value GTFSAddon::GetRealtimeTripUpdates(const Napi::CallbackInfo& info) {
             else stu_obj.Set("departure_uncertainty", env.Null());
 
             stu_obj.Set("schedule_relationship", stu.schedule_relationship);
-            stu_obj.Set("feed_id", stu.feed_id);
+            stu_obj.Set("feed_id", str(stu.feed_id));
 
             stus[j] = stu_obj;
         }
@@ -655,7 +1541,7 @@ Napi::Value GTFSAddon::GetRealtimeTripUpdates(const Napi::CallbackInfo& info) {
 
         if (tu.delay != -2147483648) obj.Set("delay", tu.delay);
         else obj.Set("delay", env.Null());
-        obj.Set("feed_id", tu.feed_id);
+        obj.Set("feed_id", str(tu.feed_id));
 
         arr[i] = obj;
     }
@@ -664,6 +1550,9 @@ Napi::Value GTFSAddon::GetRealtimeTripUpdates(const Napi::CallbackInfo& info) {
 
 Napi::Value GTFSAddon::GetRealtimeVehiclePositions(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getRealtimeVehiclePositions"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
 
     Napi::Object filter;
     bool has_filter = false;
@@ -672,90 +1561,86 @@ Napi::Value GTFSAddon::GetRealtimeVehiclePositions(const Napi::CallbackInfo& inf
         has_filter = true;
     }
 
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
+    PoolStrings str = Strings(env, generation);
+
+    std::optional<uint32_t> feed_id, trip_id, route_id, stop_id;
+    if (!RealtimeFilterId(filter, has_filter, "feed_id", data.string_pool, feed_id) ||
+        !RealtimeFilterId(filter, has_filter, "trip_id", data.string_pool, trip_id) ||
+        !RealtimeFilterId(filter, has_filter, "route_id", data.string_pool, route_id) ||
+        !RealtimeFilterId(filter, has_filter, "stop_id", data.string_pool, stop_id)) {
+        return Napi::Array::New(env, 0);
+    }
+    std::optional<std::string> vehicle_id;
+    RealtimeFilterText(filter, has_filter, "vehicle_id", vehicle_id);
+
     std::vector<const gtfs::RealtimeVehiclePosition*> matches;
-    for (const auto& vp : data.realtime_vehicle_positions) {
-        if (has_filter) {
-            if (filter.Has("feed_id") && vp.feed_id != filter.Get("feed_id").As<Napi::String>().Utf8Value()) continue;
-            if (filter.Has("trip_id") && vp.trip.trip_id != filter.Get("trip_id").As<Napi::String>().Utf8Value()) continue;
-            if (filter.Has("route_id") && vp.trip.route_id != filter.Get("route_id").As<Napi::String>().Utf8Value()) continue;
-            if (filter.Has("vehicle_id") && vp.vehicle.id != filter.Get("vehicle_id").As<Napi::String>().Utf8Value()) continue;
-            if (filter.Has("stop_id") && vp.stop_id != filter.Get("stop_id").As<Napi::String>().Utf8Value()) continue;
-        }
+    for (const auto& [feed_key, feed] : data.realtime) for (const auto& entry : feed.vehicle_positions) {
+        const gtfs::RealtimeVehiclePosition& vp = entry.value;
+        if (!RealtimeFilterMatch(feed_id, vp.feed_id) || !RealtimeFilterMatch(trip_id, vp.trip.trip_id) ||
+            !RealtimeFilterMatch(route_id, vp.trip.route_id) || !RealtimeFilterMatch(vehicle_id, vp.vehicle.id) ||
+            !RealtimeFilterMatch(stop_id, vp.stop_id)) continue;
         matches.push_back(&vp);
     }
 
     Napi::Array arr = Napi::Array::New(env, matches.size());
     for (size_t i = 0; i < matches.size(); ++i) {
-        const auto& vp = *matches[i];
-        Napi::Object obj = Napi::Object::New(env);
-
-        obj.Set("update_id", vp.update_id);
-        obj.Set("is_deleted", vp.is_deleted);
-
-        Napi::Object trip = Napi::Object::New(env);
-        trip.Set("trip_id", vp.trip.trip_id);
-        trip.Set("route_id", vp.trip.route_id);
-
-        if (vp.trip.direction_id != -1) trip.Set("direction_id", vp.trip.direction_id);
-        else trip.Set("direction_id", env.Null());
-
-        trip.Set("start_time", vp.trip.start_time);
-        if (!vp.trip.start_date.empty()) trip.Set("start_date", vp.trip.start_date);
-        else trip.Set("start_date", env.Null());
-
-        trip.Set("schedule_relationship", vp.trip.schedule_relationship);
-
-        obj.Set("trip", trip);
-
-        Napi::Object vehicle = Napi::Object::New(env);
-        vehicle.Set("id", vp.vehicle.id);
-        vehicle.Set("label", vp.vehicle.label);
-        vehicle.Set("license_plate", vp.vehicle.license_plate);
-        obj.Set("vehicle", vehicle);
-
-        Napi::Object position = Napi::Object::New(env);
-        position.Set("latitude", vp.position.latitude);
-        position.Set("longitude", vp.position.longitude);
-
-        if (vp.position.bearing != -1.0f) position.Set("bearing", vp.position.bearing);
-        else position.Set("bearing", env.Null());
-
-        if (vp.position.odometer != -1.0) position.Set("odometer", vp.position.odometer);
-        else position.Set("odometer", env.Null());
-
-        if (vp.position.speed != -1.0f) position.Set("speed", vp.position.speed);
-        else position.Set("speed", env.Null());
-
-        obj.Set("position", position);
-
-        if (vp.current_stop_sequence != -1) obj.Set("current_stop_sequence", vp.current_stop_sequence);
-        else obj.Set("current_stop_sequence", env.Null());
-
-        obj.Set("stop_id", vp.stop_id);
-
-        if (vp.current_status != -1) obj.Set("current_status", vp.current_status);
-        else obj.Set("current_status", env.Null());
-
-        if (vp.timestamp != 0) obj.Set("timestamp", (double)vp.timestamp);
-        else obj.Set("timestamp", env.Null());
-
-        if (vp.congestion_level != -1) obj.Set("congestion_level", vp.congestion_level);
-        else obj.Set("congestion_level", env.Null());
+        arr[i] = VehiclePositionToObject(env, *matches[i], str);
+    }
+    return arr;
+}
 
-        if (vp.occupancy_status != -1) obj.Set("occupancy_status", vp.occupancy_status);
-        else obj.Set("occupancy_status", env.Null());
+// getVehiclesInBBox(min_lat, min_lon, max_lat, max_lon): realtime vehicle positions inside the box
+Napi::Value GTFSAddon::GetVehiclesInBBox(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getVehiclesInBBox"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
+    if (info.Length() < 4 || !info[0].IsNumber() || !info[1].IsNumber() || !info[2].IsNumber() || !info[3].IsNumber()) {
+        Napi::TypeError::New(env, "Expected min_lat, min_lon, max_lat and max_lon (numbers)").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    double min_lat = info[0].As<Napi::Number>().DoubleValue();
+    double min_lon = info[1].As<Napi::Number>().DoubleValue();
+    double max_lat = info[2].As<Napi::Number>().DoubleValue();
+    double max_lon = info[3].As<Napi::Number>().DoubleValue();
 
-        if (vp.occupancy_percentage != -1) obj.Set("occupancy_percentage", vp.occupancy_percentage);
-        else obj.Set("occupancy_percentage", env.Null());
-        obj.Set("feed_id", vp.feed_id);
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
+    std::vector<uint32_t> matches = gtfs::collect_in_bbox(data.vehicles_by_location, min_lat, min_lon, max_lat, max_lon, [&](uint32_t i, double& lat, double& lon) {
+        lat = data.vehicles[i]->position.latitude;
+        lon = data.vehicles[i]->position.longitude;
+        return true;
+    });
 
-        arr[i] = obj;
+    PoolStrings str = Strings(env, generation);
+    Napi::Array arr = Napi::Array::New(env, matches.size());
+    for (size_t i = 0; i < matches.size(); ++i) {
+        arr[i] = VehiclePositionToObject(env, *data.vehicles[matches[i]], str);
     }
     return arr;
 }
 
+// getVehicleProgress(): every realtime vehicle snapped onto the shape of its
+// trip, as typed arrays; update_id and vehicle_id are strings, the other string
+// columns string table ids
+Napi::Value GTFSAddon::GetVehicleProgress(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getVehicleProgress"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
+    if (!LoadLazyFile(env, generation, "shapes.txt")) return env.Null();
+
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
+    gtfs::VehicleProgressColumns columns;
+    gtfs::fill_vehicle_progress_columns(data, columns);
+    return VehicleProgressColumnsToObject(env, std::move(columns));
+}
+
 Napi::Value GTFSAddon::GetRealtimeAlerts(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getRealtimeAlerts"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
 
     Napi::Object filter;
     bool has_filter = false;
@@ -764,11 +1649,18 @@ Napi::Value GTFSAddon::GetRealtimeAlerts(const Napi::CallbackInfo& info) {
         has_filter = true;
     }
 
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
+    PoolStrings str = Strings(env, generation);
+
+    std::optional<uint32_t> feed_id;
+    if (!RealtimeFilterId(filter, has_filter, "feed_id", data.string_pool, feed_id)) {
+        return Napi::Array::New(env, 0);
+    }
+
     std::vector<const gtfs::RealtimeAlert*> matches;
-    for (const auto& a : data.realtime_alerts) {
-        if (has_filter) {
-            if (filter.Has("feed_id") && a.feed_id != filter.Get("feed_id").As<Napi::String>().Utf8Value()) continue;
-        }
+    for (const auto& [feed_key, feed] : data.realtime) for (const auto& entry : feed.alerts) {
+        const gtfs::RealtimeAlert& a = entry.value;
+        if (!RealtimeFilterMatch(feed_id, a.feed_id)) continue;
         matches.push_back(&a);
     }
 
@@ -777,7 +1669,7 @@ Napi::Value GTFSAddon::GetRealtimeAlerts(const Napi::CallbackInfo& info) {
         const auto& a = *matches[i];
         Napi::Object obj = Napi::Object::New(env);
 
-        obj.Set("update_id", a.update_id);
+        obj.Set("update_id", Text(env, a.update_id));
         obj.Set("is_deleted", a.is_deleted);
 
         if (a.cause != -1) obj.Set("cause", a.cause);
@@ -792,7 +1684,7 @@ Napi::Value GTFSAddon::GetRealtimeAlerts(const Napi::CallbackInfo& info) {
 
         if (a.severity_level != -1) obj.Set("severity_level", a.severity_level);
         else obj.Set("severity_level", env.Null());
-        obj.Set("feed_id", a.feed_id);
+        obj.Set("feed_id", str(a.feed_id));
 
         arr[i] = obj;
     }
@@ -801,6 +1693,9 @@ Napi::Value GTFSAddon::GetRealtimeAlerts(const Napi::CallbackInfo& info) {
 
 Napi::Value GTFSAddon::GetStops(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getStops"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
 
     Napi::Object filter;
     bool has_filter = false;
@@ -809,273 +1704,530 @@ Napi::Value GTFSAddon::GetStops(const Napi::CallbackInfo& info) {
         has_filter = true;
     }
 
-    std::vector<const gtfs::Stop*> matches;
-    matches.reserve(data.stops.size());
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
 
-    std::string feed_id_filter = "";
-    bool has_feed_id_filter = has_filter && filter.Has("feed_id");
-    if (has_feed_id_filter) feed_id_filter = filter.Get("feed_id").As<Napi::String>().Utf8Value();
+    uint32_t feed_id = gtfs::NO_STR, stop_id = gtfs::NO_STR, stop_name = gtfs::NO_STR, zone_id = gtfs::NO_STR, parent_station = gtfs::NO_STR;
+    auto filter_id = [&](const char* key, uint32_t& out) {
+        if (!has_filter || !filter.Has(key)) return true;
+        out = data.string_pool.get_id(filter.Get(key).As<Napi::String>().Utf8Value());
+        return out != 0xFFFFFFFF;
+    };
+    if (!filter_id("feed_id", feed_id) || !filter_id("stop_id", stop_id) || !filter_id("stop_name", stop_name) ||
+        !filter_id("zone_id", zone_id) || !filter_id("parent_station", parent_station)) {
+        return Napi::Array::New(env, 0);
+    }
 
-    auto check_stop = [&](const gtfs::Stop& s) -> bool {
-        if (has_filter) {
-            if (filter.Has("stop_name")) {
-                std::string v = filter.Get("stop_name").As<Napi::String>().Utf8Value();
-                if (s.stop_name != v) return false;
-            }
-            if (filter.Has("zone_id")) {
-                std::string v = filter.Get("zone_id").As<Napi::String>().Utf8Value();
-                if (!s.zone_id.has_value() || s.zone_id.value() != v) return false;
-            }
-            if (filter.Has("parent_station")) {
-                std::string v = filter.Get("parent_station").As<Napi::String>().Utf8Value();
-                if (!s.parent_station.has_value() || s.parent_station.value() != v) return false;
-            }
-        }
+    std::vector<uint32_t> rows = gtfs::collect_rows(data.stops, feed_id, stop_id, [&](const gtfs::Stop& s) {
+        if (stop_name != gtfs::NO_STR && s.stop_name != stop_name) return false;
+        if (zone_id != gtfs::NO_STR && s.zone_id != zone_id) return false;
+        if (parent_station != gtfs::NO_STR && s.parent_station != parent_station) return false;
         return true;
-    };
+    });
 
-    if (has_filter && filter.Has("stop_id")) {
-        std::string id = filter.Get("stop_id").As<Napi::String>().Utf8Value();
-        if (has_feed_id_filter) {
-            if (data.stops.count(feed_id_filter) && data.stops.at(feed_id_filter).count(id)) {
-                const auto& s = data.stops.at(feed_id_filter).at(id);
-                if (check_stop(s)) matches.push_back(&s);
-            }
-        } else {
-            for (const auto& [fid, feed_map] : data.stops) {
-                if (feed_map.count(id)) {
-                    const auto& s = feed_map.at(id);
-                    if (check_stop(s)) matches.push_back(&s);
-                }
-            }
-        }
-    } else {
-        for (const auto& [fid, feed_map] : data.stops) {
-            if (has_feed_id_filter && fid != feed_id_filter) continue;
-            for (const auto& [id, s] : feed_map) {
-                if (check_stop(s)) matches.push_back(&s);
-            }
-        }
+    PoolStrings str = Strings(env, generation);
+    Napi::Array arr = Napi::Array::New(env, rows.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        arr[i] = StopToObject(env, data.stops[rows[i]], str);
+    }
+    return arr;
+}
+
+// getStopsNear(lat, lon, radius, limit?): stops within radius meters, nearest first,
+// each with its distance
+Napi::Value GTFSAddon::GetStopsNear(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getStopsNear"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
+    if (info.Length() < 3 || !info[0].IsNumber() || !info[1].IsNumber() || !info[2].IsNumber()) {
+        Napi::TypeError::New(env, "Expected lat (number), lon (number) and radius (number)").ThrowAsJavaScriptException();
+        return env.Null();
     }
+    double lat = info[0].As<Napi::Number>().DoubleValue();
+    double lon = info[1].As<Napi::Number>().DoubleValue();
+    double radius = info[2].As<Napi::Number>().DoubleValue();
+    size_t limit = 0;
+    if (info.Length() > 3 && info[3].IsNumber()) limit = static_cast<size_t>(std::max(0, info[3].As<Napi::Number>().Int32Value()));
 
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
+    std::vector<gtfs::NearbyMatch> matches = gtfs::collect_near(data.stops_by_location, lat, lon, radius, limit, [&](uint32_t row, double& plat, double& plon) {
+        plat = data.stops[row].stop_lat;
+        plon = data.stops[row].stop_lon;
+        return true;
+    });
+
+    PoolStrings str = Strings(env, generation);
     Napi::Array arr = Napi::Array::New(env, matches.size());
     for (size_t i = 0; i < matches.size(); ++i) {
-        const gtfs::Stop& s = *matches[i];
-        Napi::Object obj = Napi::Object::New(env);
-        obj.Set("stop_id", s.stop_id);
-        if (s.stop_code.has_value()) obj.Set("stop_code", s.stop_code.value()); else obj.Set("stop_code", env.Null());
-        obj.Set("stop_name", s.stop_name);
-        if (s.stop_desc.has_value()) obj.Set("stop_desc", s.stop_desc.value()); else obj.Set("stop_desc", env.Null());
-        if (s.stop_lat.has_value()) obj.Set("stop_lat", s.stop_lat.value()); else obj.Set("stop_lat", env.Null());
-        if (s.stop_lon.has_value()) obj.Set("stop_lon", s.stop_lon.value()); else obj.Set("stop_lon", env.Null());
-        if (s.zone_id.has_value()) obj.Set("zone_id", s.zone_id.value()); else obj.Set("zone_id", env.Null());
-        if (s.stop_url.has_value()) obj.Set("stop_url", s.stop_url.value()); else obj.Set("stop_url", env.Null());
-        if (s.location_type.has_value()) obj.Set("location_type", s.location_type.value()); else obj.Set("location_type", env.Null());
-        if (s.parent_station.has_value()) obj.Set("parent_station", s.parent_station.value()); else obj.Set("parent_station", env.Null());
-        if (s.stop_timezone.has_value()) obj.Set("stop_timezone", s.stop_timezone.value()); else obj.Set("stop_timezone", env.Null());
-        if (s.wheelchair_boarding.has_value()) obj.Set("wheelchair_boarding", s.wheelchair_boarding.value()); else obj.Set("wheelchair_boarding", env.Null());
-        if (s.level_id.has_value()) obj.Set("level_id", s.level_id.value()); else obj.Set("level_id", env.Null());
-        if (s.platform_code.has_value()) obj.Set("platform_code", s.platform_code.value()); else obj.Set("platform_code", env.Null());
-        if (s.tts_stop_name.has_value()) obj.Set("tts_stop_name", s.tts_stop_name.value()); else obj.Set("tts_stop_name", env.Null());
-        obj.Set("feed_id", s.feed_id);
+        Napi::Object obj = StopToObject(env, data.stops[matches[i].item], str);
+        obj.Set("distance", matches[i].distance);
         arr[i] = obj;
     }
     return arr;
 }
 
-Napi::Value GTFSAddon::GetStopTimes(const Napi::CallbackInfo& info) {
+// Parses a StopTimeQuery object; returns false when an id in it is unknown, so nothing can match
+bool GTFSAddon::ParseStopTimeFilter(const gtfs::GTFSData& data, const Napi::Object& config, gtfs::StopTimeFilter& f) {
+    if (config.Has("trip_id") && config.Get("trip_id").IsString()) {
+        f.trip_id = data.string_pool.get_id(config.Get("trip_id").As<Napi::String>().Utf8Value());
+        if (f.trip_id == 0xFFFFFFFF) return false;
+        f.has_trip_id = true;
+    }
+
+    if (config.Has("stop_id") && config.Get("stop_id").IsString()) {
+        f.stop_id = data.string_pool.get_id(config.Get("stop_id").As<Napi::String>().Utf8Value());
+        if (f.stop_id == 0xFFFFFFFF) return false;
+        f.has_stop_id = true;
+    }
+
+    if (config.Has("start_time")) {
+        Napi::Value v = config.Get("start_time");
+        if (v.IsNumber()) f.start_time = v.As<Napi::Number>().Int32Value();
+        else if (v.IsString()) f.start_time = gtfs::parse_time_seconds(v.As<Napi::String>().Utf8Value());
+    }
+    if (config.Has("end_time")) {
+        Napi::Value v = config.Get("end_time");
+        if (v.IsNumber()) f.end_time = v.As<Napi::Number>().Int32Value();
+        else if (v.IsString()) f.end_time = gtfs::parse_time_seconds(v.As<Napi::String>().Utf8Value());
+    }
+
+    if (config.Has("date") && config.Get("date").IsString()) {
+        f.day = gtfs::parse_date_days(config.Get("date").As<Napi::String>().Utf8Value());
+    }
+
+    if (config.Has("dateMode") && config.Get("dateMode").IsString()) {
+        f.timestamp_mode = (config.Get("dateMode").As<Napi::String>().Utf8Value() == "timestamp");
+    }
+
+    f.has_feed_id = config.Has("feed_id") && config.Get("feed_id").IsString();
+    if (f.has_feed_id) {
+        f.feed_id = data.string_pool.get_id(config.Get("feed_id").As<Napi::String>().Utf8Value());
+    }
+    return true;
+}
+
+Napi::Value GTFSAddon::GetStopTimes(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getStopTimes"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
+    if (info.Length() < 1 || !info[0].IsObject()) {
+        Napi::TypeError::New(env, "Configuration object expected").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
+    gtfs::StopTimeFilter filter;
+    if (!ParseStopTimeFilter(data, info[0].As<Napi::Object>(), filter)) return Napi::Array::New(env, 0);
+
+    std::vector<gtfs::StopTimeMatch> results = gtfs::collect_stop_times(data, filter);
+
+    PoolStrings str = Strings(env, generation);
+    gtfs::StopTimeRows stop_times = data.stop_time_rows();
+    Napi::Array arr = Napi::Array::New(env, results.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+        arr[i] = StopTimeToObject(env, stop_times[results[i].row], str);
+    }
+    return arr;
+}
+
+// getStopTimes rows plus the prediction of the matching trip update. utc_offset
+// (seconds east of UTC) lets updates that only give absolute times yield delays.
+Napi::Value GTFSAddon::GetStopTimesWithRealtime(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getStopTimesWithRealtime"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
     if (info.Length() < 1 || !info[0].IsObject()) {
         Napi::TypeError::New(env, "Configuration object expected").ThrowAsJavaScriptException();
         return env.Null();
     }
-
     Napi::Object config = info[0].As<Napi::Object>();
-    
-    bool has_trip_id = false;
-    uint32_t filter_trip_id = 0xFFFFFFFF;
-    if (config.Has("trip_id") && config.Get("trip_id").IsString()) {
-        std::string s = config.Get("trip_id").As<Napi::String>().Utf8Value();
-        filter_trip_id = data.string_pool.get_id(s);
-        if (filter_trip_id == 0xFFFFFFFF) return Napi::Array::New(env, 0);
-        has_trip_id = true;
-    }
 
-    bool has_stop_id = false;
-    uint32_t filter_stop_id = 0xFFFFFFFF;
-    if (config.Has("stop_id") && config.Get("stop_id").IsString()) {
-        std::string s = config.Get("stop_id").As<Napi::String>().Utf8Value();
-        filter_stop_id = data.string_pool.get_id(s);
-        if (filter_stop_id == 0xFFFFFFFF) return Napi::Array::New(env, 0);
-        has_stop_id = true;
+    std::optional<int32_t> utc_offset;
+    if (config.Has("utc_offset") && config.Get("utc_offset").IsNumber()) {
+        utc_offset = config.Get("utc_offset").As<Napi::Number>().Int32Value();
     }
 
-    int filter_start_time = -1;
-    int filter_end_time = -1;
-    if (config.Has("start_time")) {
-        Napi::Value v = config.Get("start_time");
-        if (v.IsNumber()) filter_start_time = v.As<Napi::Number>().Int32Value();
-        else if (v.IsString()) filter_start_time = gtfs::parse_time_seconds(v.As<Napi::String>().Utf8Value());
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
+    gtfs::StopTimeFilter filter;
+    if (!ParseStopTimeFilter(data, config, filter)) return Napi::Array::New(env, 0);
+
+    std::vector<gtfs::RealtimeStopTimeMatch> results = gtfs::collect_stop_times_with_realtime(data, filter, utc_offset);
+
+    PoolStrings str = Strings(env, generation);
+    auto set_time = [&](Napi::Object& obj, const char* key, int64_t v) {
+        if (v != -1) obj.Set(key, (double)v);
+        else obj.Set(key, env.Null());
+    };
+    auto set_predicted = [&](Napi::Object& obj, const char* delay_key, const char* time_key, int32_t scheduled, int32_t delay) {
+        if (delay == gtfs::NO_DELAY) {
+            obj.Set(delay_key, env.Null());
+            obj.Set(time_key, env.Null());
+            return;
+        }
+        obj.Set(delay_key, delay);
+        if (scheduled != gtfs::ST_NO_TIME) obj.Set(time_key, scheduled + delay);
+        else obj.Set(time_key, env.Null());
+    };
+
+    Napi::Array arr = Napi::Array::New(env, results.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+        const gtfs::RealtimeStopTimeMatch& m = results[i];
+        const gtfs::StopTime st = data.stop_time_rows()[m.row];
+        Napi::Object obj = StopTimeToObject(env, st, str);
+        obj.Set("has_realtime", m.has_trip_update);
+        obj.Set("has_stop_update", m.has_stop_update);
+        obj.Set("skipped", m.skipped);
+        set_predicted(obj, "arrival_delay", "predicted_arrival_time", st.arrival_time, m.arrival_delay);
+        set_predicted(obj, "departure_delay", "predicted_departure_time", st.departure_time, m.departure_delay);
+        set_time(obj, "arrival_timestamp", m.arrival_timestamp);
+        set_time(obj, "departure_timestamp", m.departure_timestamp);
+        arr[i] = obj;
     }
-    if (config.Has("end_time")) {
-        Napi::Value v = config.Get("end_time");
-        if (v.IsNumber()) filter_end_time = v.As<Napi::Number>().Int32Value();
-        else if (v.IsString()) filter_end_time = gtfs::parse_time_seconds(v.As<Napi::String>().Utf8Value());
+    return arr;
+}
+
+// getDepartures({stop_id, include_children?, date?, after?, before?, limit?, feed_id?, utc_offset?}):
+// the next `limit` departures in time order, with trip, route and realtime fields
+Napi::Value GTFSAddon::GetDepartures(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getDepartures"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
+    if (info.Length() < 1 || !info[0].IsObject() || !info[0].As<Napi::Object>().Get("stop_id").IsString()) {
+        Napi::TypeError::New(env, "Expected a query object with stop_id").ThrowAsJavaScriptException();
+        return env.Null();
     }
-    bool has_time_window = (filter_start_time != -1 && filter_end_time != -1);
+    Napi::Object config = info[0].As<Napi::Object>();
 
-    std::string filter_date;
-    bool has_date = false;
-    int date_wday = -1;
+    auto time_arg = [&](const char* key, int32_t fallback) {
+        if (!config.Has(key)) return fallback;
+        Napi::Value v = config.Get(key);
+        if (v.IsNumber()) return v.As<Napi::Number>().Int32Value();
+        if (v.IsString()) return gtfs::parse_time_seconds(v.As<Napi::String>().Utf8Value());
+        return fallback;
+    };
+
+    gtfs::DepartureQuery q;
+    q.include_children = config.Has("include_children") && config.Get("include_children").ToBoolean();
     if (config.Has("date") && config.Get("date").IsString()) {
-        filter_date = config.Get("date").As<Napi::String>().Utf8Value();
-        date_wday = GetDayOfWeek(filter_date);
-        has_date = (date_wday != -1); 
+        q.day = gtfs::parse_date_days(config.Get("date").As<Napi::String>().Utf8Value());
+    }
+    q.after = std::max(0, time_arg("after", 0));
+    q.before = time_arg("before", -1);
+    if (config.Has("limit") && config.Get("limit").IsNumber()) {
+        q.limit = static_cast<size_t>(std::max(0, config.Get("limit").As<Napi::Number>().Int32Value()));
+    }
+    std::optional<int32_t> utc_offset;
+    if (config.Has("utc_offset") && config.Get("utc_offset").IsNumber()) {
+        utc_offset = config.Get("utc_offset").As<Napi::Number>().Int32Value();
     }
 
-    std::string dateMode = "gtfs_date";
-    if (config.Has("dateMode") && config.Get("dateMode").IsString()) {
-        dateMode = config.Get("dateMode").As<Napi::String>().Utf8Value();
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
+    q.stop_id = data.string_pool.get_id(config.Get("stop_id").As<Napi::String>().Utf8Value());
+    if (q.stop_id == 0xFFFFFFFF) return Napi::Array::New(env, 0);
+    if (config.Has("feed_id") && config.Get("feed_id").IsString()) {
+        q.feed_id = data.string_pool.get_id(config.Get("feed_id").As<Napi::String>().Utf8Value());
+        if (q.feed_id == 0xFFFFFFFF) return Napi::Array::New(env, 0);
     }
-    bool timestamp_mode = (dateMode == "timestamp");
 
+    std::vector<gtfs::Departure> departures = gtfs::collect_departures(data, q);
 
-    std::string prev_date_str;
-    int prev_date_wday = -1;
-    if (has_date && timestamp_mode) {
-        prev_date_str = GetPreviousDate(filter_date);
-        prev_date_wday = GetDayOfWeek(prev_date_str);
-    }
+    PoolStrings str = Strings(env, generation);
+    Napi::Array arr = Napi::Array::New(env, departures.size());
+    for (size_t i = 0; i < departures.size(); ++i) {
+        const gtfs::Departure& d = departures[i];
+        const gtfs::StopTime st = data.stop_time_rows()[d.row];
+        const gtfs::Trip* trip = data.trips.find(st.feed_id, st.trip_id);
+        const gtfs::Route* route = trip ? data.routes.find(st.feed_id, trip->route_id) : nullptr;
 
-    uint32_t filter_feed_id_int = 0xFFFFFFFF;
-    bool has_feed_id = config.Has("feed_id") && config.Get("feed_id").IsString();
-    if (has_feed_id) {
-        filter_feed_id_int = data.string_pool.get_id(config.Get("feed_id").As<Napi::String>().Utf8Value());
+        Napi::Object obj = Napi::Object::New(env);
+        obj.Set("trip_id", str(st.trip_id));
+        obj.Set("stop_id", str(st.stop_id));
+        obj.Set("stop_sequence", st.stop_sequence);
+        if (st.arrival_time != gtfs::ST_NO_TIME) obj.Set("arrival_time", st.arrival_time);
+        else obj.Set("arrival_time", env.Null());
+        if (st.departure_time != gtfs::ST_NO_TIME) obj.Set("departure_time", st.departure_time);
+        else obj.Set("departure_time", env.Null());
+        obj.Set("time", d.time);
+        if (q.day != gtfs::NO_DAY) obj.Set("service_date", gtfs::format_date_days(q.day + d.day_offset));
+        else obj.Set("service_date", env.Null());
+
+        uint32_t headsign = st.stop_headsign != gtfs::ST_NO_HEADSIGN ? st.stop_headsign : (trip ? trip->trip_headsign : gtfs::NO_STR);
+        SetStr(env, obj, "headsign", headsign, str);
+        SetInt8(env, obj, "direction_id", trip ? trip->direction_id : gtfs::ST_NO_INT8);
+        SetStr(env, obj, "route_id", trip ? trip->route_id : gtfs::NO_STR, str);
+        SetStr(env, obj, "route_short_name", route ? route->route_short_name : gtfs::NO_STR, str);
+        SetStr(env, obj, "route_long_name", route ? route->route_long_name : gtfs::NO_STR, str);
+        if (route) obj.Set("route_type", route->route_type);
+        else obj.Set("route_type", env.Null());
+        SetStr(env, obj, "route_color", route ? route->route_color : gtfs::NO_STR, str);
+        SetStr(env, obj, "route_text_color", route ? route->route_text_color : gtfs::NO_STR, str);
+        obj.Set("feed_id", str(st.feed_id));
+
+        gtfs::RealtimeStopTimeMatch m{ d.row, d.day_offset };
+        if (data.realtime_join.size() != 0) {
+            gtfs::predict_stop_time(data, q.day != gtfs::NO_DAY ? q.day + d.day_offset : gtfs::NO_DAY, utc_offset, m);
+        }
+        obj.Set("has_realtime", m.has_trip_update);
+        obj.Set("skipped", m.skipped);
+        if (m.departure_delay != gtfs::NO_DELAY) {
+            obj.Set("departure_delay", m.departure_delay);
+            obj.Set("predicted_time", d.time + m.departure_delay);
+        } else {
+            obj.Set("departure_delay", env.Null());
+            obj.Set("predicted_time", env.Null());
+        }
+        arr[i] = obj;
     }
+    return arr;
+}
 
-    std::vector<std::pair<const gtfs::StopTime*, int>> results;
+// Reads a planJourney query; callers hold data.mutex. Throws and returns false on
+// bad arguments; an unknown stop leaves its id NO_STR, which plans nothing.
+bool GTFSAddon::ParseJourneyRequest(const gtfs::GTFSData& data, const Napi::CallbackInfo& info, gtfs::JourneyRequest& r) {
+    Napi::Env env = info.Env();
+    Napi::Object config = info.Length() > 0 && info[0].IsObject() ? info[0].As<Napi::Object>() : Napi::Object();
+    if (config.IsEmpty() || !config.Get("from").IsString() || !config.Get("to").IsString() || !config.Get("date").IsString()) {
+        Napi::TypeError::New(env, "Expected a query object with from, to and date").ThrowAsJavaScriptException();
+        return false;
+    }
+    r.day = gtfs::parse_date_days(config.Get("date").As<Napi::String>().Utf8Value());
+    if (r.day == gtfs::NO_DAY) {
+        Napi::TypeError::New(env, "Invalid date, expected YYYYMMDD").ThrowAsJavaScriptException();
+        return false;
+    }
+    if (config.Has("time")) {
+        Napi::Value v = config.Get("time");
+        if (v.IsNumber()) r.departure = v.As<Napi::Number>().Int32Value();
+        else if (v.IsString()) r.departure = gtfs::parse_time_seconds(v.As<Napi::String>().Utf8Value());
+        r.departure = std::max(0, r.departure);
+    }
+    if (config.Has("window") && config.Get("window").IsNumber()) {
+        r.window = std::max(0, config.Get("window").As<Napi::Number>().Int32Value());
+    }
+    if (config.Has("max_transfers") && config.Get("max_transfers").IsNumber()) {
+        r.max_transfers = static_cast<uint32_t>(std::max(0, config.Get("max_transfers").As<Napi::Number>().Int32Value()));
+    }
+    if (config.Has("threads") && config.Get("threads").IsNumber()) {
+        r.threads = static_cast<unsigned>(std::max(0, config.Get("threads").As<Napi::Number>().Int32Value()));
+    }
+    r.realtime = config.Has("realtime") && config.Get("realtime").ToBoolean();
+    if (config.Has("utc_offset") && config.Get("utc_offset").IsNumber()) {
+        r.utc_offset = config.Get("utc_offset").As<Napi::Number>().Int32Value();
+    }
+    r.from = data.string_pool.get_id(config.Get("from").As<Napi::String>().Utf8Value());
+    r.to = data.string_pool.get_id(config.Get("to").As<Napi::String>().Utf8Value());
+    return true;
+}
 
-    std::unordered_map<std::string, bool> service_cache;
+Napi::Value GTFSAddon::PlanJourney(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("planJourney"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
+    gtfs::JourneyRequest r;
+    if (!ParseJourneyRequest(data, info, r)) return env.Null();
+    if (r.from == 0xFFFFFFFF || r.to == 0xFFFFFFFF) return Napi::Array::New(env, 0);
+
+    std::vector<gtfs::Journey> journeys = gtfs::plan_journeys(data, r);
+    PoolStrings str = Strings(env, generation);
+    Napi::Array arr = Napi::Array::New(env, journeys.size());
+    for (size_t i = 0; i < journeys.size(); ++i) arr[i] = JourneyToObject(env, journeys[i], str);
+    return arr;
+}
 
-    auto check_service = [&](uint32_t feed_id_int, uint32_t trip_id_int, const std::string& date_s, int wday) -> bool {
-        uint64_t key = (static_cast<uint64_t>(feed_id_int) << 32) | trip_id_int;
-        auto trip_it = data.trip_by_intern_id.find(key);
-        if (trip_it == data.trip_by_intern_id.end()) return false;
-        const gtfs::Trip* trip = trip_it->second;
-        std::string cache_key = trip->feed_id + "|" + trip->service_id + "|" + date_s;
-        auto cache_it = service_cache.find(cache_key);
-        if (cache_it != service_cache.end()) return cache_it->second;
-        bool active = CheckServiceActiveLogic(data, trip->feed_id, trip->service_id, date_s, wday);
-        service_cache[cache_key] = active;
-        return active;
+// planJourney on the threadpool; the first query after a load also builds the
+// timetable there
+Napi::Value GTFSAddon::PlanJourneyAsync(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
+    struct Result {
+        gtfs::JourneyRequest request;
+        std::vector<gtfs::Journey> journeys;
+        StringCapture strings;
     };
+    auto result = std::make_shared<Result>();
+    {
+        std::shared_lock<std::shared_mutex> lock(data.mutex);
+        if (!ParseJourneyRequest(data, info, result->request)) return env.Null();
+    }
+
+    auto worker = new QueryWorker(env, info.This().As<Napi::Object>(), metrics.get("planJourneyAsync"), generation,
+        [result](gtfs::GTFSData& d) {
+            const gtfs::JourneyRequest& r = result->request;
+            if (r.from == 0xFFFFFFFF || r.to == 0xFFFFFFFF) return;
+            result->journeys = gtfs::plan_journeys(d, r);
+            for (const gtfs::Journey& j : result->journeys) {
+                for (const gtfs::JourneyLeg& leg : j.legs) {
+                    for (uint32_t id : { leg.from_stop, leg.to_stop, leg.trip_id, leg.route_id, leg.feed_id }) result->strings.add(d.string_pool, id);
+                }
+            }
+        },
+        [result](Napi::Env env) -> Napi::Value {
+            CapturedStrings str(env, result->strings);
+            Napi::Array arr = Napi::Array::New(env, result->journeys.size());
+            for (size_t i = 0; i < result->journeys.size(); ++i) arr[i] = JourneyToObject(env, result->journeys[i], str);
+            return arr;
+        });
+    worker->Queue();
+    return worker->GetPromise();
+}
 
-    auto check_inclusion = [&](const gtfs::StopTime& st) {
-        if (has_trip_id && st.trip_id != filter_trip_id) return;
-        if (has_stop_id && st.stop_id != filter_stop_id) return;
-        if (has_feed_id && st.feed_id != filter_feed_id_int) return;
-
-        bool active_today = true;
-        bool active_yesterday = false;
+Napi::Value GTFSAddon::GetStopTimesAsync(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
+    if (info.Length() < 1 || !info[0].IsObject()) {
+        Napi::TypeError::New(env, "Configuration object expected").ThrowAsJavaScriptException();
+        return env.Null();
+    }
 
-        if (has_date) {
-            active_today = check_service(st.feed_id, st.trip_id, filter_date, date_wday);
-            if (timestamp_mode && !prev_date_str.empty()) {
-                active_yesterday = check_service(st.feed_id, st.trip_id, prev_date_str, prev_date_wday);
+    // Rows are copied as PODs; each distinct string is resolved once
+    struct Result {
+        gtfs::StopTimeFilter filter;
+        bool valid = false;
+        std::vector<gtfs::StopTime> rows;
+        StringCapture strings;
+    };
+    auto result = std::make_shared<Result>();
+    {
+        std::shared_lock<std::shared_mutex> lock(data.mutex);
+        result->valid = ParseStopTimeFilter(data, info[0].As<Napi::Object>(), result->filter);
+    }
+
+    auto worker = new QueryWorker(env, info.This().As<Napi::Object>(), metrics.get("getStopTimesAsync"), generation,
+        [result](gtfs::GTFSData& d) {
+            if (!result->valid) return;
+            std::vector<gtfs::StopTimeMatch> matches = gtfs::collect_stop_times(d, result->filter);
+            result->rows.reserve(matches.size());
+            for (const auto& m : matches) {
+                const gtfs::StopTime st = d.stop_time_rows()[m.row];
+                result->rows.push_back(st);
+                for (uint32_t id : { st.trip_id, st.stop_id, st.feed_id, st.stop_headsign }) result->strings.add(d.string_pool, id);
             }
-        }
-
-        if (active_today) {
-            bool match_today = true;
-            if (has_time_window) {
-                 bool arrival_in = (st.arrival_time != gtfs::ST_NO_TIME && st.arrival_time >= filter_start_time && st.arrival_time <= filter_end_time);
-                 bool departure_in = (st.departure_time != gtfs::ST_NO_TIME && st.departure_time >= filter_start_time && st.departure_time <= filter_end_time);
-                 if (!arrival_in && !departure_in) match_today = false;
+        },
+        [result](Napi::Env env) -> Napi::Value {
+            CapturedStrings str(env, result->strings);
+            Napi::Array arr = Napi::Array::New(env, result->rows.size());
+            for (size_t i = 0; i < result->rows.size(); ++i) {
+                arr[i] = StopTimeToObject(env, result->rows[i], str);
             }
-            if (match_today) results.push_back({&st, 0});
-        }
-
-        if (active_yesterday) {
-            bool match_yesterday = true;
+            return arr;
+        });
+    worker->Queue();
+    return worker->GetPromise();
+}
 
-            bool arrival_spill = (st.arrival_time != gtfs::ST_NO_TIME && st.arrival_time >= 86400);
-            bool departure_spill = (st.departure_time != gtfs::ST_NO_TIME && st.departure_time >= 86400);
+// Same query as getStopTimes, returned as one typed array per column. Strings
+// are interned ids resolved through getStringTable; missing values use the
+// native sentinels (INT32_MIN times, 0xFFFFFFFF headsign, -1 flags, NaN distance).
+Napi::Value GTFSAddon::GetStopTimesColumnar(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getStopTimesColumnar"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
+    if (info.Length() < 1 || !info[0].IsObject()) {
+        Napi::TypeError::New(env, "Configuration object expected").ThrowAsJavaScriptException();
+        return env.Null();
+    }
 
-            if (!arrival_spill && !departure_spill) {
-                match_yesterday = false;
-            } else if (has_time_window) {
-                 int shifted_start = filter_start_time + 86400;
-                 int shifted_end = filter_end_time + 86400;
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
+    gtfs::StopTimeColumns columns;
+    gtfs::StopTimeFilter filter;
+    if (ParseStopTimeFilter(data, info[0].As<Napi::Object>(), filter)) {
+        gtfs::fill_stop_time_columns(data, gtfs::collect_stop_times(data, filter), columns);
+    }
+    return StopTimeColumnsToObject(env, std::move(columns));
+}
 
-                 bool arrival_in = (st.arrival_time != gtfs::ST_NO_TIME && st.arrival_time >= shifted_start && st.arrival_time <= shifted_end);
-                 bool departure_in = (st.departure_time != gtfs::ST_NO_TIME && st.departure_time >= shifted_start && st.departure_time <= shifted_end);
+Napi::Value GTFSAddon::GetStopTimesColumnarAsync(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
+    if (info.Length() < 1 || !info[0].IsObject()) {
+        Napi::TypeError::New(env, "Configuration object expected").ThrowAsJavaScriptException();
+        return env.Null();
+    }
 
-                 if (!arrival_in && !departure_in) match_yesterday = false;
-            }
-            if (match_yesterday) results.push_back({&st, -1});
-        }
+    struct Result {
+        gtfs::StopTimeFilter filter;
+        bool valid = false;
+        gtfs::StopTimeColumns columns;
     };
+    auto result = std::make_shared<Result>();
+    {
+        std::shared_lock<std::shared_mutex> lock(data.mutex);
+        result->valid = ParseStopTimeFilter(data, info[0].As<Napi::Object>(), result->filter);
+    }
+
+    auto worker = new QueryWorker(env, info.This().As<Napi::Object>(), metrics.get("getStopTimesColumnarAsync"), generation,
+        [result](gtfs::GTFSData& d) {
+            if (result->valid) gtfs::fill_stop_time_columns(d, gtfs::collect_stop_times(d, result->filter), result->columns);
+        },
+        [result](Napi::Env env) -> Napi::Value {
+            return StopTimeColumnsToObject(env, std::move(result->columns));
+        });
+    worker->Queue();
+    return worker->GetPromise();
+}
 
-    if (has_trip_id) {
-        gtfs::StopTime target;
-        target.trip_id = filter_trip_id;
-        
-        auto range = std::equal_range(data.stop_times.begin(), data.stop_times.end(), target, 
-            [](const gtfs::StopTime& a, const gtfs::StopTime& b) {
-                return a.trip_id < b.trip_id;
-            }
-        );
-
-        for (auto it = range.first; it != range.second; ++it) {
-            check_inclusion(*it);
+// Strings for interned ids. With a Uint32Array/array of ids returns them in the
+// same order (null for unknown ids); without arguments returns the whole table.
+Napi::Value GTFSAddon::GetStringTable(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getStringTable"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
+    PoolStrings str = Strings(env, generation);
+
+    if (info.Length() > 0 && info[0].IsTypedArray()) {
+        Napi::TypedArray ta = info[0].As<Napi::TypedArray>();
+        if (ta.TypedArrayType() != napi_uint32_array) {
+            Napi::TypeError::New(env, "Uint32Array of string ids expected").ThrowAsJavaScriptException();
+            return env.Null();
         }
-
-    } else if (has_stop_id) {
-        if (data.stop_times_by_stop_id.count(filter_stop_id)) {
-            const auto& indices = data.stop_times_by_stop_id.at(filter_stop_id);
-            for (size_t idx : indices) {
-                check_inclusion(data.stop_times[idx]);
-            }
+        Napi::Uint32Array ids = info[0].As<Napi::Uint32Array>();
+        size_t pool_size = data.string_pool.size();
+        Napi::Array arr = Napi::Array::New(env, ids.ElementLength());
+        for (size_t i = 0; i < ids.ElementLength(); ++i) {
+            uint32_t id = ids[i];
+            if (id < pool_size) arr[i] = str(id);
+            else arr[i] = env.Null();
         }
-    } else {
-
-        for (const auto& st : data.stop_times) {
-            check_inclusion(st);
+        return arr;
+    }
+
+    if (info.Length() > 0 && info[0].IsArray()) {
+        Napi::Array ids = info[0].As<Napi::Array>();
+        size_t pool_size = data.string_pool.size();
+        Napi::Array arr = Napi::Array::New(env, ids.Length());
+        for (uint32_t i = 0; i < ids.Length(); ++i) {
+            Napi::Value v = ids.Get(i);
+            uint32_t id = v.IsNumber() ? v.As<Napi::Number>().Uint32Value() : 0xFFFFFFFF;
+            if (id < pool_size) arr[i] = str(id);
+            else arr[i] = env.Null();
         }
+        return arr;
     }
 
-    Napi::Array arr = Napi::Array::New(env, results.size());
-    for(size_t i = 0; i < results.size(); ++i) {
-        const gtfs::StopTime* st = results[i].first;
-
-        Napi::Object obj = Napi::Object::New(env);
-        obj.Set("trip_id", data.string_pool.get(st->trip_id));
-        if (st->arrival_time != gtfs::ST_NO_TIME) obj.Set("arrival_time", st->arrival_time);
-        else obj.Set("arrival_time", env.Null());
-        if (st->departure_time != gtfs::ST_NO_TIME) obj.Set("departure_time", st->departure_time);
-        else obj.Set("departure_time", env.Null());
-        obj.Set("stop_id", data.string_pool.get(st->stop_id));
-        obj.Set("stop_sequence", st->stop_sequence);
-        if (st->stop_headsign != gtfs::ST_NO_HEADSIGN) obj.Set("stop_headsign", data.string_pool.get(st->stop_headsign));
-        else obj.Set("stop_headsign", env.Null());
-        obj.Set("pickup_type", (int)st->pickup_type);
-        obj.Set("drop_off_type", (int)st->drop_off_type);
-        if (st->shape_dist_traveled != gtfs::ST_NO_DIST) obj.Set("shape_dist_traveled", st->shape_dist_traveled);
-        else obj.Set("shape_dist_traveled", env.Null());
-        if (st->timepoint != gtfs::ST_NO_INT8) obj.Set("timepoint", (int)st->timepoint);
-        else obj.Set("timepoint", env.Null());
-        if (st->continuous_pickup != gtfs::ST_NO_INT8) obj.Set("continuous_pickup", (int)st->continuous_pickup);
-        else obj.Set("continuous_pickup", env.Null());
-        if (st->continuous_drop_off != gtfs::ST_NO_INT8) obj.Set("continuous_drop_off", (int)st->continuous_drop_off);
-        else obj.Set("continuous_drop_off", env.Null());
-        obj.Set("feed_id", data.string_pool.get(st->feed_id));
-        arr[i] = obj;
+    size_t pool_size = data.string_pool.size();
+    Napi::Array arr = Napi::Array::New(env, pool_size);
+    for (size_t i = 0; i < pool_size; ++i) {
+        arr[i] = str(static_cast<uint32_t>(i));
     }
     return arr;
 }
 
 Napi::Value GTFSAddon::GetFeedInfo(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getFeedInfo"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
     
     Napi::Object filter;
     bool has_filter = false;
@@ -1084,6 +2236,7 @@ Napi::Value GTFSAddon::GetFeedInfo(const Napi::CallbackInfo& info) {
         has_filter = true;
     }
 
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
     std::vector<const gtfs::FeedInfo*> matches;
     for (const auto& f : data.feed_info) {
         if (has_filter) {
@@ -1111,148 +2264,252 @@ Napi::Value GTFSAddon::GetFeedInfo(const Napi::CallbackInfo& info) {
     return arr;
 }
 
+void GTFSAddon::ParseTripFilter(const Napi::CallbackInfo& info, gtfs::TripFilter& f) {
+    if (info.Length() < 1 || !info[0].IsObject()) return;
+    Napi::Object filter = info[0].As<Napi::Object>();
+
+    auto str = [&](const char* key) -> std::optional<std::string> {
+        if (filter.Has(key) && filter.Get(key).IsString()) return filter.Get(key).As<Napi::String>().Utf8Value();
+        return std::nullopt;
+    };
+    f.trip_id = str("trip_id");
+    f.route_id = str("route_id");
+    f.service_id = str("service_id");
+    f.block_id = str("block_id");
+    f.feed_id = str("feed_id");
+    if (auto date = str("date")) f.day = gtfs::parse_date_days(*date);
+
+    if (filter.Has("direction_id") && !filter.Get("direction_id").IsNull()) {
+        Napi::Value v = filter.Get("direction_id");
+        if (v.IsNumber()) f.direction_id = v.As<Napi::Number>().Int32Value();
+        else if (v.IsString()) f.direction_id = std::stoi(v.As<Napi::String>().Utf8Value());
+        else f.direction_id = -1;
+    }
+}
+
 Napi::Value GTFSAddon::GetTrips(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getTrips"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
 
-    Napi::Object filter;
-    bool has_filter = false;
-    if (info.Length() > 0 && info[0].IsObject()) {
-        filter = info[0].As<Napi::Object>();
-        has_filter = true;
+    gtfs::TripFilter filter;
+    ParseTripFilter(info, filter);
+
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
+    std::vector<uint32_t> rows = gtfs::collect_trips(data, filter);
+
+    PoolStrings str = Strings(env, generation);
+    Napi::Array arr = Napi::Array::New(env, rows.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        arr[i] = TripToObject(env, data.trips[rows[i]], str);
     }
+    return arr;
+}
 
-    std::string f_trip_id, f_route_id, f_service_id, f_date, f_block_id, f_feed_id;
-    int f_direction_id = -1;
-    bool has_trip_id = has_filter && filter.Has("trip_id") && filter.Get("trip_id").IsString();
-    bool has_route_id = has_filter && filter.Has("route_id") && filter.Get("route_id").IsString();
-    bool has_service_id = has_filter && filter.Has("service_id") && filter.Get("service_id").IsString();
-    bool has_date = has_filter && filter.Has("date") && filter.Get("date").IsString();
-    bool has_block_id = has_filter && filter.Has("block_id") && filter.Get("block_id").IsString();
-    bool has_direction_id = has_filter && filter.Has("direction_id") && !filter.Get("direction_id").IsNull();
-    bool has_feed_id = has_filter && filter.Has("feed_id") && filter.Get("feed_id").IsString();
-
-    if (has_trip_id) f_trip_id = filter.Get("trip_id").As<Napi::String>().Utf8Value();
-    if (has_route_id) f_route_id = filter.Get("route_id").As<Napi::String>().Utf8Value();
-    if (has_service_id) f_service_id = filter.Get("service_id").As<Napi::String>().Utf8Value();
-    if (has_date) f_date = filter.Get("date").As<Napi::String>().Utf8Value();
-    if (has_block_id) f_block_id = filter.Get("block_id").As<Napi::String>().Utf8Value();
-    if (has_feed_id) f_feed_id = filter.Get("feed_id").As<Napi::String>().Utf8Value();
-    if (has_direction_id) {
-        if (filter.Get("direction_id").IsNumber()) f_direction_id = filter.Get("direction_id").As<Napi::Number>().Int32Value();
-        else if (filter.Get("direction_id").IsString()) f_direction_id = std::stoi(filter.Get("direction_id").As<Napi::String>().Utf8Value());
-    }
-
-    int date_wday = -1;
-    if (has_date) {
-        date_wday = GetDayOfWeek(f_date);
-    }
-
-    std::vector<const gtfs::Trip*> matches;
-    std::unordered_map<std::string, bool> service_cache;
-
-    auto check_trip = [&](const gtfs::Trip& t) -> bool {
-        if (has_route_id && t.route_id != f_route_id) return false;
-        if (has_service_id && t.service_id != f_service_id) return false;
-        if (has_block_id && (!t.block_id.has_value() || t.block_id.value() != f_block_id)) return false;
-        if (has_direction_id && (!t.direction_id.has_value() || t.direction_id.value() != f_direction_id)) return false;
-        if (has_feed_id && t.feed_id != f_feed_id) return false;
-
-        if (has_date && date_wday != -1) {
-            bool active = false;
-            auto it = service_cache.find(t.feed_id + "|" + t.service_id);
-            if (it != service_cache.end()) {
-                active = it->second;
-            } else {
-                active = CheckServiceActiveLogic(data, t.feed_id, t.service_id, f_date, date_wday);
-                service_cache[t.feed_id + "|" + t.service_id] = active;
-            }
-            if (!active) return false;
-        }
-        return true;
-    };
+Napi::Value GTFSAddon::GetTripsAsync(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
 
-    if (has_trip_id) {
-        if (has_feed_id) {
-            if (data.trips.count(f_feed_id) && data.trips.at(f_feed_id).count(f_trip_id)) {
-                const auto& t = data.trips.at(f_feed_id).at(f_trip_id);
-                if (check_trip(t)) matches.push_back(&t);
-            }
-        } else {
-            for (const auto& [fid, feed_map] : data.trips) {
-                if (feed_map.count(f_trip_id)) {
-                    const auto& t = feed_map.at(f_trip_id);
-                    if (check_trip(t)) matches.push_back(&t);
+    struct Result {
+        gtfs::TripFilter filter;
+        std::vector<gtfs::Trip> trips;
+        StringCapture strings;
+    };
+    auto result = std::make_shared<Result>();
+    ParseTripFilter(info, result->filter);
+
+    auto worker = new QueryWorker(env, info.This().As<Napi::Object>(), metrics.get("getTripsAsync"), generation,
+        [result](gtfs::GTFSData& d) {
+            std::vector<uint32_t> rows = gtfs::collect_trips(d, result->filter);
+            result->trips.reserve(rows.size());
+            for (uint32_t row : rows) {
+                const gtfs::Trip& t = d.trips[row];
+                result->trips.push_back(t);
+                for (uint32_t id : { t.trip_id, t.route_id, t.service_id, t.trip_headsign, t.trip_short_name, t.block_id, t.shape_id, t.feed_id }) {
+                    result->strings.add(d.string_pool, id);
                 }
             }
-        }
-    } else {
-        for (const auto& [fid, feed_map] : data.trips) {
-            if (has_feed_id && fid != f_feed_id) continue;
-            for (const auto& [id, t] : feed_map) {
-                if (check_trip(t)) matches.push_back(&t);
+        },
+        [result](Napi::Env env) -> Napi::Value {
+            CapturedStrings str(env, result->strings);
+            Napi::Array arr = Napi::Array::New(env, result->trips.size());
+            for (size_t i = 0; i < result->trips.size(); ++i) {
+                arr[i] = TripToObject(env, result->trips[i], str);
             }
-        }
-    }
+            return arr;
+        });
+    worker->Queue();
+    return worker->GetPromise();
+}
 
-    Napi::Array arr = Napi::Array::New(env, matches.size());
-    for (size_t i = 0; i < matches.size(); ++i) {
-        const auto& t = *matches[i];
-        Napi::Object obj = Napi::Object::New(env);
-        obj.Set("trip_id", t.trip_id);
-        obj.Set("route_id", t.route_id);
-        obj.Set("service_id", t.service_id);
-        if (t.trip_headsign.has_value()) obj.Set("trip_headsign", t.trip_headsign.value()); else obj.Set("trip_headsign", env.Null());
-        if (t.trip_short_name.has_value()) obj.Set("trip_short_name", t.trip_short_name.value()); else obj.Set("trip_short_name", env.Null());
-        if (t.direction_id.has_value()) obj.Set("direction_id", t.direction_id.value()); else obj.Set("direction_id", env.Null());
-        if (t.block_id.has_value()) obj.Set("block_id", t.block_id.value()); else obj.Set("block_id", env.Null());
-        if (t.shape_id.has_value()) obj.Set("shape_id", t.shape_id.value()); else obj.Set("shape_id", env.Null());
-        if (t.wheelchair_accessible.has_value()) obj.Set("wheelchair_accessible", t.wheelchair_accessible.value()); else obj.Set("wheelchair_accessible", env.Null());
-        if (t.bikes_allowed.has_value()) obj.Set("bikes_allowed", t.bikes_allowed.value()); else obj.Set("bikes_allowed", env.Null());
-        obj.Set("feed_id", t.feed_id);
-        arr[i] = obj;
+// shape_id / feed_id filter shared by the shape getters
+struct ShapeFilter {
+    std::optional<std::string> shape_id, feed_id;
+};
+
+static ShapeFilter ParseShapeFilter(const Napi::CallbackInfo& info) {
+    ShapeFilter f;
+    if (info.Length() > 0 && info[0].IsObject()) {
+        Napi::Object filter = info[0].As<Napi::Object>();
+        if (filter.Has("shape_id")) f.shape_id = filter.Get("shape_id").As<Napi::String>().Utf8Value();
+        if (filter.Has("feed_id")) f.feed_id = filter.Get("feed_id").As<Napi::String>().Utf8Value();
     }
-    return arr;
+    return f;
+}
+
+static std::vector<uint32_t> CollectShapes(const gtfs::GTFSData& data, const ShapeFilter& f) {
+    return gtfs::collect_shapes(data, f.shape_id, f.feed_id);
 }
 
 Napi::Value GTFSAddon::GetShapes(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getShapes"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
+    ShapeFilter filter = ParseShapeFilter(info);
+    if (!LoadLazyFile(env, generation, "shapes.txt")) return env.Null();
 
-    Napi::Object filter;
-    bool has_filter = false;
-    if (info.Length() > 0 && info[0].IsObject()) {
-        filter = info[0].As<Napi::Object>();
-        has_filter = true;
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
+    std::vector<uint32_t> rows = CollectShapes(data, filter);
+
+    PoolStrings str = Strings(env, generation);
+    Napi::Array arr = Napi::Array::New(env, rows.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        arr[i] = ShapeToObject(env, data.shapes[rows[i]], str);
     }
+    return arr;
+}
 
-    Napi::Array arr = Napi::Array::New(env);
+Napi::Value GTFSAddon::GetShapesAsync(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
 
-    size_t count = 0;
-    for (size_t i = 0; i < data.shapes.size(); ++i) {
-        if (has_filter) {
-             if (filter.Has("shape_id")) {
-                  std::string v = filter.Get("shape_id").As<Napi::String>().Utf8Value();
-                  if (data.shapes[i].shape_id != v) continue;
-             }
-             if (filter.Has("feed_id")) {
-                  std::string v = filter.Get("feed_id").As<Napi::String>().Utf8Value();
-                  if (data.shapes[i].feed_id != v) continue;
-             }
+    struct Result {
+        ShapeFilter filter;
+        std::vector<gtfs::Shape> shapes;
+        StringCapture strings;
+    };
+    auto result = std::make_shared<Result>();
+    result->filter = ParseShapeFilter(info);
+
+    auto worker = new QueryWorker(env, info.This().As<Napi::Object>(), metrics.get("getShapesAsync"), generation,
+        [result](gtfs::GTFSData& d) {
+            std::vector<uint32_t> rows = CollectShapes(d, result->filter);
+            result->shapes.reserve(rows.size());
+            for (uint32_t row : rows) {
+                const gtfs::Shape& sh = d.shapes[row];
+                result->shapes.push_back(sh);
+                result->strings.add(d.string_pool, sh.shape_id);
+                result->strings.add(d.string_pool, sh.feed_id);
+            }
+        },
+        [result](Napi::Env env) -> Napi::Value {
+            CapturedStrings str(env, result->strings);
+            Napi::Array arr = Napi::Array::New(env, result->shapes.size());
+            for (size_t i = 0; i < result->shapes.size(); ++i) {
+                arr[i] = ShapeToObject(env, result->shapes[i], str);
+            }
+            return arr;
+        });
+    worker->Needs("shapes.txt");
+    worker->Queue();
+    return worker->GetPromise();
+}
+
+// Shape points as typed arrays; shape_id and feed_id are string table ids
+Napi::Value GTFSAddon::GetShapesColumnar(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getShapesColumnar"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
+    ShapeFilter filter = ParseShapeFilter(info);
+    if (!LoadLazyFile(env, generation, "shapes.txt")) return env.Null();
+
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
+    gtfs::ShapeColumns columns;
+    gtfs::fill_shape_columns(data, CollectShapes(data, filter), columns);
+    return ShapeColumnsToObject(env, std::move(columns));
+}
+
+Napi::Value GTFSAddon::GetShapesColumnarAsync(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+
+    struct Result {
+        ShapeFilter filter;
+        gtfs::ShapeColumns columns;
+    };
+    auto result = std::make_shared<Result>();
+    result->filter = ParseShapeFilter(info);
+
+    auto worker = new QueryWorker(env, info.This().As<Napi::Object>(), metrics.get("getShapesColumnarAsync"), generation,
+        [result](gtfs::GTFSData& d) {
+            gtfs::fill_shape_columns(d, CollectShapes(d, result->filter), result->columns);
+        },
+        [result](Napi::Env env) -> Napi::Value {
+            return ShapeColumnsToObject(env, std::move(result->columns));
+        });
+    worker->Needs("shapes.txt");
+    worker->Queue();
+    return worker->GetPromise();
+}
+
+// getShapePolyline(shape_id, zoom?, { feed_id?, format? }): the shape simplified to
+// about a pixel at zoom (full resolution without one), as a Google encoded
+// polyline or, with format "float64", a Float64Array of interleaved lat/lon.
+// Returns null for an unknown shape.
+Napi::Value GTFSAddon::GetShapePolyline(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getShapePolyline"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
+    if (info.Length() < 1 || !info[0].IsString()) {
+        Napi::TypeError::New(env, "shape_id (string) expected").ThrowAsJavaScriptException();
+        return env.Null();
+    }
+    std::string shape_id = info[0].As<Napi::String>().Utf8Value();
+    bool has_zoom = info.Length() > 1 && info[1].IsNumber();
+    double zoom = has_zoom ? info[1].As<Napi::Number>().DoubleValue() : 0.0;
+
+    std::string feed_id;
+    bool as_array = false;
+    if (info.Length() > 2 && info[2].IsObject()) {
+        Napi::Object options = info[2].As<Napi::Object>();
+        if (options.Has("feed_id") && options.Get("feed_id").IsString()) feed_id = options.Get("feed_id").As<Napi::String>().Utf8Value();
+        if (options.Has("format") && options.Get("format").IsString()) {
+            std::string format = options.Get("format").As<Napi::String>().Utf8Value();
+            if (format == "float64") as_array = true;
+            else if (format != "encoded") {
+                Napi::TypeError::New(env, "format must be \"encoded\" or \"float64\"").ThrowAsJavaScriptException();
+                return env.Null();
+            }
         }
+    }
 
-        Napi::Object obj = Napi::Object::New(env);
-        obj.Set("shape_id", data.shapes[i].shape_id);
-        obj.Set("shape_pt_lat", data.shapes[i].shape_pt_lat);
-        obj.Set("shape_pt_lon", data.shapes[i].shape_pt_lon);
-        obj.Set("shape_pt_sequence", data.shapes[i].shape_pt_sequence);
-        if (data.shapes[i].shape_dist_traveled.has_value()) obj.Set("shape_dist_traveled", data.shapes[i].shape_dist_traveled.value()); else obj.Set("shape_dist_traveled", env.Null());
-        obj.Set("feed_id", data.shapes[i].feed_id);
-        arr[count++] = obj;
+    if (!LoadLazyFile(env, generation, "shapes.txt")) return env.Null();
+    std::vector<double> latlon;
+    {
+        std::shared_lock<std::shared_mutex> lock(data.mutex);
+        uint32_t shape_int = data.string_pool.get_id(shape_id);
+        uint32_t feed_int = gtfs::NO_STR;
+        if (shape_int == 0xFFFFFFFF) return env.Null();
+        if (!feed_id.empty() && (feed_int = data.string_pool.get_id(feed_id)) == 0xFFFFFFFF) return env.Null();
+        const gtfs::ShapeSpan* span = data.shapes_by_id.find(feed_int, shape_int);
+        if (!span || span->count == 0) return env.Null();
+        double tolerance = has_zoom ? gtfs::zoom_tolerance(zoom, data.shapes[span->first].shape_pt_lat) : 0.0;
+        gtfs::shape_polyline(data, *span, tolerance, latlon);
     }
-    return arr;
+
+    if (as_array) return TakeTypedArray(env, std::move(latlon));
+    return Napi::String::New(env, gtfs::encode_polyline(latlon));
 }
 
 Napi::Value GTFSAddon::GetCalendars(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getCalendars"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
 
     Napi::Object filter;
     bool has_filter = false;
@@ -1261,104 +2518,192 @@ Napi::Value GTFSAddon::GetCalendars(const Napi::CallbackInfo& info) {
         has_filter = true;
     }
 
-    std::vector<const gtfs::Calendar*> matches;
-    matches.reserve(data.calendars.size());
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
 
-    std::string feed_id_filter = "";
-    bool has_feed_id_filter = has_filter && filter.Has("feed_id");
-    if (has_feed_id_filter) feed_id_filter = filter.Get("feed_id").As<Napi::String>().Utf8Value();
+    uint32_t feed_id = gtfs::NO_STR, service_id = gtfs::NO_STR;
+    auto filter_id = [&](const char* key, uint32_t& out) {
+        if (!has_filter || !filter.Has(key)) return true;
+        out = data.string_pool.get_id(filter.Get(key).As<Napi::String>().Utf8Value());
+        return out != 0xFFFFFFFF;
+    };
+    if (!filter_id("feed_id", feed_id) || !filter_id("service_id", service_id)) return Napi::Array::New(env, 0);
 
-    if (has_filter && filter.Has("service_id")) {
-        std::string id = filter.Get("service_id").As<Napi::String>().Utf8Value();
-        if (has_feed_id_filter) {
-            if (data.calendars.count(feed_id_filter) && data.calendars.at(feed_id_filter).count(id)) {
-                matches.push_back(&data.calendars.at(feed_id_filter).at(id));
-            }
-        } else {
-            for (const auto& [fid, feed_map] : data.calendars) {
-                if (feed_map.count(id)) {
-                    matches.push_back(&feed_map.at(id));
-                }
-            }
-        }
-    } else {
-        for (const auto& [fid, feed_map] : data.calendars) {
-            if (has_feed_id_filter && fid != feed_id_filter) continue;
-            for (const auto& [id, c] : feed_map) {
-                matches.push_back(&c);
-            }
-        }
-    }
+    std::vector<uint32_t> rows = gtfs::collect_rows(data.calendars, feed_id, service_id, [](const gtfs::Calendar&) { return true; });
 
-    Napi::Array arr = Napi::Array::New(env, matches.size());
-    int i = 0;
-    for (const auto* c_ptr : matches) {
-        const auto& c = *c_ptr;
-        Napi::Object obj = Napi::Object::New(env);
-        obj.Set("service_id", c.service_id);
-        obj.Set("monday", c.monday);
-        obj.Set("tuesday", c.tuesday);
-        obj.Set("wednesday", c.wednesday);
-        obj.Set("thursday", c.thursday);
-        obj.Set("friday", c.friday);
-        obj.Set("saturday", c.saturday);
-        obj.Set("sunday", c.sunday);
-        obj.Set("start_date", c.start_date);
-        obj.Set("end_date", c.end_date);
-        obj.Set("feed_id", c.feed_id);
-        arr[i++] = obj;
+    PoolStrings str = Strings(env, generation);
+    Napi::Array arr = Napi::Array::New(env, rows.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        arr[i] = CalendarToObject(env, data.calendars[rows[i]], str);
     }
     return arr;
 }
 
-Napi::Value GTFSAddon::GetCalendarDates(const Napi::CallbackInfo& info) {
-    Napi::Env env = info.Env();
-    std::vector<gtfs::CalendarDate> flat_list;
+struct CalendarDateFilter {
+    std::optional<std::string> feed_id, service_id;
+};
 
-    Napi::Object filter;
-    bool has_filter = false;
+static CalendarDateFilter ParseCalendarDateFilter(const Napi::CallbackInfo& info) {
+    CalendarDateFilter f;
     if (info.Length() > 0 && info[0].IsObject()) {
-        filter = info[0].As<Napi::Object>();
-        has_filter = true;
+        Napi::Object filter = info[0].As<Napi::Object>();
+        if (filter.Has("feed_id") && filter.Get("feed_id").IsString()) f.feed_id = filter.Get("feed_id").As<Napi::String>().Utf8Value();
+        if (filter.Has("service_id") && filter.Get("service_id").IsString()) f.service_id = filter.Get("service_id").As<Napi::String>().Utf8Value();
     }
+    return f;
+}
 
-    std::string f_feed_id = "";
-    std::string f_service_id = "";
-    bool has_feed_id = has_filter && filter.Has("feed_id") && filter.Get("feed_id").IsString();
-    bool has_service_id = has_filter && filter.Has("service_id") && filter.Get("service_id").IsString();
-
-    if (has_feed_id) f_feed_id = filter.Get("feed_id").As<Napi::String>().Utf8Value();
-    if (has_service_id) f_service_id = filter.Get("service_id").As<Napi::String>().Utf8Value();
-
-    for (const auto& [fid, feed_dates] : data.calendar_dates) {
-        if (has_feed_id && fid != f_feed_id) continue;
-        for (const auto& [service_id, dates] : feed_dates) {
-            if (has_service_id && service_id != f_service_id) continue;
-            for (const auto& [date, exc] : dates) {
-                gtfs::CalendarDate cd;
-                cd.feed_id = fid;
-                cd.service_id = service_id;
-                cd.date = date;
-                cd.exception_type = exc;
-                flat_list.push_back(cd);
-            }
-        }
-    }
+static std::vector<gtfs::CalendarDate> CollectCalendarDates(const gtfs::GTFSData& data, const CalendarDateFilter& f) {
+    return gtfs::collect_calendar_dates(data, f.feed_id ? &*f.feed_id : nullptr, f.service_id ? &*f.service_id : nullptr);
+}
+
+Napi::Value GTFSAddon::GetCalendarDates(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    MethodTimer timer(env, metrics.get("getCalendarDates"));
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
+    CalendarDateFilter filter = ParseCalendarDateFilter(info);
+
+    std::shared_lock<std::shared_mutex> lock(data.mutex);
+    std::vector<gtfs::CalendarDate> flat_list = CollectCalendarDates(data, filter);
 
     Napi::Array arr = Napi::Array::New(env, flat_list.size());
     for (size_t i = 0; i < flat_list.size(); ++i) {
-        Napi::Object obj = Napi::Object::New(env);
-        obj.Set("service_id", flat_list[i].service_id);
-        obj.Set("date", flat_list[i].date);
-        obj.Set("exception_type", flat_list[i].exception_type);
-        obj.Set("feed_id", flat_list[i].feed_id);
-        arr[i] = obj;
+        arr[i] = CalendarDateToObject(env, flat_list[i]);
     }
     return arr;
 }
 
+Napi::Value GTFSAddon::GetCalendarDatesAsync(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+
+    struct Result {
+        CalendarDateFilter filter;
+        std::vector<gtfs::CalendarDate> dates;
+    };
+    auto result = std::make_shared<Result>();
+    result->filter = ParseCalendarDateFilter(info);
+
+    auto worker = new QueryWorker(env, info.This().As<Napi::Object>(), metrics.get("getCalendarDatesAsync"), generation,
+        [result](gtfs::GTFSData& d) {
+            result->dates = CollectCalendarDates(d, result->filter);
+        },
+        [result](Napi::Env env) -> Napi::Value {
+            Napi::Array arr = Napi::Array::New(env, result->dates.size());
+            for (size_t i = 0; i < result->dates.size(); ++i) {
+                arr[i] = CalendarDateToObject(env, result->dates[i]);
+            }
+            return arr;
+        });
+    worker->Queue();
+    return worker->GetPromise();
+}
+
+// Moves the loaded stop times into the pattern store; queries keep working on
+// the same row numbers. Returns the sizes before and after.
+Napi::Value GTFSAddon::CompactStopTimes(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
+    std::unique_lock<std::shared_mutex> lock(data.mutex);
+    size_t flat_bytes = data.stop_times.size() * sizeof(gtfs::StopTime);
+    data.compact_stop_time_rows();
+
+    const gtfs::CompactStopTimes& c = data.compact_stop_times;
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("rows", static_cast<double>(c.size()));
+    obj.Set("trips", static_cast<double>(c.run_count()));
+    obj.Set("patterns", static_cast<double>(c.pattern_count()));
+    obj.Set("profiles", static_cast<double>(c.profile_count()));
+    obj.Set("flat_bytes", static_cast<double>(flat_bytes ? flat_bytes : c.size() * sizeof(gtfs::StopTime)));
+    obj.Set("compact_bytes", static_cast<double>(c.memory_bytes()));
+    return obj;
+}
+
+// getStats(): timings of the load behind the published data, approximate bytes
+// per container and the call counters of every method called so far
+Napi::Value GTFSAddon::GetStats(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
+
+    gtfs::LoadStats load_stats;
+    std::vector<std::pair<const char*, size_t>> memory;
+    {
+        std::shared_lock<std::shared_mutex> lock(data.mutex);
+        load_stats = data.load_stats;
+        memory = data.memory_usage();
+    }
+    memory.emplace_back("raptor", gtfs::raptor_memory_bytes(data));
+
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("generation", static_cast<double>(generations.number()));
+
+    Napi::Object load = Napi::Object::New(env);
+    load.Set("total_ms", load_stats.total_ms);
+    Napi::Array files = Napi::Array::New(env, load_stats.files.size());
+    for (size_t i = 0; i < load_stats.files.size(); ++i) {
+        const gtfs::FileLoadStats& f = load_stats.files[i];
+        Napi::Object o = Napi::Object::New(env);
+        o.Set("feed_id", f.feed_id);
+        o.Set("file", f.file);
+        o.Set("bytes", static_cast<double>(f.bytes));
+        o.Set("records", static_cast<double>(f.records));
+        o.Set("inflate_ms", f.inflate_ms);
+        o.Set("parse_ms", f.parse_ms);
+        files[i] = o;
+    }
+    load.Set("files", files);
+    Napi::Array phases = Napi::Array::New(env, load_stats.phases.size());
+    for (size_t i = 0; i < load_stats.phases.size(); ++i) {
+        const gtfs::PhaseLoadStats& p = load_stats.phases[i];
+        Napi::Object o = Napi::Object::New(env);
+        o.Set("name", p.name);
+        o.Set("ms", p.ms);
+        o.Set("busy_ms", p.busy_ms);
+        o.Set("threads", static_cast<double>(p.threads));
+        o.Set("utilization", p.utilization());
+        phases[i] = o;
+    }
+    load.Set("phases", phases);
+    obj.Set("load", load);
+
+    Napi::Object mem = Napi::Object::New(env);
+    size_t total = 0;
+    for (const auto& [name, bytes] : memory) {
+        mem.Set(name, static_cast<double>(bytes));
+        total += bytes;
+    }
+    mem.Set("total", static_cast<double>(total));
+    obj.Set("memory", mem);
+
+    // Cumulative buckets, like a Prometheus histogram
+    Napi::Object methods = Napi::Object::New(env);
+    for (const auto& [name, snap] : metrics.snapshot()) {
+        Napi::Object o = Napi::Object::New(env);
+        o.Set("count", static_cast<double>(snap.count));
+        o.Set("errors", static_cast<double>(snap.errors));
+        o.Set("sum_seconds", snap.sum_ns / 1e9);
+        Napi::Array buckets = Napi::Array::New(env, gtfs::MethodStats::BUCKETS);
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < gtfs::MethodStats::BUCKETS; ++i) {
+            cumulative += snap.buckets[i];
+            Napi::Object b = Napi::Object::New(env);
+            b.Set("le", i + 1 < gtfs::MethodStats::BUCKETS ? gtfs::MethodStats::bucket_bound_seconds(i) : std::numeric_limits<double>::infinity());
+            b.Set("count", static_cast<double>(cumulative));
+            buckets[i] = b;
+        }
+        o.Set("buckets", buckets);
+        methods.Set(name, o);
+    }
+    obj.Set("methods", methods);
+    return obj;
+}
+
 Napi::Value GTFSAddon::MergeStops(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
     if (info.Length() < 2 || !info[0].IsString() || !info[1].IsArray()) {
         Napi::TypeError::New(env, "Expected targetStopId (string) and sourceStopIds (string[])").ThrowAsJavaScriptException();
         return env.Null();
@@ -1366,6 +2711,8 @@ Napi::Value GTFSAddon::MergeStops(const Napi::CallbackInfo& info) {
 
     std::string targetStopId = info[0].As<Napi::String>().Utf8Value();
     Napi::Array sourceStopsArray = info[1].As<Napi::Array>();
+
+    std::unique_lock<std::shared_mutex> lock(data.mutex);
     
     std::unordered_set<std::string> sourceStopIds;
     std::unordered_set<uint32_t> sourceStopInternalIds;
@@ -1384,51 +2731,55 @@ Napi::Value GTFSAddon::MergeStops(const Napi::CallbackInfo& info) {
 
     uint32_t targetInternalId = data.string_pool.intern(targetStopId);
 
-    // 1. Update stop_times
-    for (auto& st : data.stop_times) {
-        if (sourceStopInternalIds.count(st.stop_id)) {
-            st.stop_id = targetInternalId;
-        }
-    }
-
-    // 2. Rebuild stop_times_by_stop_id
-    auto& targetIndices = data.stop_times_by_stop_id[targetInternalId];
-    for (uint32_t srcId : sourceStopInternalIds) {
-        if (data.stop_times_by_stop_id.count(srcId)) {
-            auto& srcIndices = data.stop_times_by_stop_id.at(srcId);
-            targetIndices.insert(targetIndices.end(), srcIndices.begin(), srcIndices.end());
-            data.stop_times_by_stop_id.erase(srcId);
+    // 1. Update stop_times (copies a mapped snapshot into private memory)
+    if (!data.compact_stop_times.empty()) {
+        data.compact_stop_times.remap_stops([&](uint32_t id) { return sourceStopInternalIds.count(id) ? targetInternalId : id; });
+    } else {
+        for (auto& st : data.stop_times.mut()) {
+            if (sourceStopInternalIds.count(st.stop_id)) {
+                st.stop_id = targetInternalId;
+            }
         }
     }
-
-    // 3. Update parent_station references in stops
-    for (auto& [fid, feed_map] : data.stops) {
-        for (auto& [id, stop] : feed_map) {
-            if (stop.parent_station.has_value() && sourceStopIds.count(stop.parent_station.value())) {
-                stop.parent_station = targetStopId;
+    if (!data.merge_lost_stop_times.empty()) {
+        for (auto& st : data.merge_lost_stop_times.mut()) {
+            if (sourceStopInternalIds.count(st.stop_id)) {
+                st.stop_id = targetInternalId;
             }
         }
     }
 
-    // 4. Remove source stops from data.stops
-    for (auto& [fid, feed_map] : data.stops) {
-        for (const auto& s : sourceStopIds) {
-            feed_map.erase(s);
+    // 2. Rebuild stop_times_by_stop_id
+    data.stop_times_by_stop_id.build(data.stop_time_rows(), data.string_pool.size());
+
+    // 3. Update parent_station references and 4. remove source stops from data.stops
+    std::vector<gtfs::Stop>& stops = data.stops.mut();
+    for (auto& stop : stops) {
+        if (stop.parent_station != gtfs::NO_STR && sourceStopInternalIds.count(stop.parent_station)) {
+            stop.parent_station = targetInternalId;
         }
     }
+    stops.erase(std::remove_if(stops.begin(), stops.end(), [&](const gtfs::Stop& s) {
+        return sourceStopInternalIds.count(s.stop_id) != 0;
+    }), stops.end());
+    data.stops.reindex();
+    data.build_stop_grid();
+    data.raptor.reset();
+    data.trip_stop_distances.clear();
 
     // 5. Update realtime data
-    for (auto& tu : data.realtime_trip_updates) {
-        for (auto& stu : tu.stop_time_updates) {
-            if (sourceStopIds.count(stu.stop_id)) {
-                stu.stop_id = targetStopId;
+    for (auto& [feed_id, feed] : data.realtime) {
+        for (auto& entry : feed.trip_updates) {
+            for (auto& stu : entry.value.stop_time_updates) {
+                if (sourceStopInternalIds.count(stu.stop_id)) {
+                    stu.stop_id = targetInternalId;
+                }
             }
         }
-    }
-
-    for (auto& vp : data.realtime_vehicle_positions) {
-        if (sourceStopIds.count(vp.stop_id)) {
-            vp.stop_id = targetStopId;
+        for (auto& entry : feed.vehicle_positions) {
+            if (sourceStopInternalIds.count(entry.value.stop_id)) {
+                entry.value.stop_id = targetInternalId;
+            }
         }
     }
 
@@ -1437,6 +2788,8 @@ Napi::Value GTFSAddon::MergeStops(const Napi::CallbackInfo& info) {
 
 Napi::Value GTFSAddon::UpdateStop(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
+    std::shared_ptr<gtfs::GTFSData> generation = generations.current();
+    gtfs::GTFSData& data = *generation;
     if (info.Length() < 2 || !info[0].IsString() || !info[1].IsObject()) {
         Napi::TypeError::New(env, "Expected stop_id (string) and partialStop (object)").ThrowAsJavaScriptException();
         return env.Null();
@@ -1450,75 +2803,57 @@ Napi::Value GTFSAddon::UpdateStop(const Napi::CallbackInfo& info) {
         feed_id = info[2].As<Napi::String>().Utf8Value();
     }
 
+    std::unique_lock<std::shared_mutex> lock(data.mutex);
+
+    gtfs::StringPool& pool = data.string_pool;
+    auto set_str = [&](const char* key, uint32_t& field) {
+        if (!partial.Has(key)) return;
+        if (partial.Get(key).IsNull()) field = gtfs::NO_STR;
+        else field = pool.intern(partial.Get(key).As<Napi::String>().Utf8Value());
+    };
+    auto set_int8 = [&](const char* key, int8_t& field) {
+        if (!partial.Has(key)) return;
+        if (partial.Get(key).IsNull()) field = gtfs::ST_NO_INT8;
+        else field = static_cast<int8_t>(partial.Get(key).As<Napi::Number>().Int32Value());
+    };
+    auto set_coord = [&](const char* key, double& field) {
+        if (!partial.Has(key)) return;
+        if (partial.Get(key).IsNull()) field = std::numeric_limits<double>::quiet_NaN();
+        else field = partial.Get(key).As<Napi::Number>().DoubleValue();
+    };
+
     auto update_stop_obj = [&](gtfs::Stop& s) {
-        if (partial.Has("stop_code")) {
-            if (partial.Get("stop_code").IsNull()) s.stop_code = std::nullopt;
-            else s.stop_code = partial.Get("stop_code").As<Napi::String>().Utf8Value();
-        }
+        set_str("stop_code", s.stop_code);
         if (partial.Has("stop_name")) {
-            s.stop_name = partial.Get("stop_name").As<Napi::String>().Utf8Value();
-        }
-        if (partial.Has("stop_desc")) {
-            if (partial.Get("stop_desc").IsNull()) s.stop_desc = std::nullopt;
-            else s.stop_desc = partial.Get("stop_desc").As<Napi::String>().Utf8Value();
-        }
-        if (partial.Has("stop_lat")) {
-            if (partial.Get("stop_lat").IsNull()) s.stop_lat = std::nullopt;
-            else s.stop_lat = partial.Get("stop_lat").As<Napi::Number>().DoubleValue();
-        }
-        if (partial.Has("stop_lon")) {
-            if (partial.Get("stop_lon").IsNull()) s.stop_lon = std::nullopt;
-            else s.stop_lon = partial.Get("stop_lon").As<Napi::Number>().DoubleValue();
-        }
-        if (partial.Has("zone_id")) {
-            if (partial.Get("zone_id").IsNull()) s.zone_id = std::nullopt;
-            else s.zone_id = partial.Get("zone_id").As<Napi::String>().Utf8Value();
-        }
-        if (partial.Has("stop_url")) {
-            if (partial.Get("stop_url").IsNull()) s.stop_url = std::nullopt;
-            else s.stop_url = partial.Get("stop_url").As<Napi::String>().Utf8Value();
-        }
-        if (partial.Has("location_type")) {
-            if (partial.Get("location_type").IsNull()) s.location_type = std::nullopt;
-            else s.location_type = partial.Get("location_type").As<Napi::Number>().Int32Value();
-        }
-        if (partial.Has("parent_station")) {
-            if (partial.Get("parent_station").IsNull()) s.parent_station = std::nullopt;
-            else s.parent_station = partial.Get("parent_station").As<Napi::String>().Utf8Value();
-        }
-        if (partial.Has("stop_timezone")) {
-            if (partial.Get("stop_timezone").IsNull()) s.stop_timezone = std::nullopt;
-            else s.stop_timezone = partial.Get("stop_timezone").As<Napi::String>().Utf8Value();
-        }
-        if (partial.Has("wheelchair_boarding")) {
-            if (partial.Get("wheelchair_boarding").IsNull()) s.wheelchair_boarding = std::nullopt;
-            else s.wheelchair_boarding = partial.Get("wheelchair_boarding").As<Napi::Number>().Int32Value();
-        }
-        if (partial.Has("level_id")) {
-            if (partial.Get("level_id").IsNull()) s.level_id = std::nullopt;
-            else s.level_id = partial.Get("level_id").As<Napi::String>().Utf8Value();
-        }
-        if (partial.Has("platform_code")) {
-            if (partial.Get("platform_code").IsNull()) s.platform_code = std::nullopt;
-            else s.platform_code = partial.Get("platform_code").As<Napi::String>().Utf8Value();
-        }
-        if (partial.Has("tts_stop_name")) {
-            if (partial.Get("tts_stop_name").IsNull()) s.tts_stop_name = std::nullopt;
-            else s.tts_stop_name = partial.Get("tts_stop_name").As<Napi::String>().Utf8Value();
+            s.stop_name = pool.intern(partial.Get("stop_name").As<Napi::String>().Utf8Value());
         }
+        set_str("stop_desc", s.stop_desc);
+        set_coord("stop_lat", s.stop_lat);
+        set_coord("stop_lon", s.stop_lon);
+        set_str("zone_id", s.zone_id);
+        set_str("stop_url", s.stop_url);
+        set_int8("location_type", s.location_type);
+        set_str("parent_station", s.parent_station);
+        set_str("stop_timezone", s.stop_timezone);
+        set_int8("wheelchair_boarding", s.wheelchair_boarding);
+        set_str("level_id", s.level_id);
+        set_str("platform_code", s.platform_code);
+        set_str("tts_stop_name", s.tts_stop_name);
     };
 
     bool found = false;
-    if (!feed_id.empty()) {
-        if (data.stops.count(feed_id) && data.stops.at(feed_id).count(stop_id)) {
-            update_stop_obj(data.stops.at(feed_id).at(stop_id));
+    uint32_t stop_id_int = pool.get_id(stop_id);
+    uint32_t feed_id_int = feed_id.empty() ? gtfs::NO_STR : pool.get_id(feed_id);
+    if (stop_id_int != 0xFFFFFFFF && (feed_id.empty() || feed_id_int != 0xFFFFFFFF)) {
+        std::vector<uint32_t> rows = gtfs::collect_rows(data.stops, feed_id_int, stop_id_int, [](const gtfs::Stop&) { return true; });
+        if (!rows.empty()) {
+            std::vector<gtfs::Stop>& stops = data.stops.mut();
+            for (uint32_t row : rows) update_stop_obj(stops[row]);
             found = true;
-        }
-    } else {
-        for (auto& [fid, feed_map] : data.stops) {
-            if (feed_map.count(stop_id)) {
-                update_stop_obj(feed_map.at(stop_id));
-                found = true;
+            if (partial.Has("stop_lat") || partial.Has("stop_lon")) {
+                data.build_stop_grid();
+                data.raptor.reset();
+                data.trip_stop_distances.clear();
             }
         }
     }
@@ -0,0 +1,356 @@
+#include "GTFS.h"
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <chrono>
+#include <shared_mutex>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+namespace gtfs {
+
+// addFeed / replaceFeed / removeFeed: the next generation is built from the
+// current one instead of re-parsing every archive. Rows of the other feeds are
+// copied with their interned ids, only the changed feed is parsed, and the
+// feeds are merged again in feed_order, so the result matches a full load of
+// the same feeds in that order.
+
+enum class FeedChange { Add, Replace, Remove };
+
+// Rows of the loaded stop_times per block handed to sort_stop_times
+constexpr size_t KEPT_STOP_TIME_BLOCK_ROWS = 64 * 1024;
+
+using ShapeMap = std::unordered_map<uint32_t, std::vector<Shape>>;
+
+// Position of each feed of data.feed_order in the merge, counted from 1. Feeds
+// missing from the order rank 0 and merge first.
+static std::unordered_map<uint32_t, uint32_t> feed_ranks(GTFSData& data) {
+    std::unordered_map<uint32_t, uint32_t> ranks;
+    for (size_t i = 0; i < data.feed_order.size(); ++i) {
+        ranks.emplace(data.string_pool.intern(data.feed_order[i]), static_cast<uint32_t>(i + 1));
+    }
+    return ranks;
+}
+
+static uint32_t feed_rank(const std::unordered_map<uint32_t, uint32_t>& ranks, uint32_t feed) {
+    auto it = ranks.find(feed);
+    return it == ranks.end() ? 0 : it->second;
+}
+
+// Merges the shapes of each feed (feed -> shape_id -> rows) by feed rank, as
+// parse_shapes does during a load; the losing rows go to lost
+static ShapeMap merge_feed_shapes(std::unordered_map<uint32_t, ShapeMap>& feeds, const std::unordered_map<uint32_t, uint32_t>& ranks, int merge_strategy, const StringPool& pool, std::vector<Shape>& lost) {
+    std::vector<std::pair<uint32_t, uint32_t>> order; // (rank, feed)
+    for (const auto& [feed, shapes] : feeds) order.push_back({ feed_rank(ranks, feed), feed });
+    std::sort(order.begin(), order.end());
+    ShapeMap merged;
+    for (const auto& [rank, feed] : order) merge_shapes(merged, feeds[feed], rank == 0 ? 0 : merge_strategy, pool, &lost);
+    return merged;
+}
+
+bool feed_loaded(const GTFSData& data, const std::string& feed_id) {
+    if (data.agencies.count(feed_id) || data.calendar_dates.count(feed_id) || data.lazy_files.has_feed(feed_id)) return true;
+    for (const FeedInfo& fi : data.feed_info) {
+        if (fi.feed_id == feed_id) return true;
+    }
+    uint32_t id = data.string_pool.get_id(feed_id);
+    if (id == NO_STR) return false;
+    auto has_rows = [id](const auto& rows) {
+        for (const auto& row : rows) {
+            if (row.feed_id == id) return true;
+        }
+        return false;
+    };
+    if (has_rows(data.routes) || has_rows(data.trips) || has_rows(data.stops) || has_rows(data.calendars) || has_rows(data.shapes) || has_rows(data.merge_lost_shapes)) return true;
+    StopTimeRows stop_times = data.stop_time_rows();
+    for (size_t i = 0; i < stop_times.size(); ++i) {
+        if (stop_times[i].feed_id == id) return true;
+    }
+    return false;
+}
+
+// Copies everything of current that does not belong to feed_id into next, which
+// must be empty and hold the new feed_order. stop_times, including the rows that
+// lost a merge conflict, go to merge in blocks per feed, with the feed's rank as
+// feed index; shapes, also including the losers, go to shapes per feed. Realtime
+// state is copied by the caller once the schedule is final.
+void copy_other_feeds(GTFSData& next, FeedMerge& merge, std::unordered_map<uint32_t, ShapeMap>& shapes, const GTFSData& current, const std::string& feed_id) {
+    next.string_pool.assign(current.string_pool);
+    next.image = current.image;
+    uint32_t feed = current.string_pool.get_id(feed_id); // NO_STR when never loaded
+    std::unordered_map<uint32_t, uint32_t> ranks = feed_ranks(next);
+
+    for (const auto& [id, agencies] : current.agencies) {
+        if (id != feed_id) next.agencies.emplace(id, agencies);
+    }
+    for (const auto& [id, dates] : current.calendar_dates) {
+        if (id != feed_id) next.calendar_dates.emplace(id, dates);
+    }
+    for (const FeedInfo& fi : current.feed_info) {
+        if (fi.feed_id != feed_id) next.feed_info.push_back(fi);
+    }
+
+    auto copy_table = [feed](auto& to, const auto& from) {
+        auto& rows = to.mut();
+        rows.reserve(from.size());
+        for (const auto& row : from) {
+            if (row.feed_id != feed) rows.push_back(row);
+        }
+        to.reindex();
+    };
+    copy_table(next.calendars, current.calendars);
+    copy_table(next.routes, current.routes);
+    copy_table(next.stops, current.stops);
+    copy_table(next.trips, current.trips);
+
+    for (const Shape& s : current.shapes) {
+        if (s.feed_id != feed) shapes[s.feed_id][s.shape_id].push_back(s);
+    }
+    for (const Shape& s : current.merge_lost_shapes) {
+        if (s.feed_id != feed) shapes[s.feed_id][s.shape_id].push_back(s);
+    }
+    next.lazy_files.copy_pending(current.lazy_files, feed_id);
+
+    std::vector<StopTimeBlock> open(ranks.size() + 1);
+    std::vector<std::vector<StopTimeBlock>> full(ranks.size() + 1);
+    auto keep = [&](const StopTime& st) {
+        if (st.feed_id == feed) return;
+        uint32_t rank = feed_rank(ranks, st.feed_id);
+        StopTimeBlock& block = open[rank];
+        if (block.rows.empty()) {
+            block.rows.reserve(KEPT_STOP_TIME_BLOCK_ROWS);
+            block.feed_index = rank;
+        }
+        block.rows.push_back(st);
+        if (block.rows.size() == KEPT_STOP_TIME_BLOCK_ROWS) {
+            full[rank].push_back(std::move(block));
+            block = StopTimeBlock();
+        }
+    };
+    StopTimeRows stop_times = current.stop_time_rows();
+    for (size_t i = 0; i < stop_times.size(); ++i) keep(stop_times[i]);
+    for (const StopTime& st : current.merge_lost_stop_times) keep(st);
+    for (size_t rank = 0; rank < open.size(); ++rank) {
+        for (StopTimeBlock& block : full[rank]) merge.stop_time_blocks.push_back(std::move(block));
+        if (!open[rank].rows.empty()) merge.stop_time_blocks.push_back(std::move(open[rank]));
+    }
+}
+
+// Builds next, an empty GTFSData, from current with feed_id added, replaced or
+// removed; zip_data is unused for Remove. An added feed merges last, a replaced
+// one keeps its place in feed_order, and the rows a changed feed won or lost in
+// a merge conflict are merged again, so next holds what a full load of its
+// feeds in feed_order would. Realtime state is kept, except that of a removed
+// feed. Returns false, leaving next empty, when a removed feed is not loaded;
+// throws when an added feed already is.
+bool change_feed(GTFSData& next, const GTFSData& current, FeedChange change, const BufferView& zip_data, const std::string& feed_id, int merge_strategy, LogFn log, ProgressFn progress, const std::vector<std::string>& files_to_load = {}, unsigned int parse_threads = 0, const std::vector<std::string>& lazy_files = {}) {
+    auto t0 = std::chrono::steady_clock::now();
+    ThreadPool pool(parse_threads);
+    FeedMerge merge;
+    std::unordered_map<uint32_t, ShapeMap> feed_shapes; // feed -> its shapes, merged below
+    next.lazy_files.merge_strategy = merge_strategy;
+    {
+        std::shared_lock<std::shared_mutex> lock(current.mutex);
+        bool loaded = feed_loaded(current, feed_id);
+        if (change == FeedChange::Add && loaded) throw std::runtime_error("Feed already loaded: " + feed_id);
+        if (change == FeedChange::Remove && !loaded) return false;
+
+        if (log) log("Copying loaded feeds...");
+        auto copy_t0 = std::chrono::steady_clock::now();
+        next.feed_order = current.feed_order;
+        auto it = std::find(next.feed_order.begin(), next.feed_order.end(), feed_id);
+        if (change == FeedChange::Remove && it != next.feed_order.end()) next.feed_order.erase(it);
+        if (change != FeedChange::Remove && it == next.feed_order.end()) next.feed_order.push_back(feed_id);
+        copy_other_feeds(next, merge, feed_shapes, current, feed_id);
+        for (const auto& [id, feed] : current.realtime) {
+            if (change != FeedChange::Remove || id != feed_id) next.realtime.emplace(id, feed);
+        }
+        double copy_ms = elapsed_ns(copy_t0) / 1e6;
+        next.load_stats.phases.push_back({ "copy loaded feeds", copy_ms, copy_ms, 1 });
+    }
+
+    std::unordered_map<uint32_t, uint32_t> ranks = feed_ranks(next);
+    uint32_t feed = next.string_pool.intern(feed_id);
+    uint32_t rank = feed_rank(ranks, feed);
+    if (change != FeedChange::Remove) {
+        if (log) log("Processing feed " + feed_id + "...");
+        const std::vector<std::string>& target_files = files_to_load.empty() ? ALL_FEED_FILES : files_to_load;
+        if (!parse_feeds(next, merge, { { zip_data, feed_id, rank } }, merge_strategy, log, progress, target_files, lazy_files, pool)[0]) {
+            throw std::runtime_error("Failed to init zip reader for feed " + feed_id);
+        }
+        // The parse appended the feed; put its rows and stop_times at its rank
+        std::stable_sort(merge.stop_time_blocks.begin(), merge.stop_time_blocks.end(), [](const StopTimeBlock& a, const StopTimeBlock& b) {
+            return a.feed_index < b.feed_index;
+        });
+        if (rank != next.feed_order.size()) {
+            auto by_rank = [&ranks](const auto& a, const auto& b) { return feed_rank(ranks, a.feed_id) < feed_rank(ranks, b.feed_id); };
+            auto order_table = [&by_rank](auto& table) {
+                auto& rows = table.mut();
+                std::stable_sort(rows.begin(), rows.end(), by_rank);
+                table.reindex();
+            };
+            order_table(next.calendars);
+            order_table(next.routes);
+            order_table(next.stops);
+            order_table(next.trips);
+            std::stable_sort(next.feed_info.begin(), next.feed_info.end(), [&next, &ranks](const FeedInfo& a, const FeedInfo& b) {
+                return feed_rank(ranks, next.string_pool.get_id(a.feed_id)) < feed_rank(ranks, next.string_pool.get_id(b.feed_id));
+            });
+        }
+        feed_shapes[feed] = std::move(merge.shapes);
+    }
+    merge.shapes = merge_feed_shapes(feed_shapes, ranks, merge_strategy, next.string_pool, next.merge_lost_shapes.mut());
+
+    if (log) log("Finalizing data...");
+    finalize_feeds(next, merge, merge_strategy, log, pool);
+    auto join_t0 = std::chrono::steady_clock::now();
+    rebuild_realtime_indexes(next);
+    double join_ms = elapsed_ns(join_t0) / 1e6;
+    next.load_stats.phases.push_back({ "join realtime", join_ms, join_ms, 1 });
+
+    double ms = elapsed_ns(t0) / 1e6;
+    next.load_stats.total_ms = ms;
+    if (log) log("Updated feed " + feed_id + " in " + std::to_string(ms) + "ms");
+    return true;
+}
+
+// Parses files a lazy load kept for name (see LAZY_FEED_FILES) and installs
+// their rows under the exclusive lock. Shapes are merged again feed by feed in
+// feed_order, each feed taking its rows from its kept file or from the shapes
+// parsed at load, merge losers included, so the merge strategy picks the same
+// rows as an eager load. The shapes are read under the shared lock and
+// installed only if they did not change meanwhile; vehicles are snapped again
+// against them.
+static void parse_lazy_file(GTFSData& data, const std::string& name, const std::vector<LazyFile>& files) {
+    auto t0 = std::chrono::steady_clock::now();
+    if (name == "shapes.txt") {
+        StringPool& pool = data.string_pool;
+        std::unordered_map<uint32_t, uint32_t> ranks = feed_ranks(data);
+
+        while (true) {
+            std::unordered_map<uint32_t, ShapeMap> feeds; // feed -> its shapes
+            const Shape* base;
+            size_t base_size;
+            {
+                std::shared_lock<std::shared_mutex> lock(data.mutex);
+                base = data.shapes.data();
+                base_size = data.shapes.size();
+                for (const Shape& s : data.shapes) feeds[s.feed_id][s.shape_id].push_back(s);
+                for (const Shape& s : data.merge_lost_shapes) feeds[s.feed_id][s.shape_id].push_back(s);
+            }
+            for (const LazyFile& file : files) {
+                std::vector<char> content = inflate_lazy_file(file);
+                parse_shapes(data, feeds[pool.intern(file.feed_id)], content.data(), content.size(), 0, file.feed_id);
+            }
+
+            std::vector<Shape> lost;
+            ShapeMap merged = merge_feed_shapes(feeds, ranks, data.lazy_files.merge_strategy, pool, lost);
+            std::vector<Shape> shapes;
+            for (auto& [id, points] : merged) shapes.insert(shapes.end(), points.begin(), points.end());
+
+            std::unique_lock<std::shared_mutex> lock(data.mutex);
+            if (data.shapes.data() != base || data.shapes.size() != base_size) continue;
+            data.shapes.mut() = std::move(shapes);
+            data.merge_lost_shapes.mut() = std::move(lost);
+            data.shapes_by_id.build(data.shapes.data(), data.shapes.size());
+            data.shape_tracks.clear();
+            snap_vehicles(data);
+            data.load_stats.phases.push_back({ "lazy " + name, elapsed_ns(t0) / 1e6, elapsed_ns(t0) / 1e6, 1 });
+            data.lazy_files.loaded(name);
+            break;
+        }
+    }
+}
+
+// Parses the files a lazy load kept for name unless that already happened, or
+// waits for the parse that runs. Callers must not hold data.mutex.
+void load_lazy_file(GTFSData& data, const std::string& name) {
+    data.lazy_files.load(name, [&data, &name](const std::vector<LazyFile>& files) {
+        parse_lazy_file(data, name, files);
+    });
+}
+
+// Parses lazy files on a thread of its own, started by the first file it is
+// asked for, for callers that must not parse on their own thread. Queued files
+// keep their generation alive until parsed. stop(), also run by the destructor,
+// joins the thread; files queued but not started by then fail, which wakes
+// their waiters.
+class LazyFileLoader {
+    struct Job {
+        std::shared_ptr<GTFSData> data;
+        std::string name;
+    };
+    std::deque<Job> jobs_;
+    std::thread thread_;
+    bool stopped_ = false;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+
+    static void abandon(const Job& job) {
+        try {
+            job.data->lazy_files.load_claimed(job.name, [](const std::vector<LazyFile>&) {
+                throw std::runtime_error("loader stopped");
+            });
+        } catch (const std::exception&) {
+        }
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            ready_.wait(lock, [this] { return stopped_ || !jobs_.empty(); });
+            if (stopped_) return;
+            Job job = std::move(jobs_.front());
+            jobs_.pop_front();
+            lock.unlock();
+            try {
+                job.data->lazy_files.load_claimed(job.name, [&job](const std::vector<LazyFile>& files) {
+                    parse_lazy_file(*job.data, job.name, files);
+                });
+            } catch (const std::exception&) {
+                // Kept in lazy_files for the waiters
+            }
+            job = Job(); // the generation may be gone by now
+            lock.lock();
+        }
+    }
+
+public:
+    LazyFileLoader() = default;
+    LazyFileLoader(const LazyFileLoader&) = delete;
+    LazyFileLoader& operator=(const LazyFileLoader&) = delete;
+    ~LazyFileLoader() { stop(); }
+
+    // Waits until name of data is parsed, queueing the parse when nothing runs
+    // it yet. Throws when the parse failed. After stop() it parses on the
+    // calling thread.
+    void load(const std::shared_ptr<GTFSData>& data, const std::string& name) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!stopped_ && data->lazy_files.claim(name)) {
+                jobs_.push_back({ data, name });
+                if (!thread_.joinable()) thread_ = std::thread([this] { run(); });
+                ready_.notify_one();
+            }
+        }
+        load_lazy_file(*data, name);
+    }
+
+    void stop() {
+        std::deque<Job> left;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopped_ = true;
+            left.swap(jobs_);
+        }
+        ready_.notify_all();
+        if (thread_.joinable()) thread_.join();
+        for (const Job& job : left) abandon(job);
+    }
+};
+
+}
@@ -8,10 +8,24 @@
 #include <thread>
 #include <future>
 #include <vector>
+#include <deque>
+#include <memory>
 #include <atomic>
 #include <unordered_set>
 #include <chrono>
 #include <string_view>
+#include <bit>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define GTFS_CSV_X86 1
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define GTFS_CSV_NEON 1
+#endif
 
 namespace gtfs {
 
@@ -21,6 +35,12 @@ using ProgressFn = std::function<void(std::string task, int64_t current, int64_t
 
 // Emit progress roughly every 64KB processed per file
 constexpr size_t PROGRESS_CHUNK_BYTES = 64 * 1024;
+// Inflated bytes read per step when streaming stop_times.txt out of the archive.
+// Each step becomes one parse task; small enough that a large file makes many
+// more tasks than there are threads.
+constexpr size_t STREAM_BLOCK_BYTES = 1024 * 1024;
+// stop_times.txt parse tasks of one file queued or running per pool thread
+constexpr size_t STREAM_BLOCKS_PER_THREAD = 4;
 
 
 // Helper to remove UTF-8 BOM if present
@@ -35,6 +55,47 @@ void remove_bom(std::string& line) {
 
 
 // Helper to convert "HH:MM:SS" to seconds
+// Days since 1970-01-01 of a proleptic Gregorian date (H. Hinnant's days_from_civil)
+int32_t days_from_civil(int y, int m, int d) {
+    y -= m <= 2;
+    const int era = (y >= 0 ? y : y - 399) / 400;
+    const int yoe = y - era * 400;
+    const int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// YYYYMMDD -> day number, NO_DAY if malformed
+int32_t parse_date_days(std::string_view date_str) {
+    if (date_str.size() != 8) return NO_DAY;
+    int v[8];
+    for (size_t i = 0; i < 8; ++i) {
+        if (date_str[i] < '0' || date_str[i] > '9') return NO_DAY;
+        v[i] = date_str[i] - '0';
+    }
+    int y = v[0] * 1000 + v[1] * 100 + v[2] * 10 + v[3];
+    int m = v[4] * 10 + v[5];
+    int d = v[6] * 10 + v[7];
+    if (m < 1 || m > 12 || d < 1 || d > 31) return NO_DAY;
+    return days_from_civil(y, m, d);
+}
+
+// Day number -> YYYYMMDD (inverse of parse_date_days; H. Hinnant's civil_from_days)
+std::string format_date_days(int32_t days) {
+    int64_t z = static_cast<int64_t>(days) + 719468;
+    const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const int64_t doe = z - era * 146097;
+    const int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const int64_t mp = (5 * doy + 2) / 153;
+    const int d = static_cast<int>(doy - (153 * mp + 2) / 5 + 1);
+    const int m = static_cast<int>(mp < 10 ? mp + 3 : mp - 9);
+    const int64_t y = yoe + era * 400 + (m <= 2);
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%04d%02d%02d", static_cast<int>(y), m, d);
+    return buf;
+}
+
 int parse_time_seconds(const std::string& time_str) {
     if (time_str.empty()) return -1;
     const char* ptr = time_str.c_str();
@@ -134,8 +195,76 @@ int parse_int_view(const char* data, size_t len, int default_val = 0) {
     return result * sign;
 }
 
+// Decimal text to double. Up to 19 significant digits scaled by at most 10^22
+// take the exact path: both factors are exactly representable, so a single
+// multiply or divide is correctly rounded. Everything else (longer mantissas,
+// large exponents, inf/nan, hex) goes through strtod.
 bool parse_double_view(const char* data, size_t len, double& out) {
     if (!data || len == 0) return false;
+    static constexpr double POW10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char* p = data;
+    const char* end = data + len;
+    while (p < end && *p == ' ') ++p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any_digit = false;
+    bool exact = true;
+    auto take = [&](int d, bool fraction) {
+        any_digit = true;
+        if (mantissa == 0 && d == 0) {
+            if (fraction) --exponent;
+            return;
+        }
+        if (digits < 19) {
+            mantissa = mantissa * 10 + static_cast<uint64_t>(d);
+            ++digits;
+            if (fraction) --exponent;
+        } else if (d != 0) {
+            exact = false;
+        } else if (!fraction) {
+            ++exponent;
+        }
+    };
+    while (p < end && *p >= '0' && *p <= '9') take(*p++ - '0', false);
+    if (p < end && *p == '.') {
+        ++p;
+        while (p < end && *p >= '0' && *p <= '9') take(*p++ - '0', true);
+    }
+    if (any_digit && p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool exp_negative = false;
+        if (q < end && (*q == '-' || *q == '+')) exp_negative = *q++ == '-';
+        if (q < end && *q >= '0' && *q <= '9') {
+            int e = 0;
+            while (q < end && *q >= '0' && *q <= '9') {
+                if (e < 100000) e = e * 10 + (*q - '0');
+                ++q;
+            }
+            exponent += exp_negative ? -e : e;
+        }
+    }
+
+    if (any_digit && exact) {
+        if (mantissa == 0) {
+            out = negative ? -0.0 : 0.0;
+            return true;
+        }
+        if (mantissa <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22) {
+            double v = static_cast<double>(mantissa);
+            v = exponent < 0 ? v / POW10[-exponent] : v * POW10[exponent];
+            out = negative ? -v : v;
+            return true;
+        }
+    }
+
     char buf[32];
     if (len >= sizeof(buf)) len = sizeof(buf) - 1;
     memcpy(buf, data, len);
@@ -160,36 +289,218 @@ static inline const char* advance_line(const char* ptr, const char* end, const c
 }
 
 
-// Improved CSV parser
-std::vector<std::string> parse_csv_line(const std::string& line) {
-    std::vector<std::string> result;
+// --- Structural character scanning ---
+// Every ',', '"' and '\n' of a file is found in one pass over 64-byte blocks,
+// each turned into a bitmask with SSE2 or AVX2 (picked at runtime) or NEON.
+// Lines and their fields are then cut by walking the set bits, so the bytes of a
+// line are not read again to find its fields.
 
-    result.reserve(16); 
-    std::string cell;
-    cell.reserve(64);
+using CsvBlockMaskFn = uint64_t (*)(const char* block);
 
+#if !GTFS_CSV_X86 && !GTFS_CSV_NEON
+static uint64_t csv_block_mask_scalar(const char* p) {
+    uint64_t m = 0;
+    for (int i = 0; i < 64; ++i) {
+        char c = p[i];
+        m |= static_cast<uint64_t>(c == ',' || c == '"' || c == '\n') << i;
+    }
+    return m;
+}
+#endif
+
+#if GTFS_CSV_X86
+static uint64_t csv_block_mask_sse2(const char* p) {
+    const __m128i comma = _mm_set1_epi8(','), quote = _mm_set1_epi8('"'), nl = _mm_set1_epi8('\n');
+    uint64_t m = 0;
+    for (int i = 0; i < 4; ++i) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, comma), _mm_cmpeq_epi8(v, quote)), _mm_cmpeq_epi8(v, nl));
+        m |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(hit))) << (16 * i);
+    }
+    return m;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("avx2")))
+#endif
+static uint64_t csv_block_mask_avx2(const char* p) {
+    const __m256i comma = _mm256_set1_epi8(','), quote = _mm256_set1_epi8('"'), nl = _mm256_set1_epi8('\n');
+    uint64_t m = 0;
+    for (int i = 0; i < 2; ++i) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32 * i));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, comma), _mm256_cmpeq_epi8(v, quote)), _mm256_cmpeq_epi8(v, nl));
+        m |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(hit))) << (32 * i);
+    }
+    return m;
+}
+
+static bool cpu_has_avx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+#if GTFS_CSV_NEON
+static uint64_t csv_block_mask_neon(const char* p) {
+    const uint8_t* u = reinterpret_cast<const uint8_t*>(p);
+    const uint8x16_t comma = vdupq_n_u8(','), quote = vdupq_n_u8('"'), nl = vdupq_n_u8('\n');
+    const uint8x16_t weights = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80 };
+    uint8x16_t m[4];
+    for (int i = 0; i < 4; ++i) {
+        uint8x16_t v = vld1q_u8(u + 16 * i);
+        uint8x16_t hit = vorrq_u8(vorrq_u8(vceqq_u8(v, comma), vceqq_u8(v, quote)), vceqq_u8(v, nl));
+        m[i] = vandq_u8(hit, weights);
+    }
+    uint8x16_t sum = vpaddq_u8(vpaddq_u8(m[0], m[1]), vpaddq_u8(m[2], m[3]));
+    sum = vpaddq_u8(sum, sum);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(sum), 0);
+}
+#endif
+
+inline CsvBlockMaskFn csv_block_mask_fn() {
+    static const CsvBlockMaskFn fn = [] {
+#if GTFS_CSV_X86
+        return cpu_has_avx2() ? &csv_block_mask_avx2 : &csv_block_mask_sse2;
+#elif GTFS_CSV_NEON
+        return &csv_block_mask_neon;
+#else
+        return &csv_block_mask_scalar;
+#endif
+    }();
+    return fn;
+}
+
+constexpr size_t CSV_MAX_FIELDS = 64;
+
+// One line cut by CsvScanner. Fields are only split for lines without quotes;
+// others go to parse_csv_line.
+struct CsvLine {
+    const char* start = nullptr;
+    size_t length = 0;        // without the trailing \r
+    size_t raw_length = 0;    // up to the '\n'
+    bool has_newline = false;
+    bool quoted = false;
+    size_t field_count = 0;   // 0 when the line had more than CSV_MAX_FIELDS fields
+    uint32_t ends[CSV_MAX_FIELDS]; // end offset of each field from start
+
+    bool split() const { return !quoted && field_count != 0; }
+
+    std::pair<const char*, size_t> field(int idx) const {
+        if (idx < 0 || static_cast<size_t>(idx) >= field_count) return { nullptr, 0 };
+        size_t first = idx == 0 ? 0 : ends[idx - 1] + 1;
+        return { start + first, ends[idx] - first };
+    }
+};
+
+class CsvScanner {
+    const char* base_;
+    size_t size_;
+    size_t pos_ = 0;    // start of the next line
+    size_t block_ = 0;  // offset of the block mask_ belongs to
+    uint64_t mask_ = 0; // structural characters of the block not consumed yet
+    CsvBlockMaskFn mask_fn_;
+
+    void load(size_t block) {
+        block_ = block;
+        if (size_ - block >= 64) {
+            mask_ = mask_fn_(base_ + block);
+        } else {
+            char tail[64] = {};
+            memcpy(tail, base_ + block, size_ - block);
+            mask_ = mask_fn_(tail);
+        }
+    }
+
+public:
+    CsvScanner(const char* data, size_t size) : base_(data), size_(size), mask_fn_(csv_block_mask_fn()) {
+        if (size_ > 0) load(0);
+    }
+
+    bool next(CsvLine& line) {
+        if (pos_ >= size_) return false;
+        line.start = base_ + pos_;
+        line.quoted = false;
+        size_t n = 0;
+        bool overflow = false;
+        size_t line_end = size_;
+        line.has_newline = false;
+        for (;;) {
+            while (mask_ == 0) {
+                if (block_ + 64 >= size_) break;
+                load(block_ + 64);
+            }
+            if (mask_ == 0) break;
+            size_t at = block_ + static_cast<size_t>(std::countr_zero(mask_));
+            mask_ &= mask_ - 1;
+            char c = base_[at];
+            if (c == ',') {
+                if (n < CSV_MAX_FIELDS) line.ends[n++] = static_cast<uint32_t>(at - pos_);
+                else overflow = true;
+            } else if (c == '"') {
+                line.quoted = true;
+            } else {
+                line_end = at;
+                line.has_newline = true;
+                break;
+            }
+        }
+        line.raw_length = line_end - pos_;
+        line.length = line.raw_length;
+        if (line.length > 0 && line.start[line.length - 1] == '\r') line.length--;
+        if (n < CSV_MAX_FIELDS) line.ends[n++] = static_cast<uint32_t>(line.length);
+        else overflow = true;
+        line.field_count = overflow ? 0 : n;
+        pos_ = line.has_newline ? line_end + 1 : size_;
+        return true;
+    }
+};
+
+// Splits one CSV line into row. The strings already in row are reused, so a
+// loop that keeps its row between lines stops allocating once the cells have
+// grown to the widest values of the file.
+void parse_csv_line(std::string_view line, std::vector<std::string>& row) {
+    size_t n = 0;
+    auto next_cell = [&row, &n]() -> std::string& {
+        if (n == row.size()) row.emplace_back();
+        std::string& cell = row[n++];
+        cell.clear();
+        return cell;
+    };
+
+    std::string* cell = &next_cell();
     bool inside_quotes = false;
     for (size_t i = 0; i < line.length(); ++i) {
         char c = line[i];
         if (c == '"') {
             if (inside_quotes && i + 1 < line.length() && line[i+1] == '"') {
-        cell += '"';
+                *cell += '"';
                 i++;
             } else {
                 inside_quotes = !inside_quotes;
             }
         } else if (c == ',' && !inside_quotes) {
-            result.push_back(std::move(cell));
-
-            cell.clear(); 
+            cell = &next_cell();
         } else if (c == '\r') {
              continue;
         } else {
-            cell += c;
+            *cell += c;
         }
     }
-    result.push_back(std::move(cell));
-    return result;
+    row.resize(n);
+}
+
+std::vector<std::string> parse_csv_line(const std::string& line) {
+    std::vector<std::string> row;
+    parse_csv_line(std::string_view(line), row);
+    return row;
 }
 
 int get_col_index(const std::vector<std::string>& headers, const std::string& name) {
@@ -229,6 +540,16 @@ bool get_bool(const std::vector<std::string>& row, int index, bool default_val =
     return val == "1";
 }
 
+// Interned id of a column, NO_STR when it is missing or empty
+uint32_t get_str_id(StringPool& pool, const std::vector<std::string>& row, int index) {
+    if (index < 0 || index >= (int)row.size() || row[index].empty()) return NO_STR;
+    return pool.intern(row[index]);
+}
+
+int8_t get_int8(const std::vector<std::string>& row, int index) {
+    return static_cast<int8_t>(get_int(row, index, ST_NO_INT8));
+}
+
 
 size_t parse_agency(GTFSData& data, const char* content_data, size_t content_size, int merge_strategy, const std::string& feed_id, const std::function<void(size_t)>& on_progress = nullptr) {
     const char* ptr = content_data;
@@ -262,13 +583,13 @@ size_t parse_agency(GTFSData& data, const char* content_data, size_t content_siz
 
     data.agencies[feed_id].reserve(content_size / 80 + 16);
 
+    std::vector<std::string> row;
     size_t count = 0;
     while (ptr < end) {
         ptr = advance_line(ptr, end, line_start, line_len);
         bytes_read += line_len + 1;
         if (line_len == 0) { report_progress(bytes_read); continue; }
-        std::string line(line_start, line_len);
-        auto row = parse_csv_line(line);
+        parse_csv_line(std::string_view(line_start, line_len), row);
         Agency a;
         a.feed_id = feed_id;
         std::string tmp;
@@ -335,47 +656,36 @@ size_t parse_routes(GTFSData& data, const char* content_data, size_t content_siz
     int sort_order_idx = get_col_index(headers, "route_sort_order");
     int network_id_idx = get_col_index(headers, "network_id");
 
-    data.routes[feed_id].reserve(content_size / 100 + 16);
+    StringPool& pool = data.string_pool;
+    uint32_t feed_id_int = pool.intern(feed_id);
 
+    std::vector<std::string> row;
     size_t count = 0;
     while (ptr < end) {
         ptr = advance_line(ptr, end, line_start, line_len);
         bytes_read += line_len + 1;
         if (line_len == 0) { report_progress(bytes_read); continue; }
-        std::string line(line_start, line_len);
-        auto row = parse_csv_line(line);
+        parse_csv_line(std::string_view(line_start, line_len), row);
         Route r;
-        r.feed_id = feed_id;
-        std::string tmp;
-        r.route_id = get_val(row, id_idx);
-        tmp = get_val(row, agency_id_idx);
-        if (!tmp.empty()) r.agency_id = tmp;
-        tmp = get_val(row, short_name_idx);
-        if (!tmp.empty()) r.route_short_name = tmp;
-        tmp = get_val(row, long_name_idx);
-        if (!tmp.empty()) r.route_long_name = tmp;
-        tmp = get_val(row, desc_idx);
-        if (!tmp.empty()) r.route_desc = tmp;
+        r.feed_id = feed_id_int;
+        r.route_id = pool.intern(get_val(row, id_idx));
+        r.agency_id = get_str_id(pool, row, agency_id_idx);
+        r.route_short_name = get_str_id(pool, row, short_name_idx);
+        r.route_long_name = get_str_id(pool, row, long_name_idx);
+        r.route_desc = get_str_id(pool, row, desc_idx);
         r.route_type = get_int(row, type_idx);
-        tmp = get_val(row, url_idx);
-        if (!tmp.empty()) r.route_url = tmp;
-        tmp = get_val(row, color_idx);
-        if (!tmp.empty()) r.route_color = tmp;
-        tmp = get_val(row, text_color_idx);
-        if (!tmp.empty()) r.route_text_color = tmp;
-        tmp = get_val(row, cont_pickup_idx);
-        if (!tmp.empty()) r.continuous_pickup = get_int(row, cont_pickup_idx);
-        tmp = get_val(row, cont_drop_off_idx);
-        if (!tmp.empty()) r.continuous_drop_off = get_int(row, cont_drop_off_idx);
-        tmp = get_val(row, sort_order_idx);
-        if (!tmp.empty()) r.route_sort_order = get_int(row, sort_order_idx);
-        tmp = get_val(row, network_id_idx);
-        if (!tmp.empty()) r.network_id = tmp;
-
-        if (merge_strategy == 1 && data.routes[feed_id].count(r.route_id)) continue;
-        if (merge_strategy == 2 && data.routes[feed_id].count(r.route_id)) throw std::runtime_error("Duplicate route: " + r.route_id);
-
-        data.routes[feed_id][r.route_id] = r;
+        r.route_url = get_str_id(pool, row, url_idx);
+        r.route_color = get_str_id(pool, row, color_idx);
+        r.route_text_color = get_str_id(pool, row, text_color_idx);
+        r.continuous_pickup = get_int8(row, cont_pickup_idx);
+        r.continuous_drop_off = get_int8(row, cont_drop_off_idx);
+        r.route_sort_order = get_int(row, sort_order_idx, NO_INT);
+        r.network_id = get_str_id(pool, row, network_id_idx);
+
+        if (merge_strategy == 1 && data.routes.contains(r.feed_id, r.route_id)) continue;
+        if (merge_strategy == 2 && data.routes.contains(r.feed_id, r.route_id)) throw std::runtime_error("Duplicate route: " + get_val(row, id_idx));
+
+        data.routes.put(r);
         count++;
         report_progress(bytes_read);
     }
@@ -415,40 +725,34 @@ size_t parse_trips(GTFSData& data, const char* content_data, size_t content_size
     int wheelchair_idx = get_col_index(headers, "wheelchair_accessible");
     int bikes_idx = get_col_index(headers, "bikes_allowed");
 
-    data.trips[feed_id].reserve(content_size / 80 + 16);
+    StringPool& pool = data.string_pool;
+    uint32_t feed_id_int = pool.intern(feed_id);
+    data.trips.reserve(data.trips.size() + content_size / 80 + 16);
 
+    std::vector<std::string> row;
     size_t count = 0;
     while (ptr < end) {
         ptr = advance_line(ptr, end, line_start, line_len);
         bytes_read += line_len + 1;
         if (line_len == 0) { report_progress(bytes_read); continue; }
-        std::string line(line_start, line_len);
-        auto row = parse_csv_line(line);
+        parse_csv_line(std::string_view(line_start, line_len), row);
         Trip t;
-        t.feed_id = feed_id;
-        std::string tmp;
-        t.route_id = get_val(row, route_id_idx);
-        t.service_id = get_val(row, service_id_idx);
-        t.trip_id = get_val(row, trip_id_idx);
-        tmp = get_val(row, headsign_idx);
-        if (!tmp.empty()) t.trip_headsign = tmp;
-        tmp = get_val(row, short_name_idx);
-        if (!tmp.empty()) t.trip_short_name = tmp;
-        tmp = get_val(row, direction_id_idx);
-        if (!tmp.empty()) t.direction_id = get_int(row, direction_id_idx);
-        tmp = get_val(row, block_id_idx);
-        if (!tmp.empty()) t.block_id = tmp;
-        tmp = get_val(row, shape_id_idx);
-        if (!tmp.empty()) t.shape_id = tmp;
-        tmp = get_val(row, wheelchair_idx);
-        if (!tmp.empty()) t.wheelchair_accessible = get_int(row, wheelchair_idx);
-        tmp = get_val(row, bikes_idx);
-        if (!tmp.empty()) t.bikes_allowed = get_int(row, bikes_idx);
-
-        if (merge_strategy == 1 && data.trips[feed_id].count(t.trip_id)) continue;
-        if (merge_strategy == 2 && data.trips[feed_id].count(t.trip_id)) throw std::runtime_error("Duplicate trip: " + t.trip_id);
-
-        data.trips[feed_id][t.trip_id] = t;
+        t.feed_id = feed_id_int;
+        t.route_id = pool.intern(get_val(row, route_id_idx));
+        t.service_id = pool.intern(get_val(row, service_id_idx));
+        t.trip_id = pool.intern(get_val(row, trip_id_idx));
+        t.trip_headsign = get_str_id(pool, row, headsign_idx);
+        t.trip_short_name = get_str_id(pool, row, short_name_idx);
+        t.direction_id = get_int8(row, direction_id_idx);
+        t.block_id = get_str_id(pool, row, block_id_idx);
+        t.shape_id = get_str_id(pool, row, shape_id_idx);
+        t.wheelchair_accessible = get_int8(row, wheelchair_idx);
+        t.bikes_allowed = get_int8(row, bikes_idx);
+
+        if (merge_strategy == 1 && data.trips.contains(t.feed_id, t.trip_id)) continue;
+        if (merge_strategy == 2 && data.trips.contains(t.feed_id, t.trip_id)) throw std::runtime_error("Duplicate trip: " + get_val(row, trip_id_idx));
+
+        data.trips.put(t);
         count++;
         report_progress(bytes_read);
     }
@@ -492,49 +796,39 @@ size_t parse_stops(GTFSData& data, const char* content_data, size_t content_size
     int level_idx = get_col_index(headers, "level_id");
     int platform_idx = get_col_index(headers, "platform_code");
 
-    data.stops[feed_id].reserve(content_size / 80 + 16);
+    StringPool& pool = data.string_pool;
+    uint32_t feed_id_int = pool.intern(feed_id);
+    data.stops.reserve(data.stops.size() + content_size / 80 + 16);
+    const double no_coord = std::numeric_limits<double>::quiet_NaN();
 
+    std::vector<std::string> row;
     size_t count = 0;
     while (ptr < end) {
         ptr = advance_line(ptr, end, line_start, line_len);
         bytes_read += line_len + 1;
         if (line_len == 0) { report_progress(bytes_read); continue; }
-        std::string line(line_start, line_len);
-        auto row = parse_csv_line(line);
+        parse_csv_line(std::string_view(line_start, line_len), row);
         Stop s;
-        s.feed_id = feed_id;
-        std::string tmp;
-        s.stop_id = get_val(row, id_idx);
-        tmp = get_val(row, code_idx);
-        if (!tmp.empty()) s.stop_code = tmp;
-        s.stop_name = get_val(row, name_idx);
-        tmp = get_val(row, desc_idx);
-        if (!tmp.empty()) s.stop_desc = tmp;
-        tmp = get_val(row, lat_idx);
-        if (!tmp.empty()) s.stop_lat = get_double(row, lat_idx);
-        tmp = get_val(row, lon_idx);
-        if (!tmp.empty()) s.stop_lon = get_double(row, lon_idx);
-        tmp = get_val(row, zone_idx);
-        if (!tmp.empty()) s.zone_id = tmp;
-        tmp = get_val(row, url_idx);
-        if (!tmp.empty()) s.stop_url = tmp;
-        tmp = get_val(row, loc_type_idx);
-        if (!tmp.empty()) s.location_type = get_int(row, loc_type_idx);
-        tmp = get_val(row, parent_idx);
-        if (!tmp.empty()) s.parent_station = tmp;
-        tmp = get_val(row, tz_idx);
-        if (!tmp.empty()) s.stop_timezone = tmp;
-        tmp = get_val(row, wheelchair_idx);
-        if (!tmp.empty()) s.wheelchair_boarding = get_int(row, wheelchair_idx);
-        tmp = get_val(row, level_idx);
-        if (!tmp.empty()) s.level_id = tmp;
-        tmp = get_val(row, platform_idx);
-        if (!tmp.empty()) s.platform_code = tmp;
-
-        if (merge_strategy == 1 && data.stops[feed_id].count(s.stop_id)) continue;
-        if (merge_strategy == 2 && data.stops[feed_id].count(s.stop_id)) throw std::runtime_error("Duplicate stop: " + s.stop_id);
-
-        data.stops[feed_id][s.stop_id] = s;
+        s.feed_id = feed_id_int;
+        s.stop_id = pool.intern(get_val(row, id_idx));
+        s.stop_code = get_str_id(pool, row, code_idx);
+        s.stop_name = pool.intern(get_val(row, name_idx));
+        s.stop_desc = get_str_id(pool, row, desc_idx);
+        s.stop_lat = get_double(row, lat_idx, no_coord);
+        s.stop_lon = get_double(row, lon_idx, no_coord);
+        s.zone_id = get_str_id(pool, row, zone_idx);
+        s.stop_url = get_str_id(pool, row, url_idx);
+        s.location_type = get_int8(row, loc_type_idx);
+        s.parent_station = get_str_id(pool, row, parent_idx);
+        s.stop_timezone = get_str_id(pool, row, tz_idx);
+        s.wheelchair_boarding = get_int8(row, wheelchair_idx);
+        s.level_id = get_str_id(pool, row, level_idx);
+        s.platform_code = get_str_id(pool, row, platform_idx);
+
+        if (merge_strategy == 1 && data.stops.contains(s.feed_id, s.stop_id)) continue;
+        if (merge_strategy == 2 && data.stops.contains(s.feed_id, s.stop_id)) throw std::runtime_error("Duplicate stop: " + get_val(row, id_idx));
+
+        data.stops.put(s);
         count++;
         report_progress(bytes_read);
     }
@@ -544,6 +838,36 @@ size_t parse_stops(GTFSData& data, const char* content_data, size_t content_size
 
 
 // Updated to output to a specific vector, useful for multithreading
+// Per-chunk dictionary for stop_times parsing: rows carry chunk-local ids while the chunk
+// is parsed, and only the distinct strings are resolved against the shared pool at the
+// end, so parallel chunks don't contend on the pool's lock once per field.
+class ChunkInterner {
+    std::unordered_map<std::string_view, uint32_t> ids_;
+    std::vector<std::string_view> views_;
+    std::deque<std::string> owned_; // unquoted copies of quoted fields
+public:
+    // sv must stay valid until resolve() (it points into the chunk text)
+    uint32_t intern_view(std::string_view sv) {
+        auto [it, inserted] = ids_.try_emplace(sv, static_cast<uint32_t>(views_.size()));
+        if (inserted) views_.push_back(sv);
+        return it->second;
+    }
+
+    uint32_t intern_copy(const std::string& s) {
+        auto it = ids_.find(s);
+        if (it != ids_.end()) return it->second;
+        owned_.push_back(s);
+        return intern_view(owned_.back());
+    }
+
+    // Pool id for every local id
+    std::vector<uint32_t> resolve(StringPool& pool) const {
+        std::vector<uint32_t> global(views_.size());
+        pool.intern_all(views_.data(), views_.size(), global.data());
+        return global;
+    }
+};
+
 size_t parse_stop_times_chunk(StringPool& string_pool, const char* start, size_t length, const std::vector<std::string>& headers, uint32_t feed_id, std::vector<StopTime>& out_vec, const std::function<void(size_t)>& on_progress = nullptr) {
     int trip_id_idx = get_col_index(headers, "trip_id");
     int arrival_idx = get_col_index(headers, "arrival_time");
@@ -568,48 +892,33 @@ size_t parse_stop_times_chunk(StringPool& string_pool, const char* start, size_t
         }
     };
 
-    std::vector<std::pair<const char*, size_t>> row;
-    row.reserve(headers.size());
+    ChunkInterner local;
+    const size_t first_row = out_vec.size();
+    // stop_times is grouped by trip, so most rows repeat the previous row's trip_id
+    std::string_view last_trip;
+    uint32_t last_trip_id = 0;
+    bool has_last_trip = false;
 
-    const char* ptr = start;
-    const char* end = start + length;
+    CsvScanner scanner(start, length);
+    CsvLine line;
+    std::vector<std::string> row_str; // quoted rows
 
     size_t count = 0;
-    while (ptr < end) {
-        const char* line_start = ptr;
-        const char* line_end = static_cast<const char*>(memchr(ptr, '\n', static_cast<size_t>(end - ptr)));
-        if (!line_end) {
-            line_end = end;
-        }
-        ptr = line_end;
-        if (ptr < end) ++ptr;
-
-        size_t raw_len = static_cast<size_t>(line_end - line_start);
-        bytes_read += raw_len;
-        if (line_end < end) bytes_read += 1;
-        if (raw_len == 0) {
+    while (scanner.next(line)) {
+        bytes_read += line.raw_length;
+        if (line.has_newline) bytes_read += 1;
+        if (line.length == 0) {
             report_progress(bytes_read);
             continue;
         }
 
-        size_t parse_len = raw_len;
-        if (parse_len > 0 && line_start[parse_len - 1] == '\r') {
-            parse_len--;
-        }
-        if (parse_len == 0) {
-            report_progress(bytes_read);
-            continue;
-        }
-
-        const void* quote_pos = memchr(line_start, '"', parse_len);
-        if (quote_pos) {
-            // Quoted path: fall back to string-based CSV parser
-            std::string line(line_start, parse_len);
-            auto row_str = parse_csv_line(line);
+        if (!line.split()) {
+            // Quoted (or very wide) row: fall back to the string-based CSV parser
+            parse_csv_line(std::string_view(line.start, line.length), row_str);
 
             StopTime st;
             st.feed_id = feed_id;
-            st.trip_id = string_pool.intern(get_val(row_str, trip_id_idx));
+            st.trip_id = local.intern_copy(get_val(row_str, trip_id_idx));
             {
                 int t = parse_time_seconds(get_val(row_str, arrival_idx));
                 st.arrival_time = (t != -1) ? static_cast<int32_t>(t) : ST_NO_TIME;
@@ -618,11 +927,11 @@ size_t parse_stop_times_chunk(StringPool& string_pool, const char* start, size_t
                 int t = parse_time_seconds(get_val(row_str, departure_idx));
                 st.departure_time = (t != -1) ? static_cast<int32_t>(t) : ST_NO_TIME;
             }
-            st.stop_id = string_pool.intern(get_val(row_str, stop_id_idx));
+            st.stop_id = local.intern_copy(get_val(row_str, stop_id_idx));
             st.stop_sequence = get_int(row_str, seq_idx);
             {
                 const std::string& hs = get_val(row_str, headsign_idx);
-                st.stop_headsign = hs.empty() ? ST_NO_HEADSIGN : string_pool.intern(hs);
+                st.stop_headsign = hs.empty() ? ST_NO_HEADSIGN : local.intern_copy(hs);
             }
             st.pickup_type   = static_cast<int8_t>(get_int(row_str, pickup_idx));
             st.drop_off_type = static_cast<int8_t>(get_int(row_str, drop_off_idx));
@@ -651,29 +960,21 @@ size_t parse_stop_times_chunk(StringPool& string_pool, const char* start, size_t
             continue;
         }
 
-        // Fast path: no quotes, split by comma directly on raw buffer
-        row.clear();
-        const char* field_start = line_start;
-        const char* line_end_ptr = line_start + parse_len;
-        for (const char* p = line_start; p < line_end_ptr; ++p) {
-            if (*p == ',') {
-                row.emplace_back(field_start, static_cast<size_t>(p - field_start));
-                field_start = p + 1;
-            }
-        }
-        row.emplace_back(field_start, static_cast<size_t>(line_end_ptr - field_start));
-
-        auto get_view = [&](int idx) -> std::pair<const char*, size_t> {
-            if (idx < 0 || idx >= static_cast<int>(row.size())) return { nullptr, 0 };
-            return row[static_cast<size_t>(idx)];
-        };
+        // Fast path: no quotes, fields were cut by the scanner on the raw buffer
+        auto get_view = [&](int idx) { return line.field(idx); };
 
         StopTime st;
         st.feed_id = feed_id;
 
-        // Zero-copy intern: uses intern(const char*, size_t) to avoid std::string allocation
+        // Zero-copy intern: views point into the chunk, which outlives the local dictionary
         auto trip_view = get_view(trip_id_idx);
-        st.trip_id = string_pool.intern(trip_view.first, trip_view.second);
+        std::string_view trip_sv(trip_view.first, trip_view.second);
+        if (!has_last_trip || trip_sv != last_trip) {
+            last_trip = trip_sv;
+            last_trip_id = local.intern_view(trip_sv);
+            has_last_trip = true;
+        }
+        st.trip_id = last_trip_id;
 
         auto arrival_view = get_view(arrival_idx);
         {
@@ -687,14 +988,14 @@ size_t parse_stop_times_chunk(StringPool& string_pool, const char* start, size_t
         }
 
         auto stop_view = get_view(stop_id_idx);
-        st.stop_id = string_pool.intern(stop_view.first, stop_view.second);
+        st.stop_id = local.intern_view(std::string_view(stop_view.first, stop_view.second));
 
         auto seq_view = get_view(seq_idx);
         st.stop_sequence = parse_int_view(seq_view.first, seq_view.second);
 
         auto headsign_view = get_view(headsign_idx);
         st.stop_headsign = (headsign_view.first && headsign_view.second > 0)
-            ? string_pool.intern(headsign_view.first, headsign_view.second)
+            ? local.intern_view(std::string_view(headsign_view.first, headsign_view.second))
             : ST_NO_HEADSIGN;
 
         auto pickup_view = get_view(pickup_idx);
@@ -728,10 +1029,105 @@ size_t parse_stop_times_chunk(StringPool& string_pool, const char* start, size_t
         report_progress(bytes_read);
     }
 
+    std::vector<uint32_t> global = local.resolve(string_pool);
+    for (size_t i = first_row; i < out_vec.size(); ++i) {
+        StopTime& st = out_vec[i];
+        st.trip_id = global[st.trip_id];
+        st.stop_id = global[st.stop_id];
+        if (st.stop_headsign != ST_NO_HEADSIGN) st.stop_headsign = global[st.stop_headsign];
+    }
+
     if (on_progress && bytes_read > last_report) on_progress(bytes_read - last_report);
     return count;
 }
 
+// Where parse_stop_times_stream spent its time: inflating on the calling thread,
+// and parsing summed over the parse tasks
+struct StreamTimings {
+    std::atomic<uint64_t> inflate_ns{0};
+    std::atomic<uint64_t> parse_ns{0};
+};
+
+// Inflates stop_times.txt block by block with miniz's iterative extractor and hands each
+// newline-aligned block to a parse task on pool as soon as it is complete, so parsing
+// overlaps decompression and at most max_in_flight blocks of raw text are resident at
+// once. While that many are, the calling thread runs queued tasks. The parsed blocks
+// are appended to out_chunks in file order.
+size_t parse_stop_times_stream(StringPool& string_pool, mz_zip_archive& zip, mz_uint file_index, uint32_t feed_id, ThreadPool& pool, size_t max_in_flight, std::vector<std::vector<StopTime>>& out_chunks, const std::function<void(size_t)>& on_progress = nullptr, StreamTimings* timings = nullptr) {
+    std::unique_ptr<mz_zip_reader_extract_iter_state, decltype(&mz_zip_reader_extract_iter_free)> iter(
+        mz_zip_reader_extract_iter_new(&zip, file_index, 0), &mz_zip_reader_extract_iter_free);
+    if (!iter) throw std::runtime_error("Failed to open stop_times.txt for inflating");
+    if (max_in_flight == 0) max_in_flight = 1;
+
+    std::vector<std::string> headers;
+    bool have_headers = false;
+    // One slot per block; a deque keeps the slots in place while tasks fill them
+    std::deque<std::vector<StopTime>> parsed;
+    TaskGroup tasks(pool);
+
+    auto submit = [&](std::vector<char>&& text) {
+        if (tasks.pending() >= max_in_flight) pool.run_until([&tasks, max_in_flight] { return tasks.pending() < max_in_flight; });
+        std::vector<StopTime>& vec = parsed.emplace_back();
+        tasks.run([&string_pool, &headers, &vec, feed_id, &on_progress, timings, text = std::make_shared<std::vector<char>>(std::move(text))]() {
+            auto t0 = std::chrono::steady_clock::now();
+            vec.reserve(text->size() / 50);
+            parse_stop_times_chunk(string_pool, text->data(), text->size(), headers, feed_id, vec, on_progress);
+            if (timings) timings->parse_ns.fetch_add(elapsed_ns(t0), std::memory_order_relaxed);
+        });
+    };
+
+    // block holds the partial last line of the previous read followed by the new bytes
+    std::vector<char> block;
+    bool done = false;
+    while (!done) {
+        size_t carried = block.size();
+        block.resize(carried + STREAM_BLOCK_BYTES);
+        auto t0 = std::chrono::steady_clock::now();
+        size_t got = mz_zip_reader_extract_iter_read(iter.get(), block.data() + carried, STREAM_BLOCK_BYTES);
+        if (timings) timings->inflate_ns.fetch_add(elapsed_ns(t0), std::memory_order_relaxed);
+        block.resize(carried + got);
+        done = got == 0;
+
+        if (!have_headers) {
+            const char* nl = static_cast<const char*>(memchr(block.data(), '\n', block.size()));
+            if (!nl && !done) continue;
+            size_t line_len = nl ? static_cast<size_t>(nl - block.data()) : block.size();
+            size_t header_len = line_len;
+            if (header_len > 0 && block[header_len - 1] == '\r') header_len--;
+            std::string header_line(block.data(), header_len);
+            remove_bom(header_line);
+            headers = parse_csv_line(header_line);
+            have_headers = true;
+
+            size_t consumed = nl ? line_len + 1 : line_len;
+            if (on_progress) on_progress(consumed);
+            block.erase(block.begin(), block.begin() + static_cast<std::ptrdiff_t>(consumed));
+        }
+        if (block.empty()) continue;
+
+        size_t cut = block.size();
+        if (!done) {
+            while (cut > 0 && block[cut - 1] != '\n') --cut;
+            if (cut == 0) continue; // no complete line yet, keep reading
+        }
+        std::vector<char> tail(block.begin() + static_cast<std::ptrdiff_t>(cut), block.end());
+        block.resize(cut);
+        submit(std::move(block));
+        block = std::move(tail);
+    }
+    tasks.wait();
+    size_t count = 0;
+    for (auto& vec : parsed) {
+        count += vec.size();
+        out_chunks.push_back(std::move(vec));
+    }
+
+    if (!mz_zip_reader_extract_iter_free(iter.release())) {
+        throw std::runtime_error("Failed to inflate stop_times.txt: " + std::string(mz_zip_get_error_string(mz_zip_get_last_error(&zip))));
+    }
+    return count;
+}
+
 size_t parse_calendar(GTFSData& data, const char* content_data, size_t content_size, int merge_strategy, const std::string& feed_id, const std::function<void(size_t)>& on_progress = nullptr) {
     const char* ptr = content_data;
     const char* end = content_data + content_size;
@@ -764,16 +1160,19 @@ size_t parse_calendar(GTFSData& data, const char* content_data, size_t content_s
     int start_idx = get_col_index(headers, "start_date");
     int end_idx2 = get_col_index(headers, "end_date");
 
+    StringPool& pool = data.string_pool;
+    uint32_t feed_id_int = pool.intern(feed_id);
+
+    std::vector<std::string> row;
     size_t count = 0;
     while (ptr < end) {
         ptr = advance_line(ptr, end, line_start, line_len);
         bytes_read += line_len + 1;
         if (line_len == 0) { report_progress(bytes_read); continue; }
-        std::string line(line_start, line_len);
-        auto row = parse_csv_line(line);
+        parse_csv_line(std::string_view(line_start, line_len), row);
         Calendar c;
-        c.feed_id = feed_id;
-        c.service_id = get_val(row, service_id_idx);
+        c.feed_id = feed_id_int;
+        c.service_id = pool.intern(get_val(row, service_id_idx));
         c.monday = get_bool(row, mon_idx);
         c.tuesday = get_bool(row, tue_idx);
         c.wednesday = get_bool(row, wed_idx);
@@ -781,13 +1180,13 @@ size_t parse_calendar(GTFSData& data, const char* content_data, size_t content_s
         c.friday = get_bool(row, fri_idx);
         c.saturday = get_bool(row, sat_idx);
         c.sunday = get_bool(row, sun_idx);
-        c.start_date = get_val(row, start_idx);
-        c.end_date = get_val(row, end_idx2);
+        c.start_date = pool.intern(get_val(row, start_idx));
+        c.end_date = pool.intern(get_val(row, end_idx2));
 
-        if (merge_strategy == 1 && data.calendars[feed_id].count(c.service_id)) continue;
-        if (merge_strategy == 2 && data.calendars[feed_id].count(c.service_id)) throw std::runtime_error("Duplicate calendar: " + c.service_id);
+        if (merge_strategy == 1 && data.calendars.contains(c.feed_id, c.service_id)) continue;
+        if (merge_strategy == 2 && data.calendars.contains(c.feed_id, c.service_id)) throw std::runtime_error("Duplicate calendar: " + get_val(row, service_id_idx));
 
-        data.calendars[feed_id][c.service_id] = c;
+        data.calendars.put(c);
         count++;
         report_progress(bytes_read);
     }
@@ -820,13 +1219,13 @@ size_t parse_calendar_dates(GTFSData& data, const char* content_data, size_t con
     int date_idx = get_col_index(headers, "date");
     int exc_idx = get_col_index(headers, "exception_type");
 
+    std::vector<std::string> row;
     size_t count = 0;
     while (ptr < end) {
         ptr = advance_line(ptr, end, line_start, line_len);
         bytes_read += line_len + 1;
         if (line_len == 0) { report_progress(bytes_read); continue; }
-        std::string line(line_start, line_len);
-        auto row = parse_csv_line(line);
+        parse_csv_line(std::string_view(line_start, line_len), row);
         std::string service_id = get_val(row, service_id_idx);
         std::string date = get_val(row, date_idx);
         int exc = get_int(row, exc_idx);
@@ -839,7 +1238,23 @@ size_t parse_calendar_dates(GTFSData& data, const char* content_data, size_t con
     return count;
 }
 
-size_t parse_shapes(GTFSData& data, std::unordered_map<std::string, std::vector<Shape>>& merged_shapes, const char* content_data, size_t content_size, int merge_strategy, const std::string& feed_id, const std::function<void(size_t)>& on_progress = nullptr) {
+// Merges the shapes of one feed into those of the feeds before it. The rows that
+// lose a conflict are appended to lost, if given.
+void merge_shapes(std::unordered_map<uint32_t, std::vector<Shape>>& merged_shapes, std::unordered_map<uint32_t, std::vector<Shape>>& feed_shapes, int merge_strategy, const StringPool& pool, std::vector<Shape>* lost = nullptr) {
+    for (auto& [id, vec] : feed_shapes) {
+        auto it = merged_shapes.find(id);
+        if (it == merged_shapes.end()) {
+            merged_shapes.emplace(id, std::move(vec));
+            continue;
+        }
+        if (merge_strategy == 2) throw std::runtime_error("Duplicate shape: " + pool.get(id));
+        std::vector<Shape>& loser = merge_strategy == 1 ? vec : it->second;
+        if (lost) lost->insert(lost->end(), loser.begin(), loser.end());
+        if (merge_strategy != 1) it->second = std::move(vec);
+    }
+}
+
+size_t parse_shapes(GTFSData& data, std::unordered_map<uint32_t, std::vector<Shape>>& merged_shapes, const char* content_data, size_t content_size, int merge_strategy, const std::string& feed_id, const std::function<void(size_t)>& on_progress = nullptr, std::vector<Shape>* lost = nullptr) {
     const char* ptr = content_data;
     const char* end = content_data + content_size;
     const char* line_start; size_t line_len;
@@ -866,39 +1281,66 @@ size_t parse_shapes(GTFSData& data, std::unordered_map<std::string, std::vector<
     int seq_idx = get_col_index(headers, "shape_pt_sequence");
     int dist_idx = get_col_index(headers, "shape_dist_traveled");
 
-    std::unordered_map<std::string, std::vector<Shape>> feed_shapes;
+    StringPool& pool = data.string_pool;
+    uint32_t feed_id_int = pool.intern(feed_id);
+    std::unordered_map<uint32_t, std::vector<Shape>> feed_shapes;
 
+    // Same defaults as get_double/get_int on the split fields
+    auto view_double = [](std::pair<const char*, size_t> v, double default_val) {
+        double out = default_val;
+        if (v.second > 0) parse_double_view(v.first, v.second, out);
+        return out;
+    };
+
+    // shapes.txt is grouped by shape, so most rows repeat the previous shape_id
+    std::string_view last_shape;
+    uint32_t last_shape_id = 0;
+    std::vector<Shape>* last_points = nullptr;
+
+    CsvScanner scanner(ptr, static_cast<size_t>(end - ptr));
+    CsvLine line;
+    std::vector<std::string> row; // quoted rows
     size_t count = 0;
-    while (ptr < end) {
-        ptr = advance_line(ptr, end, line_start, line_len);
-        bytes_read += line_len + 1;
-        if (line_len == 0) { report_progress(bytes_read); continue; }
-        std::string line(line_start, line_len);
-        auto row = parse_csv_line(line);
+    while (scanner.next(line)) {
+        bytes_read += line.raw_length + 1;
+        if (line.length == 0) { report_progress(bytes_read); continue; }
         Shape s;
-        s.feed_id = feed_id;
-        s.shape_id = get_val(row, id_idx);
-        s.shape_pt_lat = get_double(row, lat_idx);
-        s.shape_pt_lon = get_double(row, lon_idx);
-        s.shape_pt_sequence = get_int(row, seq_idx);
-        std::string tmp = get_val(row, dist_idx);
-        if (!tmp.empty()) s.shape_dist_traveled = get_double(row, dist_idx);
-
-        feed_shapes[s.shape_id].push_back(s);
+        s.feed_id = feed_id_int;
+        if (line.split()) {
+            auto id_view = line.field(id_idx);
+            std::string_view id_sv(id_view.first, id_view.second);
+            if (!last_points || id_sv != last_shape) {
+                last_shape = id_sv;
+                last_shape_id = pool.intern(id_sv);
+                last_points = &feed_shapes[last_shape_id];
+            }
+            s.shape_id = last_shape_id;
+            s.shape_pt_lat = view_double(line.field(lat_idx), 0.0);
+            s.shape_pt_lon = view_double(line.field(lon_idx), 0.0);
+            auto seq_view = line.field(seq_idx);
+            s.shape_pt_sequence = parse_int_view(seq_view.first, seq_view.second);
+            s.shape_dist_traveled = view_double(line.field(dist_idx), ST_NO_DIST);
+            last_points->push_back(s);
+        } else {
+            parse_csv_line(std::string_view(line.start, line.length), row);
+            s.shape_id = pool.intern(get_val(row, id_idx));
+            s.shape_pt_lat = get_double(row, lat_idx);
+            s.shape_pt_lon = get_double(row, lon_idx);
+            s.shape_pt_sequence = get_int(row, seq_idx);
+            s.shape_dist_traveled = get_double(row, dist_idx, ST_NO_DIST);
+            feed_shapes[s.shape_id].push_back(s);
+            last_points = nullptr;
+        }
         count++;
         report_progress(bytes_read);
     }
 
     for (auto& [id, vec] : feed_shapes) {
-        if (merge_strategy == 1 && merged_shapes.count(id)) continue;
-        if (merge_strategy == 2 && merged_shapes.count(id)) throw std::runtime_error("Duplicate shape: " + id);
-
         std::sort(vec.begin(), vec.end(), [](const Shape& a, const Shape& b){
             return a.shape_pt_sequence < b.shape_pt_sequence;
         });
-
-        merged_shapes[id] = std::move(vec);
     }
+    merge_shapes(merged_shapes, feed_shapes, merge_strategy, pool, lost);
 
     if (on_progress && bytes_read > last_report) on_progress(bytes_read);
     return count;
@@ -937,13 +1379,13 @@ size_t parse_feed_info(GTFSData& data, const char* content_data, size_t content_
     int email_idx = get_col_index(headers, "feed_contact_email");
     int contact_url_idx = get_col_index(headers, "feed_contact_url");
 
+    std::vector<std::string> row;
     size_t count = 0;
     while (ptr < end) {
         ptr = advance_line(ptr, end, line_start, line_len);
         bytes_read += line_len + 1;
         if (line_len == 0) { report_progress(bytes_read); continue; }
-        std::string line(line_start, line_len);
-        auto row = parse_csv_line(line);
+        parse_csv_line(std::string_view(line_start, line_len), row);
         FeedInfo f;
         f.feed_id = feed_id;
         std::string tmp;
@@ -971,275 +1413,593 @@ size_t parse_feed_info(GTFSData& data, const char* content_data, size_t content_
     return count;
 }
 
-void load_feeds(GTFSData& data, const std::vector<BufferView>& zip_buffers, const std::vector<std::string>& feed_ids, int merge_strategy, LogFn log, ProgressFn progress, const std::vector<std::string>& files_to_load = {}) {
-    data.clear();
-
-    std::unordered_map<uint32_t, std::vector<StopTime>> merged_stop_times;
-    std::unordered_map<std::string, std::vector<Shape>> merged_shapes;
-
-    // Build effective file filter (empty = load all)
-    const std::vector<std::string> all_target_files = {
-        "agency.txt", "routes.txt", "trips.txt", "stops.txt", "stop_times.txt",
-        "calendar.txt", "calendar_dates.txt", "shapes.txt", "feed_info.txt"
+// Longest stretch of calendar.txt days materialized as bits; later days fall
+// back to the weekday rule (open-ended calendars often end in 2099)
+constexpr int32_t SERVICE_WINDOW_DAYS = 2 * 366;
+
+// Build per-service active-day bitsets and point every trip at its service
+void build_service_index(GTFSData& data) {
+    data.services.clear();
+    data.service_day_bits.clear();
+    data.service_by_intern_id.clear();
+
+    auto service_for = [&data](uint32_t feed_id, uint32_t service_id) -> uint32_t {
+        uint64_t key = (static_cast<uint64_t>(feed_id) << 32) | service_id;
+        auto it = data.service_by_intern_id.find(key);
+        if (it != data.service_by_intern_id.end()) return it->second;
+        uint32_t idx = static_cast<uint32_t>(data.services.size());
+        data.services.emplace_back();
+        data.service_by_intern_id.emplace(key, idx);
+        return idx;
     };
-    const std::vector<std::string>& target_files = files_to_load.empty() ? all_target_files : files_to_load;
 
-    int feed_idx = 0;
-    for (const auto& zip_data : zip_buffers) {
-        std::string current_feed_id = (feed_idx < (int)feed_ids.size()) ? feed_ids[feed_idx] : std::to_string(feed_idx);
-        uint32_t current_feed_id_int = data.string_pool.intern(current_feed_id);
+    // window of exception dates per service
+    std::vector<std::pair<int32_t, int32_t>> windows;
+    auto widen = [&windows](uint32_t idx, int32_t lo, int32_t hi) {
+        if (windows.size() <= idx) windows.resize(idx + 1, { INT32_MAX, INT32_MIN });
+        windows[idx].first = std::min(windows[idx].first, lo);
+        windows[idx].second = std::max(windows[idx].second, hi);
+    };
 
-        feed_idx++;
-        if (log) log("Processing feed " + current_feed_id + "...");
+    for (const Calendar& cal : data.calendars) {
+        uint32_t idx = service_for(cal.feed_id, cal.service_id);
+        int32_t start = parse_date_days(data.string_pool.get(cal.start_date));
+        int32_t end = parse_date_days(data.string_pool.get(cal.end_date));
+        if (start == NO_DAY || end == NO_DAY || end < start) continue;
+        ServiceDays& sd = data.services[idx];
+        sd.start_day = start;
+        sd.end_day = end;
+        sd.weekdays = (cal.sunday ? 1 : 0) | (cal.monday ? 2 : 0) | (cal.tuesday ? 4 : 0) | (cal.wednesday ? 8 : 0) |
+                      (cal.thursday ? 16 : 0) | (cal.friday ? 32 : 0) | (cal.saturday ? 64 : 0);
+        widen(idx, start, std::min<int64_t>(end, static_cast<int64_t>(start) + SERVICE_WINDOW_DAYS - 1));
+    }
+    for (const auto& [fid, services] : data.calendar_dates) {
+        uint32_t fid_int = data.string_pool.intern(fid);
+        for (const auto& [sid, dates] : services) {
+            uint32_t idx = service_for(fid_int, data.string_pool.intern(sid));
+            for (const auto& [date, exc] : dates) {
+                int32_t day = parse_date_days(date);
+                if (day != NO_DAY && (exc == 1 || exc == 2)) widen(idx, day, day);
+            }
+        }
+    }
+    windows.resize(data.services.size(), { INT32_MAX, INT32_MIN });
+
+    size_t words = 0;
+    for (size_t i = 0; i < data.services.size(); ++i) {
+        ServiceDays& sd = data.services[i];
+        if (windows[i].first > windows[i].second) continue;
+        sd.first_day = windows[i].first;
+        sd.day_count = static_cast<uint32_t>(static_cast<int64_t>(windows[i].second) - windows[i].first + 1);
+        sd.word_offset = words;
+        words += (sd.day_count + 63) / 64;
+    }
+    data.service_day_bits.assign(words, 0);
 
-        mz_zip_archive zip_archive;
-        memset(&zip_archive, 0, sizeof(zip_archive));
+    auto set_bit = [&data](const ServiceDays& sd, int32_t day, bool on) {
+        uint32_t bit = static_cast<uint32_t>(day - sd.first_day);
+        uint64_t& word = data.service_day_bits[sd.word_offset + (bit >> 6)];
+        if (on) word |= (uint64_t(1) << (bit & 63));
+        else word &= ~(uint64_t(1) << (bit & 63));
+    };
 
-        if (!mz_zip_reader_init_mem(&zip_archive, zip_data.data, zip_data.size, 0)) {
-            if (log) log("Failed to init zip reader for feed " + std::to_string(feed_idx));
-            std::cerr << "Failed to init zip reader" << std::endl;
-            continue;
+    for (ServiceDays& sd : data.services) {
+        int32_t last = std::min<int64_t>(sd.end_day, static_cast<int64_t>(sd.first_day) + sd.day_count - 1);
+        for (int32_t day = std::max(sd.start_day, sd.first_day); day <= last; ++day) {
+            int wday = static_cast<int>(((static_cast<int64_t>(day) % 7) + 11) % 7);
+            if ((sd.weekdays >> wday) & 1) set_bit(sd, day, true);
         }
+    }
+    for (const auto& [fid, services] : data.calendar_dates) {
+        uint32_t fid_int = data.string_pool.get_id(fid);
+        for (const auto& [sid, dates] : services) {
+            const ServiceDays& sd = data.services[service_for(fid_int, data.string_pool.get_id(sid))];
+            for (const auto& [date, exc] : dates) {
+                int32_t day = parse_date_days(date);
+                if (day == NO_DAY) continue;
+                if (exc == 1) set_bit(sd, day, true);
+                else if (exc == 2) set_bit(sd, day, false);
+            }
+        }
+    }
 
-        int64_t total_uncompressed_size = 0;
-        int file_count = mz_zip_reader_get_num_files(&zip_archive);
-
-        // Extract directly into vector<char> — no extra heap copy via mz_zip_reader_extract_file_to_heap
-        std::unordered_map<std::string, std::vector<char>> file_contents;
+    for (Trip& trip : data.trips.mut()) {
+        auto it = data.service_by_intern_id.find((static_cast<uint64_t>(trip.feed_id) << 32) | trip.service_id);
+        trip.service_index = it != data.service_by_intern_id.end() ? it->second : NO_SERVICE;
+    }
+}
 
-        for (int i = 0; i < file_count; i++) {
-            mz_zip_archive_file_stat file_stat;
-            if (!mz_zip_reader_file_stat(&zip_archive, i, &file_stat)) continue;
+// Parsed rows of one stop_times.txt chunk and the position of their feed in the load
+struct StopTimeBlock {
+    std::vector<StopTime> rows;
+    uint32_t feed_index = 0;
+};
+
+constexpr uint32_t NO_FEED_INDEX = 0xFFFFFFFFu;
+// Key bits of the first radix pass; a second counting pass per bucket orders the
+// low bits
+constexpr unsigned STOP_TIME_RADIX_BITS = 11;
+// Above this many low bits a bucket is stable-sorted instead of counted
+constexpr unsigned STOP_TIME_MAX_COUNT_BITS = 16;
+
+// The feed whose rows each trip_id keeps when several feeds define it: the last
+// (merge_strategy 0), the first (1), or none, throwing (2). Empty when all rows
+// come from one feed, in which case every row is kept.
+std::vector<uint32_t> stop_time_trip_owners(const GTFSData& data, const std::vector<StopTimeBlock>& blocks, size_t key_count, int merge_strategy) {
+    bool several_feeds = false;
+    for (const StopTimeBlock& b : blocks) {
+        if (b.feed_index != blocks.front().feed_index) { several_feeds = true; break; }
+    }
+    if (!several_feeds) return {};
+
+    // Blocks are in feed order, so a trip owned by another feed was defined earlier
+    std::vector<uint32_t> owners(key_count, NO_FEED_INDEX);
+    for (const StopTimeBlock& b : blocks) {
+        for (const StopTime& st : b.rows) {
+            uint32_t& owner = owners[st.trip_id];
+            if (owner == b.feed_index || owner == NO_FEED_INDEX) { owner = b.feed_index; continue; }
+            if (merge_strategy == 1) continue;
+            if (merge_strategy == 2) throw std::runtime_error("Duplicate trip_id in stop_times: " + data.string_pool.get(st.trip_id));
+            owner = b.feed_index;
+        }
+    }
+    return owners;
+}
 
-            std::string filename = file_stat.m_filename;
-            bool is_target = false;
-            for (const auto& tf : target_files) {
-                if (tf == filename) { is_target = true; break; }
-            }
-            if (!is_target) continue;
+// Orders the parsed rows by trip_id, then stop_sequence, into out: the order the
+// trip lookups and the compact storage rely on. The rows are radix sorted on the
+// interned trip_id (keys below key_count) across the pool, which is stable, so each
+// trip keeps its file order and only trips listed out of stop_sequence order are
+// sorted again. Rows of trips owned by another feed (see stop_time_trip_owners)
+// are dropped, and each block is released once it has been scattered.
+void sort_stop_times(std::vector<StopTimeBlock>& blocks, size_t key_count, const std::vector<uint32_t>& owners, ThreadPool& pool, std::vector<StopTime>& out) {
+    unsigned bits = static_cast<unsigned>(std::bit_width(key_count > 0 ? key_count - 1 : 0));
+    unsigned low_bits = bits > STOP_TIME_RADIX_BITS ? bits - STOP_TIME_RADIX_BITS : 0;
+    size_t bucket_count = (static_cast<size_t>(key_count > 0 ? key_count - 1 : 0) >> low_bits) + 1;
+    auto keep = [&owners](const StopTime& st, uint32_t feed_index) {
+        return owners.empty() || owners[st.trip_id] == feed_index;
+    };
 
-            size_t uncomp_size = static_cast<size_t>(file_stat.m_uncomp_size);
-            std::vector<char> buf(uncomp_size);
-            if (mz_zip_reader_extract_to_mem(&zip_archive, i, buf.data(), uncomp_size, 0)) {
-                total_uncompressed_size += static_cast<int64_t>(uncomp_size);
-                file_contents[filename] = std::move(buf);
+    // Rows per (block, bucket), then each block's first slot in every bucket
+    std::vector<uint32_t> slots(blocks.size() * bucket_count, 0);
+    pool.parallel_for(blocks.size(), [&](size_t b) {
+        uint32_t* counts = slots.data() + b * bucket_count;
+        for (const StopTime& st : blocks[b].rows) {
+            if (keep(st, blocks[b].feed_index)) counts[st.trip_id >> low_bits]++;
+        }
+    });
+    std::vector<size_t> bucket_start(bucket_count + 1, 0);
+    size_t total = 0;
+    for (size_t k = 0; k < bucket_count; ++k) {
+        bucket_start[k] = total;
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            uint32_t count = slots[b * bucket_count + k];
+            slots[b * bucket_count + k] = static_cast<uint32_t>(total);
+            total += count;
+        }
+    }
+    bucket_start[bucket_count] = total;
+    if (total > UINT32_MAX) throw std::runtime_error("Too many stop_times rows");
+
+    out.clear();
+    out.resize(total);
+    pool.parallel_for(blocks.size(), [&](size_t b) {
+        uint32_t* cursor = slots.data() + b * bucket_count;
+        for (const StopTime& st : blocks[b].rows) {
+            if (keep(st, blocks[b].feed_index)) out[cursor[st.trip_id >> low_bits]++] = st;
+        }
+        std::vector<StopTime>().swap(blocks[b].rows);
+    });
+    std::vector<uint32_t>().swap(slots);
+
+    // Each bucket holds whole trips: order it by the low key bits, then fix trips
+    // whose rows were not listed by stop_sequence
+    const uint32_t low_mask = (1u << low_bits) - 1;
+    pool.parallel_for(bucket_count, [&](size_t k) {
+        StopTime* first = out.data() + bucket_start[k];
+        StopTime* last = out.data() + bucket_start[k + 1];
+        size_t n = static_cast<size_t>(last - first);
+        if (n < 2) return;
+
+        if (low_bits > 0) {
+            bool sorted = std::is_sorted(first, last, [](const StopTime& a, const StopTime& b) { return a.trip_id < b.trip_id; });
+            if (!sorted && (low_bits > STOP_TIME_MAX_COUNT_BITS || n < (size_t(1) << low_bits))) {
+                std::stable_sort(first, last, [](const StopTime& a, const StopTime& b) { return a.trip_id < b.trip_id; });
+            } else if (!sorted) {
+                std::vector<StopTime> bucket(first, last);
+                std::vector<uint32_t> cursor((size_t(1) << low_bits) + 1, 0);
+                for (const StopTime& st : bucket) cursor[(st.trip_id & low_mask) + 1]++;
+                for (size_t d = 1; d < cursor.size(); ++d) cursor[d] += cursor[d - 1];
+                for (const StopTime& st : bucket) first[cursor[st.trip_id & low_mask]++] = st;
             }
         }
-        mz_zip_reader_end(&zip_archive);
-
-        std::vector<std::future<size_t>> futures;
-        std::atomic<int64_t> processed_bytes(0);
-
-        // Lambda that wraps a parser taking (GTFSData&, const char*, size_t, int, const string&, progress_fn)
-        auto process_file = [&](auto parser_func, const std::string& filename) -> size_t {
-            auto it = file_contents.find(filename);
-            if (it == file_contents.end()) return 0;
-            const std::vector<char>& vec = it->second;
-            auto inline_progress = [&](size_t file_bytes_done) {
-                if (!progress) return;
-                int64_t current = processed_bytes.load(std::memory_order_relaxed) + static_cast<int64_t>(file_bytes_done);
-                if (current > total_uncompressed_size) current = total_uncompressed_size;
-                progress("Loading GTFS Data (Feed " + current_feed_id + ")", current, total_uncompressed_size);
-            };
 
-            auto t0 = std::chrono::steady_clock::now();
-            size_t count = parser_func(data, vec.data(), vec.size(), merge_strategy, current_feed_id, inline_progress);
-            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
-            if (log) log("Parsed " + filename + " in " + std::to_string(ms) + "ms (" + std::to_string(count) + " records)");
-
-            int64_t current = processed_bytes.fetch_add(static_cast<int64_t>(vec.size())) + static_cast<int64_t>(vec.size());
-            if (progress) progress("Loading GTFS Data (Feed " + current_feed_id + ")", current, total_uncompressed_size);
-            return count;
-        };
+        for (StopTime* trip = first; trip != last;) {
+            StopTime* trip_end = trip + 1;
+            while (trip_end != last && trip_end->trip_id == trip->trip_id) ++trip_end;
+            auto by_sequence = [](const StopTime& a, const StopTime& b) { return a.stop_sequence < b.stop_sequence; };
+            if (!std::is_sorted(trip, trip_end, by_sequence)) std::stable_sort(trip, trip_end, by_sequence);
+            trip = trip_end;
+        }
+    });
+}
 
-        auto process_shapes_file = [&](const std::string& filename) -> size_t {
-            auto it = file_contents.find(filename);
-            if (it == file_contents.end()) return 0;
-            const std::vector<char>& vec = it->second;
-            auto inline_progress = [&](size_t file_bytes_done) {
-                if (!progress) return;
-                int64_t current = processed_bytes.load(std::memory_order_relaxed) + static_cast<int64_t>(file_bytes_done);
-                if (current > total_uncompressed_size) current = total_uncompressed_size;
-                progress("Loading GTFS Data (Feed " + current_feed_id + ")", current, total_uncompressed_size);
-            };
+// Rows that are merged across feeds once every feed has been parsed: the
+// stop_times chunks in feed order and the shapes of each shape_id
+struct FeedMerge {
+    std::vector<StopTimeBlock> stop_time_blocks;
+    std::unordered_map<uint32_t, std::vector<Shape>> shapes;
+};
+
+const std::vector<std::string> ALL_FEED_FILES = {
+    "agency.txt", "routes.txt", "trips.txt", "stops.txt", "stop_times.txt",
+    "calendar.txt", "calendar_dates.txt", "shapes.txt", "feed_info.txt"
+};
+
+// Files a lazy load keeps compressed and parses on first use
+const std::vector<std::string> LAZY_FEED_FILES = { "shapes.txt" };
+
+// Copies the compressed bytes of an archive entry; the archive itself is only
+// borrowed for the load
+bool keep_lazy_file(mz_zip_archive& zip, mz_uint index, const mz_zip_archive_file_stat& stat, const std::string& feed_id, LazyFile& out) {
+    if (stat.m_method != 0 && stat.m_method != MZ_DEFLATED) return false;
+    auto bytes = std::make_shared<std::vector<unsigned char>>(static_cast<size_t>(stat.m_comp_size));
+    if (!bytes->empty() && !mz_zip_reader_extract_to_mem(&zip, index, bytes->data(), bytes->size(), MZ_ZIP_FLAG_COMPRESSED_DATA)) return false;
+    out.name = stat.m_filename;
+    out.feed_id = feed_id;
+    out.method = stat.m_method;
+    out.crc = stat.m_crc32;
+    out.uncompressed_size = static_cast<size_t>(stat.m_uncomp_size);
+    out.compressed = std::move(bytes);
+    return true;
+}
 
-            auto t0 = std::chrono::steady_clock::now();
-            size_t count = parse_shapes(data, merged_shapes, vec.data(), vec.size(), merge_strategy, current_feed_id, inline_progress);
-            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
-            if (log) log("Parsed " + filename + " in " + std::to_string(ms) + "ms (" + std::to_string(count) + " records)");
+std::vector<char> inflate_lazy_file(const LazyFile& file) {
+    std::vector<char> out(file.uncompressed_size);
+    const std::vector<unsigned char>& in = *file.compressed;
+    if (file.method == 0) {
+        if (in.size() != out.size()) throw std::runtime_error("Corrupt " + file.name + " of feed " + file.feed_id);
+        if (!out.empty()) memcpy(out.data(), in.data(), out.size());
+    } else if (!out.empty()) {
+        size_t n = tinfl_decompress_mem_to_mem(out.data(), out.size(), in.data(), in.size(), TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
+        if (n != out.size()) throw std::runtime_error("Failed to inflate " + file.name + " of feed " + file.feed_id);
+    }
+    if (mz_crc32(MZ_CRC32_INIT, reinterpret_cast<const unsigned char*>(out.data()), out.size()) != file.crc) {
+        throw std::runtime_error("CRC mismatch in " + file.name + " of feed " + file.feed_id);
+    }
+    return out;
+}
 
-            int64_t current = processed_bytes.fetch_add(static_cast<int64_t>(vec.size())) + static_cast<int64_t>(vec.size());
-            if (progress) progress("Loading GTFS Data (Feed " + current_feed_id + ")", current, total_uncompressed_size);
-            return count;
-        };
+// One feed archive for parse_feeds; feed_index orders its stop_times against the
+// other feeds for the merge strategy
+struct FeedSource {
+    BufferView zip;
+    std::string feed_id;
+    uint32_t feed_index = 0;
+};
+
+// Runs the parse steps of one file type in feed order, whichever feed's file is
+// inflated first: the feeds append to the same tables, and which row wins a merge
+// conflict depends on the order. Every feed posts once, with an empty step when
+// it has no such file.
+class FeedOrderedSteps {
+public:
+    explicit FeedOrderedSteps(size_t feeds) : steps_(feeds), posted_(feeds, false) {}
+
+    // Runs every step that is now due on the calling thread, unless another
+    // thread already is
+    void post(size_t feed, std::function<void()> step) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        steps_[feed] = std::move(step);
+        posted_[feed] = true;
+        if (running_) return;
+        running_ = true;
+        while (next_ < posted_.size() && posted_[next_]) {
+            std::function<void()> due = std::move(steps_[next_++]);
+            lock.unlock();
+            try {
+                if (due) due();
+            } catch (...) {
+                lock.lock();
+                running_ = false;
+                throw;
+            }
+            lock.lock();
+        }
+        running_ = false;
+    }
 
-        if (file_contents.count("agency.txt"))
-            futures.push_back(std::async(std::launch::async, process_file, parse_agency, "agency.txt"));
-        if (file_contents.count("routes.txt"))
-            futures.push_back(std::async(std::launch::async, process_file, parse_routes, "routes.txt"));
-        if (file_contents.count("trips.txt"))
-            futures.push_back(std::async(std::launch::async, process_file, parse_trips, "trips.txt"));
-        if (file_contents.count("stops.txt"))
-            futures.push_back(std::async(std::launch::async, process_file, parse_stops, "stops.txt"));
-        if (file_contents.count("calendar.txt"))
-            futures.push_back(std::async(std::launch::async, process_file, parse_calendar, "calendar.txt"));
-        if (file_contents.count("calendar_dates.txt"))
-            futures.push_back(std::async(std::launch::async, process_file, parse_calendar_dates, "calendar_dates.txt"));
-        if (file_contents.count("shapes.txt"))
-            futures.push_back(std::async(std::launch::async, process_shapes_file, "shapes.txt"));
-        if (file_contents.count("feed_info.txt"))
-            futures.push_back(std::async(std::launch::async, process_file, parse_feed_info, "feed_info.txt"));
-
-        std::future<size_t> stop_times_future;
-        if (file_contents.count("stop_times.txt")) {
-            stop_times_future = std::async(std::launch::async,
-                [&data, &file_contents, progress, log, total_uncompressed_size, &processed_bytes, &merged_stop_times, merge_strategy, current_feed_id, current_feed_id_int]() -> size_t {
-                const std::vector<char>& content_vec = file_contents.at("stop_times.txt");
-                if (content_vec.empty()) return 0;
-
-                const char* content_data = content_vec.data();
-                size_t content_size = content_vec.size();
-
-                // Find header line
-                const char* nl = static_cast<const char*>(memchr(content_data, '\n', content_size));
-                if (!nl) return 0;
-                size_t header_len = static_cast<size_t>(nl - content_data);
-                if (header_len > 0 && content_data[header_len - 1] == '\r') header_len--;
-                std::string header_line(content_data, header_len);
-                remove_bom(header_line);
-                auto headers = parse_csv_line(header_line);
-
-                size_t start_pos = static_cast<size_t>(nl - content_data) + 1;
-                if (start_pos >= content_size) return 0;
-
-                processed_bytes.fetch_add(static_cast<int64_t>(start_pos));
-
-                // Cap thread count at min(hardware_concurrency, 8) to prevent oversubscription
-                unsigned int thread_count = std::thread::hardware_concurrency();
-                if (thread_count == 0) thread_count = 4;
-                if (thread_count > 8) thread_count = 8;
-
-                size_t data_size = content_size - start_pos;
-                size_t chunk_size = data_size / thread_count;
-
-                std::vector<std::future<std::vector<StopTime>>> chunk_futures;
-                size_t current_pos = start_pos;
-
-                for (unsigned int i = 0; i < thread_count; ++i) {
-                    size_t end_pos = current_pos + chunk_size;
-                    if (i == thread_count - 1) {
-                        end_pos = content_size;
-                    } else {
-                        // Advance to next newline boundary
-                        const char* search_start = content_data + end_pos;
-                        size_t remaining = content_size - end_pos;
-                        const char* next_nl = static_cast<const char*>(memchr(search_start, '\n', remaining));
-                        end_pos = next_nl ? static_cast<size_t>(next_nl - content_data) + 1 : content_size;
+private:
+    std::mutex mutex_;
+    std::vector<std::function<void()>> steps_;
+    std::vector<bool> posted_;
+    size_t next_ = 0;
+    bool running_ = false;
+};
+
+// A feed while its tasks run
+struct FeedLoad {
+    const FeedSource* source = nullptr;
+    uint32_t feed_id_int = 0;
+    bool opened = false;
+    std::unordered_map<std::string, std::pair<mz_uint, size_t>> files; // target files in the archive: index, uncompressed size
+    int64_t total_bytes = 0;                         // uncompressed size of those files
+    std::atomic<int64_t> processed_bytes{0};
+    std::vector<std::vector<StopTime>> stop_time_chunks;
+
+    std::mutex mutex; // guards the fields below
+    std::vector<FileLoadStats> file_stats;
+    bool started = false;
+    std::chrono::steady_clock::time_point first_start, last_end;
+
+    // Widens the feed's wall time to cover a task that started at t0 and ends now
+    void add_span(std::chrono::steady_clock::time_point t0) {
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!started || t0 < first_start) first_start = t0;
+        if (!started || now > last_end) last_end = now;
+        started = true;
+    }
+};
+
+using FileParser = std::function<size_t(const char*, size_t, const std::string&, const std::function<void(size_t)>&)>;
+
+// Parses the feed archives into data on pool. Every file and every stop_times.txt
+// block is a task, and the feeds run side by side; the parse steps of one file
+// type run in feed order. stop_times and shapes are collected in merge and only
+// land in data in finalize_feeds. Returns, per feed, whether its buffer was a
+// readable zip archive; feeds that were not are skipped.
+std::vector<bool> parse_feeds(GTFSData& data, FeedMerge& merge, const std::vector<FeedSource>& feeds, int merge_strategy, LogFn log, ProgressFn progress, const std::vector<std::string>& target_files, const std::vector<std::string>& lazy_files, ThreadPool& pool) {
+    std::vector<std::unique_ptr<FeedLoad>> loads;
+    for (const FeedSource& source : feeds) {
+        auto load = std::make_unique<FeedLoad>();
+        load->source = &source;
+        load->feed_id_int = data.string_pool.intern(source.feed_id);
+
+        mz_zip_archive zip;
+        memset(&zip, 0, sizeof(zip));
+        if (mz_zip_reader_init_mem(&zip, source.zip.data, source.zip.size, 0)) {
+            load->opened = true;
+            int file_count = static_cast<int>(mz_zip_reader_get_num_files(&zip));
+            for (int i = 0; i < file_count; i++) {
+                mz_zip_archive_file_stat file_stat;
+                if (!mz_zip_reader_file_stat(&zip, static_cast<mz_uint>(i), &file_stat)) continue;
+                std::string filename = file_stat.m_filename;
+                if (std::find(target_files.begin(), target_files.end(), filename) == target_files.end()) continue;
+                if (std::find(lazy_files.begin(), lazy_files.end(), filename) != lazy_files.end() &&
+                    std::find(LAZY_FEED_FILES.begin(), LAZY_FEED_FILES.end(), filename) != LAZY_FEED_FILES.end()) {
+                    LazyFile kept;
+                    if (keep_lazy_file(zip, static_cast<mz_uint>(i), file_stat, source.feed_id, kept)) {
+                        data.lazy_files.add(std::move(kept));
+                        continue;
                     }
-
-                    if (current_pos >= content_size) break;
-
-                    size_t len = end_pos - current_pos;
-                    const char* ptr = content_data + current_pos;
-
-                    chunk_futures.push_back(std::async(std::launch::async,
-                        [ptr, len, headers, &data, &processed_bytes, progress, total_uncompressed_size, current_feed_id, current_feed_id_int]() {
-                            std::vector<StopTime> vec;
-                            vec.reserve(len / 50);
-
-                            auto chunk_progress = [&](size_t delta_bytes) {
-                                int64_t current = processed_bytes.fetch_add(static_cast<int64_t>(delta_bytes)) + static_cast<int64_t>(delta_bytes);
-                                if (progress) {
-                                    if (current > total_uncompressed_size) current = total_uncompressed_size;
-                                    progress("Loading GTFS Data (Feed " + current_feed_id + ")", current, total_uncompressed_size);
-                                }
-                            };
-
-                            parse_stop_times_chunk(data.string_pool, ptr, len, headers, current_feed_id_int, vec, chunk_progress);
-                            return vec;
-                        }
-                    ));
-                    current_pos = end_pos;
                 }
+                load->files[filename] = { static_cast<mz_uint>(i), static_cast<size_t>(file_stat.m_uncomp_size) };
+                load->total_bytes += static_cast<int64_t>(file_stat.m_uncomp_size);
+            }
+            mz_zip_reader_end(&zip);
+        }
+        loads.push_back(std::move(load));
+    }
 
-                std::unordered_map<uint32_t, std::vector<StopTime>> current_feed_stop_times;
-                size_t total_count = 0;
+    // Each task reads the archive through its own reader; miniz readers are not
+    // safe to share between threads
+    auto open_zip = [](const FeedLoad& load, mz_zip_archive& zip) {
+        memset(&zip, 0, sizeof(zip));
+        if (!mz_zip_reader_init_mem(&zip, load.source->zip.data, load.source->zip.size, 0)) {
+            throw std::runtime_error("Failed to reopen the archive of feed " + load.source->feed_id);
+        }
+    };
+    auto report = [progress](FeedLoad& load, int64_t current) {
+        if (!progress) return;
+        if (current > load.total_bytes) current = load.total_bytes;
+        progress("Loading GTFS Data (Feed " + load.source->feed_id + ")", current, load.total_bytes);
+    };
+    auto add_file_stats = [](FeedLoad& load, const std::string& filename, size_t bytes, size_t records, double inflate, double parse) {
+        std::lock_guard<std::mutex> lock(load.mutex);
+        load.file_stats.push_back({ load.source->feed_id, filename, bytes, records, inflate, parse });
+    };
 
-                for (auto& f : chunk_futures) {
-                    auto chunk_vec = f.get();
-                    total_count += chunk_vec.size();
-                    for (auto& st : chunk_vec) {
-                        current_feed_stop_times[st.trip_id].push_back(std::move(st));
-                    }
-                }
+    auto table = [&data, merge_strategy](auto parser) -> FileParser {
+        return [&data, merge_strategy, parser](const char* content, size_t size, const std::string& feed_id, const std::function<void(size_t)>& on_progress) {
+            return parser(data, content, size, merge_strategy, feed_id, on_progress);
+        };
+    };
+    const std::vector<std::pair<std::string, FileParser>> parsers = {
+        { "shapes.txt", [&data, &merge, merge_strategy](const char* content, size_t size, const std::string& feed_id, const std::function<void(size_t)>& on_progress) {
+            return parse_shapes(data, merge.shapes, content, size, merge_strategy, feed_id, on_progress, &data.merge_lost_shapes.mut());
+        } },
+        { "trips.txt", table(parse_trips) },
+        { "stops.txt", table(parse_stops) },
+        { "routes.txt", table(parse_routes) },
+        { "calendar_dates.txt", table(parse_calendar_dates) },
+        { "calendar.txt", table(parse_calendar) },
+        { "agency.txt", table(parse_agency) },
+        { "feed_info.txt", table(parse_feed_info) },
+    };
+    std::vector<std::unique_ptr<FeedOrderedSteps>> steps;
+    for (size_t p = 0; p < parsers.size(); ++p) steps.push_back(std::make_unique<FeedOrderedSteps>(loads.size()));
+
+    TaskGroup tasks(pool);
+    size_t max_in_flight = pool.size() * STREAM_BLOCKS_PER_THREAD;
+
+    // stop_times.txt first: its inflate runs the longest and feeds the most tasks
+    for (auto& load_ptr : loads) {
+        FeedLoad& load = *load_ptr;
+        auto it = load.files.find("stop_times.txt");
+        if (it == load.files.end()) continue;
+        auto [index, bytes] = it->second;
+        tasks.run([&data, &load, &pool, &open_zip, &report, &add_file_stats, log, index, bytes, max_in_flight] {
+            auto t0 = std::chrono::steady_clock::now();
+            mz_zip_archive zip;
+            open_zip(load, zip);
+            std::unique_ptr<mz_zip_archive, decltype(&mz_zip_reader_end)> zip_guard(&zip, &mz_zip_reader_end);
 
-                for (auto& [tid, vec] : current_feed_stop_times) {
-                    if (merge_strategy == 1 && merged_stop_times.count(tid)) continue;
-                    if (merge_strategy == 2 && merged_stop_times.count(tid)) {
-                        throw std::runtime_error("Duplicate trip_id in stop_times: " + data.string_pool.get(tid));
-                    }
+            auto chunk_progress = [&load, &report](size_t delta_bytes) {
+                report(load, load.processed_bytes.fetch_add(static_cast<int64_t>(delta_bytes)) + static_cast<int64_t>(delta_bytes));
+            };
+            StreamTimings timings;
+            size_t total_count = parse_stop_times_stream(data.string_pool, zip, index, load.feed_id_int, pool, max_in_flight, load.stop_time_chunks, chunk_progress, &timings);
+            add_file_stats(load, "stop_times.txt", bytes, total_count, timings.inflate_ns / 1e6, timings.parse_ns / 1e6);
+            if (log) log("Loaded " + std::to_string(total_count) + " entries from stop_times.txt");
+            load.add_span(t0);
+        });
+    }
 
-                    std::sort(vec.begin(), vec.end(), [](const StopTime& a, const StopTime& b) {
-                        return a.stop_sequence < b.stop_sequence;
-                    });
-                    merged_stop_times[tid] = std::move(vec);
+    for (size_t p = 0; p < parsers.size(); ++p) {
+        for (size_t f = 0; f < loads.size(); ++f) {
+            FeedLoad& load = *loads[f];
+            FeedOrderedSteps& ordered = *steps[p];
+            const std::string& filename = parsers[p].first;
+            auto it = load.files.find(filename);
+            if (it == load.files.end()) {
+                ordered.post(f, nullptr);
+                continue;
+            }
+            auto [index, bytes] = it->second;
+            tasks.run([&load, &ordered, &open_zip, &report, &add_file_stats, &parser = parsers[p].second, &filename, log, f, index, bytes] {
+                auto t0 = std::chrono::steady_clock::now();
+                // Extract directly into vector<char>, no extra heap copy via mz_zip_reader_extract_file_to_heap
+                auto buf = std::make_shared<std::vector<char>>(bytes);
+                {
+                    mz_zip_archive zip;
+                    open_zip(load, zip);
+                    std::unique_ptr<mz_zip_archive, decltype(&mz_zip_reader_end)> zip_guard(&zip, &mz_zip_reader_end);
+                    if (!mz_zip_reader_extract_to_mem(&zip, index, buf->data(), buf->size(), 0)) buf.reset();
+                }
+                double inflate_ms = elapsed_ns(t0) / 1e6;
+                if (!buf) {
+                    ordered.post(f, nullptr);
+                    return;
                 }
 
-                if (log) log("Loaded " + std::to_string(total_count) + " entries from stop_times.txt");
-                return total_count;
+                ordered.post(f, [&load, &report, &add_file_stats, &parser, &filename, log, buf, inflate_ms, t0] {
+                    auto inline_progress = [&load, &report](size_t file_bytes_done) {
+                        report(load, load.processed_bytes.load(std::memory_order_relaxed) + static_cast<int64_t>(file_bytes_done));
+                    };
+                    auto parse_t0 = std::chrono::steady_clock::now();
+                    size_t count = parser(buf->data(), buf->size(), load.source->feed_id, inline_progress);
+                    double ms = elapsed_ns(parse_t0) / 1e6;
+                    if (log) log("Parsed " + filename + " in " + std::to_string(ms) + "ms (" + std::to_string(count) + " records)");
+                    add_file_stats(load, filename, buf->size(), count, inflate_ms, ms);
+                    report(load, load.processed_bytes.fetch_add(static_cast<int64_t>(buf->size())) + static_cast<int64_t>(buf->size()));
+                    load.add_span(t0);
+                });
             });
         }
+    }
+    tasks.wait();
+
+    // A feed's wall time runs from its first task to its last and overlaps the
+    // other feeds'; busy time counts inflate and parse of its files
+    std::vector<bool> opened;
+    for (auto& load_ptr : loads) {
+        FeedLoad& load = *load_ptr;
+        opened.push_back(load.opened);
+        for (auto& chunk : load.stop_time_chunks) {
+            if (!chunk.empty()) merge.stop_time_blocks.push_back({ std::move(chunk), load.source->feed_index });
+        }
+        if (!load.opened) continue;
+
+        std::sort(load.file_stats.begin(), load.file_stats.end(), [](const FileLoadStats& a, const FileLoadStats& b) { return a.file < b.file; });
+        double wall_ms = load.started ? std::chrono::duration<double, std::milli>(load.last_end - load.first_start).count() : 0;
+        PhaseLoadStats phase{ "parse " + load.source->feed_id, wall_ms, 0, static_cast<unsigned int>(pool.size()) };
+        for (const FileLoadStats& f : load.file_stats) phase.busy_ms += f.inflate_ms + f.parse_ms;
+        data.load_stats.phases.push_back(std::move(phase));
+        data.load_stats.files.insert(data.load_stats.files.end(), load.file_stats.begin(), load.file_stats.end());
+    }
+    return opened;
+}
+
+// Moves the merged shapes and stop_times into data and builds the indexes that
+// span every feed
+void finalize_feeds(GTFSData& data, FeedMerge& merge, int merge_strategy, LogFn log, ThreadPool& pool) {
+    // Runs one finalize step and records its time; steps on the pool also record
+    // how busy its threads were
+    auto phase = [&data, &pool](const char* name, bool on_pool, auto&& step) {
+        auto t0 = std::chrono::steady_clock::now();
+        uint64_t busy0 = pool.busy_ns();
+        step();
+        double ms = elapsed_ns(t0) / 1e6;
+        if (on_pool) data.load_stats.phases.push_back({ name, ms, (pool.busy_ns() - busy0) / 1e6, static_cast<unsigned int>(pool.size()) });
+        else data.load_stats.phases.push_back({ name, ms, ms, 1 });
+    };
 
-        for (auto& f : futures) {
-            f.get();
+    if (log) log("Indexing shapes...");
+    phase("index shapes", false, [&] {
+        std::vector<Shape>& shapes = data.shapes.mut();
+        for (auto& [id, vec] : merge.shapes) {
+            shapes.insert(shapes.end(), vec.begin(), vec.end());
         }
-        if (stop_times_future.valid()) {
-            stop_times_future.get();
+        data.shapes_by_id.build(shapes.data(), shapes.size());
+    });
+
+    if (log) log("Sorting stop times...");
+    phase("sort stop_times", true, [&] {
+        std::vector<uint32_t> owners = stop_time_trip_owners(data, merge.stop_time_blocks, data.string_pool.size(), merge_strategy);
+        // Kept for feed changes, which merge the feeds again
+        std::vector<StopTime>& lost = data.merge_lost_stop_times.mut();
+        lost.clear();
+        if (!owners.empty()) {
+            for (const StopTimeBlock& b : merge.stop_time_blocks) {
+                for (const StopTime& st : b.rows) {
+                    if (owners[st.trip_id] != b.feed_index) lost.push_back(st);
+                }
+            }
         }
+        sort_stop_times(merge.stop_time_blocks, data.string_pool.size(), owners, pool, data.stop_times.mut());
+        std::vector<StopTimeBlock>().swap(merge.stop_time_blocks);
+    });
 
-    } // end feed loop
+    if (log) log("Indexing stop times by stop_id...");
+    phase("index stop_times", true, [&] {
+        data.stop_times_by_stop_id.build(data.stop_time_rows(), data.string_pool.size(), &pool);
+    });
 
-    if (log) log("All feeds loaded. Finalizing data...");
+    if (log) log("Building service calendars...");
+    phase("build service calendars", false, [&] { build_service_index(data); });
 
-    for (auto& [id, vec] : merged_shapes) {
-        data.shapes.insert(data.shapes.end(), vec.begin(), vec.end());
-    }
+    if (log) log("Indexing trips...");
+    phase("index trips", false, [&] { data.build_trip_indexes(); });
 
-    size_t total_st = 0;
-    for (const auto& [tid, vec] : merged_stop_times) {
-        total_st += vec.size();
-    }
-    data.stop_times.reserve(total_st);
+    if (log) log("Indexing stop locations...");
+    phase("index stop locations", false, [&] { data.build_stop_grid(); });
+}
 
-    for (auto& [tid, vec] : merged_stop_times) {
-        data.stop_times.insert(data.stop_times.end(), vec.begin(), vec.end());
-    }
+// parse_threads sizes the pool shared by the parse of every feed and the
+// finalize steps; 0 = one thread per hardware thread. Files of LAZY_FEED_FILES
+// named in lazy_files are kept compressed and parsed on first use by
+// load_lazy_file.
+void load_feeds(GTFSData& data, const std::vector<BufferView>& zip_buffers, const std::vector<std::string>& feed_ids, int merge_strategy, LogFn log, ProgressFn progress, const std::vector<std::string>& files_to_load = {}, unsigned int parse_threads = 0, const std::vector<std::string>& lazy_files = {}) {
+    auto load_t0 = std::chrono::steady_clock::now();
+    data.clear();
+    data.lazy_files.merge_strategy = merge_strategy;
+    ThreadPool pool(parse_threads);
 
-    if (log) log("Sorting stop times...");
-    std::sort(data.stop_times.begin(), data.stop_times.end(),
-        [](const StopTime& a, const StopTime& b) {
-            if (a.trip_id != b.trip_id) return a.trip_id < b.trip_id;
-            return a.stop_sequence < b.stop_sequence;
-        });
+    // Parsed stop_times chunks and shapes of every feed; merged at the end
+    FeedMerge merge;
 
-    if (log) log("Indexing stop times by stop_id...");
-    for (size_t i = 0; i < data.stop_times.size(); ++i) {
-        data.stop_times_by_stop_id[data.stop_times[i].stop_id].push_back(i);
+    // Empty filter = load all
+    const std::vector<std::string>& target_files = files_to_load.empty() ? ALL_FEED_FILES : files_to_load;
+
+    std::vector<FeedSource> feeds;
+    for (size_t i = 0; i < zip_buffers.size(); ++i) {
+        std::string current_feed_id = i < feed_ids.size() ? feed_ids[i] : std::to_string(i);
+        if (log) log("Processing feed " + current_feed_id + "...");
+        data.feed_order.push_back(current_feed_id);
+        feeds.push_back({ zip_buffers[i], std::move(current_feed_id), static_cast<uint32_t>(i) });
     }
 
-    // Build O(1) trip lookup index: key = (feed_id_intern << 32) | trip_id_intern
-    if (log) log("Building trip intern index...");
-    for (const auto& [fid_str, feed_map] : data.trips) {
-        uint32_t fid_int = data.string_pool.get_id(fid_str);
-        for (const auto& [tid_str, trip] : feed_map) {
-            uint32_t tid_int = data.string_pool.get_id(tid_str);
-            if (fid_int != 0xFFFFFFFF && tid_int != 0xFFFFFFFF) {
-                uint64_t key = (static_cast<uint64_t>(fid_int) << 32) | tid_int;
-                data.trip_by_intern_id[key] = &trip;
-            }
-        }
+    std::vector<bool> opened = parse_feeds(data, merge, feeds, merge_strategy, log, progress, target_files, lazy_files, pool);
+    for (size_t i = 0; i < opened.size(); ++i) {
+        if (opened[i]) continue;
+        if (log) log("Failed to init zip reader for feed " + std::to_string(i + 1));
+        std::cerr << "Failed to init zip reader" << std::endl;
     }
 
+    if (log) log("All feeds loaded. Finalizing data...");
+    finalize_feeds(data, merge, merge_strategy, log, pool);
+    data.load_stats.total_ms = elapsed_ns(load_t0) / 1e6;
     if (log) log("GTFS Data Loading Complete.");
 }
 
@@ -0,0 +1,670 @@
+#include "GTFS.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace gtfs {
+
+// Native query layer shared by the object and columnar getters; results are
+// row indices so callers decide how to materialize them.
+
+struct StopTimeFilter {
+    uint32_t trip_id = 0xFFFFFFFF;
+    uint32_t stop_id = 0xFFFFFFFF;
+    uint32_t feed_id = 0xFFFFFFFF;
+    bool has_trip_id = false;
+    bool has_stop_id = false;
+    bool has_feed_id = false;
+    int32_t start_time = -1;   // window applies when both are set
+    int32_t end_time = -1;
+    int32_t day = NO_DAY;      // service day filter
+    bool timestamp_mode = false; // also match previous-day trips running past midnight
+};
+
+struct StopTimeMatch {
+    uint32_t row;
+    int8_t day_offset; // 0 = service day of the query, -1 = previous service day
+};
+
+std::vector<StopTimeMatch> collect_stop_times(const GTFSData& data, const StopTimeFilter& f) {
+    std::vector<StopTimeMatch> results;
+
+    bool has_time_window = (f.start_time != -1 && f.end_time != -1);
+    bool has_date = (f.day != NO_DAY);
+    StopTimeRows stop_times = data.stop_time_rows();
+
+    auto check_service = [&](uint32_t feed_id_int, uint32_t trip_id_int, int32_t day) -> bool {
+        const Trip* trip = data.trips.find(feed_id_int, trip_id_int);
+        return trip && data.service_active(trip->service_index, day);
+    };
+
+    auto check_inclusion = [&](uint32_t row) {
+        const StopTime st = stop_times[row];
+        if (f.has_trip_id && st.trip_id != f.trip_id) return;
+        if (f.has_stop_id && st.stop_id != f.stop_id) return;
+        if (f.has_feed_id && st.feed_id != f.feed_id) return;
+
+        bool active_today = true;
+        bool active_yesterday = false;
+
+        if (has_date) {
+            active_today = check_service(st.feed_id, st.trip_id, f.day);
+            if (f.timestamp_mode) {
+                active_yesterday = check_service(st.feed_id, st.trip_id, f.day - 1);
+            }
+        }
+
+        if (active_today) {
+            bool match_today = true;
+            if (has_time_window) {
+                 bool arrival_in = (st.arrival_time != ST_NO_TIME && st.arrival_time >= f.start_time && st.arrival_time <= f.end_time);
+                 bool departure_in = (st.departure_time != ST_NO_TIME && st.departure_time >= f.start_time && st.departure_time <= f.end_time);
+                 if (!arrival_in && !departure_in) match_today = false;
+            }
+            if (match_today) results.push_back({row, 0});
+        }
+
+        if (active_yesterday) {
+            bool match_yesterday = true;
+
+            bool arrival_spill = (st.arrival_time != ST_NO_TIME && st.arrival_time >= 86400);
+            bool departure_spill = (st.departure_time != ST_NO_TIME && st.departure_time >= 86400);
+
+            if (!arrival_spill && !departure_spill) {
+                match_yesterday = false;
+            } else if (has_time_window) {
+                 int shifted_start = f.start_time + 86400;
+                 int shifted_end = f.end_time + 86400;
+
+                 bool arrival_in = (st.arrival_time != ST_NO_TIME && st.arrival_time >= shifted_start && st.arrival_time <= shifted_end);
+                 bool departure_in = (st.departure_time != ST_NO_TIME && st.departure_time >= shifted_start && st.departure_time <= shifted_end);
+
+                 if (!arrival_in && !departure_in) match_yesterday = false;
+            }
+            if (match_yesterday) results.push_back({row, -1});
+        }
+    };
+
+    if (f.has_trip_id) {
+        auto [first, last] = stop_times.trip_rows(f.trip_id);
+        for (uint32_t row = first; row != last; ++row) {
+            check_inclusion(row);
+        }
+
+    } else if (f.has_stop_id) {
+        const auto& index = data.stop_times_by_stop_id;
+        if (!has_time_window) {
+            for (uint32_t idx : index.find(f.stop_id)) {
+                check_inclusion(idx);
+            }
+        } else {
+            // Rows are in departure order: binary search today's window and, for
+            // trips from the previous service day, the window shifted by 24h
+            auto today = index.find_window(f.stop_id, stop_times, f.start_time, f.end_time);
+            StopTimeIndex::Range spill;
+            if (has_date && f.timestamp_mode) {
+                spill = index.find_window(f.stop_id, stop_times, f.start_time + 86400, f.end_time + 86400);
+                if (spill.first < today.last) spill.first = today.last;
+                if (spill.last < spill.first) spill.last = spill.first;
+            }
+            for (uint32_t idx : today) {
+                check_inclusion(idx);
+            }
+            for (uint32_t idx : spill) {
+                check_inclusion(idx);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < stop_times.size(); ++i) {
+            check_inclusion(static_cast<uint32_t>(i));
+        }
+    }
+
+    return results;
+}
+
+constexpr int32_t NO_DELAY = INT32_MIN;
+
+// A scheduled stop time with the prediction of the trip update matching its trip
+// run. Delays are seconds, NO_DELAY when nothing predicts the stop.
+struct RealtimeStopTimeMatch {
+    uint32_t row;
+    int8_t day_offset;
+    bool has_trip_update = false;
+    bool has_stop_update = false;   // the feed has a stop time update for this stop
+    bool skipped = false;           // SKIPPED stop or CANCELED trip
+    int32_t arrival_delay = NO_DELAY;
+    int32_t departure_delay = NO_DELAY;
+    int64_t arrival_timestamp = -1; // POSIX times of the stop's own update
+    int64_t departure_timestamp = -1;
+};
+
+// GTFS-realtime schedule relationships
+constexpr int RT_STOP_SKIPPED = 1;
+constexpr int RT_STOP_NO_DATA = 2;
+constexpr int RT_TRIP_CANCELED = 3;
+
+// Arrival and departure delay of one stop time update; either falls back to the
+// other. Absolute times need the POSIX time of the service day's midnight.
+inline void stop_update_delays(const RealtimeStopTimeUpdate& stu, const StopTime* scheduled, const std::optional<int64_t>& day_epoch,
+                               int32_t& arrival, int32_t& departure) {
+    auto delay = [&](int delay, int64_t time, int32_t scheduled_time) -> int32_t {
+        if (delay != NO_DELAY) return delay;
+        if (time != -1 && day_epoch && scheduled && scheduled_time != ST_NO_TIME) {
+            return static_cast<int32_t>(time - (*day_epoch + scheduled_time));
+        }
+        return NO_DELAY;
+    };
+    arrival = delay(stu.arrival_delay, stu.arrival_time, scheduled ? scheduled->arrival_time : ST_NO_TIME);
+    departure = delay(stu.departure_delay, stu.departure_time, scheduled ? scheduled->departure_time : ST_NO_TIME);
+    if (arrival == NO_DELAY) arrival = departure;
+    if (departure == NO_DELAY) departure = arrival;
+}
+
+// Fills the prediction of m (row and day_offset set) for service day `day`. A stop
+// without its own update takes the delay of the nearest earlier updated stop,
+// skipping SKIPPED ones; NO_DATA ends propagation. Stops before the first update
+// use the trip's delay, if the feed gives one.
+void predict_stop_time(const GTFSData& data, int32_t day, const std::optional<int32_t>& utc_offset, RealtimeStopTimeMatch& m) {
+    StopTimeRows stop_times = data.stop_time_rows();
+    const StopTime st = stop_times[m.row];
+    const RealtimeTripRef* ref = data.realtime_join.find(st.feed_id, st.trip_id, day);
+    if (!ref) return;
+    m.has_trip_update = true;
+
+    const RealtimeTripUpdate& tu = *ref->update;
+    if (tu.trip.schedule_relationship == RT_TRIP_CANCELED) {
+        m.skipped = true;
+        return;
+    }
+
+    std::optional<int64_t> day_epoch;
+    if (utc_offset && day != NO_DAY) day_epoch = static_cast<int64_t>(day) * 86400 - *utc_offset;
+
+    // Scheduled row of the trip at a sequence, for delays given as absolute times
+    auto scheduled = [&](int32_t stop_sequence) -> std::optional<StopTime> {
+        if (stop_sequence == st.stop_sequence) return st;
+        auto [first, last] = stop_times.trip_rows(st.trip_id);
+        for (uint32_t row = first; row != last; ++row) {
+            StopTime other = stop_times[row];
+            if (other.feed_id == st.feed_id && other.stop_sequence == stop_sequence) return other;
+        }
+        return std::nullopt;
+    };
+
+    const RealtimeStopRef* first = data.realtime_join.stops_begin(*ref);
+    const RealtimeStopRef* it = std::upper_bound(first, data.realtime_join.stops_end(*ref), st.stop_sequence, [](int32_t seq, const RealtimeStopRef& s) {
+        return seq < s.stop_sequence;
+    });
+
+    if (it != first && (it - 1)->stop_sequence == st.stop_sequence) {
+        const RealtimeStopTimeUpdate& own = *(it - 1)->update;
+        m.has_stop_update = true;
+        m.arrival_timestamp = own.arrival_time;
+        m.departure_timestamp = own.departure_time;
+        if (own.schedule_relationship == RT_STOP_SKIPPED) {
+            m.skipped = true;
+            return;
+        }
+        if (own.schedule_relationship == RT_STOP_NO_DATA) return;
+        stop_update_delays(own, &st, day_epoch, m.arrival_delay, m.departure_delay);
+        if (m.arrival_delay != NO_DELAY) return;
+        --it;
+    }
+
+    while (it != first) {
+        --it;
+        const RealtimeStopTimeUpdate& prev = *it->update;
+        if (prev.schedule_relationship == RT_STOP_SKIPPED) continue;
+        if (prev.schedule_relationship == RT_STOP_NO_DATA) return;
+        int32_t arrival, departure;
+        std::optional<StopTime> prev_st = scheduled(it->stop_sequence);
+        stop_update_delays(prev, prev_st ? &*prev_st : nullptr, day_epoch, arrival, departure);
+        if (departure == NO_DELAY) return;
+        m.arrival_delay = m.departure_delay = departure;
+        return;
+    }
+
+    if (tu.delay != NO_DELAY) m.arrival_delay = m.departure_delay = tu.delay;
+}
+
+// collect_stop_times with the realtime prediction of every row
+std::vector<RealtimeStopTimeMatch> collect_stop_times_with_realtime(const GTFSData& data, const StopTimeFilter& f, const std::optional<int32_t>& utc_offset) {
+    std::vector<StopTimeMatch> rows = collect_stop_times(data, f);
+    std::vector<RealtimeStopTimeMatch> results(rows.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        RealtimeStopTimeMatch& m = results[i];
+        m.row = rows[i].row;
+        m.day_offset = rows[i].day_offset;
+        if (data.realtime_join.size() == 0) continue;
+        predict_stop_time(data, f.day != NO_DAY ? f.day + m.day_offset : NO_DAY, utc_offset, m);
+    }
+    return results;
+}
+
+// Next departures at a stop, or at a station and its child stops
+struct DepartureQuery {
+    uint32_t stop_id = NO_STR;
+    uint32_t feed_id = NO_STR; // NO_STR = any feed
+    bool include_children = false;
+    int32_t day = NO_DAY;      // without a day, service calendars are not checked
+    int32_t after = 0;         // seconds since midnight of day
+    int32_t before = -1;       // inclusive bound, -1 = none
+    size_t limit = 10;
+};
+
+struct Departure {
+    uint32_t row;
+    int8_t day_offset; // -1 = trip of the previous service day running past midnight
+    int32_t time;      // departure, seconds since midnight of the query day
+};
+
+// Merges the time-sorted index ranges of every stop of the query, today's from
+// `after` and, with a day, the previous day's from `after` + 24h, and stops at the
+// limit-th row whose service runs. Rows that allow no pickup are not departures.
+std::vector<Departure> collect_departures(const GTFSData& data, const DepartureQuery& q) {
+    std::vector<Departure> results;
+    if (q.stop_id == NO_STR || q.limit == 0) return results;
+
+    std::vector<uint32_t> stop_ids = { q.stop_id };
+    if (q.include_children) {
+        for (const Stop& stop : data.stops) {
+            if (stop.parent_station == q.stop_id && stop.stop_id != q.stop_id && (q.feed_id == NO_STR || stop.feed_id == q.feed_id)) {
+                stop_ids.push_back(stop.stop_id);
+            }
+        }
+        std::sort(stop_ids.begin(), stop_ids.end());
+        stop_ids.erase(std::unique(stop_ids.begin(), stop_ids.end()), stop_ids.end());
+    }
+
+    StopTimeRows stop_times = data.stop_time_rows();
+    struct Cursor {
+        const uint32_t* it;
+        const uint32_t* end;
+        int32_t shift;
+        int8_t day_offset;
+    };
+    auto time_of = [&stop_times](const Cursor& c) { return stop_times.board_time(*c.it) - c.shift; };
+    auto later = [&](const Cursor& a, const Cursor& b) { return time_of(a) > time_of(b); };
+    std::vector<Cursor> heap;
+
+    auto add_cursor = [&](uint32_t stop_id, int32_t shift, int8_t day_offset) {
+        StopTimeIndex::Range all = data.stop_times_by_stop_id.find(stop_id);
+        int64_t from = static_cast<int64_t>(q.after) + shift;
+        const uint32_t* first = std::lower_bound(all.first, all.last, from, [&stop_times](uint32_t row, int64_t t) {
+            int32_t bt = stop_times.board_time(row);
+            return bt == ST_NO_TIME || bt < t;
+        });
+        if (first != all.last) heap.push_back({ first, all.last, shift, day_offset });
+    };
+    for (uint32_t stop_id : stop_ids) {
+        add_cursor(stop_id, 0, 0);
+        if (q.day != NO_DAY) add_cursor(stop_id, 86400, -1);
+    }
+    std::make_heap(heap.begin(), heap.end(), later);
+
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        Cursor& c = heap.back();
+        uint32_t row = *c.it;
+        int32_t time = time_of(c);
+        if (q.before != -1 && time > q.before) break;
+
+        const StopTime st = stop_times[row];
+        bool match = st.pickup_type != 1 && (q.feed_id == NO_STR || st.feed_id == q.feed_id);
+        if (match && q.day != NO_DAY) {
+            const Trip* trip = data.trips.find(st.feed_id, st.trip_id);
+            match = trip && data.service_active(trip->service_index, q.day + c.day_offset);
+        }
+        if (match) {
+            results.push_back({ row, c.day_offset, time });
+            if (results.size() == q.limit) break;
+        }
+
+        if (++c.it == c.end) heap.pop_back();
+        else std::push_heap(heap.begin(), heap.end(), later);
+    }
+    return results;
+}
+
+struct NearbyMatch {
+    uint32_t item;
+    double distance; // meters
+};
+
+// Items of grid within radius meters of (lat, lon), nearest first and at most
+// limit of them (0 = no limit). latlon(item, lat, lon) returns false to skip an item.
+template<typename LatLon>
+std::vector<NearbyMatch> collect_near(const GeoGrid& grid, double lat, double lon, double radius, size_t limit, LatLon latlon) {
+    std::vector<NearbyMatch> results;
+    if (!(radius >= 0) || std::isnan(lat) || std::isnan(lon)) return results;
+    constexpr double DEG = 3.14159265358979323846 / 180.0;
+    constexpr double METERS_PER_DEG = 6371008.8 * DEG;
+    double dlat = radius / METERS_PER_DEG;
+    double dlon = dlat / std::max(0.01, std::cos(lat * DEG));
+    grid.visit(lat - dlat, lon - dlon, lat + dlat, lon + dlon, [&](uint32_t item) {
+        double plat, plon;
+        if (!latlon(item, plat, plon)) return;
+        double d = haversine_m(lat, lon, plat, plon);
+        if (d <= radius) results.push_back({ item, d });
+    });
+    auto nearer = [](const NearbyMatch& a, const NearbyMatch& b) { return a.distance < b.distance; };
+    if (limit != 0 && results.size() > limit) {
+        std::partial_sort(results.begin(), results.begin() + limit, results.end(), nearer);
+        results.resize(limit);
+    } else {
+        std::sort(results.begin(), results.end(), nearer);
+    }
+    return results;
+}
+
+// Items of grid inside the box, in grid order
+template<typename LatLon>
+std::vector<uint32_t> collect_in_bbox(const GeoGrid& grid, double min_lat, double min_lon, double max_lat, double max_lon, LatLon latlon) {
+    std::vector<uint32_t> results;
+    grid.visit(min_lat, min_lon, max_lat, max_lon, [&](uint32_t item) {
+        double lat, lon;
+        if (!latlon(item, lat, lon)) return;
+        if (lat >= min_lat && lat <= max_lat && lon >= min_lon && lon <= max_lon) results.push_back(item);
+    });
+    return results;
+}
+
+// Columns of a stop time result, filled natively so they can be handed to JS
+// as typed arrays without per-row objects
+struct StopTimeColumns {
+    std::vector<uint32_t> trip_id, stop_id, stop_headsign, feed_id;
+    std::vector<int32_t> arrival_time, departure_time, stop_sequence;
+    std::vector<double> shape_dist_traveled; // NaN when missing
+    std::vector<int8_t> pickup_type, drop_off_type, timepoint, continuous_pickup, continuous_drop_off, day_offset;
+};
+
+void fill_stop_time_columns(const GTFSData& data, const std::vector<StopTimeMatch>& results, StopTimeColumns& c) {
+    size_t n = results.size();
+    c.trip_id.resize(n);
+    c.stop_id.resize(n);
+    c.stop_headsign.resize(n);
+    c.feed_id.resize(n);
+    c.arrival_time.resize(n);
+    c.departure_time.resize(n);
+    c.stop_sequence.resize(n);
+    c.shape_dist_traveled.resize(n);
+    c.pickup_type.resize(n);
+    c.drop_off_type.resize(n);
+    c.timepoint.resize(n);
+    c.continuous_pickup.resize(n);
+    c.continuous_drop_off.resize(n);
+    c.day_offset.resize(n);
+
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    StopTimeRows stop_times = data.stop_time_rows();
+    for (size_t i = 0; i < n; ++i) {
+        const StopTime st = stop_times[results[i].row];
+        c.trip_id[i] = st.trip_id;
+        c.stop_id[i] = st.stop_id;
+        c.stop_headsign[i] = st.stop_headsign;
+        c.feed_id[i] = st.feed_id;
+        c.arrival_time[i] = st.arrival_time;
+        c.departure_time[i] = st.departure_time;
+        c.stop_sequence[i] = st.stop_sequence;
+        c.shape_dist_traveled[i] = st.shape_dist_traveled != ST_NO_DIST ? st.shape_dist_traveled : nan;
+        c.pickup_type[i] = st.pickup_type;
+        c.drop_off_type[i] = st.drop_off_type;
+        c.timepoint[i] = st.timepoint;
+        c.continuous_pickup[i] = st.continuous_pickup;
+        c.continuous_drop_off[i] = st.continuous_drop_off;
+        c.day_offset[i] = results[i].day_offset;
+    }
+}
+
+// Interned id of a filter value; NO_STR for an absent filter, nullopt when the
+// value was never interned (so nothing can match)
+inline std::optional<uint32_t> filter_id(const GTFSData& data, const std::optional<std::string>& value) {
+    if (!value) return NO_STR;
+    uint32_t id = data.string_pool.get_id(*value);
+    if (id == 0xFFFFFFFF) return std::nullopt;
+    return id;
+}
+
+// Rows of an EntityTable matching optional interned feed_id / id filters
+// (NO_STR = any) and pred
+template<typename Table, typename Pred>
+std::vector<uint32_t> collect_rows(const Table& table, uint32_t feed_id, uint32_t id, Pred pred) {
+    std::vector<uint32_t> rows;
+    if (id != NO_STR && feed_id != NO_STR) {
+        uint32_t row = table.find_row(feed_id, id);
+        if (row != Table::NO_ROW && pred(table[row])) rows.push_back(row);
+        return rows;
+    }
+    for (size_t i = 0; i < table.size(); ++i) {
+        const auto& rec = table[i];
+        if (id != NO_STR && Table::id_of(rec) != id) continue;
+        if (feed_id != NO_STR && rec.feed_id != feed_id) continue;
+        if (pred(rec)) rows.push_back(static_cast<uint32_t>(i));
+    }
+    return rows;
+}
+
+// Trip filters; empty optionals match everything. Matches come in row order,
+// except that a block_id filter returns the block's trips by first departure.
+struct TripFilter {
+    std::optional<std::string> trip_id, route_id, service_id, block_id, feed_id;
+    std::optional<int> direction_id;
+    int32_t day = NO_DAY;
+};
+
+std::vector<uint32_t> collect_trips(const GTFSData& data, const TripFilter& f) {
+    auto trip_id = filter_id(data, f.trip_id);
+    auto route_id = filter_id(data, f.route_id);
+    auto service_id = filter_id(data, f.service_id);
+    auto block_id = filter_id(data, f.block_id);
+    auto feed_id = filter_id(data, f.feed_id);
+    if (!trip_id || !route_id || !service_id || !block_id || !feed_id) return {};
+
+    auto match = [&](const Trip& t) {
+        if (*route_id != NO_STR && t.route_id != *route_id) return false;
+        if (*service_id != NO_STR && t.service_id != *service_id) return false;
+        if (*block_id != NO_STR && t.block_id != *block_id) return false;
+        if (f.direction_id && (t.direction_id == ST_NO_INT8 || t.direction_id != *f.direction_id)) return false;
+        if (f.day != NO_DAY && !data.service_active(t.service_index, f.day)) return false;
+        return true;
+    };
+    if (*trip_id != NO_STR && *feed_id != NO_STR) return collect_rows(data.trips, *feed_id, *trip_id, match);
+
+    // Candidates come from one secondary index: a block's trips, which keep their
+    // departure order, or else the smallest run among the other filters
+    std::optional<RowIndex::Range> candidates;
+    auto narrow = [&candidates](const RowIndex& index, uint32_t key) {
+        if (key == NO_STR) return;
+        RowIndex::Range range = index.find(key);
+        if (!candidates || range.size() < candidates->size()) candidates = range;
+    };
+    if (*block_id != NO_STR) {
+        narrow(data.trips_by_block, *block_id);
+    } else {
+        narrow(data.trips_by_id, *trip_id);
+        narrow(data.trips_by_route, *route_id);
+        narrow(data.trips_by_service_id, *service_id);
+    }
+
+    std::vector<uint32_t> rows;
+    auto consider = [&](uint32_t row) {
+        const Trip& t = data.trips[row];
+        if (*trip_id != NO_STR && t.trip_id != *trip_id) return;
+        if ((*feed_id == NO_STR || t.feed_id == *feed_id) && match(t)) rows.push_back(row);
+    };
+    if (candidates) {
+        for (uint32_t row : *candidates) consider(row);
+        return rows;
+    }
+    if (f.day != NO_DAY) {
+        // Trips of the services running that day, back in row order
+        for (uint32_t s = 0; s < data.services.size(); ++s) {
+            if (!data.service_active(s, f.day)) continue;
+            for (uint32_t row : data.trips_by_service.find(s)) consider(row);
+        }
+        std::sort(rows.begin(), rows.end());
+        return rows;
+    }
+    return collect_rows(data.trips, *feed_id, NO_STR, match);
+}
+
+std::vector<CalendarDate> collect_calendar_dates(const GTFSData& data, const std::string* feed_id, const std::string* service_id) {
+    std::vector<CalendarDate> flat_list;
+    for (const auto& [fid, feed_dates] : data.calendar_dates) {
+        if (feed_id && fid != *feed_id) continue;
+        for (const auto& [sid, dates] : feed_dates) {
+            if (service_id && sid != *service_id) continue;
+            for (const auto& [date, exc] : dates) {
+                CalendarDate cd;
+                cd.feed_id = fid;
+                cd.service_id = sid;
+                cd.date = date;
+                cd.exception_type = exc;
+                flat_list.push_back(std::move(cd));
+            }
+        }
+    }
+    return flat_list;
+}
+
+// Rows of data.shapes matching the optional shape_id / feed_id filters
+std::vector<uint32_t> collect_shapes(const GTFSData& data, const std::optional<std::string>& shape_id, const std::optional<std::string>& feed_id) {
+    auto shape_int = filter_id(data, shape_id);
+    auto feed_int = filter_id(data, feed_id);
+    if (!shape_int || !feed_int) return {};
+
+    std::vector<uint32_t> rows;
+    auto add_span = [&rows](const ShapeSpan& sp) {
+        for (uint32_t i = 0; i < sp.count; ++i) rows.push_back(sp.first + i);
+    };
+    if (*shape_int != NO_STR && *feed_int != NO_STR) {
+        if (const ShapeSpan* sp = data.shapes_by_id.find(*feed_int, *shape_int)) add_span(*sp);
+        return rows;
+    }
+    for (const ShapeSpan& sp : data.shapes_by_id.spans()) {
+        if (*shape_int != NO_STR && sp.shape_id != *shape_int) continue;
+        if (*feed_int != NO_STR && sp.feed_id != *feed_int) continue;
+        add_span(sp);
+    }
+    return rows;
+}
+
+// Tolerance (meters) that keeps a shape within about one screen pixel at a
+// web map zoom level, at the latitude of the shape
+inline double zoom_tolerance(double zoom, double lat) {
+    constexpr double EQUATOR_METERS_PER_PIXEL = 156543.03392; // 256px tiles at zoom 0
+    constexpr double DEG = 3.14159265358979323846 / 180.0;
+    return EQUATOR_METERS_PER_PIXEL * std::cos(lat * DEG) / std::pow(2.0, zoom);
+}
+
+// Interleaved lat/lon of the points of a shape kept at tolerance (meters); tolerance <= 0 keeps every point
+void shape_polyline(const GTFSData& data, const ShapeSpan& span, double tolerance, std::vector<double>& latlon) {
+    const FlatArray<float>& tol = data.shapes_by_id.tolerance();
+    latlon.clear();
+    for (uint32_t i = span.first; i < span.first + span.count; ++i) {
+        if (tolerance > 0 && tol[i] < tolerance) continue;
+        latlon.push_back(data.shapes[i].shape_pt_lat);
+        latlon.push_back(data.shapes[i].shape_pt_lon);
+    }
+}
+
+// Google encoded polyline (precision 1e5) of interleaved lat/lon
+std::string encode_polyline(const std::vector<double>& latlon) {
+    std::string out;
+    out.reserve(latlon.size() * 3);
+    auto put = [&out](int64_t v) {
+        uint64_t u = v < 0 ? ~(static_cast<uint64_t>(v) << 1) : (static_cast<uint64_t>(v) << 1);
+        while (u >= 0x20) {
+            out.push_back(static_cast<char>((0x20 | (u & 0x1f)) + 63));
+            u >>= 5;
+        }
+        out.push_back(static_cast<char>(u + 63));
+    };
+    int64_t prev_lat = 0, prev_lon = 0;
+    for (size_t i = 0; i + 1 < latlon.size(); i += 2) {
+        int64_t lat = std::llround(latlon[i] * 1e5);
+        int64_t lon = std::llround(latlon[i + 1] * 1e5);
+        put(lat - prev_lat);
+        put(lon - prev_lon);
+        prev_lat = lat;
+        prev_lon = lon;
+    }
+    return out;
+}
+
+struct ShapeColumns {
+    std::vector<uint32_t> shape_id, feed_id; // string pool ids
+    std::vector<double> shape_pt_lat, shape_pt_lon, shape_dist_traveled; // NaN distance when missing
+    std::vector<int32_t> shape_pt_sequence;
+};
+
+void fill_shape_columns(const GTFSData& data, const std::vector<uint32_t>& rows, ShapeColumns& c) {
+    size_t n = rows.size();
+    c.shape_id.resize(n);
+    c.feed_id.resize(n);
+    c.shape_pt_lat.resize(n);
+    c.shape_pt_lon.resize(n);
+    c.shape_dist_traveled.resize(n);
+    c.shape_pt_sequence.resize(n);
+
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    for (size_t i = 0; i < n; ++i) {
+        const Shape& sh = data.shapes[rows[i]];
+        c.shape_id[i] = sh.shape_id;
+        c.feed_id[i] = sh.feed_id;
+        c.shape_pt_lat[i] = sh.shape_pt_lat;
+        c.shape_pt_lon[i] = sh.shape_pt_lon;
+        c.shape_pt_sequence[i] = sh.shape_pt_sequence;
+        c.shape_dist_traveled[i] = sh.shape_dist_traveled != ST_NO_DIST ? sh.shape_dist_traveled : nan;
+    }
+}
+
+struct VehicleProgressColumns {
+    std::vector<std::string_view> update_id, vehicle_id; // in the realtime arenas; convert under the data lock
+    std::vector<uint32_t> trip_id, feed_id, shape_id, next_stop_id; // string pool ids
+    std::vector<double> lat, lon, distance, offset, shape_length, next_stop_distance; // NaN when not snapped
+    std::vector<int32_t> next_stop_sequence;
+};
+
+// One row per realtime vehicle, from the progress snap_vehicles computed on the
+// last realtime update
+void fill_vehicle_progress_columns(const GTFSData& data, VehicleProgressColumns& c) {
+    size_t n = std::min(data.vehicles.size(), data.vehicle_progress.size());
+    c.update_id.resize(n);
+    c.vehicle_id.resize(n);
+    c.trip_id.resize(n);
+    c.feed_id.resize(n);
+    c.shape_id.resize(n);
+    c.next_stop_id.resize(n);
+    c.lat.resize(n);
+    c.lon.resize(n);
+    c.distance.resize(n);
+    c.offset.resize(n);
+    c.shape_length.resize(n);
+    c.next_stop_distance.resize(n);
+    c.next_stop_sequence.resize(n);
+
+    for (size_t i = 0; i < n; ++i) {
+        const RealtimeVehiclePosition& vp = *data.vehicles[i];
+        const VehicleProgress& p = data.vehicle_progress[i];
+        c.update_id[i] = vp.update_id.view();
+        c.vehicle_id[i] = vp.vehicle.id.view();
+        c.trip_id[i] = vp.trip.trip_id;
+        c.feed_id[i] = vp.feed_id;
+        c.shape_id[i] = p.shape_id;
+        c.next_stop_id[i] = p.next_stop_id;
+        c.lat[i] = p.lat;
+        c.lon[i] = p.lon;
+        c.distance[i] = p.distance;
+        c.offset[i] = p.offset;
+        c.shape_length[i] = p.shape_length;
+        c.next_stop_distance[i] = p.next_stop_distance;
+        c.next_stop_sequence[i] = p.next_stop_sequence;
+    }
+}
+
+}
@@ -0,0 +1,749 @@
+#include "GTFS.h"
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace gtfs {
+
+// RAPTOR (Delling, Pajor, Werneck: Round-Based Public Transit Routing) over the
+// loaded timetable. Trips with the same stop sequence form a pattern; a pattern's
+// trips never overtake each other, so at every stop they are in departure order and
+// the earliest catchable trip is a binary search away.
+
+constexpr int32_t RAPTOR_INF = INT32_MAX;
+constexpr double RAPTOR_WALK_SPEED = 1.3;          // m/s, straight line
+constexpr double RAPTOR_FOOTPATH_RADIUS = 400.0;   // meters between stops linked by a footpath
+constexpr uint8_t RAPTOR_NO_PICKUP = 1;
+constexpr uint8_t RAPTOR_NO_DROP_OFF = 2;
+
+struct RaptorPattern {
+    uint32_t first_stop = 0; // into pattern_stops
+    uint32_t stop_count = 0;
+    uint32_t first_trip = 0; // into trips; event e of trip t is at (t * stop_count + e) past first_event
+    uint32_t trip_count = 0;
+    uint32_t first_event = 0;
+};
+
+struct RaptorTrip {
+    uint32_t trip_row = 0;      // data.trips row
+    uint32_t service_index = NO_SERVICE;
+    uint32_t pattern = 0;
+};
+
+struct RaptorFootpath {
+    uint32_t to = 0;
+    int32_t duration = 0;
+};
+
+struct RaptorTimetable {
+    std::vector<uint32_t> stop_ids;                     // dense stop -> interned stop_id
+    std::unordered_map<uint32_t, uint32_t> stop_index;  // interned stop_id -> dense stop
+    std::vector<RaptorPattern> patterns;
+    std::vector<uint32_t> pattern_stops;                // dense stops
+    std::vector<RaptorTrip> trips;
+    std::unordered_multimap<uint32_t, uint32_t> trips_by_id; // interned trip_id -> trips, one per feed
+
+    // Per event (trip, stop of its pattern); missing times are interpolated
+    std::vector<int32_t> arrivals;
+    std::vector<int32_t> departures;
+    std::vector<uint8_t> flags;                          // RAPTOR_NO_PICKUP | RAPTOR_NO_DROP_OFF
+    std::vector<uint32_t> rows;                          // stop_times row
+
+    std::vector<uint32_t> stop_pattern_offsets;          // dense stop -> stop_patterns
+    std::vector<std::pair<uint32_t, uint32_t>> stop_patterns; // (pattern, position)
+    std::vector<uint32_t> footpath_offsets;              // dense stop -> footpaths
+    std::vector<RaptorFootpath> footpaths;
+
+    uint32_t dense_stop(uint32_t stop_id) const {
+        auto it = stop_index.find(stop_id);
+        return it == stop_index.end() ? NO_STR : it->second;
+    }
+
+    size_t memory_bytes() const {
+        return vector_bytes(stop_ids) + hash_table_bytes(stop_index) + vector_bytes(patterns) + vector_bytes(pattern_stops) +
+            vector_bytes(trips) + hash_table_bytes(trips_by_id) + vector_bytes(arrivals) + vector_bytes(departures) +
+            vector_bytes(flags) + vector_bytes(rows) + vector_bytes(stop_pattern_offsets) + vector_bytes(stop_patterns) +
+            vector_bytes(footpath_offsets) + vector_bytes(footpaths);
+    }
+};
+
+// Bytes of the journey planner timetable, 0 until the first query builds it
+size_t raptor_memory_bytes(const GTFSData& data) {
+    std::lock_guard<std::mutex> lock(data.raptor_mutex);
+    return data.raptor ? data.raptor->memory_bytes() : 0;
+}
+
+std::shared_ptr<const RaptorTimetable> build_raptor_timetable(const GTFSData& data) {
+    auto tt = std::make_shared<RaptorTimetable>();
+    StopTimeRows st = data.stop_time_rows();
+
+    auto dense = [&](uint32_t stop_id) {
+        auto [it, inserted] = tt->stop_index.try_emplace(stop_id, static_cast<uint32_t>(tt->stop_ids.size()));
+        if (inserted) tt->stop_ids.push_back(stop_id);
+        return it->second;
+    };
+
+    // One run of rows per (feed, trip); rows of a trip are contiguous unless two
+    // feeds share the trip_id, in which case they are split by feed
+    struct Run {
+        uint32_t trip;          // into tt->trips
+        std::vector<uint32_t> rows;
+    };
+    std::vector<Run> runs;
+    for (size_t begin = 0; begin < st.size();) {
+        size_t end = begin;
+        while (end < st.size() && st[end].trip_id == st[begin].trip_id) ++end;
+        std::vector<std::pair<uint32_t, std::vector<uint32_t>>> by_feed;
+        for (size_t r = begin; r < end; ++r) {
+            auto it = std::find_if(by_feed.begin(), by_feed.end(), [&](const auto& f) { return f.first == st[r].feed_id; });
+            if (it == by_feed.end()) {
+                by_feed.emplace_back(st[r].feed_id, std::vector<uint32_t>());
+                it = by_feed.end() - 1;
+            }
+            it->second.push_back(static_cast<uint32_t>(r));
+        }
+        for (auto& [feed_id, rows] : by_feed) {
+            if (rows.size() < 2) continue;
+            uint32_t trip_row = data.trips.find_row(feed_id, st[begin].trip_id);
+            if (trip_row == EntityTable<Trip, &Trip::trip_id>::NO_ROW) continue;
+            RaptorTrip trip;
+            trip.trip_row = trip_row;
+            trip.service_index = data.trips[trip_row].service_index;
+            runs.push_back({ static_cast<uint32_t>(tt->trips.size()), std::move(rows) });
+            tt->trips.push_back(trip);
+        }
+        begin = end;
+    }
+
+    // Times of a run with gaps filled linearly by position between known times
+    auto run_times = [&](const Run& run, std::vector<int32_t>& arr, std::vector<int32_t>& dep) {
+        size_t n = run.rows.size();
+        arr.assign(n, ST_NO_TIME);
+        dep.assign(n, ST_NO_TIME);
+        for (size_t i = 0; i < n; ++i) {
+            const StopTime& s = st[run.rows[i]];
+            arr[i] = s.arrival_time != ST_NO_TIME ? s.arrival_time : s.departure_time;
+            dep[i] = s.departure_time != ST_NO_TIME ? s.departure_time : s.arrival_time;
+        }
+        size_t prev = n;
+        for (size_t i = 0; i < n; ++i) {
+            if (arr[i] == ST_NO_TIME) continue;
+            if (prev != n && i > prev + 1) {
+                for (size_t j = prev + 1; j < i; ++j) {
+                    int32_t t = dep[prev] + static_cast<int32_t>(static_cast<int64_t>(arr[i] - dep[prev]) * static_cast<int64_t>(j - prev) / static_cast<int64_t>(i - prev));
+                    arr[j] = dep[j] = t;
+                }
+            }
+            prev = i;
+        }
+        return arr.front() != ST_NO_TIME && arr.back() != ST_NO_TIME;
+    };
+
+    // Group runs by stop sequence, then split each group into overtaking-free patterns
+    std::unordered_map<std::string, std::vector<uint32_t>> groups;
+    std::vector<std::vector<int32_t>> run_arr(runs.size()), run_dep(runs.size());
+    std::vector<std::string> group_order;
+    for (size_t r = 0; r < runs.size(); ++r) {
+        if (!run_times(runs[r], run_arr[r], run_dep[r])) continue;
+        std::string key;
+        key.reserve(runs[r].rows.size() * sizeof(uint32_t));
+        for (uint32_t row : runs[r].rows) {
+            uint32_t s = dense(st[row].stop_id);
+            key.append(reinterpret_cast<const char*>(&s), sizeof(s));
+        }
+        auto [it, inserted] = groups.try_emplace(key);
+        if (inserted) group_order.push_back(key);
+        it->second.push_back(static_cast<uint32_t>(r));
+    }
+
+    std::vector<RaptorTrip> ordered_trips;
+    for (const std::string& key : group_order) {
+        std::vector<uint32_t>& members = groups[key];
+        std::sort(members.begin(), members.end(), [&](uint32_t a, uint32_t b) {
+            return run_dep[a][0] < run_dep[b][0];
+        });
+        auto dominated = [&](uint32_t before, uint32_t after) {
+            for (size_t i = 0; i < run_arr[before].size(); ++i) {
+                if (run_arr[after][i] < run_arr[before][i] || run_dep[after][i] < run_dep[before][i]) return false;
+            }
+            return true;
+        };
+        std::vector<std::vector<uint32_t>> split;
+        for (uint32_t r : members) {
+            auto it = std::find_if(split.begin(), split.end(), [&](const std::vector<uint32_t>& p) { return dominated(p.back(), r); });
+            if (it == split.end()) split.emplace_back(1, r);
+            else it->push_back(r);
+        }
+
+        const Run& first = runs[members[0]];
+        for (const std::vector<uint32_t>& p : split) {
+            RaptorPattern pattern;
+            pattern.first_stop = static_cast<uint32_t>(tt->pattern_stops.size());
+            pattern.stop_count = static_cast<uint32_t>(first.rows.size());
+            pattern.first_trip = static_cast<uint32_t>(ordered_trips.size());
+            pattern.trip_count = static_cast<uint32_t>(p.size());
+            pattern.first_event = static_cast<uint32_t>(tt->arrivals.size());
+            for (uint32_t row : first.rows) tt->pattern_stops.push_back(tt->stop_index[st[row].stop_id]);
+            for (uint32_t r : p) {
+                RaptorTrip trip = tt->trips[runs[r].trip];
+                trip.pattern = static_cast<uint32_t>(tt->patterns.size());
+                tt->trips_by_id.emplace(data.trips[trip.trip_row].trip_id, static_cast<uint32_t>(ordered_trips.size()));
+                ordered_trips.push_back(trip);
+                for (size_t i = 0; i < runs[r].rows.size(); ++i) {
+                    const StopTime& s = st[runs[r].rows[i]];
+                    tt->arrivals.push_back(run_arr[r][i]);
+                    tt->departures.push_back(run_dep[r][i]);
+                    tt->flags.push_back((s.pickup_type == 1 ? RAPTOR_NO_PICKUP : 0) | (s.drop_off_type == 1 ? RAPTOR_NO_DROP_OFF : 0));
+                    tt->rows.push_back(runs[r].rows[i]);
+                }
+            }
+            tt->patterns.push_back(pattern);
+        }
+    }
+    // Trips without usable times never made it into a pattern
+    tt->trips = std::move(ordered_trips);
+
+    size_t n = tt->stop_ids.size();
+    tt->stop_pattern_offsets.assign(n + 1, 0);
+    for (const RaptorPattern& p : tt->patterns) {
+        for (uint32_t i = 0; i < p.stop_count; ++i) ++tt->stop_pattern_offsets[tt->pattern_stops[p.first_stop + i] + 1];
+    }
+    for (size_t i = 1; i <= n; ++i) tt->stop_pattern_offsets[i] += tt->stop_pattern_offsets[i - 1];
+    tt->stop_patterns.resize(tt->stop_pattern_offsets[n]);
+    std::vector<uint32_t> fill(tt->stop_pattern_offsets.begin(), tt->stop_pattern_offsets.end() - 1);
+    for (uint32_t pi = 0; pi < tt->patterns.size(); ++pi) {
+        const RaptorPattern& p = tt->patterns[pi];
+        for (uint32_t i = 0; i < p.stop_count; ++i) tt->stop_patterns[fill[tt->pattern_stops[p.first_stop + i]]++] = { pi, i };
+    }
+
+    // Footpaths between stops within walking radius, from the stop grid
+    std::unordered_map<uint32_t, uint32_t> stop_row;
+    for (uint32_t r = 0; r < data.stops.size(); ++r) stop_row.emplace(data.stops[r].stop_id, r);
+    tt->footpath_offsets.assign(n + 1, 0);
+    for (uint32_t s = 0; s < n; ++s) {
+        tt->footpath_offsets[s] = static_cast<uint32_t>(tt->footpaths.size());
+        auto it = stop_row.find(tt->stop_ids[s]);
+        if (it == stop_row.end()) continue;
+        const Stop& from = data.stops[it->second];
+        if (std::isnan(from.stop_lat) || std::isnan(from.stop_lon)) continue;
+        constexpr double DEG = 3.14159265358979323846 / 180.0;
+        double dlat = RAPTOR_FOOTPATH_RADIUS / (6371008.8 * DEG);
+        double dlon = dlat / std::max(0.01, std::cos(from.stop_lat * DEG));
+        data.stops_by_location.visit(from.stop_lat - dlat, from.stop_lon - dlon, from.stop_lat + dlat, from.stop_lon + dlon, [&](uint32_t row) {
+            const Stop& to = data.stops[row];
+            uint32_t t = tt->dense_stop(to.stop_id);
+            if (t == NO_STR || t == s) return;
+            double d = haversine_m(from.stop_lat, from.stop_lon, to.stop_lat, to.stop_lon);
+            if (d > RAPTOR_FOOTPATH_RADIUS) return;
+            tt->footpaths.push_back({ t, static_cast<int32_t>(std::ceil(d / RAPTOR_WALK_SPEED)) });
+        });
+    }
+    tt->footpath_offsets[n] = static_cast<uint32_t>(tt->footpaths.size());
+    return tt;
+}
+
+// Timetable of data, built on first use. Callers hold data.mutex (shared is
+// enough); concurrent first callers wait for a single build. Writers that change
+// stop_times, stops or trips reset data.raptor under the exclusive lock.
+std::shared_ptr<const RaptorTimetable> raptor_timetable(const GTFSData& data) {
+    std::lock_guard<std::mutex> lock(data.raptor_mutex);
+    if (!data.raptor) data.raptor = build_raptor_timetable(data);
+    return data.raptor;
+}
+
+// Realtime times of the trip runs that have a trip update, for one query day.
+// Keyed by (trip << 1 | shift), shift 1 = run of the previous service day.
+struct RaptorDelays {
+    struct Times {
+        std::vector<int32_t> arrivals;   // RAPTOR_INF where the stop is skipped
+        std::vector<int32_t> departures;
+    };
+    std::unordered_map<uint64_t, Times> runs;
+    int32_t max_late = 0;  // largest delay, bounds the trip search
+    int32_t max_early = 0; // largest negative delay, as a positive number
+
+    const Times* find(uint32_t trip, uint32_t shift) const {
+        auto it = runs.find((static_cast<uint64_t>(trip) << 1) | shift);
+        return it == runs.end() ? nullptr : &it->second;
+    }
+};
+
+RaptorDelays build_raptor_delays(const GTFSData& data, const RaptorTimetable& tt, int32_t day, const std::optional<int32_t>& utc_offset) {
+    RaptorDelays delays;
+    std::unordered_set<uint32_t> seen;
+    for (const auto& [feed_key, feed] : data.realtime) {
+        for (const auto& entry : feed.trip_updates) {
+            uint32_t trip_id = entry.value.trip.trip_id;
+            if (trip_id == NO_STR || !seen.insert(trip_id).second) continue;
+            auto [first_trip, last_trip] = tt.trips_by_id.equal_range(trip_id);
+            for (auto it = first_trip; it != last_trip; ++it) {
+                uint32_t trip = it->second;
+                const RaptorPattern& p = tt.patterns[tt.trips[trip].pattern];
+                uint32_t first = p.first_event + (trip - p.first_trip) * p.stop_count;
+                for (uint32_t shift = 0; shift < 2; ++shift) {
+                    int32_t service_day = day - static_cast<int32_t>(shift);
+                    RaptorDelays::Times times;
+                    times.arrivals.resize(p.stop_count);
+                    times.departures.resize(p.stop_count);
+                    bool updated = false;
+                    for (uint32_t i = 0; i < p.stop_count; ++i) {
+                        RealtimeStopTimeMatch m{ tt.rows[first + i], 0 };
+                        predict_stop_time(data, service_day, utc_offset, m);
+                        updated = updated || m.has_trip_update;
+                        int32_t arrival = tt.arrivals[first + i], departure = tt.departures[first + i];
+                        if (m.skipped) {
+                            arrival = departure = RAPTOR_INF;
+                        } else {
+                            if (m.arrival_delay != NO_DELAY) arrival += m.arrival_delay;
+                            if (m.departure_delay != NO_DELAY) departure += m.departure_delay;
+                            for (int32_t d : { m.arrival_delay, m.departure_delay }) {
+                                if (d == NO_DELAY) continue;
+                                delays.max_late = std::max(delays.max_late, d);
+                                delays.max_early = std::max(delays.max_early, -d);
+                            }
+                        }
+                        times.arrivals[i] = arrival;
+                        times.departures[i] = departure;
+                    }
+                    if (updated) delays.runs[(static_cast<uint64_t>(trip) << 1) | shift] = std::move(times);
+                }
+            }
+        }
+    }
+    return delays;
+}
+
+struct RaptorQuery {
+    std::vector<uint32_t> origins;  // dense stops
+    std::vector<uint32_t> targets;
+    int32_t day = NO_DAY;
+    int32_t departure = 0;          // seconds since midnight of day
+    int32_t window = 0;             // > 0: range query over departures in [departure, departure + window]
+    uint32_t max_transfers = 4;
+    unsigned threads = 0;           // range queries; 0 = hardware concurrency
+    const RaptorDelays* delays = nullptr;
+};
+
+struct JourneyLeg {
+    uint32_t from_stop = NO_STR;    // interned stop ids
+    uint32_t to_stop = NO_STR;
+    int32_t departure = 0;          // seconds since midnight of the query day
+    int32_t arrival = 0;
+    uint32_t trip_row = NO_STR;     // data.trips row; NO_STR for a walk
+    uint32_t trip_id = NO_STR;      // interned ids of the trip
+    uint32_t route_id = NO_STR;
+    uint32_t feed_id = NO_STR;
+    uint32_t board_row = NO_STR;    // stop_times rows
+    uint32_t alight_row = NO_STR;
+};
+
+struct Journey {
+    int32_t departure = 0;
+    int32_t arrival = 0;
+    uint32_t transfers = 0;
+    std::vector<JourneyLeg> legs;
+};
+
+// One RAPTOR search state; reused across the departures of a range query, since
+// labels of a later departure stay valid for an earlier one (rRAPTOR)
+class RaptorSearch {
+    enum : uint8_t { NONE, ORIGIN, TRANSIT, WALK };
+    struct Parent {
+        uint8_t kind = NONE;
+        uint8_t round = 0;   // round the label was set in
+        uint8_t shift = 0;   // TRANSIT: 1 = run of the previous service day
+        uint32_t from = 0;   // dense stop boarded at or walked from
+        uint32_t trip = 0;
+        uint32_t board = 0;  // pattern positions
+        uint32_t alight = 0;
+        int32_t departure = 0;
+    };
+
+    const GTFSData& data_;
+    const RaptorTimetable& tt_;
+    const RaptorQuery& q_;
+    uint32_t rounds_;
+    size_t n_;
+    std::vector<std::vector<int32_t>> tau_;      // [round][stop], non-increasing in round
+    std::vector<std::vector<Parent>> parent_;
+    std::vector<char> marked_, pattern_marked_;
+    std::vector<uint32_t> marked_list_;
+    std::vector<uint32_t> pattern_from_;         // earliest marked position per pattern
+
+    int32_t event_departure(uint32_t trip, uint32_t shift, uint32_t pos, bool board) const {
+        const RaptorPattern& p = tt_.patterns[tt_.trips[trip].pattern];
+        uint32_t e = p.first_event + (trip - p.first_trip) * p.stop_count + pos;
+        if (board && (tt_.flags[e] & RAPTOR_NO_PICKUP)) return RAPTOR_INF;
+        int32_t t = tt_.departures[e];
+        if (q_.delays) {
+            if (const RaptorDelays::Times* d = q_.delays->find(trip, shift)) t = d->departures[pos];
+        }
+        return t == RAPTOR_INF ? t : t - static_cast<int32_t>(shift) * 86400;
+    }
+
+    int32_t event_arrival(uint32_t trip, uint32_t shift, uint32_t pos) const {
+        const RaptorPattern& p = tt_.patterns[tt_.trips[trip].pattern];
+        uint32_t e = p.first_event + (trip - p.first_trip) * p.stop_count + pos;
+        if (tt_.flags[e] & RAPTOR_NO_DROP_OFF) return RAPTOR_INF;
+        int32_t t = tt_.arrivals[e];
+        if (q_.delays) {
+            if (const RaptorDelays::Times* d = q_.delays->find(trip, shift)) t = d->arrivals[pos];
+        }
+        return t == RAPTOR_INF ? t : t - static_cast<int32_t>(shift) * 86400;
+    }
+
+    // Earliest trip of pattern pi boardable at pos no earlier than `time`
+    bool earliest_trip(uint32_t pi, uint32_t pos, int32_t time, uint32_t& trip, uint32_t& shift, int32_t& departure) const {
+        const RaptorPattern& p = tt_.patterns[pi];
+        int32_t late = q_.delays ? q_.delays->max_late : 0;
+        int32_t early = q_.delays ? q_.delays->max_early : 0;
+        departure = RAPTOR_INF;
+        for (uint32_t s = 0; s < 2; ++s) {
+            int64_t frame = static_cast<int64_t>(time) + static_cast<int64_t>(s) * 86400;
+            // Scheduled departures at pos are sorted across the pattern's trips
+            uint32_t lo = 0, hi = p.trip_count;
+            while (lo < hi) {
+                uint32_t mid = (lo + hi) / 2;
+                if (tt_.departures[p.first_event + mid * p.stop_count + pos] < frame - late) lo = mid + 1;
+                else hi = mid;
+            }
+            for (uint32_t i = lo; i < p.trip_count; ++i) {
+                int64_t scheduled = tt_.departures[p.first_event + i * p.stop_count + pos];
+                if (scheduled - early - static_cast<int64_t>(s) * 86400 >= departure) break;
+                uint32_t t = p.first_trip + i;
+                if (!data_.service_active(tt_.trips[t].service_index, q_.day - static_cast<int32_t>(s))) continue;
+                int32_t d = event_departure(t, s, pos, true);
+                if (d == RAPTOR_INF || d < time || d >= departure) continue;
+                departure = d;
+                trip = t;
+                shift = s;
+            }
+        }
+        return departure != RAPTOR_INF;
+    }
+
+    int32_t target_best(uint32_t round) const {
+        int32_t best = RAPTOR_INF;
+        for (uint32_t t : q_.targets) best = std::min(best, tau_[round][t]);
+        return best;
+    }
+
+    // Sets the label of stop s in round k and keeps later rounds no worse
+    bool improve(uint32_t k, uint32_t s, int32_t time, const Parent& parent) {
+        if (time >= tau_[k][s] || time >= target_best(k)) return false;
+        for (uint32_t r = k; r <= rounds_ && time < tau_[r][s]; ++r) {
+            tau_[r][s] = time;
+            parent_[r][s] = parent;
+        }
+        if (!marked_[s]) {
+            marked_[s] = 1;
+            marked_list_.push_back(s);
+        }
+        return true;
+    }
+
+    void relax_footpaths(uint32_t k, const std::vector<uint32_t>& from) {
+        for (uint32_t s : from) {
+            int32_t t = tau_[k][s];
+            if (t == RAPTOR_INF || parent_[k][s].kind == WALK) continue;
+            for (uint32_t f = tt_.footpath_offsets[s]; f < tt_.footpath_offsets[s + 1]; ++f) {
+                const RaptorFootpath& fp = tt_.footpaths[f];
+                Parent p;
+                p.kind = WALK;
+                p.round = static_cast<uint8_t>(k);
+                p.from = s;
+                p.departure = t;
+                improve(k, fp.to, t + fp.duration, p);
+            }
+        }
+    }
+
+public:
+    RaptorSearch(const GTFSData& data, const RaptorTimetable& tt, const RaptorQuery& q)
+        : data_(data), tt_(tt), q_(q), rounds_(q.max_transfers + 1), n_(tt.stop_ids.size()),
+          tau_(rounds_ + 1, std::vector<int32_t>(n_, RAPTOR_INF)), parent_(rounds_ + 1, std::vector<Parent>(n_)),
+          marked_(n_, 0), pattern_marked_(tt.patterns.size(), 0), pattern_from_(tt.patterns.size(), 0) {}
+
+    // Best arrival at a target per round, for the caller to spot improvements
+    std::vector<int32_t> target_arrivals() const {
+        std::vector<int32_t> out(rounds_ + 1);
+        for (uint32_t k = 0; k <= rounds_; ++k) out[k] = target_best(k);
+        return out;
+    }
+
+    void run(int32_t departure) {
+        marked_list_.clear();
+        std::fill(marked_.begin(), marked_.end(), 0);
+        for (uint32_t o : q_.origins) {
+            Parent p;
+            p.kind = ORIGIN;
+            p.departure = departure;
+            improve(0, o, departure, p);
+        }
+        std::vector<uint32_t> current = marked_list_;
+        relax_footpaths(0, current);
+
+        for (uint32_t k = 1; k <= rounds_ && !marked_list_.empty(); ++k) {
+            std::vector<uint32_t> patterns;
+            for (uint32_t s : marked_list_) {
+                marked_[s] = 0;
+                for (uint32_t i = tt_.stop_pattern_offsets[s]; i < tt_.stop_pattern_offsets[s + 1]; ++i) {
+                    auto [pi, pos] = tt_.stop_patterns[i];
+                    if (!pattern_marked_[pi]) {
+                        pattern_marked_[pi] = 1;
+                        pattern_from_[pi] = pos;
+                        patterns.push_back(pi);
+                    } else if (pos < pattern_from_[pi]) {
+                        pattern_from_[pi] = pos;
+                    }
+                }
+            }
+            marked_list_.clear();
+
+            for (uint32_t pi : patterns) {
+                pattern_marked_[pi] = 0;
+                const RaptorPattern& p = tt_.patterns[pi];
+                bool on_trip = false;
+                uint32_t trip = 0, shift = 0, board = 0;
+                int32_t board_time = 0;
+                for (uint32_t pos = pattern_from_[pi]; pos < p.stop_count; ++pos) {
+                    uint32_t s = tt_.pattern_stops[p.first_stop + pos];
+                    if (on_trip) {
+                        int32_t arrival = event_arrival(trip, shift, pos);
+                        if (arrival != RAPTOR_INF) {
+                            Parent par;
+                            par.kind = TRANSIT;
+                            par.round = static_cast<uint8_t>(k);
+                            par.shift = static_cast<uint8_t>(shift);
+                            par.from = tt_.pattern_stops[p.first_stop + board];
+                            par.trip = trip;
+                            par.board = board;
+                            par.alight = pos;
+                            par.departure = board_time;
+                            improve(k, s, arrival, par);
+                        }
+                    }
+                    int32_t ready = tau_[k - 1][s];
+                    if (ready == RAPTOR_INF) continue;
+                    if (on_trip && ready >= event_departure(trip, shift, pos, false)) continue;
+                    uint32_t t, sh;
+                    int32_t d;
+                    if (earliest_trip(pi, pos, ready, t, sh, d)) {
+                        on_trip = true;
+                        trip = t;
+                        shift = sh;
+                        board = pos;
+                        board_time = d;
+                    }
+                }
+            }
+
+            current = marked_list_;
+            relax_footpaths(k, current);
+        }
+    }
+
+    // Journey to the best target at round k, or false when none was found
+    bool journey(uint32_t k, Journey& out) const {
+        uint32_t target = NO_STR;
+        int32_t best = RAPTOR_INF;
+        for (uint32_t t : q_.targets) {
+            if (tau_[k][t] < best) {
+                best = tau_[k][t];
+                target = t;
+            }
+        }
+        if (target == NO_STR) return false;
+
+        out = Journey();
+        out.arrival = best;
+        uint32_t s = target, round = k;
+        for (size_t guard = 0; guard < 4 * (rounds_ + 1); ++guard) {
+            const Parent& p = parent_[round][s];
+            if (p.kind == ORIGIN || p.kind == NONE) break;
+            JourneyLeg leg;
+            leg.from_stop = tt_.stop_ids[p.from];
+            leg.to_stop = tt_.stop_ids[s];
+            leg.departure = p.departure;
+            leg.arrival = tau_[round][s];
+            if (p.kind == TRANSIT) {
+                const RaptorTrip& trip = tt_.trips[p.trip];
+                const RaptorPattern& pat = tt_.patterns[trip.pattern];
+                uint32_t first = pat.first_event + (p.trip - pat.first_trip) * pat.stop_count;
+                leg.trip_row = trip.trip_row;
+                leg.trip_id = data_.trips[trip.trip_row].trip_id;
+                leg.route_id = data_.trips[trip.trip_row].route_id;
+                leg.feed_id = data_.trips[trip.trip_row].feed_id;
+                leg.board_row = tt_.rows[first + p.board];
+                leg.alight_row = tt_.rows[first + p.alight];
+                ++out.transfers;
+                round = p.round - 1;
+            } else {
+                round = p.round;
+            }
+            s = p.from;
+            out.legs.push_back(leg);
+        }
+        if (out.legs.empty()) return false;
+        std::reverse(out.legs.begin(), out.legs.end());
+        out.departure = out.legs.front().departure;
+        if (out.transfers > 0) --out.transfers;
+        return true;
+    }
+
+    uint32_t rounds() const { return rounds_; }
+};
+
+// Drops journeys another one beats on departure (later), arrival and transfers
+void pareto_journeys(std::vector<Journey>& journeys) {
+    std::sort(journeys.begin(), journeys.end(), [](const Journey& a, const Journey& b) {
+        if (a.departure != b.departure) return a.departure > b.departure;
+        if (a.arrival != b.arrival) return a.arrival < b.arrival;
+        return a.transfers < b.transfers;
+    });
+    std::vector<Journey> kept;
+    for (Journey& j : journeys) {
+        bool dominated = std::any_of(kept.begin(), kept.end(), [&](const Journey& k) {
+            return k.departure >= j.departure && k.arrival <= j.arrival && k.transfers <= j.transfers;
+        });
+        if (!dominated) kept.push_back(std::move(j));
+    }
+    std::sort(kept.begin(), kept.end(), [](const Journey& a, const Journey& b) {
+        if (a.departure != b.departure) return a.departure < b.departure;
+        return a.transfers < b.transfers;
+    });
+    journeys = std::move(kept);
+}
+
+// Earliest-arrival journeys (one per transfer count that improves the arrival); with
+// a window, the Pareto set over departure, arrival and transfers of all departures
+// in it. Range queries split the departures into contiguous chunks, one thread each.
+std::vector<Journey> raptor_journeys(const GTFSData& data, const RaptorTimetable& tt, const RaptorQuery& q) {
+    std::vector<Journey> journeys;
+    if (q.origins.empty() || q.targets.empty() || q.day == NO_DAY) return journeys;
+
+    auto collect = [&](RaptorSearch& search, std::vector<int32_t>& before, std::vector<Journey>& out) {
+        std::vector<int32_t> after = search.target_arrivals();
+        for (uint32_t k = 0; k <= search.rounds(); ++k) {
+            if (after[k] >= before[k]) continue;
+            Journey j;
+            if (search.journey(k, j)) out.push_back(std::move(j));
+        }
+        before = std::move(after);
+    };
+
+    if (q.window <= 0) {
+        RaptorSearch search(data, tt, q);
+        std::vector<int32_t> before(search.rounds() + 1, RAPTOR_INF);
+        search.run(q.departure);
+        collect(search, before, journeys);
+        pareto_journeys(journeys);
+        return journeys;
+    }
+
+    // Candidate departures: boardable departures at the origins, and at stops one
+    // footpath away less the walk, within the window
+    std::vector<int32_t> times;
+    auto add_departures = [&](uint32_t s, int32_t walk) {
+        for (uint32_t i = tt.stop_pattern_offsets[s]; i < tt.stop_pattern_offsets[s + 1]; ++i) {
+            auto [pi, pos] = tt.stop_patterns[i];
+            const RaptorPattern& p = tt.patterns[pi];
+            for (uint32_t t = 0; t < p.trip_count; ++t) {
+                uint32_t e = p.first_event + t * p.stop_count + pos;
+                if (tt.flags[e] & RAPTOR_NO_PICKUP) continue;
+                for (int32_t shift = 0; shift < 2; ++shift) {
+                    int32_t d = tt.departures[e] - shift * 86400 - walk;
+                    if (d < q.departure || d > q.departure + q.window) continue;
+                    if (!data.service_active(tt.trips[p.first_trip + t].service_index, q.day - shift)) continue;
+                    times.push_back(d);
+                }
+            }
+        }
+    };
+    for (uint32_t o : q.origins) {
+        add_departures(o, 0);
+        for (uint32_t f = tt.footpath_offsets[o]; f < tt.footpath_offsets[o + 1]; ++f) add_departures(tt.footpaths[f].to, tt.footpaths[f].duration);
+    }
+    std::sort(times.begin(), times.end(), std::greater<int32_t>());
+    times.erase(std::unique(times.begin(), times.end()), times.end());
+    if (times.empty()) return journeys;
+
+    unsigned threads = q.threads ? q.threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min<unsigned>(threads, static_cast<unsigned>(times.size()));
+    size_t chunk = (times.size() + threads - 1) / threads;
+    std::vector<std::future<std::vector<Journey>>> parts;
+    for (size_t begin = 0; begin < times.size(); begin += chunk) {
+        size_t end = std::min(times.size(), begin + chunk);
+        parts.push_back(std::async(std::launch::async, [&, begin, end]() {
+            std::vector<Journey> out;
+            RaptorSearch search(data, tt, q);
+            std::vector<int32_t> before(search.rounds() + 1, RAPTOR_INF);
+            for (size_t i = begin; i < end; ++i) {
+                search.run(times[i]);
+                collect(search, before, out);
+            }
+            return out;
+        }));
+    }
+    for (auto& f : parts) {
+        std::vector<Journey> part = f.get();
+        journeys.insert(journeys.end(), std::make_move_iterator(part.begin()), std::make_move_iterator(part.end()));
+    }
+    pareto_journeys(journeys);
+    return journeys;
+}
+
+// Journey query by stop ids; a station stands for itself and its child stops
+struct JourneyRequest {
+    uint32_t from = NO_STR;         // interned stop ids
+    uint32_t to = NO_STR;
+    int32_t day = NO_DAY;
+    int32_t departure = 0;          // seconds since midnight of day
+    int32_t window = 0;             // seconds; 0 = earliest arrival only
+    uint32_t max_transfers = 4;
+    unsigned threads = 0;
+    bool realtime = false;          // apply delays of the trip update store
+    std::optional<int32_t> utc_offset; // resolves absolute realtime times, see predict_stop_time
+};
+
+std::vector<Journey> plan_journeys(const GTFSData& data, const JourneyRequest& r) {
+    std::shared_ptr<const RaptorTimetable> tt = raptor_timetable(data);
+
+    auto resolve = [&](uint32_t stop_id) {
+        std::vector<uint32_t> dense;
+        auto add = [&](uint32_t id) {
+            uint32_t s = tt->dense_stop(id);
+            if (s != NO_STR && std::find(dense.begin(), dense.end(), s) == dense.end()) dense.push_back(s);
+        };
+        add(stop_id);
+        for (const Stop& stop : data.stops) {
+            if (stop.parent_station == stop_id) add(stop.stop_id);
+        }
+        return dense;
+    };
+
+    RaptorQuery q;
+    q.origins = resolve(r.from);
+    q.targets = resolve(r.to);
+    q.day = r.day;
+    q.departure = r.departure;
+    q.window = r.window;
+    q.max_transfers = std::min<uint32_t>(r.max_transfers, 16);
+    q.threads = r.threads;
+    RaptorDelays delays;
+    if (r.realtime && data.realtime_join.size() != 0 && r.day != NO_DAY) {
+        delays = build_raptor_delays(data, *tt, r.day, r.utc_offset);
+        q.delays = &delays;
+    }
+    return raptor_journeys(data, *tt, q);
+}
+
+}
@@ -1,8 +1,10 @@
-    #include "GTFS.h"
+#include "GTFS.h"
 #include "nanopb/pb_decode.h"
 #include "gtfs-realtime.pb.h"
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <unordered_set>
 #include <iostream>
 
 namespace gtfs {
@@ -22,34 +24,112 @@ bool decode_string(pb_istream_t *stream, const pb_field_t *field, void **arg) {
     return true;
 }
 
+// Target of a string field interned straight from the input: every stream here comes
+// from pb_istream_from_buffer, so stream->state points at the field's bytes and no
+// temporary std::string is built
+struct InternedField {
+    StringPool* pool;
+    uint32_t* id;
+};
+
+bool decode_interned(pb_istream_t *stream, const pb_field_t *field, void **arg) {
+    InternedField* target = (InternedField*)*arg;
+    size_t len = stream->bytes_left;
+    *target->id = len ? target->pool->intern(std::string_view((const char*)stream->state, len)) : NO_STR;
+    return pb_read(stream, NULL, len);
+}
+
+// Target of a string field that is not a join key: copied from the input into the
+// arena of the staged message
+struct TextField {
+    RealtimeArena* arena;
+    RealtimeText* text;
+};
+
+bool decode_text(pb_istream_t *stream, const pb_field_t *field, void **arg) {
+    TextField* target = (TextField*)*arg;
+    size_t len = stream->bytes_left;
+    *target->text = target->arena->copy(std::string_view((const char*)stream->state, len));
+    return pb_read(stream, NULL, len);
+}
+
+// A string field viewed in place in the input, which outlives the decode
+bool decode_view(pb_istream_t *stream, const pb_field_t *field, void **arg) {
+    std::string_view* target = (std::string_view*)*arg;
+    size_t len = stream->bytes_left;
+    *target = std::string_view((const char*)stream->state, len);
+    return pb_read(stream, NULL, len);
+}
+
+// Fixed set of field slots for one entity's callbacks, on the stack
+struct EntityFields {
+    InternedField interned[8];
+    TextField texts[12];
+    size_t interned_count = 0;
+    size_t text_count = 0;
+    StringPool* pool;
+    RealtimeArena* arena;
+
+    EntityFields(StringPool* pool, RealtimeArena* arena) : pool(pool), arena(arena) {}
+
+    void bind(pb_callback_t& cb, uint32_t& target) {
+        InternedField& slot = interned[interned_count++];
+        slot.pool = pool;
+        slot.id = &target;
+        cb.funcs.decode = decode_interned;
+        cb.arg = &slot;
+    }
+
+    void bind(pb_callback_t& cb, RealtimeText& target) {
+        TextField& slot = texts[text_count++];
+        slot.arena = arena;
+        slot.text = &target;
+        cb.funcs.decode = decode_text;
+        cb.arg = &slot;
+    }
+};
+
 struct TranslatedStringContext {
     std::string* target;
 };
 
 
 struct TripUpdateContext {
-    GTFSData* data;
     RealtimeTripUpdate current_update;
-    std::string feed_id;
+    std::vector<RealtimeStopTimeUpdate>* stop_time_updates; // staged until the entity is complete
+    StringPool* pool;
+    uint32_t feed_id;
 };
 
 
 struct VehiclePositionContext {
-    GTFSData* data;
     RealtimeVehiclePosition current_pos;
-    std::string feed_id;
+    uint32_t feed_id;
 };
 
 
 struct AlertContext {
-    GTFSData* data;
     RealtimeAlert current_alert;
-    std::string feed_id;
+    uint32_t feed_id;
+};
+
+// One decoded FeedMessage, staged outside the data lock; apply_realtime_message
+// merges it into the live store
+struct RealtimeMessage {
+    uint32_t source = 0;
+    uint64_t timestamp = 0;   // FeedHeader.timestamp, 0 when absent
+    bool full_dataset = true;
+    bool complete = false;    // the whole message decoded
+    RealtimeFeed entities;    // upserts, in message order; their ids, texts and stop time updates in its arena
+    std::vector<RealtimeText> deleted; // in the arena of entities
 };
 
 struct RealtimeParseContext {
-    GTFSData* data;
-    std::string feed_id;
+    RealtimeMessage* message;
+    StringPool* pool;
+    uint32_t feed_id;
+    size_t position = 0; // entities seen so far, keys entities without an id
+    std::vector<RealtimeStopTimeUpdate> stop_time_updates; // reused by every entity
 };
 
 // --- Main Parsing Functions ---
@@ -57,17 +137,12 @@ bool decode_translated_string_content(pb_istream_t *stream, const pb_field_t *fi
     std::string* inner_str = (std::string*)*arg;
     GTFSv2_Realtime_TranslatedString_Translation t = GTFSv2_Realtime_TranslatedString_Translation_init_zero;
 
-    std::string temp_text;
-    t.text.funcs.decode = decode_string;
-    t.text.arg = &temp_text;
-
-    if (!pb_decode(stream, GTFSv2_Realtime_TranslatedString_Translation_fields, &t))
-         return false;
-
+    // Only the first non-empty translation is kept; later ones are skipped undecoded
     if (inner_str->empty()) {
-        *inner_str = temp_text;
+        t.text.funcs.decode = decode_string;
+        t.text.arg = inner_str;
     }
-    return true;
+    return pb_decode(stream, GTFSv2_Realtime_TranslatedString_Translation_fields, &t);
 }
 
 void setup_translated_string_decoding(GTFSv2_Realtime_TranslatedString& ts, std::string* target) {
@@ -77,59 +152,89 @@ void setup_translated_string_decoding(GTFSv2_Realtime_TranslatedString& ts, std:
 
 
 // --- Main Entry Points ---
-void parse_realtime_feed(GTFSData& data, const unsigned char* buf, size_t len, int type, const std::string& feed_id = "") {
+// Decodes FeedMessage.header (field 1) and skips everything else, so the entities
+// are never visited
+bool decode_feed_header(const unsigned char* buf, size_t len, GTFSv2_Realtime_FeedHeader& header) {
+    pb_istream_t stream = pb_istream_from_buffer(buf, len);
+    pb_wire_type_t wire_type;
+    uint32_t tag;
+    bool eof = false;
+    while (pb_decode_tag(&stream, &wire_type, &tag, &eof)) {
+        if (tag == 1 && wire_type == PB_WT_STRING) {
+            header = GTFSv2_Realtime_FeedHeader_init_zero;
+            pb_istream_t sub;
+            if (!pb_make_string_substream(&stream, &sub)) return false;
+            bool ok = pb_decode(&sub, GTFSv2_Realtime_FeedHeader_fields, &header);
+            return pb_close_string_substream(&stream, &sub) && ok;
+        }
+        if (!pb_skip_field(&stream, wire_type)) return false;
+    }
+    return false;
+}
+
+// Header timestamp and incrementality; false when the message has no readable header
+bool read_realtime_header(const unsigned char* buf, size_t len, uint64_t& timestamp, bool& full_dataset) {
+    GTFSv2_Realtime_FeedHeader header = GTFSv2_Realtime_FeedHeader_init_zero;
+    bool has_header = decode_feed_header(buf, len, header);
+    timestamp = has_header && header.has_timestamp ? header.timestamp : 0;
+    full_dataset = !(has_header && header.has_incrementality &&
+        header.incrementality == GTFSv2_Realtime_FeedHeader_Incrementality_DIFFERENTIAL);
+    return has_header;
+}
+
+// True when a message stamped `timestamp` was already applied from this source
+bool realtime_unchanged(const RealtimeFeed& feed, uint32_t source, uint64_t timestamp) {
+    if (timestamp == 0) return false;
+    auto it = feed.header_timestamps.find(source);
+    return it != feed.header_timestamps.end() && it->second == timestamp;
+}
+
+// Decodes one FeedMessage from `source` (see realtime_source) into out. Besides the
+// string pool, which locks internally and only receives the trip, route and stop
+// ids, it touches no shared state, so buffers can be decoded in parallel.
+void decode_realtime_message(StringPool& pool, const unsigned char* buf, size_t len, uint32_t source, uint32_t feed_id, RealtimeMessage& out) {
+    out.source = source;
+    read_realtime_header(buf, len, out.timestamp, out.full_dataset);
+
     GTFSv2_Realtime_FeedMessage message = GTFSv2_Realtime_FeedMessage_init_zero;
 
     message.entity.funcs.decode = [](pb_istream_t *stream, const pb_field_t *field, void **arg) -> bool {
         RealtimeParseContext* ctx = (RealtimeParseContext*)*arg;
-        GTFSData* data = ctx->data;
-        std::string feed_id = ctx->feed_id;
+        RealtimeFeed& staged = ctx->message->entities;
+        uint32_t feed_id = ctx->feed_id;
 
         GTFSv2_Realtime_FeedEntity entity = GTFSv2_Realtime_FeedEntity_init_zero;
+        EntityFields fields(ctx->pool, &staged.arena);
 
         TripUpdateContext tu_ctx;
-        tu_ctx.data = data;
+        tu_ctx.pool = ctx->pool;
         tu_ctx.feed_id = feed_id;
+        tu_ctx.stop_time_updates = &ctx->stop_time_updates;
+        ctx->stop_time_updates.clear();
 
         VehiclePositionContext vp_ctx;
-        vp_ctx.data = data;
         vp_ctx.feed_id = feed_id;
 
         AlertContext al_ctx;
-        al_ctx.data = data;
         al_ctx.feed_id = feed_id;
 
         tu_ctx.current_update.trip.feed_id = feed_id;
         tu_ctx.current_update.feed_id = feed_id;
         vp_ctx.current_pos.trip.feed_id = feed_id;
-        vp_ctx.current_pos.feed_id = feed_id; // wait, vp doesn't have it direct? Actually TripDescriptor does.
+        vp_ctx.current_pos.feed_id = feed_id;
         al_ctx.current_alert.feed_id = feed_id;
 
 
-        entity.id.funcs.decode = decode_string;
-        std::string entity_id;
+        std::string_view entity_id;
+        entity.id.funcs.decode = decode_view;
         entity.id.arg = &entity_id;
-
-        entity.trip_update.trip.trip_id.funcs.decode = decode_string;
-        entity.trip_update.trip.trip_id.arg = &tu_ctx.current_update.trip.trip_id;
-
-        entity.trip_update.trip.route_id.funcs.decode = decode_string;
-        entity.trip_update.trip.route_id.arg = &tu_ctx.current_update.trip.route_id;
-
-        entity.trip_update.trip.start_time.funcs.decode = decode_string;
-        entity.trip_update.trip.start_time.arg = &tu_ctx.current_update.trip.start_time;
-
-        entity.trip_update.trip.start_date.funcs.decode = decode_string;
-        entity.trip_update.trip.start_date.arg = &tu_ctx.current_update.trip.start_date;
-
-        entity.trip_update.vehicle.id.funcs.decode = decode_string;
-        entity.trip_update.vehicle.id.arg = &tu_ctx.current_update.vehicle.id;
-
-        entity.trip_update.vehicle.label.funcs.decode = decode_string;
-        entity.trip_update.vehicle.label.arg = &tu_ctx.current_update.vehicle.label;
-
-        entity.trip_update.vehicle.license_plate.funcs.decode = decode_string;
-        entity.trip_update.vehicle.license_plate.arg = &tu_ctx.current_update.vehicle.license_plate;
+        fields.bind(entity.trip_update.trip.trip_id, tu_ctx.current_update.trip.trip_id);
+        fields.bind(entity.trip_update.trip.route_id, tu_ctx.current_update.trip.route_id);
+        fields.bind(entity.trip_update.trip.start_time, tu_ctx.current_update.trip.start_time);
+        fields.bind(entity.trip_update.trip.start_date, tu_ctx.current_update.trip.start_date);
+        fields.bind(entity.trip_update.vehicle.id, tu_ctx.current_update.vehicle.id);
+        fields.bind(entity.trip_update.vehicle.label, tu_ctx.current_update.vehicle.label);
+        fields.bind(entity.trip_update.vehicle.license_plate, tu_ctx.current_update.vehicle.license_plate);
 
         entity.trip_update.stop_time_update.funcs.decode = [](pb_istream_t *stream, const pb_field_t *field, void **arg) -> bool {
             TripUpdateContext* inner_ctx = (TripUpdateContext*)*arg;
@@ -137,16 +242,15 @@ void parse_realtime_feed(GTFSData& data, const unsigned char* buf, size_t len, i
             stu.feed_id = inner_ctx->feed_id;
             GTFSv2_Realtime_TripUpdate_StopTimeUpdate pb_stu = GTFSv2_Realtime_TripUpdate_StopTimeUpdate_init_zero;
 
-            pb_stu.stop_id.funcs.decode = decode_string;
-            pb_stu.stop_id.arg = &stu.stop_id;
+            InternedField stop_id_field = { inner_ctx->pool, &stu.stop_id };
+            pb_stu.stop_id.funcs.decode = decode_interned;
+            pb_stu.stop_id.arg = &stop_id_field;
 
             if (!pb_decode(stream, GTFSv2_Realtime_TripUpdate_StopTimeUpdate_fields, &pb_stu)) return false;
 
             stu.stop_sequence = pb_stu.stop_sequence;
             stu.schedule_relationship = pb_stu.schedule_relationship;
             stu.trip_id = inner_ctx->current_update.trip.trip_id;
-            stu.start_date = inner_ctx->current_update.trip.start_date;
-            stu.start_time = inner_ctx->current_update.trip.start_time;
 
             if (pb_stu.has_arrival) {
                 if (pb_stu.arrival.has_delay) stu.arrival_delay = pb_stu.arrival.delay;
@@ -185,35 +289,20 @@ void parse_realtime_feed(GTFSData& data, const unsigned char* buf, size_t len, i
             if (pb_stu.has_stop_sequence) stu.stop_sequence = pb_stu.stop_sequence;
             else stu.stop_sequence = -1;
 
-            inner_ctx->current_update.stop_time_updates.push_back(stu);
+            inner_ctx->stop_time_updates->push_back(stu);
             return true;
         };
         entity.trip_update.stop_time_update.arg = &tu_ctx;
 
 
-        entity.vehicle.trip.trip_id.funcs.decode = decode_string;
-        entity.vehicle.trip.trip_id.arg = &vp_ctx.current_pos.trip.trip_id;
-
-        entity.vehicle.trip.route_id.funcs.decode = decode_string;
-        entity.vehicle.trip.route_id.arg = &vp_ctx.current_pos.trip.route_id;
-
-        entity.vehicle.trip.start_time.funcs.decode = decode_string;
-        entity.vehicle.trip.start_time.arg = &vp_ctx.current_pos.trip.start_time;
-
-        entity.vehicle.trip.start_date.funcs.decode = decode_string;
-        entity.vehicle.trip.start_date.arg = &vp_ctx.current_pos.trip.start_date;
-
-        entity.vehicle.vehicle.id.funcs.decode = decode_string;
-        entity.vehicle.vehicle.id.arg = &vp_ctx.current_pos.vehicle.id;
-
-        entity.vehicle.vehicle.label.funcs.decode = decode_string;
-        entity.vehicle.vehicle.label.arg = &vp_ctx.current_pos.vehicle.label;
-
-        entity.vehicle.vehicle.license_plate.funcs.decode = decode_string;
-        entity.vehicle.vehicle.license_plate.arg = &vp_ctx.current_pos.vehicle.license_plate;
-
-        entity.vehicle.stop_id.funcs.decode = decode_string;
-        entity.vehicle.stop_id.arg = &vp_ctx.current_pos.stop_id;
+        fields.bind(entity.vehicle.trip.trip_id, vp_ctx.current_pos.trip.trip_id);
+        fields.bind(entity.vehicle.trip.route_id, vp_ctx.current_pos.trip.route_id);
+        fields.bind(entity.vehicle.trip.start_time, vp_ctx.current_pos.trip.start_time);
+        fields.bind(entity.vehicle.trip.start_date, vp_ctx.current_pos.trip.start_date);
+        fields.bind(entity.vehicle.vehicle.id, vp_ctx.current_pos.vehicle.id);
+        fields.bind(entity.vehicle.vehicle.label, vp_ctx.current_pos.vehicle.label);
+        fields.bind(entity.vehicle.vehicle.license_plate, vp_ctx.current_pos.vehicle.license_plate);
+        fields.bind(entity.vehicle.stop_id, vp_ctx.current_pos.stop_id);
 
 
         setup_translated_string_decoding(entity.alert.header_text, &al_ctx.current_alert.header_text);
@@ -223,10 +312,21 @@ void parse_realtime_feed(GTFSData& data, const unsigned char* buf, size_t len, i
         if (!pb_decode(stream, GTFSv2_Realtime_FeedEntity_fields, &entity))
             return false;
 
-        if (entity.has_trip_update) {
-            tu_ctx.current_update.update_id = entity_id;
-            tu_ctx.current_update.is_deleted = entity.is_deleted;
+        size_t position = ctx->position++;
+        std::string positional;
+        if (entity_id.empty()) {
+            positional = "#" + std::to_string(position);
+            entity_id = positional;
+        }
+        if (entity.is_deleted) {
+            staged.trip_updates.erase(entity_id);
+            staged.vehicle_positions.erase(entity_id);
+            staged.alerts.erase(entity_id);
+            ctx->message->deleted.push_back(staged.arena.copy(entity_id));
+            return true;
+        }
 
+        if (entity.has_trip_update) {
             if (entity.trip_update.has_timestamp) tu_ctx.current_update.timestamp = entity.trip_update.timestamp;
 
             if (entity.trip_update.has_delay) tu_ctx.current_update.delay = entity.trip_update.delay;
@@ -238,19 +338,19 @@ void parse_realtime_feed(GTFSData& data, const unsigned char* buf, size_t len, i
             if (entity.trip_update.trip.has_schedule_relationship) tu_ctx.current_update.trip.schedule_relationship = entity.trip_update.trip.schedule_relationship;
             else tu_ctx.current_update.trip.schedule_relationship = 0;
 
-            for(auto& stu : tu_ctx.current_update.stop_time_updates) {
-                if(stu.trip_id.empty()) {
+            for(auto& stu : ctx->stop_time_updates) {
+                if(stu.trip_id == NO_STR) {
                     stu.trip_id = tu_ctx.current_update.trip.trip_id;
                 }
+                stu.start_date = tu_ctx.current_update.trip.start_date;
+                stu.start_time = tu_ctx.current_update.trip.start_time;
             }
+            tu_ctx.current_update.stop_time_updates = staged.arena.copy(ctx->stop_time_updates.data(), ctx->stop_time_updates.size());
 
-            tu_ctx.data->realtime_trip_updates.push_back(tu_ctx.current_update);
+            staged.trip_updates.put(entity_id, std::move(tu_ctx.current_update), ctx->message->source, 0, staged.arena);
         }
 
         if (entity.has_vehicle) {
-             vp_ctx.current_pos.update_id = entity_id;
-             vp_ctx.current_pos.is_deleted = entity.is_deleted;
-
              if (entity.vehicle.has_current_stop_sequence) vp_ctx.current_pos.current_stop_sequence = entity.vehicle.current_stop_sequence;
              else vp_ctx.current_pos.current_stop_sequence = -1;
 
@@ -287,13 +387,10 @@ void parse_realtime_feed(GTFSData& data, const unsigned char* buf, size_t len, i
                  if (entity.vehicle.position.has_speed) vp_ctx.current_pos.position.speed = entity.vehicle.position.speed;
                  else vp_ctx.current_pos.position.speed = -1.0f;
              }
-             vp_ctx.data->realtime_vehicle_positions.push_back(vp_ctx.current_pos);
+             staged.vehicle_positions.put(entity_id, std::move(vp_ctx.current_pos), ctx->message->source, 0, staged.arena);
         }
 
         if (entity.has_alert) {
-            al_ctx.current_alert.update_id = entity_id;
-            al_ctx.current_alert.is_deleted = entity.is_deleted;
-
             if (entity.alert.has_cause) al_ctx.current_alert.cause = entity.alert.cause;
             else al_ctx.current_alert.cause = -1;
 
@@ -303,20 +400,278 @@ void parse_realtime_feed(GTFSData& data, const unsigned char* buf, size_t len, i
             if (entity.alert.has_severity_level) al_ctx.current_alert.severity_level = entity.alert.severity_level;
             else al_ctx.current_alert.severity_level = -1;
 
-            al_ctx.data->realtime_alerts.push_back(al_ctx.current_alert);
+            staged.alerts.put(entity_id, std::move(al_ctx.current_alert), ctx->message->source, 0, staged.arena);
         }
 
         return true;
     };
     RealtimeParseContext ctx;
-    ctx.data = &data;
+    ctx.message = &out;
+    ctx.pool = &pool;
     ctx.feed_id = feed_id;
     message.entity.arg = &ctx;
 
     pb_istream_t stream = pb_istream_from_buffer(buf, len);
-    if (!pb_decode(&stream, GTFSv2_Realtime_FeedMessage_fields, &message)) {
+    out.complete = pb_decode(&stream, GTFSv2_Realtime_FeedMessage_fields, &message);
+    if (!out.complete) {
         std::cerr << "Failed to parse protobuf: " << PB_GET_ERROR(&stream) << std::endl;
     }
 }
 
+// Merges a decoded message into the feed's store. A FULL_DATASET message replaces
+// the entities its source sent before; a DIFFERENTIAL one only upserts and deletes.
+// An incomplete message keeps what was decoded, but neither sweeps nor records its
+// header, so the next poll of the source is applied again.
+void apply_realtime_message(RealtimeFeed& feed, RealtimeMessage& msg) {
+    uint32_t generation = ++feed.generation;
+    if (!msg.deleted.empty()) {
+        std::unordered_set<std::string_view> deleted;
+        for (const RealtimeText& id : msg.deleted) deleted.insert(id.view());
+        auto gone = [&deleted](const auto& entry) { return deleted.count(entry.id.view()) != 0; };
+        feed.trip_updates.erase_if(gone);
+        feed.vehicle_positions.erase_if(gone);
+        feed.alerts.erase_if(gone);
+    }
+    // Out of the message's arena, which is released with the staged entities
+    for (auto& entry : msg.entities.trip_updates) {
+        relocate(entry.value, feed.arena);
+        feed.trip_updates.put(entry.id.view(), std::move(entry.value), msg.source, generation, feed.arena);
+    }
+    for (auto& entry : msg.entities.vehicle_positions) {
+        relocate(entry.value, feed.arena);
+        feed.vehicle_positions.put(entry.id.view(), std::move(entry.value), msg.source, generation, feed.arena);
+    }
+    for (auto& entry : msg.entities.alerts) feed.alerts.put(entry.id.view(), std::move(entry.value), msg.source, generation, feed.arena);
+    msg.deleted.clear();
+    msg.entities = RealtimeFeed();
+
+    if (!msg.complete) return;
+    if (msg.full_dataset) {
+        uint32_t source = msg.source;
+        auto stale = [source, generation](const auto& entry) { return entry.source == source && entry.generation != generation; };
+        feed.trip_updates.erase_if(stale);
+        feed.vehicle_positions.erase_if(stale);
+        feed.alerts.erase_if(stale);
+    }
+    if (msg.timestamp != 0) feed.header_timestamps[msg.source] = msg.timestamp;
+    else feed.header_timestamps.erase(msg.source);
+}
+
+// Decodes and applies one FeedMessage in place. Returns false, without decoding any
+// entity, when its header timestamp equals that of the last message applied from
+// the same source.
+bool parse_realtime_feed(RealtimeFeed& feed, StringPool& pool, uint32_t source, const unsigned char* buf, size_t len, uint32_t feed_id) {
+    uint64_t timestamp;
+    bool full_dataset;
+    read_realtime_header(buf, len, timestamp, full_dataset);
+    if (realtime_unchanged(feed, source, timestamp)) return false;
+
+    RealtimeMessage msg;
+    decode_realtime_message(pool, buf, len, source, feed_id, msg);
+    apply_realtime_message(feed, msg);
+    return true;
+}
+
+// The store an update call for feed_id writes to. Without a feed_id the update
+// replaces the realtime state of every feed.
+RealtimeFeed& realtime_feed_for_update(GTFSData& data, const std::string& feed_id) {
+    if (feed_id.empty()) {
+        for (auto it = data.realtime.begin(); it != data.realtime.end();) {
+            if (it->first.empty()) ++it;
+            else it = data.realtime.erase(it);
+        }
+    }
+    return data.realtime[feed_id];
+}
+
+// Slack around the stretch of shape the vehicle's stop and status allow, so a
+// position reported just before a stop or just after leaving it still matches
+constexpr double VEHICLE_SNAP_SLACK_M = 100.0;
+
+// Meters along the shape (span span_index of shapes_by_id) of each of the
+// trip's stop times: from shape_dist_traveled when the stop times and the shape
+// both have it, else by snapping each stop no earlier than the one before
+static std::vector<double> stop_distances_along(const GTFSData& data, const Trip& trip, const ShapeSpan& sp, size_t span_index, const std::vector<StopTime>& trip_stops) {
+    const ShapeTracks& tracks = data.shape_tracks;
+    const Shape* pts = data.shapes.data();
+    std::vector<double> distances(trip_stops.size());
+    double prev = 0;
+    for (size_t i = 0; i < trip_stops.size(); ++i) {
+        const StopTime& st = trip_stops[i];
+        double d = prev;
+        if (st.shape_dist_traveled == ST_NO_DIST || !tracks.at_traveled(pts, sp, st.shape_dist_traveled, d)) {
+            const Stop* stop = data.stops.find(trip.feed_id, st.stop_id);
+            ShapeTracks::Snap snap;
+            if (stop && tracks.snap(pts, sp, span_index, stop->stop_lat, stop->stop_lon, prev, std::numeric_limits<double>::infinity(), snap)) d = snap.distance;
+        }
+        distances[i] = prev = std::max(d, prev);
+    }
+    return distances;
+}
+
+// Fills vehicle_progress for data.vehicles: each vehicle's trip (by trip_id,
+// preferring the vehicle's feed) gives the shape, and its current stop and
+// status narrow where on the shape it can be, so loops and shapes that double
+// back snap to the right pass. Stop distances are kept per trip for as long as
+// some vehicle runs it.
+void snap_vehicles(GTFSData& data) {
+    data.vehicle_progress.assign(data.vehicles.size(), VehicleProgress());
+    if (data.shapes.empty()) {
+        data.trip_stop_distances.clear();
+        return;
+    }
+    if (!data.shape_tracks.built()) data.shape_tracks.build(data.shapes, data.shapes_by_id);
+    const ShapeTracks& tracks = data.shape_tracks;
+    const double inf = std::numeric_limits<double>::infinity();
+
+    StopTimeRows stop_times = data.stop_time_rows();
+    std::unordered_map<uint32_t, std::vector<double>> kept;
+    std::vector<StopTime> trip_stops;
+    for (size_t v = 0; v < data.vehicles.size(); ++v) {
+        const RealtimeVehiclePosition& vp = *data.vehicles[v];
+        uint32_t row = NO_STR;
+        for (uint32_t r : data.trips_by_id.find(vp.trip.trip_id)) {
+            if (row == NO_STR || data.trips[r].feed_id == vp.feed_id) row = r;
+            if (data.trips[r].feed_id == vp.feed_id) break;
+        }
+        if (row == NO_STR) continue;
+        const Trip& trip = data.trips[row];
+        const ShapeSpan* sp = trip.shape_id == NO_STR ? nullptr : data.shapes_by_id.find(trip.feed_id, trip.shape_id);
+        if (!sp) continue;
+        size_t span_index = static_cast<size_t>(sp - data.shapes_by_id.spans().data());
+
+        VehicleProgress& out = data.vehicle_progress[v];
+        out.shape_id = trip.shape_id;
+        out.shape_length = tracks.length(*sp);
+
+        trip_stops.clear();
+        auto [first, last] = stop_times.trip_rows(trip.trip_id);
+        for (uint32_t i = first; i != last; ++i) {
+            StopTime st = stop_times[i];
+            if (st.feed_id == trip.feed_id) trip_stops.push_back(st);
+        }
+        auto cached = kept.find(row);
+        if (cached == kept.end()) {
+            auto previous = data.trip_stop_distances.find(row);
+            if (previous != data.trip_stop_distances.end() && previous->second.size() == trip_stops.size()) {
+                cached = kept.emplace(row, std::move(previous->second)).first;
+            } else {
+                cached = kept.emplace(row, stop_distances_along(data, trip, *sp, span_index, trip_stops)).first;
+            }
+        }
+        const std::vector<double>& stop_dist = cached->second;
+        size_t n = trip_stops.size();
+
+        // The stop the vehicle is at or heading to
+        size_t k = n;
+        for (size_t i = 0; i < n; ++i) {
+            if (vp.current_stop_sequence != -1 ? trip_stops[i].stop_sequence == vp.current_stop_sequence
+                                               : vp.stop_id != NO_STR && trip_stops[i].stop_id == vp.stop_id) {
+                k = i;
+                break;
+            }
+        }
+        bool stopped = vp.current_status == GTFSv2_Realtime_VehiclePosition_VehicleStopStatus_STOPPED_AT;
+        double lo = 0, hi = inf;
+        if (k < n) {
+            lo = k > 0 ? stop_dist[k - 1] - VEHICLE_SNAP_SLACK_M : 0;
+            if (!stopped) hi = stop_dist[k] + VEHICLE_SNAP_SLACK_M;
+            else if (k + 1 < n) hi = stop_dist[k + 1] + VEHICLE_SNAP_SLACK_M;
+        }
+
+        ShapeTracks::Snap snap;
+        bool positioned = vp.position.latitude != 0 || vp.position.longitude != 0;
+        if (positioned && tracks.snap(data.shapes.data(), *sp, span_index, vp.position.latitude, vp.position.longitude, lo, hi, snap)) {
+            out.lat = snap.lat;
+            out.lon = snap.lon;
+            out.distance = snap.distance;
+            out.offset = snap.offset;
+        }
+
+        size_t next = n;
+        if (k < n) next = stopped ? k + 1 : k;
+        else if (!std::isnan(out.distance)) next = static_cast<size_t>(std::upper_bound(stop_dist.begin(), stop_dist.end(), out.distance) - stop_dist.begin());
+        if (next < n) {
+            out.next_stop_id = trip_stops[next].stop_id;
+            out.next_stop_sequence = trip_stops[next].stop_sequence;
+            out.next_stop_distance = std::max(0.0, stop_dist[next] - out.distance);
+        }
+    }
+    data.trip_stop_distances = std::move(kept);
+}
+
+// Rebuilds data.realtime_join and the vehicle grid from data.realtime; callers hold
+// the data lock exclusively and call it after every change to the realtime state.
+// Feeds whose arenas are mostly dead runs are compacted first.
+void rebuild_realtime_indexes(GTFSData& data) {
+    for (auto& [feed_key, feed] : data.realtime) {
+        if (feed.sparse()) feed.compact();
+    }
+
+    std::vector<RealtimeTripRef> trips;
+    std::vector<RealtimeStopRef> stops;
+    StopTimeRows stop_times = data.stop_time_rows();
+    for (const auto& [feed_key, feed] : data.realtime) {
+        for (const auto& entry : feed.trip_updates) {
+            const RealtimeTripUpdate& tu = entry.value;
+            if (tu.trip.trip_id == NO_STR) continue;
+
+            RealtimeTripRef ref;
+            ref.trip_id = tu.trip.trip_id;
+            ref.feed_id = tu.feed_id;
+            if (!tu.trip.start_date.empty()) ref.day = parse_date_days(tu.trip.start_date.view());
+            ref.update = &tu;
+            ref.first_stop = static_cast<uint32_t>(stops.size());
+
+            // Static rows of the trip, for updates that give a stop_id but no stop_sequence
+            auto [first_row, last_row] = stop_times.trip_rows(tu.trip.trip_id);
+            for (const RealtimeStopTimeUpdate& stu : tu.stop_time_updates) {
+                int32_t seq = stu.stop_sequence;
+                if (seq == -1 && stu.stop_id != NO_STR) {
+                    for (uint32_t row = first_row; row != last_row; ++row) {
+                        StopTime st = stop_times[row];
+                        if (st.stop_id == stu.stop_id && (tu.feed_id == NO_STR || st.feed_id == tu.feed_id)) {
+                            seq = st.stop_sequence;
+                            break;
+                        }
+                    }
+                }
+                if (seq != -1) stops.push_back({ seq, &stu });
+            }
+            ref.stop_count = static_cast<uint32_t>(stops.size()) - ref.first_stop;
+            std::stable_sort(stops.begin() + ref.first_stop, stops.end(), [](const RealtimeStopRef& a, const RealtimeStopRef& b) {
+                return a.stop_sequence < b.stop_sequence;
+            });
+            trips.push_back(ref);
+        }
+    }
+    data.realtime_join.build(std::move(trips), std::move(stops));
+
+    data.vehicles.clear();
+    for (const auto& [feed_key, feed] : data.realtime) {
+        for (const auto& entry : feed.vehicle_positions) data.vehicles.push_back(&entry.value);
+    }
+    data.vehicles_by_location.build(data.vehicles.size(), [&data](size_t i, double& lat, double& lon) {
+        lat = data.vehicles[i]->position.latitude;
+        lon = data.vehicles[i]->position.longitude;
+        return lat != 0 || lon != 0;
+    });
+    snap_vehicles(data);
+}
+
+// Drops the entities and header state of every source not in `sources`, i.e. of
+// messages the latest update call no longer provided
+void retain_realtime_sources(RealtimeFeed& feed, const std::vector<uint32_t>& sources) {
+    auto gone = [&sources](const auto& entry) {
+        return std::find(sources.begin(), sources.end(), entry.source) == sources.end();
+    };
+    feed.trip_updates.erase_if(gone);
+    feed.vehicle_positions.erase_if(gone);
+    feed.alerts.erase_if(gone);
+    for (auto it = feed.header_timestamps.begin(); it != feed.header_timestamps.end();) {
+        if (std::find(sources.begin(), sources.end(), it->first) == sources.end()) it = feed.header_timestamps.erase(it);
+        else ++it;
+    }
+}
+
 }
@@ -0,0 +1,618 @@
+#include "GTFS.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <type_traits>
+#include <chrono>
+#include <memory>
+#include <random>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace gtfs {
+
+// Binary snapshot of a finalized GTFSData. Bump SNAPSHOT_VERSION whenever the
+// layout of the file or of StopTime changes; older files are then rejected.
+//
+// The file is position independent: the string pool is an offset table plus a
+// blob, and the entity tables, stop_times and the stop index are 8-byte
+// aligned raw arrays, so a loaded (or mmap'ed) file is used in place rather
+// than copied.
+constexpr char     SNAPSHOT_MAGIC[8] = { 'Q', 'D', 'F', 'G', 'T', 'F', 'S', '\0' };
+constexpr uint32_t SNAPSHOT_VERSION  = 6;
+constexpr size_t   SNAPSHOT_ALIGN    = 8;
+constexpr uint32_t SNAPSHOT_ENDIAN   = 0x01020304u;
+
+class SnapshotWriter {
+    std::FILE* file_;
+    size_t pos_ = 0;
+public:
+    explicit SnapshotWriter(const std::string& path) : file_(std::fopen(path.c_str(), "wb")) {
+        if (!file_) throw std::runtime_error("Failed to open snapshot for writing: " + path);
+    }
+    ~SnapshotWriter() { if (file_) std::fclose(file_); }
+
+    void close() {
+        if (!file_) return;
+        bool ok = std::fflush(file_) == 0;
+        ok = (std::fclose(file_) == 0) && ok;
+        file_ = nullptr;
+        if (!ok) throw std::runtime_error("Failed to flush snapshot");
+    }
+
+    void bytes(const void* p, size_t n) {
+        if (n == 0) return;
+        if (std::fwrite(p, 1, n, file_) != n) throw std::runtime_error("Failed to write snapshot");
+        pos_ += n;
+    }
+
+    void align() {
+        static const char zeros[SNAPSHOT_ALIGN] = {};
+        bytes(zeros, (SNAPSHOT_ALIGN - pos_ % SNAPSHOT_ALIGN) % SNAPSHOT_ALIGN);
+    }
+
+    template<typename T>
+    void pod(const T& v) {
+        static_assert(std::is_trivially_copyable_v<T>, "pod() requires a trivially copyable type");
+        bytes(&v, sizeof(T));
+    }
+
+    void u32(uint32_t v) { pod(v); }
+    void u64(uint64_t v) { pod(v); }
+
+    void str(const std::string& s) {
+        u32(static_cast<uint32_t>(s.size()));
+        bytes(s.data(), s.size());
+    }
+
+    void opt_str(const std::optional<std::string>& s) {
+        pod<uint8_t>(s.has_value() ? 1 : 0);
+        if (s.has_value()) str(s.value());
+    }
+
+    void opt_int(const std::optional<int>& v) {
+        pod<uint8_t>(v.has_value() ? 1 : 0);
+        if (v.has_value()) pod<int32_t>(v.value());
+    }
+
+    void opt_double(const std::optional<double>& v) {
+        pod<uint8_t>(v.has_value() ? 1 : 0);
+        if (v.has_value()) pod<double>(v.value());
+    }
+
+    // Count, then the elements at the next aligned offset so readers can view them in place
+    template<typename T>
+    void pod_array(const T* items, size_t n) {
+        static_assert(std::is_trivially_copyable_v<T>, "pod_array() requires a trivially copyable type");
+        static_assert(alignof(T) <= SNAPSHOT_ALIGN, "pod_array() element alignment exceeds SNAPSHOT_ALIGN");
+        u64(n);
+        align();
+        bytes(items, n * sizeof(T));
+    }
+
+    template<typename T>
+    void pod_array(const std::vector<T>& vec) { pod_array(vec.data(), vec.size()); }
+
+    template<typename T>
+    void pod_array(const FlatArray<T>& arr) { pod_array(arr.data(), arr.size()); }
+};
+
+class SnapshotReader {
+    const char* base_;
+    const char* ptr_;
+    const char* end_;
+public:
+    SnapshotReader(const char* data, size_t size) : base_(data), ptr_(data), end_(data + size) {}
+
+    void bytes(void* out, size_t n) {
+        if (static_cast<size_t>(end_ - ptr_) < n) throw std::runtime_error("Snapshot is truncated");
+        if (n) memcpy(out, ptr_, n);
+        ptr_ += n;
+    }
+
+    template<typename T>
+    T pod() {
+        T v;
+        bytes(&v, sizeof(T));
+        return v;
+    }
+
+    uint32_t u32() { return pod<uint32_t>(); }
+    uint64_t u64() { return pod<uint64_t>(); }
+
+    std::string str() {
+        uint32_t n = u32();
+        if (static_cast<size_t>(end_ - ptr_) < n) throw std::runtime_error("Snapshot is truncated");
+        std::string s(ptr_, n);
+        ptr_ += n;
+        return s;
+    }
+
+    std::optional<std::string> opt_str() {
+        if (!pod<uint8_t>()) return std::nullopt;
+        return str();
+    }
+
+    std::optional<int> opt_int() {
+        if (!pod<uint8_t>()) return std::nullopt;
+        return static_cast<int>(pod<int32_t>());
+    }
+
+    std::optional<double> opt_double() {
+        if (!pod<uint8_t>()) return std::nullopt;
+        return pod<double>();
+    }
+
+    // Views an array written by SnapshotWriter::pod_array; the buffer must outlive the result
+    template<typename T>
+    const T* pod_array(size_t& count) {
+        uint64_t n = u64();
+        size_t pad = (SNAPSHOT_ALIGN - static_cast<size_t>(ptr_ - base_) % SNAPSHOT_ALIGN) % SNAPSHOT_ALIGN;
+        if (static_cast<size_t>(end_ - ptr_) < pad) throw std::runtime_error("Snapshot is truncated");
+        ptr_ += pad;
+        if (n > static_cast<uint64_t>(end_ - ptr_) / sizeof(T)) throw std::runtime_error("Snapshot is truncated");
+        const T* items = reinterpret_cast<const T*>(ptr_);
+        count = static_cast<size_t>(n);
+        ptr_ += count * sizeof(T);
+        return items;
+    }
+
+    bool at_end() const { return ptr_ == end_; }
+};
+
+// Writes every feed-scoped map as: feed count, then per feed (feed_id, record count, records)
+template<typename T, typename WriteFn>
+void write_feed_maps(SnapshotWriter& w, const std::unordered_map<std::string, std::unordered_map<std::string, T>>& maps, WriteFn write_record) {
+    w.u32(static_cast<uint32_t>(maps.size()));
+    for (const auto& [fid, feed_map] : maps) {
+        w.str(fid);
+        w.u32(static_cast<uint32_t>(feed_map.size()));
+        for (const auto& [key, rec] : feed_map) {
+            w.str(key);
+            write_record(rec);
+        }
+    }
+}
+
+template<typename T, typename ReadFn>
+void read_feed_maps(SnapshotReader& r, std::unordered_map<std::string, std::unordered_map<std::string, T>>& maps, ReadFn read_record) {
+    uint32_t feeds = r.u32();
+    for (uint32_t f = 0; f < feeds; ++f) {
+        std::string fid = r.str();
+        auto& feed_map = maps[fid];
+        uint32_t n = r.u32();
+        feed_map.reserve(n);
+        for (uint32_t i = 0; i < n; ++i) {
+            std::string key = r.str();
+            T rec = read_record();
+            rec.feed_id = fid;
+            feed_map.emplace(std::move(key), std::move(rec));
+        }
+    }
+}
+
+// Temporary file next to path, unique to this process and call, so processes
+// saving the same snapshot never write to the same file
+static std::string snapshot_tmp_path(const std::string& path) {
+#ifdef _WIN32
+    unsigned long pid = GetCurrentProcessId();
+#else
+    unsigned long pid = static_cast<unsigned long>(getpid());
+#endif
+    std::random_device rd;
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), ".%lu.%08x.tmp", pid, static_cast<unsigned>(rd()));
+    return path + suffix;
+}
+
+void save_snapshot(const GTFSData& data, const std::string& path) {
+    // Write to a temporary file and rename so readers never observe a partial snapshot
+    std::string tmp_path = snapshot_tmp_path(path);
+    {
+        SnapshotWriter w(tmp_path);
+        w.bytes(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        w.u32(SNAPSHOT_VERSION);
+        w.u32(SNAPSHOT_ENDIAN);
+        w.u32(static_cast<uint32_t>(sizeof(StopTime)));
+        w.u32(static_cast<uint32_t>(sizeof(Route)));
+        w.u32(static_cast<uint32_t>(sizeof(Stop)));
+        w.u32(static_cast<uint32_t>(sizeof(Trip)));
+        w.u32(static_cast<uint32_t>(sizeof(Calendar)));
+        w.u32(static_cast<uint32_t>(sizeof(Shape)));
+        w.u32(static_cast<uint32_t>(sizeof(ServiceDays)));
+
+        // String pool, in id order so interned ids survive the round trip:
+        // offsets, blob, then a power-of-two probe table keyed by stable_hash
+        size_t pool_size = data.string_pool.size();
+        std::vector<uint32_t> offsets(pool_size + 1, 0);
+        std::string blob;
+        std::vector<uint32_t> slots;
+        {
+            size_t slot_count = 1;
+            while (slot_count < pool_size * 2) slot_count <<= 1;
+            if (pool_size == 0) slot_count = 0;
+            slots.assign(slot_count, StringPool::EXT_EMPTY);
+            for (size_t i = 0; i < pool_size; ++i) {
+                std::string str = data.string_pool.get(static_cast<uint32_t>(i));
+                if (blob.size() + str.size() > 0xFFFFFFFFu) throw std::runtime_error("String pool too large for snapshot");
+                blob += str;
+                offsets[i + 1] = static_cast<uint32_t>(blob.size());
+                uint32_t mask = static_cast<uint32_t>(slot_count - 1);
+                uint32_t h = StringPool::stable_hash(str) & mask;
+                while (slots[h] != StringPool::EXT_EMPTY) h = (h + 1) & mask;
+                slots[h] = static_cast<uint32_t>(i);
+            }
+        }
+        w.pod_array(offsets);
+        w.pod_array(blob.data(), blob.size());
+        w.pod_array(slots);
+
+        write_feed_maps(w, data.agencies, [&](const Agency& a) {
+            w.opt_str(a.agency_id);
+            w.str(a.agency_name);
+            w.str(a.agency_url);
+            w.str(a.agency_timezone);
+            w.opt_str(a.agency_lang);
+            w.opt_str(a.agency_phone);
+            w.opt_str(a.agency_fare_url);
+            w.opt_str(a.agency_email);
+        });
+
+        w.pod_array(data.calendars.rows());
+
+        w.u32(static_cast<uint32_t>(data.calendar_dates.size()));
+        for (const auto& [fid, services] : data.calendar_dates) {
+            w.str(fid);
+            w.u32(static_cast<uint32_t>(services.size()));
+            for (const auto& [service_id, dates] : services) {
+                w.str(service_id);
+                w.u32(static_cast<uint32_t>(dates.size()));
+                for (const auto& [date, exc] : dates) {
+                    w.str(date);
+                    w.pod<int32_t>(exc);
+                }
+            }
+        }
+
+        w.pod_array(data.routes.rows());
+        w.pod_array(data.stops.rows());
+        w.pod_array(data.trips.rows());
+        w.pod_array(data.shapes);
+        w.pod_array(data.shapes_by_id.spans());
+        w.pod_array(data.shapes_by_id.tolerance());
+
+        w.u32(static_cast<uint32_t>(data.feed_info.size()));
+        for (const auto& f : data.feed_info) {
+            w.str(f.feed_publisher_name);
+            w.str(f.feed_publisher_url);
+            w.str(f.feed_lang);
+            w.opt_str(f.default_lang);
+            w.opt_str(f.feed_start_date);
+            w.opt_str(f.feed_end_date);
+            w.opt_str(f.feed_version);
+            w.opt_str(f.feed_contact_email);
+            w.opt_str(f.feed_contact_url);
+            w.str(f.feed_id);
+        }
+
+        // Services are stored rather than rebuilt so trip rows keep their service_index
+        std::vector<uint64_t> service_keys(data.services.size(), 0);
+        for (const auto& [key, idx] : data.service_by_intern_id) service_keys[idx] = key;
+        w.pod_array(data.services);
+        w.pod_array(service_keys);
+        w.pod_array(data.service_day_bits);
+
+        if (!data.compact_stop_times.empty()) {
+            // Snapshots always hold flat rows so attachSnapshot can map them
+            std::vector<StopTime> rows;
+            data.compact_stop_times.expand(rows);
+            w.pod_array(rows);
+        } else {
+            w.pod_array(data.stop_times);
+        }
+        w.pod_array(data.stop_times_by_stop_id.offsets());
+        w.pod_array(data.stop_times_by_stop_id.rows());
+        w.pod<int32_t>(data.stop_times_by_stop_id.max_span());
+
+        // What later feed changes merge again
+        w.u32(static_cast<uint32_t>(data.feed_order.size()));
+        for (const std::string& id : data.feed_order) w.str(id);
+        w.pod_array(data.merge_lost_stop_times);
+        w.pod_array(data.merge_lost_shapes);
+
+        w.bytes(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        w.close();
+    }
+
+#ifdef _WIN32
+    // rename does not replace an existing file here. Elsewhere it replaces it
+    // atomically, so other processes never find the snapshot missing.
+    std::remove(path.c_str());
+#endif
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("Failed to move snapshot into place: " + path);
+    }
+}
+
+// Restores data from a snapshot image at [base, base + size). Large arrays and
+// the string pool view the image in place; owner keeps it alive.
+void restore_snapshot(GTFSData& data, const char* base, size_t size, std::shared_ptr<const void> owner, const std::string& path) {
+    SnapshotReader r(base, size);
+
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    r.bytes(magic, sizeof(magic));
+    if (memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0) throw std::runtime_error("Not a GTFS snapshot: " + path);
+    uint32_t version = r.u32();
+    if (version != SNAPSHOT_VERSION) {
+        throw std::runtime_error("Unsupported snapshot version " + std::to_string(version) + " (expected " + std::to_string(SNAPSHOT_VERSION) + ")");
+    }
+    if (r.u32() != SNAPSHOT_ENDIAN) throw std::runtime_error("Snapshot was written on a machine with different endianness");
+    if (r.u32() != sizeof(StopTime)) throw std::runtime_error("Snapshot StopTime layout does not match this build");
+    for (size_t record_size : { sizeof(Route), sizeof(Stop), sizeof(Trip), sizeof(Calendar), sizeof(Shape), sizeof(ServiceDays) }) {
+        if (r.u32() != record_size) throw std::runtime_error("Snapshot record layout does not match this build");
+    }
+
+    data.clear();
+
+    // Never leave a half-restored GTFSData behind
+    try {
+        data.image = std::move(owner);
+
+        size_t n_offsets = 0, blob_size = 0, n_slots = 0;
+        const uint32_t* offsets = r.pod_array<uint32_t>(n_offsets);
+        const char* blob = r.pod_array<char>(blob_size);
+        const uint32_t* slots = r.pod_array<uint32_t>(n_slots);
+        if (n_offsets == 0 || n_offsets - 1 > 0xFFFFFFFEu || offsets[0] != 0 || offsets[n_offsets - 1] != blob_size) {
+            throw std::runtime_error("Snapshot string pool is corrupt");
+        }
+        for (size_t i = 1; i < n_offsets; ++i) {
+            if (offsets[i] < offsets[i - 1]) throw std::runtime_error("Snapshot string pool is corrupt");
+        }
+        if ((n_slots & (n_slots - 1)) != 0 || (n_offsets > 1 && n_slots <= n_offsets - 1)) throw std::runtime_error("Snapshot string pool is corrupt");
+        for (size_t i = 0; i < n_slots; ++i) {
+            if (slots[i] != StringPool::EXT_EMPTY && slots[i] >= n_offsets - 1) throw std::runtime_error("Snapshot string pool is corrupt");
+        }
+        data.string_pool.attach(offsets, blob, static_cast<uint32_t>(n_offsets - 1), slots, static_cast<uint32_t>(n_slots));
+
+        read_feed_maps(r, data.agencies, [&]() {
+            Agency a;
+            a.agency_id = r.opt_str();
+            a.agency_name = r.str();
+            a.agency_url = r.str();
+            a.agency_timezone = r.str();
+            a.agency_lang = r.opt_str();
+            a.agency_phone = r.opt_str();
+            a.agency_fare_url = r.opt_str();
+            a.agency_email = r.opt_str();
+            return a;
+        });
+
+        size_t n_rows = 0;
+        const Calendar* calendars = r.pod_array<Calendar>(n_rows);
+        data.calendars.attach(calendars, n_rows);
+
+        uint32_t cd_feeds = r.u32();
+        for (uint32_t f = 0; f < cd_feeds; ++f) {
+            auto& services = data.calendar_dates[r.str()];
+            uint32_t n_services = r.u32();
+            for (uint32_t s = 0; s < n_services; ++s) {
+                auto& dates = services[r.str()];
+                uint32_t n_dates = r.u32();
+                for (uint32_t d = 0; d < n_dates; ++d) {
+                    std::string date = r.str();
+                    dates[std::move(date)] = r.pod<int32_t>();
+                }
+            }
+        }
+
+        // String ids inside records are trusted like the stop index rows below
+        const Route* routes = r.pod_array<Route>(n_rows);
+        data.routes.attach(routes, n_rows);
+        const Stop* stops = r.pod_array<Stop>(n_rows);
+        data.stops.attach(stops, n_rows);
+        data.build_stop_grid();
+        const Trip* trips = r.pod_array<Trip>(n_rows);
+        data.trips.attach(trips, n_rows);
+        const Shape* shapes = r.pod_array<Shape>(n_rows);
+        data.shapes.attach(shapes, n_rows);
+        size_t n_spans = 0, n_tolerance = 0;
+        const ShapeSpan* spans = r.pod_array<ShapeSpan>(n_spans);
+        const float* tolerance = r.pod_array<float>(n_tolerance);
+        if (n_tolerance != n_rows) throw std::runtime_error("Snapshot shape index is corrupt");
+        for (size_t i = 0; i < n_spans; ++i) {
+            if (spans[i].first > n_rows || spans[i].count > n_rows - spans[i].first) throw std::runtime_error("Snapshot shape index is corrupt");
+        }
+        data.shapes_by_id.attach(spans, n_spans, tolerance, n_tolerance);
+
+        uint32_t n_feed_info = r.u32();
+        for (uint32_t i = 0; i < n_feed_info; ++i) {
+            FeedInfo f;
+            f.feed_publisher_name = r.str();
+            f.feed_publisher_url = r.str();
+            f.feed_lang = r.str();
+            f.default_lang = r.opt_str();
+            f.feed_start_date = r.opt_str();
+            f.feed_end_date = r.opt_str();
+            f.feed_version = r.opt_str();
+            f.feed_contact_email = r.opt_str();
+            f.feed_contact_url = r.opt_str();
+            f.feed_id = r.str();
+            data.feed_info.push_back(std::move(f));
+        }
+
+        size_t n_services = 0, n_keys = 0, n_words = 0;
+        const ServiceDays* services = r.pod_array<ServiceDays>(n_services);
+        const uint64_t* service_keys = r.pod_array<uint64_t>(n_keys);
+        const uint64_t* words = r.pod_array<uint64_t>(n_words);
+        if (n_keys != n_services) throw std::runtime_error("Snapshot services are corrupt");
+        for (size_t i = 0; i < n_services; ++i) {
+            const ServiceDays& sd = services[i];
+            if (sd.word_offset > n_words || (static_cast<size_t>(sd.day_count) + 63) / 64 > n_words - sd.word_offset) {
+                throw std::runtime_error("Snapshot services are corrupt");
+            }
+        }
+        data.services.assign(services, services + n_services);
+        data.service_day_bits.assign(words, words + n_words);
+        data.service_by_intern_id.reserve(n_services);
+        for (size_t i = 0; i < n_services; ++i) data.service_by_intern_id.emplace(service_keys[i], static_cast<uint32_t>(i));
+
+        size_t n_stop_times = 0;
+        const StopTime* stop_times = r.pod_array<StopTime>(n_stop_times);
+        data.stop_times.attach(stop_times, n_stop_times);
+
+        // Row ids themselves are trusted: validating them would touch every page of the index
+        size_t n_idx_offsets = 0, n_idx_rows = 0;
+        const uint32_t* idx_offsets = r.pod_array<uint32_t>(n_idx_offsets);
+        const uint32_t* idx_rows = r.pod_array<uint32_t>(n_idx_rows);
+        int32_t idx_max_span = r.pod<int32_t>();
+        if (n_idx_rows != n_stop_times || (n_idx_offsets > 0 && idx_offsets[n_idx_offsets - 1] != n_idx_rows)) {
+            throw std::runtime_error("Snapshot stop index is corrupt");
+        }
+        for (size_t i = 1; i < n_idx_offsets; ++i) {
+            if (idx_offsets[i] < idx_offsets[i - 1]) throw std::runtime_error("Snapshot stop index is corrupt");
+        }
+        if (idx_max_span < 0) throw std::runtime_error("Snapshot stop index is corrupt");
+        data.stop_times_by_stop_id.attach(idx_offsets, n_idx_offsets, idx_rows, n_idx_rows, idx_max_span);
+        data.build_trip_indexes();
+
+        uint32_t n_feeds = r.u32();
+        for (uint32_t i = 0; i < n_feeds; ++i) data.feed_order.push_back(r.str());
+        size_t n_lost = 0;
+        const StopTime* lost_stop_times = r.pod_array<StopTime>(n_lost);
+        data.merge_lost_stop_times.attach(lost_stop_times, n_lost);
+        const Shape* lost_shapes = r.pod_array<Shape>(n_lost);
+        data.merge_lost_shapes.attach(lost_shapes, n_lost);
+
+        r.bytes(magic, sizeof(magic));
+        if (memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0 || !r.at_end()) {
+            throw std::runtime_error("Snapshot is corrupt: " + path);
+        }
+    } catch (...) {
+        data.clear();
+        throw;
+    }
+}
+
+void load_snapshot(GTFSData& data, const std::string& path, LogFn log) {
+    auto t0 = std::chrono::steady_clock::now();
+
+    auto buf = std::make_shared<std::vector<char>>();
+    {
+        std::FILE* f = std::fopen(path.c_str(), "rb");
+        if (!f) throw std::runtime_error("Failed to open snapshot: " + path);
+        std::fseek(f, 0, SEEK_END);
+        long size = std::ftell(f);
+        std::fseek(f, 0, SEEK_SET);
+        if (size < 0) {
+            std::fclose(f);
+            throw std::runtime_error("Failed to read snapshot: " + path);
+        }
+        buf->resize(static_cast<size_t>(size));
+        size_t got = buf->empty() ? 0 : std::fread(buf->data(), 1, buf->size(), f);
+        std::fclose(f);
+        if (got != buf->size()) throw std::runtime_error("Failed to read snapshot: " + path);
+    }
+
+    const char* base = buf->data();
+    size_t size = buf->size();
+    restore_snapshot(data, base, size, std::move(buf), path);
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    data.load_stats.phases.push_back({ "read snapshot", ms, ms, 1 });
+    data.load_stats.total_ms = ms;
+    if (log) log("Loaded snapshot " + path + " in " + std::to_string(ms) + "ms (" + std::to_string(data.stop_times.size()) + " stop times)");
+}
+
+// Read-only mapping of a snapshot file. Pages are shared by every process that
+// maps the same file; the mapping stays valid if the file is later replaced.
+class MappedFile {
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+#endif
+public:
+    explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) throw std::runtime_error("Failed to open snapshot: " + path);
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_, &size)) {
+            CloseHandle(file_);
+            throw std::runtime_error("Failed to read snapshot: " + path);
+        }
+        size_ = static_cast<size_t>(size.QuadPart);
+        if (size_ > 0) {
+            mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            void* p = mapping_ ? MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0) : nullptr;
+            if (!p) {
+                if (mapping_) CloseHandle(mapping_);
+                CloseHandle(file_);
+                throw std::runtime_error("Failed to map snapshot: " + path);
+            }
+            data_ = static_cast<const char*>(p);
+        }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Failed to open snapshot: " + path);
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Failed to read snapshot: " + path);
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ > 0) {
+            void* p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Failed to map snapshot: " + path);
+            }
+            data_ = static_cast<const char*>(p);
+        }
+        ::close(fd);
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (data_) UnmapViewOfFile(data_);
+        if (mapping_) CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+#else
+        if (data_) ::munmap(const_cast<char*>(data_), size_);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+};
+
+void attach_snapshot(GTFSData& data, const std::string& path, LogFn log) {
+    auto t0 = std::chrono::steady_clock::now();
+
+    auto mapped = std::make_shared<MappedFile>(path);
+    const char* base = mapped->data();
+    size_t size = mapped->size();
+    restore_snapshot(data, base, size, std::move(mapped), path);
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    data.load_stats.phases.push_back({ "map snapshot", ms, ms, 1 });
+    data.load_stats.total_ms = ms;
+    if (log) log("Attached snapshot " + path + " in " + std::to_string(ms) + "ms (" + std::to_string(data.stop_times.size()) + " stop times)");
+}
+
+}
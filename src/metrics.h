@@ -0,0 +1,98 @@
+#ifndef GTFS_METRICS_H
+#define GTFS_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace gtfs {
+
+// Calls, failures and a latency histogram of one addon method. Recording is a
+// few relaxed atomic adds, so it stays on in production; readers may see
+// counters of a call that is still being recorded.
+class MethodStats {
+public:
+    // Bucket i holds calls of at most 4^i microseconds (1us .. ~1s); the last
+    // bucket holds everything slower
+    static constexpr size_t BUCKETS = 12;
+
+    static constexpr double bucket_bound_seconds(size_t i) {
+        return static_cast<double>(uint64_t(1) << (2 * i)) / 1e6;
+    }
+
+    void record(uint64_t ns, bool failed) {
+        uint64_t us = (ns + 999) / 1000;
+        size_t bucket = us <= 1 ? 0 : (static_cast<size_t>(std::bit_width(us - 1)) + 1) / 2;
+        if (bucket >= BUCKETS) bucket = BUCKETS - 1;
+        buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_ns_.fetch_add(ns, std::memory_order_relaxed);
+        if (failed) errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    struct Snapshot {
+        uint64_t count = 0;
+        uint64_t errors = 0;
+        uint64_t sum_ns = 0;
+        std::array<uint64_t, BUCKETS> buckets{};
+    };
+
+    Snapshot snapshot() const {
+        Snapshot s;
+        s.count = count_.load(std::memory_order_relaxed);
+        s.errors = errors_.load(std::memory_order_relaxed);
+        s.sum_ns = sum_ns_.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < BUCKETS; ++i) s.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+        return s;
+    }
+
+private:
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> errors_{0};
+    std::atomic<uint64_t> sum_ns_{0};
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets_{};
+};
+
+// MethodStats by method name. Entries are created on first use and never
+// removed, so callers may keep the reference.
+class Metrics {
+    mutable std::mutex mutex_;
+    std::deque<std::pair<std::string, MethodStats>> entries_;
+    std::unordered_map<std::string_view, MethodStats*> by_name_;
+public:
+    MethodStats& get(std::string_view name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = by_name_.find(name);
+        if (it != by_name_.end()) return *it->second;
+        auto& entry = entries_.emplace_back(std::piecewise_construct, std::forward_as_tuple(name), std::forward_as_tuple());
+        by_name_.emplace(entry.first, &entry.second);
+        return entry.second;
+    }
+
+    std::vector<std::pair<std::string, MethodStats::Snapshot>> snapshot() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<std::pair<std::string, MethodStats::Snapshot>> out;
+        out.reserve(entries_.size());
+        for (const auto& [name, stats] : entries_) out.emplace_back(name, stats.snapshot());
+        return out;
+    }
+};
+
+inline uint64_t elapsed_ns(std::chrono::steady_clock::time_point since) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count());
+}
+
+} // namespace gtfs
+
+#endif
@@ -0,0 +1,289 @@
+#ifndef GTFS_THREAD_POOL_H
+#define GTFS_THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace gtfs {
+
+// Fixed set of worker threads for a load: the file and chunk tasks of every feed
+// and the data-parallel finalize steps. Each thread has its own task queue; it
+// runs its newest task first and steals the oldest of another queue when its own
+// is empty. Threads outside the pool share queue 0. A thread waiting on tasks
+// (parallel_for, TaskGroup::wait, run_until) runs queued tasks meanwhile, so a
+// wait from inside a task cannot stall on workers that are all busy.
+class ThreadPool {
+public:
+    // 0 = one thread per hardware thread
+    explicit ThreadPool(unsigned int threads = 0) {
+        if (threads == 0) threads = std::thread::hardware_concurrency();
+        if (threads == 0) threads = 4;
+        for (unsigned int i = 0; i < threads; ++i) queues_.push_back(std::make_unique<Queue>());
+        // The caller is the last thread of every loop
+        for (unsigned int i = 1; i < threads; ++i) workers_.emplace_back([this, i] { work(i); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (auto& w : workers_) w.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return workers_.size() + 1; }
+
+    // Time spent inside loop bodies and tasks so far, summed over threads. A task
+    // that waits on other tasks counts the ones it runs meanwhile, not its sleep.
+    uint64_t busy_ns() const { return busy_ns_.load(std::memory_order_relaxed); }
+
+    // Queues fn on the calling thread's queue. fn must not throw; TaskGroup::run
+    // collects exceptions for a set of tasks.
+    void submit(std::function<void()> fn) {
+        Queue& q = *queues_[own_queue()];
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(std::move(fn));
+        }
+        queued_.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+        }
+        // Waiters in run_until sleep on the same condition, so wake them all
+        // when there are any; otherwise one idle worker is enough
+        if (waiters_.load() > 0) wake_.notify_all();
+        else wake_.notify_one();
+    }
+
+    // Runs queued tasks on the calling thread until done() holds, sleeping while
+    // there are none. done() is checked again whenever a task of a TaskGroup on
+    // this pool finishes, so it should only depend on such tasks.
+    void run_until(const std::function<bool()>& done) {
+        size_t own = own_queue();
+        while (!done()) {
+            if (run_one(own)) continue;
+            auto t0 = std::chrono::steady_clock::now();
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                waiters_.fetch_add(1);
+                wake_.wait(lock, [this, &done] { return queued_.load() > 0 || done(); });
+                waiters_.fetch_sub(1);
+            }
+            // The sleep is not work of the task this thread is inside of
+            if (depth_ > 0) busy_ns_.fetch_sub(since(t0), std::memory_order_relaxed);
+        }
+    }
+
+    // Calls fn(i) for every i in [0, count) across the pool and returns once all
+    // calls have finished. The first exception thrown by fn is rethrown here;
+    // indices not yet started when it is thrown are skipped.
+    void parallel_for(size_t count, const std::function<void(size_t)>& fn) {
+        if (count == 0) return;
+        if (count == 1 || workers_.empty()) {
+            Timed timed(*this);
+            for (size_t i = 0; i < count; ++i) fn(i);
+            return;
+        }
+
+        auto loop = std::make_shared<Loop>();
+        loop->count = count;
+        loop->fn = &fn;
+        size_t helpers = std::min(workers_.size(), count - 1);
+        // A helper that starts after the loop ran out of indices returns at once
+        for (size_t i = 0; i < helpers; ++i) submit([this, loop] { run(*loop); });
+
+        run(*loop);
+        // Indices left are running on other threads, so this wait cannot block them
+        std::unique_lock<std::mutex> lock(loop->mutex);
+        loop->finished.wait(lock, [&loop] { return loop->done == loop->count; });
+        if (loop->error) std::rethrow_exception(loop->error);
+    }
+
+private:
+    friend class TaskGroup;
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    struct Loop {
+        size_t count = 0;
+        const std::function<void(size_t)>* fn = nullptr;
+        std::atomic<size_t> next{0};
+        size_t done = 0; // guarded by mutex
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+
+    // Adds the time until destruction to busy_ns, unless the thread is already
+    // inside a timed task or loop body
+    struct Timed {
+        ThreadPool& pool;
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        explicit Timed(ThreadPool& pool) : pool(pool) { ++depth_; }
+        ~Timed() {
+            if (--depth_ == 0) pool.busy_ns_.fetch_add(since(t0), std::memory_order_relaxed);
+        }
+    };
+
+    static uint64_t since(std::chrono::steady_clock::time_point t0) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+    }
+
+    size_t own_queue() const { return current_ == this ? current_queue_ : 0; }
+
+    // Pops the newest task of queue own, or steals the oldest of another queue,
+    // and runs it. Returns false when every queue was empty.
+    bool run_one(size_t own) {
+        std::function<void()> task;
+        for (size_t k = 0; k < queues_.size() && !task; ++k) {
+            size_t i = (own + k) % queues_.size();
+            Queue& q = *queues_[i];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (q.tasks.empty()) continue;
+            if (i == own) {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+            } else {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+            }
+        }
+        if (!task) return false;
+        queued_.fetch_sub(1);
+        task();
+        return true;
+    }
+
+    // Wakes threads in run_until after a TaskGroup task finished
+    void notify_waiters() {
+        if (waiters_.load() == 0) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+        }
+        wake_.notify_all();
+    }
+
+    // Claims indices until none are left; every claimed index counts as done,
+    // whether it ran, threw or was skipped after an error
+    void run(Loop& loop) {
+        size_t i;
+        while ((i = loop.next.fetch_add(1, std::memory_order_relaxed)) < loop.count) {
+            bool failed;
+            {
+                std::lock_guard<std::mutex> lock(loop.mutex);
+                failed = static_cast<bool>(loop.error);
+            }
+            if (!failed) {
+                Timed timed(*this);
+                try {
+                    (*loop.fn)(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(loop.mutex);
+                    if (!loop.error) loop.error = std::current_exception();
+                }
+            }
+            std::lock_guard<std::mutex> lock(loop.mutex);
+            if (++loop.done == loop.count) loop.finished.notify_all();
+        }
+    }
+
+    void work(size_t index) {
+        current_ = this;
+        current_queue_ = index;
+        for (;;) {
+            if (run_one(index)) continue;
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this] { return stopping_ || queued_.load() > 0; });
+            if (stopping_ && queued_.load() == 0) return;
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues_; // queue 0 belongs to threads outside the pool
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> queued_{0};
+    std::atomic<size_t> waiters_{0};
+    std::mutex mutex_; // guards stopping_ and the sleeps on wake_
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    std::atomic<uint64_t> busy_ns_{0};
+
+    static inline thread_local const ThreadPool* current_ = nullptr;
+    static inline thread_local size_t current_queue_ = 0;
+    static inline thread_local int depth_ = 0;
+};
+
+// Tasks run on a ThreadPool that are waited for together. wait() runs queued
+// tasks while it waits and rethrows the first exception a task threw; tasks
+// started after that exception are skipped.
+class TaskGroup {
+public:
+    explicit TaskGroup(ThreadPool& pool) : pool_(pool), state_(std::make_shared<State>()) {}
+
+    // Waits without rethrowing, so the tasks never outlive what they refer to
+    ~TaskGroup() {
+        try { pool_.run_until([this] { return pending() == 0; }); } catch (...) {}
+    }
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void run(std::function<void()> fn) {
+        state_->pending.fetch_add(1);
+        pool_.submit([pool = &pool_, state = state_, fn = std::move(fn)] {
+            if (!state->failed.load()) {
+                ThreadPool::Timed timed(*pool);
+                try {
+                    fn();
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    if (!state->error) state->error = std::current_exception();
+                    state->failed.store(true);
+                }
+            }
+            state->pending.fetch_sub(1);
+            pool->notify_waiters();
+        });
+    }
+
+    // Tasks queued or running
+    size_t pending() const { return state_->pending.load(); }
+
+    void wait() {
+        pool_.run_until([this] { return pending() == 0; });
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        if (state_->error) std::rethrow_exception(std::exchange(state_->error, nullptr));
+    }
+
+private:
+    struct State {
+        std::atomic<size_t> pending{0};
+        std::atomic<bool> failed{false};
+        std::mutex mutex;
+        std::exception_ptr error;
+    };
+
+    ThreadPool& pool_;
+    std::shared_ptr<State> state_; // shared with the queued tasks
+};
+
+} // namespace gtfs
+
+#endif
@@ -205,6 +205,10 @@ export interface Stop {
     feed_id: string;
 }
 
+export interface NearbyStop extends Stop {
+    distance: number; // Meters
+}
+
 export interface StopTime {
     trip_id: string;
     stop_id: string;
@@ -386,6 +390,146 @@ export interface StopTimeQuery {
     feed_id?: string;
 }
 
+export interface DepartureQuery {
+    stop_id: string;
+    include_children?: boolean; // Also departures from stops whose parent_station is stop_id
+    date?: string; // YYYYMMDD; without it service calendars are not checked
+    after?: number | string; // Seconds or HH:MM:SS, default midnight
+    before?: number | string; // Inclusive upper bound
+    limit?: number; // Default 10
+    feed_id?: string;
+    utc_offset?: number; // See StopTimeWithRealtimeQuery
+}
+
+export interface Departure {
+    trip_id: string;
+    stop_id: string;
+    stop_sequence: number;
+    arrival_time: number | null; // Seconds since midnight of service_date
+    departure_time: number | null;
+    time: number; // Departure, seconds since midnight of the query date
+    service_date: string | null; // The query date, or the day before for trips running past midnight
+    headsign: string | null; // stop_headsign, else trip_headsign
+    direction_id: number | null;
+    route_id: string | null;
+    route_short_name: string | null;
+    route_long_name: string | null;
+    route_type: number | null;
+    route_color: string | null;
+    route_text_color: string | null;
+    feed_id: string;
+    has_realtime: boolean;
+    skipped: boolean;
+    departure_delay: number | null; // Seconds
+    predicted_time: number | null; // time + departure_delay
+}
+
+export interface JourneyQuery {
+    from: string; // stop_id; a station also stands for its child stops
+    to: string;
+    date: string; // YYYYMMDD
+    time?: number | string; // Earliest departure, seconds or HH:MM:SS, default midnight
+    window?: number; // Seconds; plan every departure in [time, time + window]
+    max_transfers?: number; // Default 4
+    realtime?: boolean; // Apply the delays of the loaded trip updates
+    utc_offset?: number; // See StopTimeWithRealtimeQuery
+    threads?: number; // Range queries; default one per core
+}
+
+export interface JourneyLeg {
+    mode: 'transit' | 'walk';
+    from_stop_id: string;
+    to_stop_id: string;
+    departure_time: number; // Seconds since midnight of the query date
+    arrival_time: number;
+    trip_id: string | null; // null for walks
+    route_id: string | null;
+    feed_id: string | null;
+}
+
+export interface Journey {
+    departure_time: number;
+    arrival_time: number;
+    transfers: number;
+    legs: JourneyLeg[];
+}
+
+export interface StopTimeWithRealtimeQuery extends StopTimeQuery {
+    utc_offset?: number; // Seconds east of UTC; turns absolute realtime times into delays
+}
+
+// A scheduled stop time joined with the trip update of its trip run. A stop without
+// its own update takes the delay of the nearest earlier updated stop.
+export interface StopTimeWithRealtime extends StopTime {
+    has_realtime: boolean; // a trip update matches this trip run
+    has_stop_update: boolean; // the update names this stop
+    skipped: boolean; // SKIPPED stop or CANCELED trip
+    arrival_delay: number | null; // Seconds
+    departure_delay: number | null;
+    predicted_arrival_time: number | null; // Seconds since midnight
+    predicted_departure_time: number | null;
+    arrival_timestamp: number | null; // POSIX time given by the stop's own update
+    departure_timestamp: number | null;
+}
+
+// Columnar stop times: one typed array per field, all of `length` entries.
+// String fields hold string table ids (see GTFS.getStringTable). Missing values:
+// -2147483648 for times, 0xFFFFFFFF for stop_headsign, -1 for flags, NaN for distances.
+export interface StopTimesColumnar {
+    length: number;
+    trip_id: Uint32Array;
+    stop_id: Uint32Array;
+    arrival_time: Int32Array;
+    departure_time: Int32Array;
+    stop_sequence: Int32Array;
+    stop_headsign: Uint32Array;
+    shape_dist_traveled: Float64Array;
+    pickup_type: Int8Array;
+    drop_off_type: Int8Array;
+    timepoint: Int8Array;
+    continuous_pickup: Int8Array;
+    continuous_drop_off: Int8Array;
+    feed_id: Uint32Array;
+    day_offset: Int8Array; // -1 when matched as a previous-day trip (dateMode "timestamp")
+}
+
+export interface ShapesColumnar {
+    length: number;
+    shape_id: Uint32Array;
+    shape_pt_lat: Float64Array;
+    shape_pt_lon: Float64Array;
+    shape_pt_sequence: Int32Array;
+    shape_dist_traveled: Float64Array; // NaN when missing
+    feed_id: Uint32Array;
+}
+
+// Realtime vehicles snapped onto the shapes of their trips, one row per vehicle.
+// Distances are meters along the shape; NaN, 0xFFFFFFFF and -1 when the vehicle
+// has no position, no trip with a shape or no next stop.
+export interface VehicleProgressColumnar {
+    length: number;
+    update_id: string[]; // realtime ids are not in the string table
+    vehicle_id: string[];
+    trip_id: Uint32Array;
+    feed_id: Uint32Array;
+    shape_id: Uint32Array;
+    lat: Float64Array; // snapped position
+    lon: Float64Array;
+    distance: Float64Array;
+    offset: Float64Array; // meters between the reported and the snapped position
+    shape_length: Float64Array;
+    next_stop_id: Uint32Array;
+    next_stop_sequence: Int32Array;
+    next_stop_distance: Float64Array; // meters from the vehicle to the next stop along the shape
+}
+
+// Options for GTFS.getShapePolyline. "encoded" returns a Google encoded polyline
+// string (precision 1e5); "float64" returns interleaved [lat, lon, ...] pairs.
+export interface ShapePolylineOptions {
+    feed_id?: string;
+    format?: 'encoded' | 'float64';
+}
+
 export interface ProgressInfo {
     task: string;
     total: number;
@@ -404,6 +548,55 @@ export interface GTFSOptions {
     mergeStrategy?: GTFSMergeStrategy;
     filesToLoad?: string[];     // e.g. ['agency.txt','routes.txt'] — omit to load all
     skipStopTimes?: boolean;    // shorthand to skip stop_times.txt
+    snapshot?: boolean;         // with cache: reuse binary snapshots keyed by feed URL + ETag
+    threads?: number;           // load thread pool size, shared by all feeds and finalize; default one per hardware thread
+    lazyFiles?: string[];       // ['shapes.txt']: kept compressed at load and parsed on first use
+    compactStopTimes?: boolean; // store stop times as trip patterns after every load except attachSnapshot, see GTFS.compactStopTimes
+    cacheStrings?: boolean;     // reuse the JS strings of sync getters across calls, see GTFS.setStringCache
+}
+
+export interface StopTimeCompaction {
+    rows: number;
+    trips: number; // Stored (trip_id, feed_id) runs
+    patterns: number; // Distinct stop sequences with their pickup/drop-off, headsign and distance fields
+    profiles: number; // Distinct timing offset sequences
+    flat_bytes: number; // Size of the rows before compaction
+    compact_bytes: number;
+}
+
+export interface FileLoadStats {
+    feed_id: string;
+    file: string;
+    bytes: number; // Uncompressed
+    records: number;
+    inflate_ms: number;
+    parse_ms: number; // Summed over the parallel parse tasks for stop_times.txt
+}
+
+export interface PhaseLoadStats {
+    name: string; // "parse <feed_id>", "sort stop_times", "index stop_times", ...
+    ms: number; // Wall time
+    busy_ms: number; // Time the phase's threads spent working, summed
+    threads: number;
+    utilization: number; // busy_ms / (ms * threads), at most 1
+}
+
+export interface MethodStats {
+    count: number;
+    errors: number;
+    sum_seconds: number;
+    buckets: { le: number; count: number }[]; // Cumulative, like a Prometheus histogram; the last le is Infinity
+}
+
+export interface GTFSStats {
+    generation: number; // Loads, snapshot restores and feed changes published so far
+    load: {
+        total_ms: number;
+        files: FileLoadStats[];
+        phases: PhaseLoadStats[];
+    };
+    memory: Record<string, number>; // Approximate bytes per container, plus total
+    methods: Record<string, MethodStats>; // By method name, for the methods called so far
 }
 
 export interface GTFSActions {